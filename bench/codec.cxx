@@ -0,0 +1,286 @@
+// Benchmark for the compressed mesh format (see obj_codec.cxx): Stores every
+// mesh both in the cache (see LOAD_CACHED), which holds obj_reader's lists
+// as they are, and compressed, and compares their sizes, the time it takes
+// to load either, and the precision lost by quantization.
+//
+// Both files are loaded from the page cache ("warm") and once after
+// dropping them from it ("cold", i.e. from the disk; this does not work on
+// tmpfs). Loading the compressed file is faster than loading the cache
+// wherever the disk (or network) is slower than the "break-even" rate:
+// there, the time saved by reading fewer bytes is more than the time spent
+// decoding them.
+//
+// Usage: bench_codec [-r rounds] [-d dir] [-b position_bits] [-O] [file...]
+// Without files, all meshes from data/ are used (so run this from the
+// repository root). The compressed files are written to "dir" (default:
+// the current directory); caches are removed again if they have not been
+// there before. -O welds, triangulates and reorders the meshes for
+// rendering before storing them, as one would for an asset store.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "obj_reader.h"
+#include "dake/parallel.h"
+
+
+static const char *default_files[] = {
+    "data/bear/bear_body.obj",
+    "data/bear/bear_head.obj",
+    "data/bear/blossom.obj",
+    "data/bear/stem.obj",
+    "data/bear/swing.obj",
+    "data/bear/swing_rack.obj",
+    "data/robot/arm_left_lower.obj",
+    "data/robot/arm_left_upper.obj",
+    "data/robot/arm_right_lower.obj",
+    "data/robot/arm_right_upper.obj",
+    "data/robot/leg_left.obj",
+    "data/robot/leg_right.obj",
+    "data/robot/torso_lower.obj",
+    "data/robot/torso_upper.obj",
+    NULL
+};
+
+
+// Default number of repetitions of every measurement
+#define ROUNDS 5
+
+// No further repetitions once this many seconds have been spent on one
+#define MAX_SECONDS 1.
+
+
+static double now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+
+static size_t file_size(const std::string &name)
+{
+    struct stat st;
+    return stat(name.c_str(), &st) ? 0 : st.st_size;
+}
+
+
+// Drop the file from the page cache, so the next read comes from the disk
+static void evict(const std::string &name)
+{
+    int fd = open(name.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+
+// Largest difference between the attributes of the two readers; "scale"
+// is applied to every difference
+template<typename T> static double max_error(const std::vector<T> &a, const std::vector<T> &b, int n, double scale)
+{
+    double err = 0.;
+    for (size_t i = 0; i < std::min(a.size(), b.size()); i++)
+        for (int c = 0; c < n; c++)
+            err = std::max(err, fabs((double)a[i][c] - b[i][c]) * scale);
+    return err;
+}
+
+
+// Largest angle (in degrees) between the normals of the two readers
+static double max_angle(const std::vector<dake::vec3> &a, const std::vector<dake::vec3> &b)
+{
+    double min_cos = 1.;
+    for (size_t i = 0; i < std::min(a.size(), b.size()); i++)
+    {
+        float la = a[i].length();
+        if (la > 0.f)
+            min_cos = std::min(min_cos, (double)a[i].dot(b[i]) / la);
+    }
+    return acos(std::max(-1., std::min(min_cos, 1.))) * 180. / M_PI;
+}
+
+
+static bool same_topology(obj_reader &a, obj_reader &b)
+{
+    const face_list &fa = a.get_faces(), &fb = b.get_faces();
+    if ((fa.size() != fb.size()) || (fa.corners.size() != fb.corners.size()))
+        return false;
+
+    for (size_t i = 0; i < fa.size(); i++)
+        if ((fa.offsets[i + 1] != fb.offsets[i + 1]) || (fa.mats[i]->name != fb.mats[i]->name) ||
+            (fa.groups[i] != fb.groups[i]) || (fa.smoothing[i] != fb.smoothing[i]))
+            return false;
+
+    for (size_t i = 0; i < fa.corners.size(); i++)
+        if ((fa.corners[i].index_vertex != fb.corners[i].index_vertex) ||
+            (fa.corners[i].index_normal != fb.corners[i].index_normal) ||
+            (fa.corners[i].index_texcoord != fb.corners[i].index_texcoord))
+            return false;
+
+    return true;
+}
+
+
+int main(int argc, char *argv[])
+{
+    int rounds = ROUNDS, flags = obj_reader::LOAD_PARALLEL;
+    std::string dir = ".";
+    obj_reader::codec_options opts;
+    std::vector<const char *> files;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-r") && (i + 1 < argc))
+            rounds = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-d") && (i + 1 < argc))
+            dir = argv[++i];
+        else if (!strcmp(argv[i], "-b") && (i + 1 < argc))
+            opts.position_bits = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-O"))
+            flags |= obj_reader::LOAD_WELD | obj_reader::LOAD_TRIANGULATE | obj_reader::LOAD_OPTIMIZE;
+        else
+            files.push_back(argv[i]);
+    }
+
+    if (rounds < 1)
+        rounds = 1;
+    if (files.empty())
+        for (int i = 0; default_files[i]; i++)
+            files.push_back(default_files[i]);
+
+    std::string codec_name = dir + "/bench_codec.objz";
+
+    printf("%u worker threads, %u bit positions, %u bit normals, %u bit texture coordinates\n",
+           dake::worker_count(), opts.position_bits, opts.normal_bits, opts.tex_coord_bits);
+
+    int failures = 0;
+    size_t cache_total = 0, codec_total = 0;
+    double cache_time = 0., decode_time = 0., cold_time = 0.;
+
+    for (std::vector<const char *>::const_iterator fi = files.begin(); fi != files.end(); fi++)
+    {
+        std::string cache_name = std::string(*fi) + ".cache";
+        bool had_cache = file_size(cache_name) > 0;
+
+        obj_reader src(*fi, flags | obj_reader::LOAD_CACHED);
+        if (src.get_faces().empty())
+        {
+            fprintf(stderr, "Could not load %s\n", *fi);
+            failures++;
+            continue;
+        }
+
+        double t0 = now();
+        bool saved = src.save_compressed(codec_name, opts);
+        double encode = now() - t0;
+
+        size_t cache_size = file_size(cache_name), codec_size = file_size(codec_name);
+        if (!saved || !cache_size)
+        {
+            failures++;
+            continue;
+        }
+
+        // Warm: best of several rounds
+        double cache_warm = 0., decode = 0., total = 0.;
+        for (int r = 0; r < rounds && total < MAX_SECONDS; r++)
+        {
+            double t_cache, t_decode;
+            {
+                t0 = now();
+                obj_reader cached(*fi, flags | obj_reader::LOAD_CACHED);
+                t_cache = now() - t0;
+            }
+            {
+                t0 = now();
+                obj_reader dec(codec_name);
+                t_decode = now() - t0;
+            }
+
+            cache_warm = (!r || t_cache < cache_warm) ? t_cache : cache_warm;
+            decode = (!r || t_decode < decode) ? t_decode : decode;
+            total += t_cache + t_decode;
+        }
+
+        // Cold: once each
+        double cache_cold;
+        evict(cache_name);
+        {
+            t0 = now();
+            obj_reader cached(*fi, flags | obj_reader::LOAD_CACHED);
+            cache_cold = now() - t0;
+        }
+
+        evict(codec_name);
+        t0 = now();
+        obj_reader dec(codec_name);
+        double codec_cold = now() - t0;
+
+        if (!had_cache)
+            unlink(cache_name.c_str());
+
+        dake::vec3 extent = src.get_bbox_max() - src.get_bbox_min();
+        double diagonal = extent.length();
+
+        bool same = same_topology(src, dec);
+        if (!same)
+            failures++;
+
+        // Reading the cache from the disk took this much longer than from
+        // the page cache
+        double disk_rate = (cache_cold > cache_warm) ? cache_size / (cache_cold - cache_warm) : 0.;
+
+        printf("%s: %zu faces, %zu vertices%s\n", *fi, src.get_faces().size(), src.get_vertices().size(),
+               same ? "" : " -- TOPOLOGY DIFFERS");
+        printf("  size    %9.2f MB cache %9.2f MB compressed (%.1f%%, %.2f bytes/corner)\n",
+               cache_size / 1e6, codec_size / 1e6, 100. * codec_size / cache_size,
+               (double)codec_size / src.get_faces().corners.size());
+        printf("  warm    %9.2f ms cache %9.2f ms compressed, %.2f ms to encode\n",
+               cache_warm * 1e3, decode * 1e3, encode * 1e3);
+        printf("  cold    %9.2f ms cache %9.2f ms compressed (disk: %.0f MB/s)\n",
+               cache_cold * 1e3, codec_cold * 1e3, disk_rate / 1e6);
+        if (decode > cache_warm)
+            printf("  break-even at %.0f MB/s", (cache_size - codec_size) / (decode - cache_warm) / 1e6);
+        else
+            printf("  compressed is faster at any rate");
+        printf("; error: positions %.2g of the diagonal, normals %.3g deg, texture coordinates %.2g\n",
+               max_error(src.get_vertices(), dec.get_vertices(), 3, diagonal > 0. ? 1. / diagonal : 0.),
+               max_angle(src.get_normals(), dec.get_normals()),
+               max_error(src.get_tex_coords(), dec.get_tex_coords(), 2, 1.));
+
+        cache_total += cache_size;
+        codec_total += codec_size;
+        cache_time += cache_warm;
+        decode_time += decode;
+        cold_time += cache_cold;
+    }
+
+    unlink(codec_name.c_str());
+
+    if (decode_time > 0.)
+    {
+        printf("total: %.2f MB cache, %.2f MB compressed (%.1f%%), %.2f ms vs. %.2f ms warm",
+               cache_total / 1e6, codec_total / 1e6, 100. * codec_total / cache_total,
+               cache_time * 1e3, decode_time * 1e3);
+        if (decode_time > cache_time)
+            printf(", break-even at %.0f MB/s", (cache_total - codec_total) / (decode_time - cache_time) / 1e6);
+        if (cold_time > cache_time)
+            printf(", disk %.0f MB/s", cache_total / (cold_time - cache_time) / 1e6);
+        printf("\n");
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,293 @@
+// Generator for synthetic OBJ files of any size, for benchmarking the
+// loaders on more than the few thousand faces of the meshes in data/. The
+// surface is a torus with some bumps on it, sampled on a regular grid; the
+// output only depends on the options, so runs are reproducible.
+//
+// Usage: bench_generate [options] out.obj
+//   -f count    Number of faces to generate (about; default 1000000)
+//   -s shape    tris, quads, ngons (octagons) or mixed (default tris)
+//   -m count    Number of materials (written to out.mtl, default 1); the
+//               faces switch between them in blocks
+//   -g count    Number of groups (g statements, default 1)
+//   -n          Leave out the normals
+//   -t          Leave out the texture coordinates
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+
+enum shape
+{
+    SHAPE_TRIS,
+    SHAPE_QUADS,
+    SHAPE_NGONS,
+    SHAPE_MIXED
+};
+
+// Number of grid cells merged into one n-gon (making 2 * (n + 1) corners)
+#define NGON_CELLS 3
+
+
+struct options
+{
+    size_t faces;
+    shape sh;
+    unsigned materials, groups;
+    bool normals, tex_coords;
+};
+
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "Usage: %s [-f faces] [-s tris|quads|ngons|mixed] [-m materials] [-g groups] [-n] [-t] out.obj\n", argv0);
+    exit(1);
+}
+
+
+// Average number of faces one row of grid cells turns into
+static double faces_per_cell(shape sh)
+{
+    switch (sh)
+    {
+        case SHAPE_TRIS:  return 2.;
+        case SHAPE_QUADS: return 1.;
+        case SHAPE_NGONS: return 1. / NGON_CELLS;
+        default:          return (2. + 1. + 1. / NGON_CELLS) / 3.;
+    }
+}
+
+
+// Position and normal of the bumpy torus at (u, v) in [0, 1)^2
+static void surface(double u, double v, double pos[3], double nrm[3])
+{
+    const double R = 1., r = .35;
+    double a = u * 2. * M_PI, b = v * 2. * M_PI;
+
+    // Small bumps, so the coordinates do not repeat
+    double h = r * (1. + .05 * sin(a * 17.) * sin(b * 13.));
+
+    pos[0] = (R + h * cos(b)) * cos(a);
+    pos[1] = h * sin(b);
+    pos[2] = (R + h * cos(b)) * sin(a);
+
+    // The normal of the smooth torus is close enough
+    nrm[0] = cos(b) * cos(a);
+    nrm[1] = sin(b);
+    nrm[2] = cos(b) * sin(a);
+}
+
+
+// Write one face with the given grid vertex indices (zero based)
+static void write_face(FILE *fp, const options &opt, const size_t *idx, int count)
+{
+    fputc('f', fp);
+    for (int i = 0; i < count; i++)
+    {
+        size_t v = idx[i] + 1;
+        if (opt.normals && opt.tex_coords)
+            fprintf(fp, " %zu/%zu/%zu", v, v, v);
+        else if (opt.normals)
+            fprintf(fp, " %zu//%zu", v, v);
+        else if (opt.tex_coords)
+            fprintf(fp, " %zu/%zu", v, v);
+        else
+            fprintf(fp, " %zu", v);
+    }
+    fputc('\n', fp);
+}
+
+
+int main(int argc, char *argv[])
+{
+    options opt;
+    opt.faces = 1000000;
+    opt.sh = SHAPE_TRIS;
+    opt.materials = opt.groups = 1;
+    opt.normals = opt.tex_coords = true;
+
+    const char *out = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-f") && (i + 1 < argc))
+            opt.faces = strtoull(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "-m") && (i + 1 < argc))
+            opt.materials = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "-g") && (i + 1 < argc))
+            opt.groups = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "-s") && (i + 1 < argc))
+        {
+            i++;
+            if (!strcmp(argv[i], "tris"))
+                opt.sh = SHAPE_TRIS;
+            else if (!strcmp(argv[i], "quads"))
+                opt.sh = SHAPE_QUADS;
+            else if (!strcmp(argv[i], "ngons"))
+                opt.sh = SHAPE_NGONS;
+            else if (!strcmp(argv[i], "mixed"))
+                opt.sh = SHAPE_MIXED;
+            else
+                usage(argv[0]);
+        }
+        else if (!strcmp(argv[i], "-n"))
+            opt.normals = false;
+        else if (!strcmp(argv[i], "-t"))
+            opt.tex_coords = false;
+        else if ((argv[i][0] != '-') && !out)
+            out = argv[i];
+        else
+            usage(argv[0]);
+    }
+
+    if (!out || !opt.faces)
+        usage(argv[0]);
+    if (!opt.materials)
+        opt.materials = 1;
+    if (!opt.groups)
+        opt.groups = 1;
+
+
+    // Grid of cols x rows cells, about twice as wide as high (like the
+    // torus), with the number of columns divisible by NGON_CELLS
+    double cells = opt.faces / faces_per_cell(opt.sh);
+    size_t rows = (size_t)ceil(sqrt(cells / 2.));
+    if (rows < 2)
+        rows = 2;
+    size_t cols = (size_t)ceil(cells / rows / NGON_CELLS) * NGON_CELLS;
+    if (cols < NGON_CELLS)
+        cols = NGON_CELLS;
+
+    // The seams are not closed (the grid has one more vertex per row and
+    // column), so the texture coordinates do not wrap
+    size_t vcols = cols + 1, vrows = rows + 1;
+
+    std::string obj_name(out), mtl_name(obj_name);
+    size_t dot = mtl_name.rfind('.');
+    size_t slash = mtl_name.rfind('/');
+    if ((dot != std::string::npos) && ((slash == std::string::npos) || (dot > slash)))
+        mtl_name.erase(dot);
+    mtl_name += ".mtl";
+    std::string mtl_base = (slash == std::string::npos) ? mtl_name : mtl_name.substr(slash + 1);
+
+
+    FILE *mtl = fopen(mtl_name.c_str(), "w");
+    if (!mtl)
+    {
+        perror(mtl_name.c_str());
+        return 1;
+    }
+
+    for (unsigned i = 0; i < opt.materials; i++)
+    {
+        double t = opt.materials > 1 ? (double)i / (opt.materials - 1) : 0.;
+        fprintf(mtl, "newmtl mat%u\n", i);
+        fprintf(mtl, "Ka 0.1 0.1 0.1\n");
+        fprintf(mtl, "Kd %.3f %.3f %.3f\n", .2 + .6 * t, .8 - .6 * t, .5);
+        fprintf(mtl, "Ks 0.3 0.3 0.3\n");
+        fprintf(mtl, "Ns 20\n");
+        fprintf(mtl, "illum 2\n\n");
+    }
+    fclose(mtl);
+
+
+    FILE *fp = fopen(obj_name.c_str(), "w");
+    if (!fp)
+    {
+        perror(obj_name.c_str());
+        return 1;
+    }
+
+    fprintf(fp, "# Generated by bench_generate: %zu x %zu grid\n", cols, rows);
+    fprintf(fp, "mtllib %s\n", mtl_base.c_str());
+
+    for (size_t y = 0; y < vrows; y++)
+    {
+        for (size_t x = 0; x < vcols; x++)
+        {
+            double pos[3], nrm[3];
+            surface((double)x / cols, (double)y / rows, pos, nrm);
+            fprintf(fp, "v %.6f %.6f %.6f\n", pos[0], pos[1], pos[2]);
+        }
+    }
+
+    if (opt.tex_coords)
+        for (size_t y = 0; y < vrows; y++)
+            for (size_t x = 0; x < vcols; x++)
+                fprintf(fp, "vt %.6f %.6f\n", (double)x / cols, (double)y / rows);
+
+    if (opt.normals)
+    {
+        for (size_t y = 0; y < vrows; y++)
+        {
+            for (size_t x = 0; x < vcols; x++)
+            {
+                double pos[3], nrm[3];
+                surface((double)x / cols, (double)y / rows, pos, nrm);
+                fprintf(fp, "vn %.6f %.6f %.6f\n", nrm[0], nrm[1], nrm[2]);
+            }
+        }
+    }
+
+
+    // Materials and groups change every so many rows
+    size_t rows_per_mat = (rows + opt.materials - 1) / opt.materials;
+    size_t rows_per_group = (rows + opt.groups - 1) / opt.groups;
+    size_t face_count = 0;
+
+    for (size_t y = 0; y < rows; y++)
+    {
+        if (!(y % rows_per_group) && (opt.groups > 1))
+            fprintf(fp, "g group%zu\n", y / rows_per_group);
+        if (!(y % rows_per_mat))
+            fprintf(fp, "usemtl mat%zu\n", y / rows_per_mat);
+
+        shape sh = (opt.sh == SHAPE_MIXED) ? static_cast<shape>(y % 3) : opt.sh;
+
+        for (size_t x = 0; x < cols; )
+        {
+            size_t a = y * vcols + x, b = a + 1, c = a + vcols + 1, d = a + vcols;
+
+            if (sh == SHAPE_TRIS)
+            {
+                size_t t1[3] = { a, b, c }, t2[3] = { a, c, d };
+                write_face(fp, opt, t1, 3);
+                write_face(fp, opt, t2, 3);
+                face_count += 2;
+                x++;
+            }
+            else if (sh == SHAPE_QUADS)
+            {
+                size_t q[4] = { a, b, c, d };
+                write_face(fp, opt, q, 4);
+                face_count++;
+                x++;
+            }
+            else
+            {
+                // Bottom edge from left to right, top edge back
+                size_t n[2 * (NGON_CELLS + 1)];
+                for (int i = 0; i <= NGON_CELLS; i++)
+                {
+                    n[i] = a + i;
+                    n[2 * NGON_CELLS + 1 - i] = d + i;
+                }
+                write_face(fp, opt, n, 2 * (NGON_CELLS + 1));
+                face_count++;
+                x += NGON_CELLS;
+            }
+        }
+    }
+
+    if (ferror(fp) | fclose(fp))
+    {
+        perror(obj_name.c_str());
+        return 1;
+    }
+
+    printf("%s: %zu vertices, %zu faces, %u materials, %u groups\n",
+           obj_name.c_str(), vcols * vrows, face_count, opt.materials, opt.groups);
+    return 0;
+}
@@ -0,0 +1,3 @@
+// Stand-in for the cgv header of the same name, so dake/texture.h can be
+// included by the benchmarks, which are built without the cgv framework
+#include <GL/gl.h>
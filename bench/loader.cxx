@@ -0,0 +1,372 @@
+// Throughput benchmark for the OBJ loaders: Loads every file with every
+// loader mode and reports the parse speed (in MB of OBJ per second, and
+// faces per second), the peak resident set size and the number and size of
+// the heap allocations made by one load. Every file/mode pair is measured in
+// a process of its own, so the peak memory of one does not show up in the
+// next.
+//
+// Usage: bench_loader [-r rounds] [-m mode[,mode...]] [file.obj...]
+// Without files, all meshes from data/ are used (so run this from the
+// repository root). Files made by bench_generate can be given in addition.
+// Every load is repeated up to "rounds" times (default 5, fewer for files
+// taking longer than a second), and the fastest one is reported.
+//
+// The "cached" mode creates the cache before measuring (so it measures a
+// warm cache) and removes it afterwards if it has not been there before; its
+// MB/s still refer to the OBJ file. "shared" has another process publish the
+// mesh in shared memory first (see obj_reader::LOAD_SHARED) and keep it
+// there while this one loads it; it only takes the draw data, which is not
+// copied. "lazy" only loads the positions.
+// Textures are never read (see no_textures.cxx).
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "obj_reader.h"
+#include "obj_stream.h"
+#include "dake/parallel.h"
+
+
+static const char *default_files[] = {
+    "data/bear/bear_body.obj",
+    "data/bear/bear_head.obj",
+    "data/bear/blossom.obj",
+    "data/bear/stem.obj",
+    "data/bear/swing.obj",
+    "data/bear/swing_rack.obj",
+    "data/robot/arm_left_lower.obj",
+    "data/robot/arm_left_upper.obj",
+    "data/robot/arm_right_lower.obj",
+    "data/robot/arm_right_upper.obj",
+    "data/robot/leg_left.obj",
+    "data/robot/leg_right.obj",
+    "data/robot/torso_lower.obj",
+    "data/robot/torso_upper.obj",
+    NULL
+};
+
+
+// Default number of repetitions of every load
+#define ROUNDS 5
+
+// No further repetitions once this many seconds have been spent on a load
+#define MAX_SECONDS 1.
+
+
+// Loader modes; "flags" are the obj_reader flags, STREAM_ONLY means
+// read_obj_stream with an obj_stream_stats consumer instead
+#define STREAM_ONLY -1
+
+struct mode
+{
+    const char *name;
+    int flags;
+};
+
+static const mode modes[] = {
+    { "stream",   0 },
+    { "mapped",   obj_reader::LOAD_MAPPED },
+    { "parallel", obj_reader::LOAD_PARALLEL },
+    { "cached",   obj_reader::LOAD_PARALLEL | obj_reader::LOAD_CACHED },
+    { "shared",   obj_reader::LOAD_PARALLEL | obj_reader::LOAD_SHARED },
+    { "lazy",     obj_reader::LOAD_PARALLEL | obj_reader::LOAD_LAZY },
+    { "consumer", STREAM_ONLY },
+    { "full",     obj_reader::LOAD_PARALLEL | obj_reader::LOAD_WELD | obj_reader::LOAD_NORMALS |
+                  obj_reader::LOAD_TRIANGULATE | obj_reader::LOAD_OPTIMIZE },
+    { NULL, 0 }
+};
+
+
+// All heap allocations going through operator new are counted here
+static std::atomic<size_t> alloc_count(0), alloc_bytes(0);
+
+void *operator new(size_t size)
+{
+    alloc_count.fetch_add(1, std::memory_order_relaxed);
+    alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+
+    void *p = malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    alloc_count.fetch_add(1, std::memory_order_relaxed);
+    alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+    return malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &nt) noexcept
+{
+    return operator new(size, nt);
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+    free(p);
+}
+
+
+static double now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+
+static bool file_exists(const std::string &name)
+{
+    struct stat st;
+    return !stat(name.c_str(), &st);
+}
+
+
+// Peak resident set size of this process in MB
+static double peak_rss(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss / 1024.;
+}
+
+
+// Loads "file" once with mode "m" and returns the number of faces loaded
+static size_t load_once(const char *file, const mode &m)
+{
+    if (m.flags == STREAM_ONLY)
+    {
+        obj_stream_stats stats;
+        if (!read_obj_stream(file, stats))
+            return 0;
+        return stats.face_count;
+    }
+
+    obj_reader reader(file, m.flags);
+    if (m.flags & obj_reader::LOAD_LAZY)
+        return reader.get_vertices().size();
+
+    // Only what is drawn, so the face list is not copied out of the block
+    if (m.flags & obj_reader::LOAD_SHARED)
+    {
+        const indexed_mesh &mesh = reader.get_indexed_mesh();
+        size_t faces = 0;
+        for (std::vector<mesh_batch>::const_iterator bi = mesh.batches.begin(); bi != mesh.batches.end(); bi++)
+            faces += bi->count / bi->face_size;
+        return faces;
+    }
+
+    return reader.get_faces().size();
+}
+
+
+// Measures mode "m" on "file" (of "bytes" bytes) and prints the result; run
+// in a child process
+static int measure(const char *file, size_t bytes, const mode &m, int rounds)
+{
+    if (m.flags != STREAM_ONLY && (m.flags & obj_reader::LOAD_CACHED))
+        load_once(file, m);
+
+    // Published by another process, so the parsed lists do not count
+    // towards this one's memory. That one keeps its reader (and so the
+    // block) until the measurement is done; the block is removed when the
+    // last process using it exits.
+    int hold[2] = { -1, -1 };
+    pid_t primer = -1;
+    if (m.flags != STREAM_ONLY && (m.flags & obj_reader::LOAD_SHARED))
+    {
+        int ready[2];
+        if (pipe(ready) || pipe(hold))
+            return 1;
+
+        primer = fork();
+        if (!primer)
+        {
+            close(ready[0]);
+            close(hold[1]);
+
+            {
+                obj_reader reader(file, m.flags);
+                char ok = obj_reader::is_shared(file, m.flags);
+                if (write(ready[1], &ok, 1) == 1)
+                    while (read(hold[0], &ok, 1) > 0);
+            }
+            _exit(0);
+        }
+
+        close(ready[1]);
+        close(hold[0]);
+
+        char ok = 0;
+        if ((primer < 0) || (read(ready[0], &ok, 1) != 1) || !ok)
+        {
+            fprintf(stderr, "%s: Could not publish %s\n", m.name, file);
+            return 1;
+        }
+        close(ready[0]);
+    }
+
+    double best = 0., total = 0.;
+    size_t count = 0, allocs = 0, alloc_size = 0;
+
+    for (int r = 0; r < rounds && total < MAX_SECONDS; r++)
+    {
+        size_t a0 = alloc_count, b0 = alloc_bytes;
+        double t0 = now();
+
+        count = load_once(file, m);
+
+        double t = now() - t0;
+        allocs = alloc_count - a0;
+        alloc_size = alloc_bytes - b0;
+
+        if (!r || t < best)
+            best = t;
+        total += t;
+    }
+
+    if (primer > 0)
+    {
+        close(hold[1]);
+        waitpid(primer, NULL, 0);
+    }
+
+    if (!count)
+    {
+        fprintf(stderr, "%s: Could not load %s\n", m.name, file);
+        return 1;
+    }
+
+    // Lazy loads only have positions, so count those instead of faces
+    printf("  %-9s %8.2f ms %9.1f MB/s %8.2f M%s/s %9.1f MB RSS %10zu allocs %10.1f MB alloc'd\n",
+           m.name, best * 1e3, bytes / best / 1e6, count / best / 1e6,
+           (m.flags != STREAM_ONLY && (m.flags & obj_reader::LOAD_LAZY)) ? "vert " : "faces",
+           peak_rss(), allocs, alloc_size / 1e6);
+    return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    int rounds = ROUNDS;
+    std::vector<const char *> files;
+    std::vector<const mode *> selected;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-r") && (i + 1 < argc))
+            rounds = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-m") && (i + 1 < argc))
+        {
+            std::string list(argv[++i]);
+            size_t start = 0;
+            while (start <= list.length())
+            {
+                size_t end = list.find(',', start);
+                if (end == std::string::npos)
+                    end = list.length();
+
+                std::string name = list.substr(start, end - start);
+                int j;
+                for (j = 0; modes[j].name && name != modes[j].name; j++);
+                if (!modes[j].name)
+                {
+                    fprintf(stderr, "Unknown mode %s\n", name.c_str());
+                    return 1;
+                }
+                selected.push_back(&modes[j]);
+
+                start = end + 1;
+            }
+        }
+        else
+            files.push_back(argv[i]);
+    }
+
+    if (rounds < 1)
+        rounds = 1;
+    if (files.empty())
+        for (int i = 0; default_files[i]; i++)
+            files.push_back(default_files[i]);
+    if (selected.empty())
+        for (int i = 0; modes[i].name; i++)
+            selected.push_back(&modes[i]);
+
+    printf("%u worker threads\n", dake::worker_count());
+
+    int failures = 0;
+    for (std::vector<const char *>::const_iterator fi = files.begin(); fi != files.end(); fi++)
+    {
+        struct stat st;
+        if (stat(*fi, &st))
+        {
+            perror(*fi);
+            failures++;
+            continue;
+        }
+
+        printf("%s (%.1f MB)\n", *fi, st.st_size / 1e6);
+
+        std::string cache = std::string(*fi) + ".cache";
+        bool had_cache = file_exists(cache);
+
+        for (std::vector<const mode *>::const_iterator mi = selected.begin(); mi != selected.end(); mi++)
+        {
+            fflush(stdout);
+
+            pid_t pid = fork();
+            if (pid < 0)
+            {
+                perror("fork");
+                return 1;
+            }
+            if (!pid)
+            {
+                int ret = measure(*fi, st.st_size, **mi, rounds);
+                fflush(stdout);
+                _exit(ret);
+            }
+
+            int status;
+            if ((waitpid(pid, &status, 0) < 0) || !WIFEXITED(status) || WEXITSTATUS(status))
+                failures++;
+        }
+
+        if (!had_cache)
+            unlink(cache.c_str());
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,68 @@
+// Replacement for dake/texture.cxx for the benchmarks: Textures referenced by
+// materials are only recorded, not read (reading images would need the cgv
+// framework, and is not what the benchmarks measure anyway).
+
+#include <list>
+#include <mutex>
+#include <string>
+
+#include "dake/texture.h"
+
+
+dake::texture::texture(const std::string &name):
+    tex_id(0),
+    fname(name),
+    width(0),
+    height(0),
+    changed(false)
+{
+}
+
+
+dake::texture::~texture(void)
+{
+}
+
+
+void dake::texture::bind(void) const
+{
+}
+
+
+bool dake::texture::reload(void)
+{
+    return true;
+}
+
+
+dake::texture_manager::~texture_manager(void)
+{
+    for (std::list<texture *>::iterator i = textures.begin(); i != textures.end(); i++)
+        delete *i;
+}
+
+
+const dake::texture *dake::texture_manager::find_texture(const std::string &name)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    for (std::list<dake::texture *>::iterator i = textures.begin(); i != textures.end(); i++)
+        if (name == (*i)->get_fname())
+            return *i;
+
+    texture *nt = new dake::texture(name);
+    textures.push_back(nt);
+    return nt;
+}
+
+
+bool dake::texture_manager::reload(const std::string &name)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    for (std::list<dake::texture *>::iterator i = textures.begin(); i != textures.end(); i++)
+        if (name == (*i)->get_fname())
+            return true;
+
+    return false;
+}
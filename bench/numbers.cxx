@@ -0,0 +1,272 @@
+// Microbenchmark for the number parsers in dake/parse.h: Compares them to
+// the string stream based parsing done by obj_reader's stream path on the
+// numbers found in OBJ files. Also checks dake::parse_float against strtof
+// on random input.
+//
+// Usage: bench_numbers [file.obj...]
+// Without arguments, all meshes from data/ are used (so run this from the
+// repository root).
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/time.h>
+
+#include "dake/mapped_file.h"
+#include "dake/parse.h"
+
+
+static const char *default_files[] = {
+    "data/bear/bear_body.obj",
+    "data/bear/bear_head.obj",
+    "data/bear/blossom.obj",
+    "data/bear/stem.obj",
+    "data/bear/swing.obj",
+    "data/bear/swing_rack.obj",
+    "data/robot/arm_left_lower.obj",
+    "data/robot/arm_left_upper.obj",
+    "data/robot/arm_right_lower.obj",
+    "data/robot/arm_right_upper.obj",
+    "data/robot/leg_left.obj",
+    "data/robot/leg_right.obj",
+    "data/robot/torso_lower.obj",
+    "data/robot/torso_upper.obj",
+    NULL
+};
+
+
+// Repeat every measurement this often
+#define ROUNDS 20
+
+
+static double now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+
+// Prevents the compiler from optimizing the parsing away
+static volatile float float_sink;
+static volatile int int_sink;
+
+
+struct corpus
+{
+    // Attribute lines (v, vn, vt) without their keyword
+    std::vector<std::string> attr_lines;
+    // Face lines without their keyword
+    std::vector<std::string> face_lines;
+    // All numbers in attribute lines and all indices in face lines
+    std::vector<std::string> floats, ints;
+    size_t float_bytes, int_bytes;
+};
+
+
+static void add_file(corpus &c, const char *fname)
+{
+    dake::mapped_file file(fname);
+    if (!file.is_open())
+    {
+        fprintf(stderr, "Could not open %s\n", fname);
+        exit(1);
+    }
+
+    const char *p = file.begin(), *e = file.end();
+    while (p < e)
+    {
+        const char *eol = static_cast<const char *>(memchr(p, '\n', e - p));
+        if (!eol)
+            eol = e;
+
+        std::string line(p, eol);
+        size_t sp = line.find(' ');
+        std::string kw = line.substr(0, sp);
+        std::string rest = (sp == std::string::npos) ? std::string() : line.substr(sp + 1);
+
+        bool attr = (kw == "v") || (kw == "vn") || (kw == "vt");
+        if (attr || (kw == "f"))
+        {
+            (attr ? c.attr_lines : c.face_lines).push_back(rest);
+
+            std::string tok;
+            for (size_t i = 0; i <= rest.length(); i++)
+            {
+                char ch = (i < rest.length()) ? rest[i] : ' ';
+                if ((ch == ' ') || (ch == '\r') || (!attr && (ch == '/')))
+                {
+                    if (!tok.empty())
+                    {
+                        (attr ? c.floats : c.ints).push_back(tok);
+                        (attr ? c.float_bytes : c.int_bytes) += tok.length();
+                    }
+                    tok.clear();
+                }
+                else
+                    tok += ch;
+            }
+        }
+
+        p = eol + 1;
+    }
+}
+
+
+static void report(const char *name, double t, size_t count, size_t bytes)
+{
+    t /= ROUNDS;
+    printf("  %-28s %8.2f ms  %7.1f ns/number  %8.1f MB/s\n",
+           name, t * 1e3, t * 1e9 / count, bytes / t / 1e6);
+}
+
+
+static void bench_floats(const corpus &c)
+{
+    printf("%zu floats (%zu bytes):\n", c.floats.size(), c.float_bytes);
+
+    // What process_vertex() and friends do
+    double t0 = now();
+    for (int r = 0; r < ROUNDS; r++)
+    {
+        for (size_t i = 0; i < c.attr_lines.size(); i++)
+        {
+            std::stringstream line(c.attr_lines[i]);
+            float v;
+            while (line >> v)
+                float_sink = v;
+        }
+    }
+    report("stringstream >> float", now() - t0, c.floats.size(), c.float_bytes);
+
+    t0 = now();
+    for (int r = 0; r < ROUNDS; r++)
+        for (size_t i = 0; i < c.floats.size(); i++)
+            float_sink = strtof(c.floats[i].c_str(), NULL);
+    report("strtof", now() - t0, c.floats.size(), c.float_bytes);
+
+    t0 = now();
+    for (int r = 0; r < ROUNDS; r++)
+    {
+        for (size_t i = 0; i < c.floats.size(); i++)
+        {
+            const char *p = c.floats[i].data();
+            float v = 0.f;
+            dake::parse_float(p, p + c.floats[i].length(), v);
+            float_sink = v;
+        }
+    }
+    report("dake::parse_float", now() - t0, c.floats.size(), c.float_bytes);
+}
+
+
+static void bench_ints(const corpus &c)
+{
+    printf("%zu indices (%zu bytes):\n", c.ints.size(), c.int_bytes);
+
+    // What process_face() does
+    double t0 = now();
+    for (int r = 0; r < ROUNDS; r++)
+    {
+        for (size_t i = 0; i < c.face_lines.size(); i++)
+        {
+            std::stringstream line(c.face_lines[i]);
+            std::string entry;
+            while (std::getline(line, entry, ' '))
+            {
+                std::stringstream entry_stream(entry);
+                std::string indexstr;
+                while (std::getline(entry_stream, indexstr, '/'))
+                    if (!indexstr.empty())
+                        int_sink = strtol(indexstr.c_str(), NULL, 10);
+            }
+        }
+    }
+    report("getline + strtol", now() - t0, c.ints.size(), c.int_bytes);
+
+    t0 = now();
+    for (int r = 0; r < ROUNDS; r++)
+    {
+        for (size_t i = 0; i < c.ints.size(); i++)
+        {
+            const char *p = c.ints[i].data();
+            int v = 0;
+            dake::parse_int(p, p + c.ints[i].length(), v);
+            int_sink = v;
+        }
+    }
+    report("dake::parse_int", now() - t0, c.ints.size(), c.int_bytes);
+}
+
+
+// Compares parse_float against strtof on the corpus and on random decimal
+// strings of varying length and exponent
+static int check_floats(const corpus &c)
+{
+    int mismatches = 0;
+    size_t checked = 0;
+
+    std::vector<std::string> inputs(c.floats);
+
+    srand(42);
+    for (int i = 0; i < 1000000; i++)
+    {
+        char buf[64];
+        int len = 0;
+
+        if (rand() & 1)
+            buf[len++] = '-';
+
+        int idigits = rand() % 8, fdigits = rand() % 20;
+        for (int j = 0; j < idigits; j++)
+            buf[len++] = '0' + rand() % 10;
+        buf[len++] = '.';
+        for (int j = 0; j < fdigits; j++)
+            buf[len++] = '0' + rand() % 10;
+        if (!idigits && !fdigits)
+            buf[len++] = '5';
+        if (!(rand() % 4))
+            len += sprintf(buf + len, "e%i", rand() % 80 - 40);
+        buf[len] = 0;
+
+        inputs.push_back(buf);
+    }
+
+    for (size_t i = 0; i < inputs.size(); i++)
+    {
+        const char *p = inputs[i].data();
+        float a = 0.f, b = strtof(inputs[i].c_str(), NULL);
+
+        if (!dake::parse_float(p, p + inputs[i].length(), a) || memcmp(&a, &b, sizeof(a)))
+        {
+            if (mismatches++ < 10)
+                fprintf(stderr, "Mismatch for %s: %.9g vs. %.9g\n", inputs[i].c_str(), a, b);
+        }
+        checked++;
+    }
+
+    printf("Checked %zu floats against strtof: %i mismatches\n", checked, mismatches);
+    return mismatches;
+}
+
+
+int main(int argc, char *argv[])
+{
+    corpus c;
+    c.float_bytes = c.int_bytes = 0;
+
+    if (argc > 1)
+        for (int i = 1; i < argc; i++)
+            add_file(c, argv[i]);
+    else
+        for (int i = 0; default_files[i]; i++)
+            add_file(c, default_files[i]);
+
+    bench_floats(c);
+    bench_ints(c);
+
+    return check_floats(c) ? 1 : 0;
+}
@@ -0,0 +1,258 @@
+// Benchmark for loading a whole scene at once (see dake/file_batch.h):
+// Loads all given meshes, with their material libraries and textures, once
+// one file after another on this thread (as obj_reader does on its own,
+// "serial"), and once through mesh_loader, which reads all files as a batch
+// and parses every mesh as soon as it has arrived ("batch").
+//
+// Every load is measured in a process of its own, so no material library
+// is known from a load before, both with all files dropped from the page
+// cache first ("cold", i.e. from the disk; this does not work on tmpfs) and
+// with all of them in it ("warm"). Batching only pays off on cold loads,
+// where the serial load takes about the sum of all reads and the batch
+// about the slowest one (plus parsing).
+//
+// Usage: bench_scene [-r rounds] [file...]
+// Without files, all meshes from data/ are used (so run this from the
+// repository root). Textures are read completely by the serial load (as
+// the image reader would), but not decoded by either (see no_textures.cxx).
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "mesh_loader.h"
+#include "obj_reader.h"
+#include "dake/file_batch.h"
+#include "dake/parallel.h"
+
+
+static const char *default_files[] = {
+    "data/bear/bear_body.obj",
+    "data/bear/bear_head.obj",
+    "data/bear/blossom.obj",
+    "data/bear/stem.obj",
+    "data/bear/swing.obj",
+    "data/bear/swing_rack.obj",
+    "data/robot/arm_left_lower.obj",
+    "data/robot/arm_left_upper.obj",
+    "data/robot/arm_right_lower.obj",
+    "data/robot/arm_right_upper.obj",
+    "data/robot/leg_left.obj",
+    "data/robot/leg_right.obj",
+    "data/robot/torso_lower.obj",
+    "data/robot/torso_upper.obj",
+    NULL
+};
+
+
+// Default number of repetitions of every measurement
+#define ROUNDS 5
+
+#define FLAGS obj_reader::LOAD_PARALLEL
+
+
+static double now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+
+// Drop the file from the page cache, so the next read comes from the disk
+static void evict(const std::string &name)
+{
+    int fd = open(name.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+
+// Read the whole file and throw it away
+static void read_file(const std::string &name)
+{
+    int fd = open(name.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+
+    char buf[65536];
+    while (read(fd, buf, sizeof(buf)) > 0);
+    close(fd);
+}
+
+
+static size_t load_serial(const std::vector<const char *> &files)
+{
+    size_t faces = 0;
+
+    for (std::vector<const char *>::const_iterator fi = files.begin(); fi != files.end(); fi++)
+    {
+        obj_reader mesh(*fi, FLAGS);
+        mesh.get_indexed_mesh();
+        faces += mesh.get_faces().size();
+
+        std::set<std::string> textures;
+        const std::vector<const material *> &mats = mesh.get_materials();
+        for (std::vector<const material *>::const_iterator mi = mats.begin(); mi != mats.end(); mi++)
+            if (!(*mi)->tex_fname.empty())
+                textures.insert((*mi)->tex_fname);
+
+        for (std::set<std::string>::const_iterator ti = textures.begin(); ti != textures.end(); ti++)
+            read_file(*ti);
+    }
+
+    return faces;
+}
+
+
+static size_t load_batch(const std::vector<const char *> &files)
+{
+    mesh_loader loader;
+    loader.lod_ratios.clear();
+
+    for (std::vector<const char *>::const_iterator fi = files.begin(); fi != files.end(); fi++)
+        loader.add(*fi, FLAGS);
+
+    loader.start();
+    while (loader.finished() < files.size())
+        usleep(100);
+
+    size_t faces = 0;
+    for (size_t i = 0; i < loader.size(); i++)
+        if (loader.get(i))
+            faces += loader.get(i)->get_faces().size();
+    return faces;
+}
+
+
+// Runs one load in a child process and returns the time it took (or a
+// negative value on failure); "faces" receives the number of faces loaded
+static double measure(const std::vector<const char *> &files, bool batch, size_t &faces)
+{
+    int fds[2];
+    if (pipe(fds))
+        return -1.;
+
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if (!pid)
+    {
+        close(fds[0]);
+
+        double t0 = now();
+        size_t count = batch ? load_batch(files) : load_serial(files);
+        double result[2] = { now() - t0, (double)count };
+
+        _exit(write(fds[1], result, sizeof(result)) == sizeof(result) ? 0 : 1);
+    }
+
+    close(fds[1]);
+
+    double result[2] = { -1., 0. };
+    if ((pid < 0) || (read(fds[0], result, sizeof(result)) != sizeof(result)))
+        result[0] = -1.;
+    close(fds[0]);
+
+    int status;
+    if ((pid > 0) && ((waitpid(pid, &status, 0) < 0) || !WIFEXITED(status) || WEXITSTATUS(status)))
+        result[0] = -1.;
+
+    faces = (size_t)result[1];
+    return result[0];
+}
+
+
+int main(int argc, char *argv[])
+{
+    int rounds = ROUNDS;
+    std::vector<const char *> files;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-r") && (i + 1 < argc))
+            rounds = atoi(argv[++i]);
+        else
+            files.push_back(argv[i]);
+    }
+
+    if (rounds < 1)
+        rounds = 1;
+    if (files.empty())
+        for (int i = 0; default_files[i]; i++)
+            files.push_back(default_files[i]);
+
+    // All files making up the scene, so they can be evicted
+    std::set<std::string> scene;
+    for (std::vector<const char *>::const_iterator fi = files.begin(); fi != files.end(); fi++)
+    {
+        obj_reader mesh(*fi, FLAGS);
+        if (mesh.get_faces().empty())
+        {
+            fprintf(stderr, "Could not load %s\n", *fi);
+            return 1;
+        }
+
+        scene.insert(*fi);
+        scene.insert(mesh.get_mtl_files().begin(), mesh.get_mtl_files().end());
+
+        const std::vector<const material *> &mats = mesh.get_materials();
+        for (std::vector<const material *>::const_iterator mi = mats.begin(); mi != mats.end(); mi++)
+            if (!(*mi)->tex_fname.empty())
+                scene.insert((*mi)->tex_fname);
+    }
+
+    dake::file_batch probe;
+    printf("%zu meshes, %zu files in total, %u worker threads, reading through %s\n", files.size(), scene.size(),
+           dake::worker_count(), probe.uses_io_uring() ? "io_uring" : "a thread pool");
+
+    int failures = 0;
+    double best[2][2] = { { 0., 0. }, { 0., 0. } };
+    size_t faces[2] = { 0, 0 };
+
+    for (int r = 0; r < rounds; r++)
+    {
+        for (int cold = 1; cold >= 0; cold--)
+        {
+            for (int batch = 0; batch < 2; batch++)
+            {
+                if (cold)
+                    for (std::set<std::string>::const_iterator si = scene.begin(); si != scene.end(); si++)
+                        evict(*si);
+
+                double t = measure(files, batch, faces[batch]);
+                if (t < 0.)
+                {
+                    fprintf(stderr, "%s load failed\n", batch ? "Batch" : "Serial");
+                    failures++;
+                    continue;
+                }
+
+                if (!r || t < best[cold][batch])
+                    best[cold][batch] = t;
+            }
+        }
+    }
+
+    if (faces[0] != faces[1])
+    {
+        fprintf(stderr, "Serial load has %zu faces, batch load %zu\n", faces[0], faces[1]);
+        failures++;
+    }
+
+    printf("  cold   %9.2f ms serial %9.2f ms batch\n", best[1][0] * 1e3, best[1][1] * 1e3);
+    printf("  warm   %9.2f ms serial %9.2f ms batch\n", best[0][0] * 1e3, best[0][1] * 1e3);
+
+    return failures ? 1 : 0;
+}
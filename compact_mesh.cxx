@@ -0,0 +1,105 @@
+#include "compact_mesh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <stdint.h>
+
+
+void compact_mesh::build(const indexed_mesh &mesh)
+{
+    indices16 = mesh.indices16;
+    indices32 = mesh.indices32;
+    batches = mesh.batches;
+    has_normals = mesh.has_normals;
+    has_tex_coords = mesh.has_tex_coords;
+
+    dake::vec3 pos_max(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
+    pos_min = -pos_max;
+
+    for (mesh_array<mesh_vertex>::const_iterator vi = mesh.vertices.begin(); vi != mesh.vertices.end(); vi++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            if (vi->position[j] < pos_min[j])
+                pos_min[j] = vi->position[j];
+            if (vi->position[j] > pos_max[j])
+                pos_max[j] = vi->position[j];
+        }
+    }
+
+    // A flat axis gets a scale of zero, so all values decode to pos_min
+    float inv_scale[3];
+    for (int j = 0; j < 3; j++)
+    {
+        if (mesh.vertices.empty())
+            pos_min[j] = 0.f;
+
+        float extent = mesh.vertices.empty() ? 0.f : pos_max[j] - pos_min[j];
+        pos_scale[j] = extent / 65535.f;
+        inv_scale[j] = (extent > 0.f) ? 1.f / extent : 0.f;
+    }
+
+    std::vector<compact_vertex> &list = vertices.edit();
+    list.resize(mesh.vertices.size());
+
+    for (size_t i = 0; i < mesh.vertices.size(); i++)
+    {
+        const mesh_vertex &in = mesh.vertices[i];
+        compact_vertex &out = list[i];
+
+        for (int j = 0; j < 3; j++)
+            out.position[j] = dake::to_unorm16((in.position[j] - pos_min[j]) * inv_scale[j]);
+        out.reserved = 0;
+
+        out.normal = has_normals ? dake::to_oct32(in.normal) : 0;
+
+        out.tex_coord[0] = dake::to_half(in.tex_coord[0]);
+        out.tex_coord[1] = dake::to_half(in.tex_coord[1]);
+    }
+}
+
+
+compact_error compact_mesh::error_against(const indexed_mesh &mesh) const
+{
+    compact_error err;
+    size_t count = std::min(vertices.size(), mesh.vertices.size());
+    size_t normal_count = 0;
+    double pos_sum = 0., normal_sum = 0., tc_sum = 0.;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const mesh_vertex &ref = mesh.vertices[i];
+
+        float pos_err = (position(i) - ref.position).length();
+        pos_sum += pos_err;
+        err.position_max = std::max(err.position_max, pos_err);
+
+        dake::vec2 tc = tex_coord(i);
+        float tc_err = std::max(fabsf(tc[0] - ref.tex_coord[0]), fabsf(tc[1] - ref.tex_coord[1]));
+        tc_sum += tc_err;
+        err.tex_coord_max = std::max(err.tex_coord_max, tc_err);
+
+        if (has_normals && (ref.normal.length() > 0.f))
+        {
+            float cos_angle = normal(i).dot(ref.normal.normalized());
+            cos_angle = std::max(-1.f, std::min(1.f, cos_angle));
+
+            float angle = acosf(cos_angle) * 180.f / static_cast<float>(M_PI);
+            normal_sum += angle;
+            err.normal_max = std::max(err.normal_max, angle);
+            normal_count++;
+        }
+    }
+
+    if (count)
+    {
+        err.position_mean = static_cast<float>(pos_sum / count);
+        err.tex_coord_mean = static_cast<float>(tc_sum / count);
+    }
+    if (normal_count)
+        err.normal_mean = static_cast<float>(normal_sum / normal_count);
+
+    return err;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+
+#include "dake/quantize.h"
+#include "dake/vector.h"
+
+#include "indexed_mesh.h"
+
+
+// A vertex of a compact_mesh, half the size of a mesh_vertex (16 instead of
+// 32 bytes):
+//  * position: 16 bit per axis, relative to the mesh's bounding box
+//  * normal: octahedral encoding in 32 bit (see dake::to_oct32)
+//  * tex_coord: half floats
+struct compact_vertex
+{
+    uint16_t position[3];
+    // Padding, so normal is aligned; always zero
+    uint16_t reserved;
+    uint32_t normal;
+    uint16_t tex_coord[2];
+};
+
+// Errors of a compact_mesh against the full precision mesh it was built
+// from. Positions are compared by their distance, normals by the angle
+// between them (in degrees; vertices without a normal are skipped) and
+// texture coordinates by the larger difference of both components.
+struct compact_error
+{
+    float position_max, position_mean;
+    float normal_max, normal_mean;
+    float tex_coord_max, tex_coord_mean;
+
+    compact_error(void):
+        position_max(0.f), position_mean(0.f),
+        normal_max(0.f), normal_mean(0.f),
+        tex_coord_max(0.f), tex_coord_mean(0.f)
+    {}
+};
+
+// An indexed_mesh with quantized vertex attributes. The indices and batches
+// are the same as in the mesh it has been built from (and if that only has
+// views of its indices, so does this one).
+struct compact_mesh
+{
+    mesh_array<compact_vertex> vertices;
+
+    mesh_array<uint16_t> indices16;
+    mesh_array<uint32_t> indices32;
+
+    std::vector<mesh_batch> batches;
+
+    bool has_normals, has_tex_coords;
+
+    // A position is pos_min + pos_scale * (quantized value), per axis
+    dake::vec3 pos_min, pos_scale;
+
+    compact_mesh(void): has_normals(false), has_tex_coords(false) {}
+
+    size_t index_count(void) const
+    { return indices16.empty() ? indices32.size() : indices16.size(); }
+
+    uint32_t index(size_t i) const
+    { return indices16.empty() ? indices32[i] : indices16[i]; }
+
+    // Quantize the given mesh's vertices and copy its indices and batches
+    void build(const indexed_mesh &mesh);
+
+    // Decode the attributes of vertex "i"
+    dake::vec3 position(size_t i) const
+    {
+        const compact_vertex &v = vertices[i];
+        return dake::vec3(pos_min.x() + pos_scale.x() * v.position[0],
+                          pos_min.y() + pos_scale.y() * v.position[1],
+                          pos_min.z() + pos_scale.z() * v.position[2]);
+    }
+
+    // Zero if the mesh has no normals
+    dake::vec3 normal(size_t i) const
+    { return has_normals ? dake::from_oct32(vertices[i].normal) : dake::vec3(); }
+
+    dake::vec2 tex_coord(size_t i) const
+    {
+        return dake::vec2(dake::from_half(vertices[i].tex_coord[0]),
+                          dake::from_half(vertices[i].tex_coord[1]));
+    }
+
+    mesh_vertex decode(size_t i) const
+    {
+        mesh_vertex v;
+        v.position = position(i);
+        v.normal = normal(i);
+        v.tex_coord = tex_coord(i);
+        return v;
+    }
+
+    // Compare all vertices against those of "mesh", which must be the one
+    // this has been built from
+    compact_error error_against(const indexed_mesh &mesh) const;
+
+    // Size of the vertex and index data in bytes
+    size_t memory_size(void) const
+    {
+        return vertices.size() * sizeof(compact_vertex) + indices16.size() * sizeof(uint16_t)
+             + indices32.size() * sizeof(uint32_t);
+    }
+};
@@ -0,0 +1,85 @@
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <string>
+
+#ifdef __GNUC__
+#include <fcntl.h>
+#include <unistd.h>
+#else
+#include <process.h>
+#define getpid _getpid
+#endif
+
+#include "atomic_file.h"
+
+
+dake::atomic_file::atomic_file(const std::string &fname):
+    name(fname),
+    fp(NULL)
+{
+    static std::atomic<unsigned> counter(0);
+
+    // Only fails for names left over from a process with the same ID
+    for (int attempt = 0; !fp && (attempt < 16); attempt++)
+    {
+        char suffix[32];
+        snprintf(suffix, sizeof(suffix), ".%d.%u.tmp", (int)getpid(), counter++);
+        tmp_name = name + suffix;
+
+#ifdef __GNUC__
+        int fd = open(tmp_name.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+        if (fd < 0)
+        {
+            if (errno != EEXIST)
+                break;
+            continue;
+        }
+
+        fp = fdopen(fd, "wb");
+        if (!fp)
+        {
+            close(fd);
+            remove(tmp_name.c_str());
+            break;
+        }
+#else
+        fp = fopen(tmp_name.c_str(), "wb");
+        if (!fp)
+            break;
+#endif
+    }
+
+    if (!fp)
+        tmp_name.clear();
+}
+
+
+dake::atomic_file::~atomic_file(void)
+{
+    if (fp)
+        fclose(fp);
+    if (!tmp_name.empty())
+        remove(tmp_name.c_str());
+}
+
+
+bool dake::atomic_file::commit(void)
+{
+    if (!fp)
+        return false;
+
+    bool ok = !ferror(fp);
+    ok = !fclose(fp) && ok;
+    fp = NULL;
+
+#ifndef __GNUC__
+    remove(name.c_str());
+#endif
+    if (!ok || rename(tmp_name.c_str(), name.c_str()))
+        return false;
+
+    // Nothing left to remove
+    tmp_name.clear();
+    return true;
+}
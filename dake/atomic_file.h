@@ -0,0 +1,42 @@
+#ifndef ATOMIC_FILE_H
+#define ATOMIC_FILE_H
+
+#include <cstdio>
+#include <string>
+
+
+namespace dake
+{
+
+// Writes a whole file at once: Everything goes to a temporary file of its
+// own next to it first (named after the process and a counter, so several
+// writers never share one), which only replaces the file on commit(). Thus
+// nobody ever opens a partially written file, and of several processes
+// writing the same file at the same time, the last one to commit wins.
+class atomic_file
+{
+    private:
+        std::string name, tmp_name;
+        FILE *fp;
+
+        atomic_file(const atomic_file &);
+        atomic_file &operator=(const atomic_file &);
+
+    public:
+        atomic_file(const std::string &name);
+        // Removes the temporary file unless it has been committed
+        ~atomic_file(void);
+
+        // Where to write to; NULL if the temporary file could not be
+        // created
+        FILE *stream(void) { return fp; }
+
+        // Close the temporary file and move it into place; if that fails
+        // (or anything written before did), it is removed and false is
+        // returned
+        bool commit(void);
+};
+
+}
+
+#endif
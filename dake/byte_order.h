@@ -0,0 +1,41 @@
+#ifndef BYTE_ORDER_H
+#define BYTE_ORDER_H
+
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
+
+
+namespace dake
+{
+
+// Reading values from binary files in either byte order.
+
+
+// Whether this machine stores the least significant byte first
+static inline bool little_endian(void)
+{
+    uint16_t v = 1;
+    unsigned char b;
+    memcpy(&b, &v, 1);
+    return b == 1;
+}
+
+
+// Read a value of type T (which may be unaligned) from p, stored in big
+// endian byte order if "big" is set and in little endian order otherwise
+template<typename T> static inline T load_value(const char *p, bool big)
+{
+    unsigned char b[sizeof(T)];
+    memcpy(b, p, sizeof(T));
+    if (big == little_endian())
+        std::reverse(b, b + sizeof(T));
+
+    T v;
+    memcpy(&v, b, sizeof(T));
+    return v;
+}
+
+}
+
+#endif
@@ -0,0 +1,509 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <string>
+#include <vector>
+
+#ifdef __GNUC__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#ifdef __has_include
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING
+#endif
+#endif
+#endif
+
+#include "file_batch.h"
+
+
+// Number of threads reading files if io_uring cannot be used. Reading is
+// mostly waiting, so this does not depend on the number of cores.
+#define IO_THREADS 8
+
+// Number of reads in flight through io_uring at once
+#define QUEUE_DEPTH 64
+
+
+// Read the whole file "name" into "data"
+static bool read_file(const std::string &name, std::vector<char> &data)
+{
+#ifdef __GNUC__
+    int fd = open(name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    data.resize(st.st_size);
+
+    size_t done = 0;
+    while (done < data.size())
+    {
+        ssize_t len = read(fd, &data[done], data.size() - done);
+        if ((len < 0) && (errno == EINTR))
+            continue;
+        if (len < 0)
+        {
+            close(fd);
+            data.clear();
+            return false;
+        }
+        // The file has become shorter in the meantime
+        if (!len)
+            break;
+
+        done += len;
+    }
+
+    data.resize(done);
+    close(fd);
+    return true;
+#else
+    FILE *fp = fopen(name.c_str(), "rb");
+    if (!fp)
+        return false;
+
+    fseek(fp, 0, SEEK_END);
+    data.resize(ftell(fp));
+    fseek(fp, 0, SEEK_SET);
+
+    data.resize(data.empty() ? 0 : fread(&data[0], 1, data.size(), fp));
+    fclose(fp);
+    return true;
+#endif
+}
+
+
+#ifdef HAVE_IO_URING
+
+// The rings shared with the kernel, and what every slot (i.e. read in
+// flight) is reading; slots are identified by the user_data of their
+// submissions and completions
+struct dake::file_batch::ring
+{
+    int fd;
+
+    void *sq_map, *cq_map;
+    size_t sq_map_len, cq_map_len;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    // Submissions not taken by the kernel yet
+    unsigned unsubmitted;
+
+    request *slot_requests[QUEUE_DEPTH];
+    int slot_fds[QUEUE_DEPTH];
+    size_t slot_offsets[QUEUE_DEPTH];
+    struct iovec slot_iovs[QUEUE_DEPTH];
+    std::vector<unsigned> free_slots;
+
+    // Submit reading the rest of the file of slot "s"
+    void queue_read(unsigned s)
+    {
+        request *r = slot_requests[s];
+        slot_iovs[s].iov_base = &r->data[slot_offsets[s]];
+        slot_iovs[s].iov_len = r->data.size() - slot_offsets[s];
+
+        // Only this thread writes the tail
+        unsigned tail = *sq_tail;
+        unsigned index = tail & *sq_mask;
+
+        struct io_uring_sqe *sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READV;
+        sqe->fd = slot_fds[s];
+        sqe->addr = reinterpret_cast<unsigned long>(&slot_iovs[s]);
+        sqe->len = 1;
+        sqe->off = slot_offsets[s];
+        sqe->user_data = s;
+
+        sq_array[index] = index;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        unsubmitted++;
+    }
+};
+
+
+dake::file_batch::ring *dake::file_batch::create_ring(void)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    int fd = syscall(__NR_io_uring_setup, QUEUE_DEPTH, &p);
+    if (fd < 0)
+        return NULL;
+
+    ring *r = new ring;
+    r->fd = fd;
+    r->unsubmitted = 0;
+    r->sq_map = r->cq_map = MAP_FAILED;
+    r->sqes = static_cast<struct io_uring_sqe *>(MAP_FAILED);
+
+    r->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    // Both rings may share one mapping
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single)
+        r->sq_map_len = r->cq_map_len = std::max(r->sq_map_len, r->cq_map_len);
+
+    r->sq_map = mmap(NULL, r->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (r->sq_map != MAP_FAILED)
+        r->cq_map = single ? r->sq_map : mmap(NULL, r->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                              fd, IORING_OFF_CQ_RING);
+    if (r->cq_map != MAP_FAILED)
+        r->sqes = static_cast<struct io_uring_sqe *>(mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE,
+                                                          MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+    if (r->sqes == MAP_FAILED)
+    {
+        destroy_ring(r);
+        return NULL;
+    }
+
+    char *sq = static_cast<char *>(r->sq_map), *cq = static_cast<char *>(r->cq_map);
+    r->sq_head = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+    r->sq_tail = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+    r->sq_mask = reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+    r->sq_array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+    r->cq_head = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+    r->cq_tail = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+    r->cq_mask = reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+    r->cqes = reinterpret_cast<struct io_uring_cqe *>(cq + p.cq_off.cqes);
+
+    // Every slot has at most one submission queued, so the rings never
+    // overflow as long as there are at least as many entries as slots
+    unsigned slots = std::min<unsigned>(QUEUE_DEPTH, p.sq_entries);
+    for (unsigned s = slots; s > 0; s--)
+        r->free_slots.push_back(s - 1);
+
+    return r;
+}
+
+
+void dake::file_batch::destroy_ring(ring *r)
+{
+    if (r->sqes != MAP_FAILED)
+        munmap(r->sqes, r->sqes_len);
+    if ((r->cq_map != MAP_FAILED) && (r->cq_map != r->sq_map))
+        munmap(r->cq_map, r->cq_map_len);
+    if (r->sq_map != MAP_FAILED)
+        munmap(r->sq_map, r->sq_map_len);
+
+    close(r->fd);
+    delete r;
+}
+
+#endif
+
+
+dake::file_batch::file_batch(bool allow_io_uring):
+    uring(NULL),
+    active(0),
+    running(false),
+    stopping(false)
+{
+#ifdef HAVE_IO_URING
+    if (allow_io_uring)
+        uring = create_ring();
+#else
+    (void)allow_io_uring;
+#endif
+}
+
+
+dake::file_batch::~file_batch(void)
+{
+    for (std::deque<request *>::iterator i = pending.begin(); i != pending.end(); i++)
+        delete *i;
+    for (std::deque<request *>::iterator i = completed.begin(); i != completed.end(); i++)
+        delete *i;
+
+#ifdef HAVE_IO_URING
+    if (uring)
+        destroy_ring(uring);
+#endif
+}
+
+
+void dake::file_batch::add(const std::string &name, file_receiver &receiver, size_t tag)
+{
+    request *r = new request;
+    r->name = name;
+    r->receiver = &receiver;
+    r->tag = tag;
+    r->ok = false;
+
+    std::lock_guard<std::mutex> guard(lock);
+    pending.push_back(r);
+
+    // Another thread for the pool, unless it is as large as it gets
+    if (running && !uring && (workers.size() < IO_THREADS))
+        workers.push_back(std::thread(&file_batch::work, this));
+    wake_workers.notify_one();
+}
+
+
+size_t dake::file_batch::run(void)
+{
+    return uring ? run_ring() : run_pool();
+}
+
+
+size_t dake::file_batch::deliver(std::unique_lock<std::mutex> &guard)
+{
+    size_t failed = 0;
+    std::exception_ptr error;
+
+    while (!completed.empty())
+    {
+        request *r = completed.front();
+        completed.pop_front();
+
+        // The receiver may add files
+        guard.unlock();
+
+        if (!r->ok)
+            failed++;
+
+        try
+        {
+            r->receiver->file_read(r->tag, r->name, r->data, r->ok);
+        }
+        catch (...)
+        {
+            if (!error)
+                error = std::current_exception();
+        }
+        delete r;
+
+        guard.lock();
+    }
+
+    if (error)
+        std::rethrow_exception(error);
+
+    return failed;
+}
+
+
+// Every thread of the pool reads one file after another until the batch is
+// done
+void dake::file_batch::work(void)
+{
+    std::unique_lock<std::mutex> guard(lock);
+
+    for (;;)
+    {
+        while (pending.empty() && !stopping)
+            wake_workers.wait(guard);
+        if (pending.empty())
+            return;
+
+        request *r = pending.front();
+        pending.pop_front();
+        active++;
+
+        guard.unlock();
+        r->ok = read_file(r->name, r->data);
+        guard.lock();
+
+        active--;
+        completed.push_back(r);
+        wake_runner.notify_one();
+    }
+}
+
+
+size_t dake::file_batch::run_pool(void)
+{
+    std::unique_lock<std::mutex> guard(lock);
+
+    running = true;
+    for (size_t i = 0; (i < pending.size()) && (i < IO_THREADS); i++)
+        workers.push_back(std::thread(&file_batch::work, this));
+
+    size_t failed = 0;
+    std::exception_ptr error;
+
+    for (;;)
+    {
+        while (completed.empty() && (active || !pending.empty()))
+            wake_runner.wait(guard);
+        if (completed.empty())
+            break;
+
+        try
+        {
+            failed += deliver(guard);
+        }
+        catch (...)
+        {
+            if (!error)
+                error = std::current_exception();
+        }
+    }
+
+    stopping = true;
+    wake_workers.notify_all();
+    guard.unlock();
+
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+
+    guard.lock();
+    workers.clear();
+    running = stopping = false;
+    guard.unlock();
+
+    if (error)
+        std::rethrow_exception(error);
+
+    return failed;
+}
+
+
+size_t dake::file_batch::run_ring(void)
+{
+#ifdef HAVE_IO_URING
+    std::unique_lock<std::mutex> guard(lock);
+
+    ring &r = *uring;
+    unsigned in_flight = 0;
+    size_t failed = 0;
+    std::exception_ptr error;
+
+    for (;;)
+    {
+        // Start reading as many files as there are free slots. Opening is
+        // done right here, as it does not have to wait for the disk as
+        // long as the directories are cached.
+        while (!r.free_slots.empty() && !pending.empty())
+        {
+            request *req = pending.front();
+            pending.pop_front();
+
+            struct stat st;
+            int fd = open(req->name.c_str(), O_RDONLY | O_CLOEXEC);
+            if ((fd >= 0) && (fstat(fd, &st) < 0))
+            {
+                close(fd);
+                fd = -1;
+            }
+            if (fd < 0)
+            {
+                completed.push_back(req);
+                continue;
+            }
+            if (!st.st_size)
+            {
+                close(fd);
+                req->ok = true;
+                completed.push_back(req);
+                continue;
+            }
+
+            req->data.resize(st.st_size);
+
+            unsigned s = r.free_slots.back();
+            r.free_slots.pop_back();
+            r.slot_requests[s] = req;
+            r.slot_fds[s] = fd;
+            r.slot_offsets[s] = 0;
+            r.queue_read(s);
+            in_flight++;
+        }
+
+        // Only wait for a read if there is nothing to deliver
+        unsigned wait = (completed.empty() && in_flight) ? 1 : 0;
+        if (r.unsubmitted || wait)
+        {
+            int ret = syscall(__NR_io_uring_enter, r.fd, r.unsubmitted, wait, wait ? IORING_ENTER_GETEVENTS : 0,
+                              NULL, 0);
+            // Otherwise, it has been interrupted or the kernel is short of
+            // resources for the moment, so just try again
+            if (ret >= 0)
+                r.unsubmitted -= ret;
+        }
+
+        unsigned head = *r.cq_head;
+        unsigned tail = __atomic_load_n(r.cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++)
+        {
+            const struct io_uring_cqe &cqe = r.cqes[head & *r.cq_mask];
+            unsigned s = cqe.user_data;
+            request *req = r.slot_requests[s];
+
+            if ((cqe.res == -EINTR) || (cqe.res == -EAGAIN))
+            {
+                r.queue_read(s);
+                continue;
+            }
+
+            if (cqe.res > 0)
+            {
+                r.slot_offsets[s] += cqe.res;
+                // Large reads may come in pieces
+                if (r.slot_offsets[s] < req->data.size())
+                {
+                    r.queue_read(s);
+                    continue;
+                }
+            }
+
+            // Done, or the file has become shorter in the meantime
+            req->ok = cqe.res >= 0;
+            req->data.resize(req->ok ? r.slot_offsets[s] : 0);
+
+            close(r.slot_fds[s]);
+            r.free_slots.push_back(s);
+            in_flight--;
+            completed.push_back(req);
+        }
+        __atomic_store_n(r.cq_head, head, __ATOMIC_RELEASE);
+
+        if (!completed.empty())
+        {
+            try
+            {
+                failed += deliver(guard);
+            }
+            catch (...)
+            {
+                if (!error)
+                    error = std::current_exception();
+            }
+        }
+        else if (!in_flight && pending.empty())
+            break;
+    }
+
+    guard.unlock();
+
+    if (error)
+        std::rethrow_exception(error);
+
+    return failed;
+#else
+    return run_pool();
+#endif
+}
@@ -0,0 +1,104 @@
+#ifndef FILE_BATCH_H
+#define FILE_BATCH_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace dake
+{
+
+// Receives the files read by a file_batch
+class file_receiver
+{
+    public:
+        virtual ~file_receiver(void) {}
+
+        // The whole contents of the file "name", added to the batch with
+        // "tag". The data may be taken (e.g. by swapping it with a vector of
+        // one's own). "ok" is false (and the data empty) if the file could
+        // not be read.
+        virtual void file_read(size_t tag, const std::string &name, std::vector<char> &data, bool ok) = 0;
+};
+
+
+// Reads whole files, many at once: All files added to a batch are read at
+// the same time when it is run, through io_uring on Linux kernels providing
+// it and on a pool of threads otherwise, so the batch takes about as long
+// as its slowest read instead of all reads one after another (which matters
+// on cold caches and network file systems). Every file is handed to its
+// receiver as soon as it has been read completely, while the other reads go
+// on. Receivers are called one at a time on the thread running the batch
+// and may add more files to it (e.g. those a file just read refers to).
+// Not thread safe otherwise.
+class file_batch
+{
+    private:
+        struct request
+        {
+            std::string name;
+            file_receiver *receiver;
+            size_t tag;
+            std::vector<char> data;
+            bool ok;
+        };
+
+        // The io_uring instance; see file_batch.cxx
+        struct ring;
+        ring *uring;
+
+        // Return NULL if io_uring is not available (or not permitted)
+        static ring *create_ring(void);
+        static void destroy_ring(ring *r);
+
+        // Files not read yet resp. read, but not handed to their receivers
+        // yet; guarded by "lock" while the thread pool is running
+        std::deque<request *> pending, completed;
+        // Number of files the pool is reading right now
+        size_t active;
+        bool running, stopping;
+        std::mutex lock;
+        std::condition_variable wake_workers, wake_runner;
+        std::vector<std::thread> workers;
+
+        void work(void);
+        size_t run_pool(void);
+        size_t run_ring(void);
+
+        // Hand everything completed to the receivers; returns the number
+        // of files which could not be read
+        size_t deliver(std::unique_lock<std::mutex> &guard);
+
+        file_batch(const file_batch &);
+        file_batch &operator=(const file_batch &);
+
+    public:
+        // io_uring is only used if "allow_io_uring" is set
+        file_batch(bool allow_io_uring = true);
+        // Drops all files not read yet
+        ~file_batch(void);
+
+        // Read the file "name" and hand it to "receiver" along with "tag"
+        // once the batch is run (or soon, if it is running already)
+        void add(const std::string &name, file_receiver &receiver, size_t tag = 0);
+
+        // Read all files added before and while running, and return once
+        // all of them have been handed to their receivers. Returns the
+        // number of files which could not be read. If a receiver throws,
+        // the rest are still read and delivered before the first exception
+        // is rethrown here.
+        size_t run(void);
+
+        // Whether the files are read through io_uring (and not through a
+        // pool of threads)
+        bool uses_io_uring(void) const { return uring != NULL; }
+};
+
+}
+
+#endif
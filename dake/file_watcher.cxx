@@ -0,0 +1,114 @@
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <climits>
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif
+
+#include "file_watcher.h"
+
+
+dake::file_watcher::file_watcher(void)
+{
+#ifdef __linux__
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#else
+    fd = -1;
+#endif
+}
+
+
+dake::file_watcher::~file_watcher(void)
+{
+#ifdef __linux__
+    if (fd >= 0)
+        close(fd);
+#endif
+}
+
+
+bool dake::file_watcher::watch(const std::string &name)
+{
+#ifdef __linux__
+    if (fd < 0)
+        return false;
+
+    char buf[PATH_MAX];
+    if (!realpath(name.c_str(), buf))
+        return false;
+
+    std::string path(buf);
+    size_t slash = path.rfind('/');
+    std::string dir = slash ? path.substr(0, slash) : std::string("/");
+
+    // Only the directory can be watched for files being replaced; watching
+    // it again just returns the same descriptor
+    int wd = inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (wd < 0)
+        return false;
+
+    dirs[wd] = dir;
+
+    std::pair<std::multimap<std::string, std::string>::iterator,
+              std::multimap<std::string, std::string>::iterator> r = files.equal_range(path);
+    for (std::multimap<std::string, std::string>::iterator i = r.first; i != r.second; i++)
+        if (i->second == name)
+            return true;
+
+    files.insert(std::make_pair(path, name));
+    return true;
+#else
+    (void)name;
+    return false;
+#endif
+}
+
+
+void dake::file_watcher::poll(std::vector<std::string> &changed)
+{
+#ifdef __linux__
+    if (fd < 0)
+        return;
+
+    size_t first = changed.size();
+    alignas(struct inotify_event) char buf[4096];
+
+    ssize_t len;
+    while ((len = read(fd, buf, sizeof(buf))) > 0)
+    {
+        for (char *p = buf; p < buf + len; )
+        {
+            const struct inotify_event *ev = reinterpret_cast<const struct inotify_event *>(p);
+            p += sizeof(*ev) + ev->len;
+
+            // Events have been lost, so everything may have changed
+            if (ev->mask & IN_Q_OVERFLOW)
+            {
+                for (std::multimap<std::string, std::string>::const_iterator i = files.begin(); i != files.end(); i++)
+                    if (std::find(changed.begin() + first, changed.end(), i->second) == changed.end())
+                        changed.push_back(i->second);
+                continue;
+            }
+
+            std::map<int, std::string>::const_iterator dir = dirs.find(ev->wd);
+            if (!ev->len || (dir == dirs.end()))
+                continue;
+
+            std::string path = (dir->second == "/" ? std::string() : dir->second) + "/" + ev->name;
+
+            std::pair<std::multimap<std::string, std::string>::const_iterator,
+                      std::multimap<std::string, std::string>::const_iterator> r = files.equal_range(path);
+            for (std::multimap<std::string, std::string>::const_iterator i = r.first; i != r.second; i++)
+                if (std::find(changed.begin() + first, changed.end(), i->second) == changed.end())
+                    changed.push_back(i->second);
+        }
+    }
+#else
+    (void)changed;
+#endif
+}
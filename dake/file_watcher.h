@@ -0,0 +1,43 @@
+#ifndef FILE_WATCHER_H
+#define FILE_WATCHER_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+
+namespace dake
+{
+
+// Notices when files are written to or replaced (as many editors save by
+// renaming a new file over the old one). The directories containing the
+// files are watched through inotify on Linux; on other systems, watch()
+// always fails and no changes are ever reported. Not thread safe.
+class file_watcher
+{
+    private:
+        int fd;
+        // Canonical path of every directory watched, by watch descriptor
+        std::map<int, std::string> dirs;
+        // Names files have been given to watch() with, by canonical path
+        std::multimap<std::string, std::string> files;
+
+        file_watcher(const file_watcher &);
+        file_watcher &operator=(const file_watcher &);
+
+    public:
+        file_watcher(void);
+        ~file_watcher(void);
+
+        // Watch the file "name", which must exist; returns false if it
+        // cannot be watched
+        bool watch(const std::string &name);
+
+        // Append the names (as given to watch()) of all files changed since
+        // the last call to "changed", each name once. Does not block.
+        void poll(std::vector<std::string> &changed);
+};
+
+}
+
+#endif
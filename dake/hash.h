@@ -0,0 +1,52 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
+
+namespace dake
+{
+
+// 64 bit FNV-1a hash of a memory range; pass a previous result as "h" to
+// hash several ranges as one
+static inline uint64_t hash64(const void *data, size_t len, uint64_t h = UINT64_C(0xcbf29ce484222325))
+{
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= p[i];
+        h *= UINT64_C(0x100000001b3);
+    }
+
+    return h;
+}
+
+
+// Another 64 bit hash of a memory range, which takes eight bytes at a time
+// and is therefore several times as fast as hash64 on large ranges (the
+// results differ from hash64's)
+static inline uint64_t hash64_wide(const void *data, size_t len, uint64_t h = UINT64_C(0xcbf29ce484222325))
+{
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    size_t i;
+
+    for (i = 0; i + 8 <= len; i += 8)
+    {
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+
+        w *= UINT64_C(0x9e3779b97f4a7c15);
+        w ^= w >> 32;
+        h = (h ^ w) * UINT64_C(0x100000001b3);
+    }
+
+    h = hash64(p + i, len - i, h ^ len);
+    return h ^ (h >> 29);
+}
+
+}
+
+#endif
@@ -0,0 +1,88 @@
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#ifdef __GNUC__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "mapped_file.h"
+
+
+dake::mapped_file::mapped_file(const std::string &name):
+    ptr(NULL),
+    len(0),
+    opened(false)
+#ifndef __GNUC__
+    , buffer(NULL)
+#endif
+{
+#ifdef __GNUC__
+    int fd = open(name.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        close(fd);
+        return;
+    }
+
+    len = st.st_size;
+    if (len)
+    {
+        void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+        {
+            close(fd);
+            len = 0;
+            return;
+        }
+
+        // We are going to read the file front to back exactly once
+        madvise(map, len, MADV_SEQUENTIAL);
+        ptr = static_cast<const char *>(map);
+    }
+
+    // The mapping stays valid after the descriptor is gone
+    close(fd);
+#else
+    FILE *fp = fopen(name.c_str(), "rb");
+    if (!fp)
+        return;
+
+    fseek(fp, 0, SEEK_END);
+    len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    buffer = static_cast<char *>(malloc(len ? len : 1));
+    if (fread(buffer, 1, len, fp) != len)
+    {
+        fclose(fp);
+        free(buffer);
+        buffer = NULL;
+        len = 0;
+        return;
+    }
+    fclose(fp);
+
+    ptr = buffer;
+#endif
+
+    opened = true;
+}
+
+
+dake::mapped_file::~mapped_file(void)
+{
+#ifdef __GNUC__
+    if (ptr)
+        munmap(const_cast<char *>(ptr), len);
+#else
+    free(buffer);
+#endif
+}
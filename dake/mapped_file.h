@@ -0,0 +1,39 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+
+namespace dake
+{
+
+// Read-only view of a whole file. On systems providing mmap() the file is
+// mapped directly, otherwise it is read into a heap buffer once.
+class mapped_file
+{
+    private:
+        const char *ptr;
+        size_t len;
+        bool opened;
+#ifndef __GNUC__
+        char *buffer;
+#endif
+
+        mapped_file(const mapped_file &);
+        mapped_file &operator=(const mapped_file &);
+
+    public:
+        mapped_file(const std::string &name);
+        ~mapped_file(void);
+
+        bool is_open(void) const { return opened; }
+
+        const char *begin(void) const { return ptr; }
+        const char *end(void) const { return ptr + len; }
+        size_t size(void) const { return len; }
+};
+
+}
+
+#endif
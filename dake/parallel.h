@@ -0,0 +1,72 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <cstddef>
+#include <exception>
+#include <thread>
+#include <vector>
+
+
+namespace dake
+{
+
+// Number of worker threads to use for data parallel work
+static inline unsigned worker_count(void)
+{
+    unsigned n = std::thread::hardware_concurrency();
+    return n ? n : 1;
+}
+
+
+// Runs func(i) for i = first, first + stride, first + 2 * stride, ... < count
+// and stores any exception thrown in *error.
+template<typename F> void parallel_strided(F *func, size_t first, size_t stride, size_t count, std::exception_ptr *error)
+{
+    try
+    {
+        for (size_t i = first; i < count; i += stride)
+            (*func)(i);
+    }
+    catch (...)
+    {
+        *error = std::current_exception();
+    }
+}
+
+
+// Calls func(i) for every i in [0, count), distributing the calls over up
+// to worker_count() threads (the calling thread being one of them). Returns
+// once all calls are done; if any of them threw, the first exception is
+// rethrown here.
+template<typename F> void parallel_for(size_t count, F func)
+{
+    size_t threads = worker_count();
+    if (threads > count)
+        threads = count;
+
+    if (threads <= 1)
+    {
+        for (size_t i = 0; i < count; i++)
+            func(i);
+        return;
+    }
+
+    std::vector<std::exception_ptr> errors(threads);
+    std::vector<std::thread> workers;
+
+    for (size_t t = 1; t < threads; t++)
+        workers.push_back(std::thread(parallel_strided<F>, &func, t, threads, count, &errors[t]));
+
+    parallel_strided(&func, 0, threads, count, &errors[0]);
+
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+
+    for (size_t t = 0; t < threads; t++)
+        if (errors[t])
+            std::rethrow_exception(errors[t]);
+}
+
+}
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef PARSE_H
+#define PARSE_H
+
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+
+
+namespace dake
+{
+
+// Number parsers working on a character range [p, e) which need not be
+// NUL-terminated. They neither allocate memory nor depend on the locale.
+// On success, they store the value, advance p behind the number and return
+// true; otherwise, p is left untouched and false is returned.
+
+
+// Parses a decimal integer with optional sign
+static inline bool parse_int(const char *&p, const char *e, int &out)
+{
+    const char *s = p;
+
+    bool neg = (s < e) && (*s == '-');
+    s += (s < e) && ((*s == '-') || (*s == '+'));
+
+    const char *digits = s;
+    unsigned val = 0;
+    unsigned d;
+
+    // (unsigned)(c - '0') < 10 checks for a digit with a single compare
+    while ((s < e) && ((d = static_cast<unsigned char>(*s) - '0') < 10))
+    {
+        val = val * 10 + d;
+        s++;
+    }
+
+    if (s == digits)
+        return false;
+
+    out = neg ? -static_cast<int>(val) : static_cast<int>(val);
+    p = s;
+    return true;
+}
+
+
+// Slow path of parse_float(): Hands a NUL-terminated copy of the token to
+// strtof(). Used for everything the fast path cannot round correctly.
+static inline bool parse_float_slow(const char *&p, const char *e, float &out)
+{
+    char buf[128];
+    size_t len = 0;
+
+    while ((p + len < e) && (len < sizeof(buf) - 1) && p[len] && !strchr(" \t\r\n/", p[len]))
+        len++;
+    if (!len || (len >= sizeof(buf) - 1))
+        return false;
+
+    memcpy(buf, p, len);
+    buf[len] = 0;
+
+    char *end;
+    out = strtof(buf, &end);
+    if (end == buf)
+        return false;
+
+    p += end - buf;
+    return true;
+}
+
+
+// Parses a decimal floating point number ([+-]digits[.digits][(e|E)[+-]digits])
+// and returns the correctly rounded float value, just like strtof() would.
+//
+// The fast path gathers up to 19 significant digits into an integer w and a
+// decimal exponent q. If w < 2^53 and |q| <= 22, both w and 10^|q| are exact
+// doubles, so w * 10^q resp. w / 10^-q is the correctly rounded double of the
+// exact value. Rounding that to float gives the correctly rounded float,
+// unless the double hit a midpoint between two floats exactly (then the
+// exact value may have been on either side); that case as well as anything
+// else out of the fast path's reach is handed to strtof().
+static inline bool parse_float(const char *&p, const char *e, float &out)
+{
+    static const double pow10[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    const char *s = p;
+
+    bool neg = (s < e) && (*s == '-');
+    s += (s < e) && ((*s == '-') || (*s == '+'));
+
+    uint64_t w = 0;
+    int digits = 0, q = 0;
+    unsigned d;
+
+    const char *int_start = s;
+    while ((s < e) && ((d = static_cast<unsigned char>(*s) - '0') < 10))
+    {
+        w = w * 10 + d;
+        digits += (w != 0);
+        s++;
+    }
+    bool any = s != int_start;
+
+    if ((s < e) && (*s == '.'))
+    {
+        const char *frac_start = ++s;
+        while ((s < e) && ((d = static_cast<unsigned char>(*s) - '0') < 10))
+        {
+            w = w * 10 + d;
+            digits += (w != 0);
+            q--;
+            s++;
+        }
+        any = any || (s != frac_start);
+    }
+
+    if (!any)
+        return parse_float_slow(p, e, out); // inf, nan, hex, ...
+
+    if ((s < e) && ((*s == 'e') || (*s == 'E')))
+    {
+        const char *exp = s + 1;
+        int eval;
+        if (!parse_int(exp, e, eval) || (eval > 1000) || (eval < -1000))
+            return parse_float_slow(p, e, out);
+        q += eval;
+        s = exp;
+    }
+
+    if ((digits > 19) || (w >= (UINT64_C(1) << 53)) || (q < -22) || (q > 22))
+        return parse_float_slow(p, e, out);
+
+    double v = static_cast<double>(w);
+    v = (q < 0) ? v / pow10[-q] : v * pow10[q];
+
+    // Check for a float midpoint (bit 28 set, bits 0..27 clear) and for
+    // values in or near the float subnormal range, where the float has
+    // fewer mantissa bits than assumed here
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    if (((bits & ((UINT64_C(1) << 29) - 1)) == (UINT64_C(1) << 28)) || (w && (v < 1e-37)))
+        return parse_float_slow(p, e, out);
+
+    float f = static_cast<float>(v);
+    out = neg ? -f : f;
+    p = s;
+    return true;
+}
+
+}
+
+#endif
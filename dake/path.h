@@ -0,0 +1,44 @@
+#ifndef PATH_H
+#define PATH_H
+
+#include <climits>
+#include <cstdlib>
+#include <string>
+
+
+namespace dake
+{
+
+// Absolute path of "filename" with all symbolic links and "." and ".."
+// components resolved, so one file always gets the same name
+static inline bool canonical_path(const std::string &filename, std::string &path)
+{
+#ifdef __GNUC__
+    char buf[PATH_MAX];
+    if (!realpath(filename.c_str(), buf))
+        return false;
+#else
+    char buf[_MAX_PATH];
+    if (!_fullpath(buf, filename.c_str(), sizeof(buf)))
+        return false;
+#endif
+
+    path = buf;
+    return true;
+}
+
+
+// The directory relative names in "filename" are looked up in (as
+// obj_reader::obj_dirname): everything before the last slash, "/" for
+// files in the root directory and "." if there is no slash at all
+static inline std::string directory_of(const std::string &filename)
+{
+    size_t slash = filename.rfind('/');
+    if (slash == std::string::npos)
+        return std::string(".");
+    return filename.substr(0, slash ? slash : 1);
+}
+
+}
+
+#endif
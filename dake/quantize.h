@@ -0,0 +1,183 @@
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+
+#include "vector.h"
+
+
+namespace dake
+{
+
+// Conversions between floats and compact fixed-size representations, for
+// storing vertex attributes with less memory.
+
+
+// Convert a value in [0, 1] (clamped) to a 16 bit unsigned normalized value
+static inline uint16_t to_unorm16(float v)
+{
+    if (!(v > 0.f))
+        return 0;
+    if (v >= 1.f)
+        return 65535;
+    return static_cast<uint16_t>(v * 65535.f + .5f);
+}
+
+static inline float from_unorm16(uint16_t v)
+{
+    return v / 65535.f;
+}
+
+
+// Convert a value in [-1, 1] (clamped) to a 16 bit signed normalized value
+static inline int16_t to_snorm16(float v)
+{
+    if (!(v > -1.f))
+        return -32767;
+    if (v >= 1.f)
+        return 32767;
+    return static_cast<int16_t>(floorf(v * 32767.f + .5f));
+}
+
+static inline float from_snorm16(int16_t v)
+{
+    float f = v / 32767.f;
+    return (f < -1.f) ? -1.f : f;
+}
+
+
+// Convert a float to an IEEE 754 half float (rounding to nearest even;
+// values too large become infinity, NaN stays NaN)
+static inline uint16_t to_half(float f)
+{
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+
+    uint16_t sign = (x >> 16) & 0x8000;
+    uint32_t abs = x & 0x7fffffff;
+
+    // NaN and infinity
+    if (abs >= 0x7f800000)
+        return sign | 0x7c00 | ((abs > 0x7f800000) ? 0x200 : 0);
+
+    // Too large: infinity (65520 and above round to it)
+    if (abs >= 0x477ff000)
+        return sign | 0x7c00;
+
+    // Normal half
+    if (abs >= 0x38800000)
+    {
+        uint32_t rounded = abs + 0xfff + ((abs >> 13) & 1);
+        return sign | static_cast<uint16_t>((rounded - 0x38000000) >> 13);
+    }
+
+    // Subnormal half (or zero): shift the mantissa including the implicit
+    // bit into place, rounding to nearest even
+    if (abs < 0x33000000)
+        return sign;
+
+    uint32_t exp = abs >> 23;
+    uint32_t mant = (abs & 0x7fffff) | 0x800000;
+    uint32_t shift = 126 - exp;
+    uint32_t half_mant = mant >> shift;
+    uint32_t rest = mant & ((1u << shift) - 1);
+    uint32_t halfway = 1u << (shift - 1);
+
+    if ((rest > halfway) || ((rest == halfway) && (half_mant & 1)))
+        half_mant++;
+
+    return sign | static_cast<uint16_t>(half_mant);
+}
+
+static inline float from_half(uint16_t h)
+{
+    uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    uint32_t x;
+
+    if (exp == 0x1f)
+        x = sign | 0x7f800000 | (mant << 13);
+    else if (exp)
+        x = sign | ((exp + 112) << 23) | (mant << 13);
+    else if (!mant)
+        x = sign;
+    else
+    {
+        // Subnormal: normalize the mantissa
+        exp = 113;
+        while (!(mant & 0x400))
+        {
+            mant <<= 1;
+            exp--;
+        }
+        x = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+    }
+
+    float f;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+
+// Map a vector to octahedral coordinates: it is projected onto the
+// octahedron |x| + |y| + |z| = 1, whose lower half is folded onto the upper
+// one, giving two coordinates in [-1, 1]. The zero vector gives (0, 0).
+static inline void to_oct(const vec3 &n, float &x, float &y)
+{
+    float l1 = fabsf(n.x()) + fabsf(n.y()) + fabsf(n.z());
+    x = 0.f;
+    y = 0.f;
+
+    if (l1 > 0.f)
+    {
+        x = n.x() / l1;
+        y = n.y() / l1;
+
+        if (n.z() < 0.f)
+        {
+            float fx = (1.f - fabsf(y)) * ((x >= 0.f) ? 1.f : -1.f);
+            float fy = (1.f - fabsf(x)) * ((y >= 0.f) ? 1.f : -1.f);
+            x = fx;
+            y = fy;
+        }
+    }
+}
+
+// Reverse to_oct; the result is normalized. Written without branches, as
+// the folded half is hit at random when decoding many vectors.
+static inline vec3 from_oct(float x, float y)
+{
+    float z = 1.f - fabsf(x) - fabsf(y);
+
+    // Unfolding moves both coordinates towards zero by the same distance
+    float t = (z < 0.f) ? -z : 0.f;
+    x += (x >= 0.f) ? -t : t;
+    y += (y >= 0.f) ? -t : t;
+
+    return vec3(x, y, z) * (1.f / sqrtf(x * x + y * y + z * z));
+}
+
+
+// Encode a unit vector with the octahedral mapping (see to_oct), storing
+// both coordinates as 16 bit signed normalized values (x in the low, y in
+// the high half). The zero vector is encoded as (0, 0, 1).
+static inline uint32_t to_oct32(const vec3 &n)
+{
+    float x, y;
+    to_oct(n, x, y);
+
+    return static_cast<uint16_t>(to_snorm16(x)) | (static_cast<uint32_t>(static_cast<uint16_t>(to_snorm16(y))) << 16);
+}
+
+// Decode a vector encoded by to_oct32; the result is normalized
+static inline vec3 from_oct32(uint32_t v)
+{
+    return from_oct(from_snorm16(static_cast<int16_t>(v & 0xffff)), from_snorm16(static_cast<int16_t>(v >> 16)));
+}
+
+}
+
+#endif
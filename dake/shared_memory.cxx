@@ -0,0 +1,148 @@
+#include <cstdio>
+#include <string>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "shared_memory.h"
+
+
+dake::shared_memory::shared_memory(void):
+    ptr(NULL),
+    len(0),
+    dev(0),
+    ino(0)
+{
+}
+
+
+dake::shared_memory::~shared_memory(void)
+{
+    close();
+}
+
+
+bool dake::shared_memory::open(const std::string &name, bool writable)
+{
+    close();
+
+#ifdef __linux__
+    int fd = shm_open(name.c_str(), writable ? O_RDWR : O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if ((fstat(fd, &st) < 0) || !st.st_size)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void *map = mmap(NULL, st.st_size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    ptr = static_cast<char *>(map);
+    len = st.st_size;
+    dev = st.st_dev;
+    ino = st.st_ino;
+    return true;
+#else
+    (void)name;
+    (void)writable;
+    return false;
+#endif
+}
+
+
+bool dake::shared_memory::create(const std::string &name, size_t size)
+{
+    close();
+
+#ifdef __linux__
+    if (!size)
+        return false;
+
+    // Only readable by this user, since everyone could change it otherwise
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+        return false;
+
+    // posix_fallocate() makes sure the memory is there now, instead of
+    // failing with SIGBUS on first touching a page when it runs out
+    void *map = MAP_FAILED;
+    struct stat st;
+    if (!ftruncate(fd, size) && !posix_fallocate(fd, 0, size) && !fstat(fd, &st))
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (map == MAP_FAILED)
+    {
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    ptr = static_cast<char *>(map);
+    len = size;
+    dev = st.st_dev;
+    ino = st.st_ino;
+    return true;
+#else
+    (void)name;
+    (void)size;
+    return false;
+#endif
+}
+
+
+void dake::shared_memory::close(void)
+{
+#ifdef __linux__
+    if (ptr)
+        munmap(ptr, len);
+#endif
+
+    ptr = NULL;
+    len = 0;
+    dev = ino = 0;
+}
+
+
+bool dake::shared_memory::remove(const std::string &name)
+{
+#ifdef __linux__
+    return !shm_unlink(name.c_str());
+#else
+    (void)name;
+    return false;
+#endif
+}
+
+
+bool dake::shared_memory::remove_if_same(const std::string &name) const
+{
+#ifdef __linux__
+    if (!ptr)
+        return false;
+
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    bool same = !fstat(fd, &st) && (st.st_dev == dev) && (st.st_ino == ino);
+    ::close(fd);
+
+    // Another process could still replace it right now, but then that
+    // only loses the block (which can be created again), nothing else
+    return same && !shm_unlink(name.c_str());
+#else
+    (void)name;
+    return false;
+#endif
+}
@@ -0,0 +1,62 @@
+#ifndef SHARED_MEMORY_H
+#define SHARED_MEMORY_H
+
+#include <cstddef>
+#include <string>
+
+
+namespace dake
+{
+
+// A named block of memory all processes on this machine can map (POSIX
+// shared memory). It stays there when no process has it open any longer,
+// until it is removed. On systems without POSIX shared memory, open() and
+// create() always fail.
+class shared_memory
+{
+    private:
+        char *ptr;
+        size_t len;
+        // Identify the block mapped, whatever its name refers to by now
+        unsigned long long dev, ino;
+
+        shared_memory(const shared_memory &);
+        shared_memory &operator=(const shared_memory &);
+
+    public:
+        shared_memory(void);
+        // Unmaps the block (which stays there, see remove())
+        ~shared_memory(void);
+
+        // Map the existing block "name" (starting with a slash), read-only
+        // unless "writable" is set
+        bool open(const std::string &name, bool writable = false);
+
+        // Create the block "name" with "size" bytes (all zero) and map it
+        // writable; fails if it exists already
+        bool create(const std::string &name, size_t size);
+
+        void close(void);
+
+        // Remove the block "name"; processes which have mapped it can go on
+        // using it
+        static bool remove(const std::string &name);
+
+        // Remove the block "name" only if it is still the one mapped here
+        // (and not another one created under the same name since)
+        bool remove_if_same(const std::string &name) const;
+
+        bool is_open(void) const { return ptr != NULL; }
+
+        // Only to be written to if the block has been created or opened
+        // writable
+        char *data(void) { return ptr; }
+
+        const char *begin(void) const { return ptr; }
+        const char *end(void) const { return ptr + len; }
+        size_t size(void) const { return len; }
+};
+
+}
+
+#endif
@@ -1,6 +1,8 @@
 #include <cstdlib>
 #include <cstdio>
+#include <cstring>
 #include <list>
+#include <mutex>
 #include <string>
 #include <cgv/media/image/image_reader.h>
 #include <cgv_gl/gl/gl.h>
@@ -8,8 +10,8 @@
 #include "texture.h"
 
 
-dake::texture::texture(const std::string &name):
-    fname(name)
+// Read the image "name" as RGB pixels
+static bool read_image(const std::string &name, std::vector<unsigned char> &pixels, int &width, int &height)
 {
     cgv::data::data_format df;
     cgv::media::image::image_reader ir(df);
@@ -18,30 +20,86 @@ dake::texture::texture(const std::string &name):
     if (!ir.read_image(name, dv))
     {
         fprintf(stderr, "Could not load image: %s\n", ir.get_last_error().c_str());
-        throw 23;
+        return false;
     }
 
-    glGenTextures(1, &tex_id);
+    width = dv.get_format()->get_width();
+    height = dv.get_format()->get_height();
+    pixels.resize((size_t)width * height * 3);
+    memcpy(pixels.data(), dv.get_ptr(0), pixels.size());
+    return true;
+}
 
-    glEnable(GL_TEXTURE_2D);
-    glBindTexture(GL_TEXTURE_2D, tex_id);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, dv.get_format()->get_width(), dv.get_format()->get_width(), 0, GL_RGB, GL_UNSIGNED_BYTE, dv.get_ptr(0));
+
+dake::texture::texture(const std::string &name):
+    tex_id(0),
+    fname(name),
+    changed(false)
+{
+    // Keep the image until there is a GL context to upload it to
+    if (!read_image(name, pixels, width, height))
+        throw 23;
 }
 
 
 dake::texture::~texture(void)
 {
-    glDeleteTextures(1, &tex_id);
+    if (tex_id)
+        glDeleteTextures(1, &tex_id);
+}
+
+
+bool dake::texture::reload(void)
+{
+    std::vector<unsigned char> new_pixels;
+    int new_width, new_height;
+
+    if (!read_image(fname, new_pixels, new_width, new_height))
+        return false;
+
+    std::lock_guard<std::mutex> guard(image_lock);
+    pixels.swap(new_pixels);
+    width = new_width;
+    height = new_height;
+    changed = true;
+
+    return true;
+}
+
+
+// Upload the image waiting and drop it; the texture has to be bound
+void dake::texture::upload(void) const
+{
+    std::lock_guard<std::mutex> guard(image_lock);
+
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+
+    std::vector<unsigned char>().swap(pixels);
+    changed = false;
 }
 
 
 void dake::texture::bind(void) const
 {
+    if (!tex_id)
+    {
+        glGenTextures(1, &tex_id);
+
+        glEnable(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, tex_id);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        upload();
+        return;
+    }
+
     glBindTexture(GL_TEXTURE_2D, tex_id);
+
+    // Reloaded since the last time
+    if (changed)
+        upload();
 }
 
 
@@ -54,6 +112,10 @@ dake::texture_manager::~texture_manager(void)
 
 const dake::texture *dake::texture_manager::find_texture(const std::string &name)
 {
+    // The lock is held while reading a new image, so an image is never read
+    // twice (and the image reader is never used concurrently)
+    std::lock_guard<std::mutex> guard(lock);
+
     for (std::list<dake::texture *>::iterator i = textures.begin(); i != textures.end(); i++)
         if (name == (*i)->get_fname())
             return *i;
@@ -62,3 +124,16 @@ const dake::texture *dake::texture_manager::find_texture(const std::string &name
     textures.push_back(nt);
     return nt;
 }
+
+
+bool dake::texture_manager::reload(const std::string &name)
+{
+    // As in find_texture, the image reader must not be used concurrently
+    std::lock_guard<std::mutex> guard(lock);
+
+    for (std::list<dake::texture *>::iterator i = textures.begin(); i != textures.end(); i++)
+        if (name == (*i)->get_fname())
+            return (*i)->reload();
+
+    return false;
+}
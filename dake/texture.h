@@ -1,44 +1,80 @@
 #ifndef TEXTURE_H
 #define TEXTURE_H
 
+#include <atomic>
 #include <list>
+#include <mutex>
 #include <string>
+#include <vector>
 #include <cgv_gl/gl/gl.h>
 
 
 namespace dake
 {
 
+// The image is read when the texture is created, which may happen on any
+// thread; it is only uploaded to GL on the first bind(), which thus has to
+// happen on the thread owning the GL context. The same goes for images read
+// again by reload().
 class texture
 {
     private:
-        GLuint tex_id;
+        mutable GLuint tex_id;
         std::string fname;
 
+        // Image data waiting for the upload; guarded by "image_lock", as
+        // reload() may replace it on any thread. "changed" is set while
+        // there is an image waiting.
+        mutable std::vector<unsigned char> pixels;
+        int width, height;
+        mutable std::mutex image_lock;
+        mutable std::atomic<bool> changed;
+
+        void upload(void) const;
+
+        texture(const texture &);
+        texture &operator=(const texture &);
+
     public:
         texture(const std::string &name);
         ~texture(void);
 
         void bind(void) const;
 
+        // Read the image again (because the file has changed); it replaces
+        // the old one on the next bind(). Returns false (keeping the old
+        // image) if the file could not be read.
+        bool reload(void);
+
         const std::string &get_fname(void) const { return fname; }
 };
 
 
+// May be used from multiple threads at once
 class texture_manager
 {
     private:
         std::list<texture *> textures;
+        std::mutex lock;
+
+        static void create_instance(texture_manager **texman)
+        { *texman = new texture_manager; }
 
     public:
         ~texture_manager(void);
 
         const texture *find_texture(const std::string &name);
 
+        // Reload the texture read from the file "name" (see
+        // texture::reload), if there is one. Returns false if there is none
+        // or it could not be read.
+        bool reload(const std::string &name);
+
         static texture_manager &instance(void)
         {
             static texture_manager *texman = NULL;
-            if (!texman) texman = new texture_manager;
+            static std::once_flag created;
+            std::call_once(created, create_instance, &texman);
             return *texman;
         }
 };
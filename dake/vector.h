@@ -237,6 +237,9 @@ class vec3
         vec3 operator^(const vec3 &ov) const
         { return vec3(vec[1] * ov[2] - vec[2] * ov[1], vec[2] * ov[0] - vec[0] * ov[2], vec[0] * ov[1] - vec[1] * ov[0]); }
 
+        float dot(const vec3 &ov) const
+        { return vec[0] * ov[0] + vec[1] * ov[1] + vec[2] * ov[2]; }
+
         operator const float *(void) const
         { return vec; }
 
@@ -6,6 +6,10 @@
 #include "dake/texture.h"
 #include "dake/vector.h"
 
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
 #include <cgv/gui/key_event.h>
 #include <cgv/gui/mouse_event.h>
 #include <cgv/utils/ostream_printf.h>
@@ -18,10 +22,15 @@ using namespace cgv::utils;
 
 // The constructor of this class
 exercise1::exercise1():node("Exercise 1"),
+    meshs_ready(0),
     counter(0),
     is_pointcloud(false),
     show_bbox(false),
     show_coordinate_system(false),
+    use_lod(true),
+    use_culling(false),
+    clusters_culled(0),
+    triangles_drawn(0),
     free_mode(false),
     timer_offset(0.0),
     meshs_loaded(false),
@@ -32,6 +41,16 @@ exercise1::exercise1():node("Exercise 1"),
     // Connect the timer_event method to the (cgv-library) animation
     // trigger to be called every 1/60 sec.
     connect(get_animation_trigger().shoot, this, &exercise1::timer_event);
+
+    for (int i = 0; i < 11; i++)
+        meshs[i] = NULL;
+
+    // Meshs are drawn from both sides
+    culler.backface = false;
+
+    // Meshs (and their materials) edited while the viewer is running are
+    // shown right away
+    loader.hot_reload = true;
 }
 
 
@@ -57,6 +76,28 @@ void exercise1::timer_event(double , double dt)
         counter++;
         post_redraw();
 
+        // Update the loading progress shown in the GUI
+        if (meshs_loaded && (meshs_ready < (int)loader.size()))
+        {
+            int ready = loader.finished();
+            if (ready != meshs_ready)
+            {
+                meshs_ready = ready;
+                update_member(&meshs_ready);
+            }
+        }
+
+        if (clusters_culled != (int)(frame_stats.frustum_culled + frame_stats.backface_culled))
+        {
+            clusters_culled = frame_stats.frustum_culled + frame_stats.backface_culled;
+            update_member(&clusters_culled);
+        }
+        if (triangles_drawn != (int)frame_stats.triangles_drawn)
+        {
+            triangles_drawn = frame_stats.triangles_drawn;
+            update_member(&triangles_drawn);
+        }
+
         dake::particle_generator::instance().tick(fps);
         if (((counter + 1) % 100 <= 3) && (!ascending || (counter < ascension_counter_start)) && !free_mode)
         {
@@ -101,6 +142,23 @@ void exercise1::create_gui() {
     // that calls post_redraw to redraw the scene.
     add_member_control(this, "Show Coordinate System", show_coordinate_system, "toggle");
 
+    // Create a toggle button that controls the variable "use_lod".
+    add_member_control(this, "Level of Detail", use_lod, "toggle");
+
+    // Create a toggle button that controls the variable "use_culling".
+    add_member_control(this, "Meshlet Culling", use_culling, "toggle");
+
+    // Create a toggle button that controls whether changed files are
+    // reloaded
+    add_member_control(this, "Hot Reload", loader.hot_reload, "toggle");
+
+    // Show how many of the meshs have been loaded so far
+    add_view("Meshs Loaded", meshs_ready);
+
+    // Show how much meshlet culling saves
+    add_view("Meshlets Culled", clusters_culled);
+    add_view("Triangles Drawn", triangles_drawn);
+
 
     // To add further control elements you can copy the lines above. Other control
     // elements such as buttons exist. To create a button which calls an arbitrary method
@@ -214,31 +272,54 @@ void exercise1::stream_help(std::ostream &os)
 
 
 void exercise1::draw(context& c) {
+    frame_stats = cull_stats();
+
     if (!meshs_loaded)
     {
+        // Other viewer instances running on this machine share the meshs
+        // they have loaded already (see LOAD_SHARED)
+        int load_flags = obj_reader::LOAD_PARALLEL | obj_reader::LOAD_CACHED | obj_reader::LOAD_SHARED |
+                         obj_reader::LOAD_WELD | obj_reader::LOAD_TRIANGULATE | obj_reader::LOAD_OPTIMIZE |
+                         obj_reader::LOAD_NORMALS;
+
+        // A point cloud only needs the positions; everything else is only
+        // loaded when it is needed
+        if (is_pointcloud)
+            load_flags |= obj_reader::LOAD_LAZY;
+
+        // The meshs are loaded in the background; until they are ready,
+        // placeholders are drawn in their place
 #ifdef MADOKA_MODE
-        meshs[0] = new obj_reader("data/madoka/torso_upper.obj");
+        loader.add("data/madoka/torso_upper.obj", load_flags);
 #else
-        meshs[0] = new obj_reader("data/robot/torso_upper.obj");
+        loader.add("data/robot/torso_upper.obj", load_flags);
 #endif
-        meshs[1] = new obj_reader("data/robot/torso_lower.obj");
-        meshs[2] = new obj_reader("data/robot/leg_left.obj");
-        meshs[3] = new obj_reader("data/robot/leg_right.obj");
-        meshs[4] = new obj_reader("data/robot/arm_left_lower.obj");
-        meshs[5] = new obj_reader("data/robot/arm_left_upper.obj");
-        meshs[6] = new obj_reader("data/robot/arm_right_lower.obj");
-        meshs[7] = new obj_reader("data/robot/arm_right_upper.obj");
-        meshs[8] = new obj_reader("data/bear/stem.obj");
-        meshs[9] = new obj_reader("data/bear/blossom.obj");
+        loader.add("data/robot/torso_lower.obj", load_flags);
+        loader.add("data/robot/leg_left.obj", load_flags);
+        loader.add("data/robot/leg_right.obj", load_flags);
+        loader.add("data/robot/arm_left_lower.obj", load_flags);
+        loader.add("data/robot/arm_left_upper.obj", load_flags);
+        loader.add("data/robot/arm_right_lower.obj", load_flags);
+        loader.add("data/robot/arm_right_upper.obj", load_flags);
+        loader.add("data/bear/stem.obj", load_flags);
+        loader.add("data/bear/blossom.obj", load_flags);
 #ifdef MADOKA_MODE
-        meshs[10] = new obj_reader("data/madoka/wings.obj");
-#else
-        meshs[10] = NULL;
+        loader.add("data/madoka/wings.obj", load_flags);
 #endif
 
+        loader.start();
+
         meshs_loaded = true;
     }
 
+    // Swap in the meshs reloaded because their files have changed; this
+    // deletes the old ones, so all of them have to be picked up again
+    loader.update();
+
+    // Pick up the meshs which have been (re)loaded since the last frame
+    for (size_t i = 0; i < loader.size(); i++)
+        meshs[i] = loader.get(i);
+
     dake::vec4 robot_col(.6f, .6f, .6f, 1.f);
 
 
@@ -549,6 +630,44 @@ void exercise1::render_bounding_box(obj_reader* model)
 
 
 
+void exercise1::render_placeholder()
+{
+    GLfloat color[4] ={0, 0, 0,0 };
+    glGetFloatv(GL_CURRENT_COLOR, color);
+
+    glPushAttrib(GL_ENABLE_BIT);
+    glDisable(GL_LIGHTING);
+    glDisable(GL_TEXTURE_2D);
+
+    glPushMatrix();
+    glRotatef(counter * 4.f, 0.f, 1.f, 0.f);
+
+    glColor4f(.5f, .5f, .5f, 1.f);
+    dake::vec3 corners[2] = { dake::vec3(-.5f, -.5f, -.5f), dake::vec3(.5f, .5f, .5f) };
+    glBegin(GL_LINES);
+    for (int i = 0, gray = 0; i < 4; i++, gray = i ^ (i >> 1))
+    {
+        // The corner following this one on the square
+        int j = (i + 1) & 3, next = j ^ (j >> 1);
+        for (int z = 0; z < 2; z++)
+        {
+            glVertex3fv(dake::vec3(corners[gray & 1][0], corners[gray >> 1][1], corners[z][2]));
+            glVertex3fv(dake::vec3(corners[next & 1][0], corners[next >> 1][1], corners[z][2]));
+        }
+        glVertex3fv(dake::vec3(corners[gray & 1][0], corners[gray >> 1][1], corners[0][2]));
+        glVertex3fv(dake::vec3(corners[gray & 1][0], corners[gray >> 1][1], corners[1][2]));
+    }
+    glEnd();
+
+    glPopMatrix();
+
+    glPopAttrib();
+    glColor4fv(color);
+}
+
+
+
+
 void exercise1::render_coordinate_system()
 {
     GLfloat color[4] ={0, 0, 0,0 };
@@ -589,11 +708,79 @@ void exercise1::render_coordinate_system()
 
 
 
+// Size of the bounding box of "model" on screen in pixels (the larger one
+// of its width and height), or FLT_MAX if it reaches behind the viewer
+float exercise1::projected_size(obj_reader *model)
+{
+    GLdouble modelview[16], projection[16];
+    GLint viewport[4];
+
+    glGetDoublev(GL_MODELVIEW_MATRIX, modelview);
+    glGetDoublev(GL_PROJECTION_MATRIX, projection);
+    glGetIntegerv(GL_VIEWPORT, viewport);
+
+    dake::vec3 bbox[2] = { model->get_bbox_min(), model->get_bbox_max() };
+    double min_x = HUGE_VAL, min_y = HUGE_VAL, max_x = -HUGE_VAL, max_y = -HUGE_VAL;
+
+    for (int i = 0; i < 8; i++)
+    {
+        double obj[4] = { bbox[i & 1][0], bbox[(i >> 1) & 1][1], bbox[i >> 2][2], 1. }, eye[4], clip[4];
+
+        // Both matrices are column-major
+        for (int r = 0; r < 4; r++)
+            eye[r] = modelview[r] * obj[0] + modelview[4 + r] * obj[1] + modelview[8 + r] * obj[2] + modelview[12 + r] * obj[3];
+        for (int r = 0; r < 4; r++)
+            clip[r] = projection[r] * eye[0] + projection[4 + r] * eye[1] + projection[8 + r] * eye[2] + projection[12 + r] * eye[3];
+
+        if (clip[3] <= 0.)
+            return FLT_MAX;
+
+        min_x = std::min(min_x, clip[0] / clip[3]);
+        max_x = std::max(max_x, clip[0] / clip[3]);
+        min_y = std::min(min_y, clip[1] / clip[3]);
+        max_y = std::max(max_y, clip[1] / clip[3]);
+    }
+
+    // Normalized device coordinates span two units across the viewport
+    return std::max((max_x - min_x) * viewport[2], (max_y - min_y) * viewport[3]) / 2.;
+}
+
+
+
+
+// Set up "culler" for the current modelview and projection matrices
+void exercise1::update_culler(void)
+{
+    GLfloat modelview[16], projection[16], object_to_clip[16];
+
+    glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
+    glGetFloatv(GL_PROJECTION_MATRIX, projection);
+
+    // projection * modelview, all column-major
+    for (int col = 0; col < 4; col++)
+        for (int r = 0; r < 4; r++)
+            object_to_clip[col * 4 + r] = projection[r] * modelview[col * 4] + projection[4 + r] * modelview[col * 4 + 1] +
+                                          projection[8 + r] * modelview[col * 4 + 2] + projection[12 + r] * modelview[col * 4 + 3];
+
+    culler.set_view(object_to_clip);
+}
+
+
+
 // Render the mesh "model". This method calls render_mesh_pointcloud
 // if the variable "is_pointcloud" is true and "render_mesh_solid"
 // otherwise.
 void exercise1::render_mesh(obj_reader *model)
 {
+    // Meshs which are still being loaded get a placeholder; the ones which
+    // failed to load are simply left out
+    if (!model)
+    {
+        if (meshs_ready < (int)loader.size())
+            render_placeholder();
+        return;
+    }
+
     // Shall a bounding cube be rendered?
     if (show_bbox)
         render_bounding_box(model);
@@ -660,71 +847,127 @@ void exercise1::render_mesh_solid(obj_reader *model)
     // iterate over all points. Each of these points contain the
     // indices of the vertices list or normals list, or -1 if
     // the information is not present.
+    // The faces are drawn from the single-indexed version of the
+    // mesh, batch by batch, so every batch of faces with the same
+    // material and number of corners is a single draw call.
+
+    // Meshs loaded lazily for the point cloud are completed in the
+    // background (which also builds their levels of detail); they get a
+    // placeholder until the loader has swapped in the complete mesh
+    if (!model->is_complete())
+    {
+        loader.complete(model);
+        render_placeholder();
+        return;
+    }
+
+    // Far away meshs are drawn with a coarser level of detail
+    const indexed_mesh *mesh = &model->get_indexed_mesh();
+    if (use_lod)
+    {
+        int level = select_lod(model->get_lods(), (model->get_bbox_max() - model->get_bbox_min()).length(),
+                               projected_size(model));
+        if (level >= 0)
+            mesh = &model->get_lods()[level].mesh;
+    }
+
+    if (mesh->vertices.empty())
+        return;
+
+    // The full detail mesh is drawn only as far as its meshlets are inside
+    // of the view frustum (meshs are drawn from both sides, so there is no
+    // backface culling); points and lines are not part of any meshlet and
+    // are always drawn
+    const std::vector<mesh_batch> *batches = &mesh->batches;
+    GLenum index_type = mesh->is_16bit() ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    const char *indices = static_cast<const char *>(mesh->index_data());
+    size_t index_size = mesh->index_size();
+
+    if (use_culling && (mesh == &model->get_indexed_mesh()))
+    {
+        culled_indices.clear();
+        culled_batches.clear();
+
+        for (std::vector<mesh_batch>::const_iterator i = mesh->batches.begin(); i != mesh->batches.end(); i++)
+        {
+            if (i->face_size >= 3)
+                continue;
+
+            mesh_batch b = *i;
+            b.first = culled_indices.size();
+            for (unsigned j = 0; j < i->count; j++)
+                culled_indices.push_back(mesh->index(i->first + j));
+            culled_batches.push_back(b);
+        }
+
+        update_culler();
+        culler.cull(model->get_meshlets(), culled_indices, culled_batches, frame_stats);
 
-    const std::vector<dake::vec3> &normals = model->get_normals();
-    const std::vector<dake::vec2> &tex_coords = model->get_tex_coords();
-    const std::vector<dake::vec3> &vertices = model->get_vertices();
+        if (culled_indices.empty())
+            return;
+
+        batches = &culled_batches;
+        index_type = GL_UNSIGNED_INT;
+        indices = reinterpret_cast<const char *>(&culled_indices[0]);
+        index_size = sizeof(culled_indices[0]);
+    }
 
-    int current_render_mode = -1;
+    glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+
+    const mesh_vertex *v = &mesh->vertices[0];
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(3, GL_FLOAT, sizeof(*v), &v->position);
+
+    // Without any normals, keep using the current one
+    if (mesh->has_normals)
+    {
+        glEnableClientState(GL_NORMAL_ARRAY);
+        glNormalPointer(GL_FLOAT, sizeof(*v), &v->normal);
+    }
+
+    if (mesh->has_tex_coords)
+    {
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glTexCoordPointer(2, GL_FLOAT, sizeof(*v), &v->tex_coord);
+    }
 
     const material *current_mat = NULL;
 
-    // for (auto f: model->get_faces())
-    for (std::vector<face>::const_iterator i = model->get_faces().begin(); i != model->get_faces().end(); i++)
+    // for (auto b: *batches)
+    for (std::vector<mesh_batch>::const_iterator i = batches->begin(); i != batches->end(); i++)
     {
-        const face &f = *i;
-        int desired_render_mode;
+        const mesh_batch &b = *i;
+        GLenum render_mode;
 
-        if (f.mat != current_mat)
+        if (b.mat != current_mat)
         {
-            if (current_render_mode >= 0)
-                glEnd();
-            current_render_mode = -1;
-
-            glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, f.mat->ambient);
-            glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, f.mat->diffuse);
-            glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, f.mat->specular);
-            glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, f.mat->spec_co);
+            glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, b.mat->ambient);
+            glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, b.mat->diffuse);
+            glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, b.mat->specular);
+            glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, b.mat->spec_co);
 
-            if (f.mat->tex)
-                f.mat->tex->bind();
+            if (b.mat->tex)
+                b.mat->tex->bind();
             else
                 glBindTexture(GL_TEXTURE_2D, 0);
 
-            current_mat = f.mat;
+            current_mat = b.mat;
         }
 
-        switch (f.corners.size())
+        switch (b.face_size)
         {
-            case 1: desired_render_mode = GL_POINTS; break;
-            case 2: desired_render_mode = GL_LINES; break;
-            case 3: desired_render_mode = GL_TRIANGLES; break;
-            case 4: desired_render_mode = GL_QUADS; break;
-            default: desired_render_mode = GL_TRIANGLE_FAN; break;
+            case 1: render_mode = GL_POINTS; break;
+            case 2: render_mode = GL_LINES; break;
+            case 3: render_mode = GL_TRIANGLES; break;
+            case 4: render_mode = GL_QUADS; break;
+            default: render_mode = GL_TRIANGLE_FAN; break;
         }
 
-        if ((desired_render_mode != current_render_mode) || (current_render_mode == GL_TRIANGLE_FAN))
-        {
-            if (current_render_mode >= 0)
-                glEnd();
-            glBegin(current_render_mode = desired_render_mode);
-        }
-
-        //for (auto c: f.corners)
-        for (std::vector<face_corner>::const_iterator ci = f.corners.begin(); ci != f.corners.end(); ci++)
-        {
-            const face_corner &c = *ci;
-
-            if (c.index_normal > 0)
-                glNormal3fv(normals[c.index_normal - 1]);
-            if (c.index_texcoord > 0)
-                glTexCoord2fv(tex_coords[c.index_texcoord - 1]);
-            glVertex3fv(vertices[c.index_vertex - 1]);
-        }
+        glDrawElements(render_mode, b.count, index_type, indices + b.first * index_size);
     }
 
-    if (current_render_mode >= 0)
-        glEnd();
+    glPopClientAttrib();
 
 
     // *** End of task 1.2.5 ***
@@ -7,6 +7,7 @@
 
 #include "dake/vector.h"
 
+#include "mesh_loader.h"
 #include "obj_reader.h"
 
 using namespace cgv::base;
@@ -22,8 +23,12 @@ class exercise1 : public node,
                   public event_handler
 {
 private:
-    // The example meshs
+    // The example meshs; NULL while they are still being loaded
     obj_reader *meshs[11];
+    // Loads the meshs in the background
+    mesh_loader loader;
+    // Number of meshs loaded so far (shown in the GUI)
+    int meshs_ready;
     // The animation counter
     int counter;
     // True if the mesh shall be rendered as a point cloud
@@ -32,6 +37,20 @@ private:
     bool show_bbox;
     // True if coordinate systems shall be rendered
     bool show_coordinate_system;
+    // True if meshs shall be drawn with a level of detail fitting their
+    // size on screen
+    bool use_lod;
+    // True if meshlets outside of the view frustum shall not be drawn
+    bool use_culling;
+    // Rejects meshlets for use_culling
+    cluster_culler culler;
+    // Culling statistics of the current frame, and the numbers of meshlets
+    // culled and of triangles drawn in the last one (shown in the GUI)
+    cull_stats frame_stats;
+    int clusters_culled, triangles_drawn;
+    // Indices and batches of the meshlets left after culling
+    std::vector<uint32_t> culled_indices;
+    std::vector<mesh_batch> culled_batches;
     // True iff in free mode
     bool free_mode;
     // Counter to ensure smooth frames
@@ -66,6 +85,16 @@ private:
     // Render the mesh "model" as solid geometry
     void render_mesh_solid(obj_reader *model);
 
+    // Size of the bounding box of "model" on screen in pixels
+    float projected_size(obj_reader *model);
+
+    // Set up "culler" for the current modelview and projection matrices
+    void update_culler(void);
+
+    // Render a spinning wire cube in place of a mesh which has not been
+    // loaded yet
+    void render_placeholder();
+
     // Render the bounding box of a mesh. This method is called from
     // render_mesh if show_bbox is set to true
     void render_bounding_box(obj_reader* model);
@@ -0,0 +1,107 @@
+#include "indexed_mesh.h"
+#include "obj_reader.h"
+
+#include <cstring>
+#include <vector>
+#include <stdint.h>
+
+
+static inline uint32_t hash_corner(const face_corner &c)
+{
+    uint64_t h = (uint32_t)c.index_vertex   * UINT64_C(0x9e3779b97f4a7c15)
+               ^ (uint32_t)c.index_texcoord * UINT64_C(0xc2b2ae3d27d4eb4f)
+               ^ (uint32_t)c.index_normal   * UINT64_C(0x165667b19e3779f9);
+    return h ^ (h >> 29);
+}
+
+static inline bool same_corner(const face_corner &a, const face_corner &b)
+{
+    return (a.index_vertex == b.index_vertex) && (a.index_texcoord == b.index_texcoord) && (a.index_normal == b.index_normal);
+}
+
+
+void indexed_mesh::build(const std::vector<dake::vec3> &positions, const std::vector<dake::vec3> &normals,
+                         const std::vector<dake::vec2> &tex_coords, const face_list &faces)
+{
+    size_t corner_count = faces.corners.size();
+
+    // Open addressing with linear probing; a slot holds the index of the
+    // vertex plus one, or zero if it is free. The table is kept at most
+    // half full.
+    size_t capacity = 16;
+    while (capacity < corner_count * 2)
+        capacity *= 2;
+    std::vector<uint32_t> slots(capacity, 0);
+    size_t mask = capacity - 1;
+
+    // The OBJ corner every vertex has been created from
+    std::vector<face_corner> keys;
+
+    std::vector<uint32_t> indices(corner_count);
+
+    vertices.clear();
+    has_normals = has_tex_coords = false;
+
+    for (size_t i = 0; i < corner_count; i++)
+    {
+        const face_corner &c = faces.corners[i];
+        size_t slot = hash_corner(c) & mask;
+
+        while (slots[slot] && !same_corner(keys[slots[slot] - 1], c))
+            slot = (slot + 1) & mask;
+
+        if (!slots[slot])
+        {
+            mesh_vertex v;
+
+            if ((c.index_vertex > 0) && ((size_t)c.index_vertex <= positions.size()))
+                v.position = positions[c.index_vertex - 1];
+            if ((c.index_normal > 0) && ((size_t)c.index_normal <= normals.size()))
+            {
+                v.normal = normals[c.index_normal - 1];
+                has_normals = true;
+            }
+            if ((c.index_texcoord > 0) && ((size_t)c.index_texcoord <= tex_coords.size()))
+            {
+                v.tex_coord = tex_coords[c.index_texcoord - 1];
+                has_tex_coords = true;
+            }
+
+            vertices.edit().push_back(v);
+            keys.push_back(c);
+            slots[slot] = vertices.size();
+        }
+
+        indices[i] = slots[slot] - 1;
+    }
+
+    indices16.clear();
+    indices32.clear();
+    if (vertices.size() <= 65536)
+        indices16.edit().assign(indices.begin(), indices.end());
+    else
+        indices32.edit().swap(indices);
+
+
+    // Put consecutive faces of the same size and material together
+    batches.clear();
+    for (size_t i = 0; i < faces.size(); i++)
+    {
+        unsigned first = faces.offsets[i], size = faces.offsets[i + 1] - first;
+        if (!size)
+            continue;
+
+        if (!batches.empty())
+        {
+            mesh_batch &b = batches.back();
+            if ((b.face_size == size) && (size <= 4) && (b.mat == faces.mats[i]) && (b.first + b.count == first))
+            {
+                b.count += size;
+                continue;
+            }
+        }
+
+        mesh_batch b = { first, size, size, faces.mats[i] };
+        batches.push_back(b);
+    }
+}
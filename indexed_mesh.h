@@ -0,0 +1,130 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+
+#include "dake/vector.h"
+
+
+struct face_corner;
+struct face_list;
+struct material;
+
+
+// A list of vertices or indices of a mesh: either a list of its own or a
+// read-only view of memory owned by someone else (e.g. a block of shared
+// memory, see obj_reader::LOAD_SHARED), which has to stay there as long as
+// the view is used. Reading works the same either way; copying a view only
+// copies the view.
+template<typename T> class mesh_array
+{
+    private:
+        std::vector<T> list;
+        const T *view;
+        size_t view_size;
+
+    public:
+        typedef const T *const_iterator;
+
+        mesh_array(void): view(NULL), view_size(0) {}
+
+        size_t size(void) const { return view ? view_size : list.size(); }
+        bool empty(void) const { return !size(); }
+
+        const T *data(void) const { return view ? view : list.data(); }
+        const T &operator[](size_t i) const { return data()[i]; }
+
+        const_iterator begin(void) const { return data(); }
+        const_iterator end(void) const { return data() + size(); }
+
+        // Drop the view resp. the elements of the list
+        void clear(void) { view = NULL; view_size = 0; list.clear(); }
+
+        // The list of its own, for changing it; a view is copied into it
+        // first
+        std::vector<T> &edit(void)
+        {
+            if (view)
+            {
+                list.assign(view, view + view_size);
+                view = NULL;
+                view_size = 0;
+            }
+            return list;
+        }
+
+        // Refer to the "count" elements at "elems" instead of a list of its
+        // own (which is freed)
+        void set_view(const T *elems, size_t count)
+        {
+            std::vector<T>().swap(list);
+            view = count ? elems : NULL;
+            view_size = count;
+        }
+
+        bool is_view(void) const { return view != NULL; }
+};
+
+
+// A vertex of an indexed mesh with all of its attributes interleaved, as
+// needed for vertex arrays
+struct mesh_vertex
+{
+    dake::vec3 position;
+    dake::vec3 normal;
+    dake::vec2 tex_coord;
+};
+
+// A range of indices which can be drawn at once: all faces in it use the
+// same material and have the same number of corners ("face_size"). Faces
+// with more than four corners get a batch of their own.
+struct mesh_batch
+{
+    unsigned first, count;
+    unsigned face_size;
+    const material *mat;
+};
+
+// A mesh with only one index stream. OBJ files index positions, normals and
+// texture coordinates separately; here, every distinct combination of these
+// is one vertex.
+struct indexed_mesh
+{
+    mesh_array<mesh_vertex> vertices;
+
+    // Indices into "vertices", one per face corner in the order of the face
+    // list the mesh was built from. Only one of both lists is filled:
+    // indices16 if there are at most 65536 vertices, indices32 otherwise.
+    mesh_array<uint16_t> indices16;
+    mesh_array<uint32_t> indices32;
+
+    std::vector<mesh_batch> batches;
+
+    // True if any vertex got a normal resp. a texture coordinate from the
+    // OBJ file (otherwise those attributes are all zero)
+    bool has_normals, has_tex_coords;
+
+    indexed_mesh(void): has_normals(false), has_tex_coords(false) {}
+
+    size_t index_count(void) const
+    { return indices16.empty() ? indices32.size() : indices16.size(); }
+
+    uint32_t index(size_t i) const
+    { return indices16.empty() ? indices32[i] : indices16[i]; }
+
+    bool is_16bit(void) const
+    { return !indices16.empty(); }
+
+    // Pointer to the index data and size of one index in bytes
+    const void *index_data(void) const
+    { return indices16.empty() ? static_cast<const void *>(indices32.data()) : static_cast<const void *>(indices16.data()); }
+
+    size_t index_size(void) const
+    { return indices16.empty() ? sizeof(uint32_t) : sizeof(uint16_t); }
+
+    // Build the mesh from the given attribute lists and faces. Corner
+    // combinations are de-duplicated with an open addressing hash table;
+    // corner indices out of range of their list yield zero attributes.
+    void build(const std::vector<dake::vec3> &positions, const std::vector<dake::vec3> &normals,
+               const std::vector<dake::vec2> &tex_coords, const face_list &faces);
+};
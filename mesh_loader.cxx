@@ -0,0 +1,458 @@
+#include "mesh_loader.h"
+#include "mtl_library.h"
+
+#include "dake/file_batch.h"
+#include "dake/parallel.h"
+#include "dake/texture.h"
+
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+
+
+// Bytes read for jobs no worker has taken yet, at most
+#define MAX_READ_AHEAD (256 << 20)
+
+
+mesh_loader::mesh_loader(void):
+    done_count(0),
+    all_read(false),
+    read_ahead(0),
+    reloading(false),
+    hot_reload(false)
+{
+    // Every level has half the triangles of the one before
+    for (float ratio = .5f; ratio > .03f; ratio /= 2.f)
+        lod_ratios.push_back(ratio);
+}
+
+
+mesh_loader::~mesh_loader(void)
+{
+    if (reader.joinable())
+        reader.join();
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+    if (reloader.joinable())
+        reloader.join();
+
+    for (size_t i = 0; i < jobs.size(); i++)
+        delete jobs[i].mesh;
+    for (size_t i = 0; i < reloaded.size(); i++)
+        delete reloaded[i].second;
+}
+
+
+size_t mesh_loader::add(const std::string &filename, int flags)
+{
+    job j;
+    j.filename = filename;
+    j.flags = flags;
+    j.mesh = NULL;
+    j.watched = false;
+    j.has_contents = false;
+    j.read_size = 0;
+    j.lazy = flags & obj_reader::LOAD_LAZY;
+    jobs.push_back(j);
+    return jobs.size() - 1;
+}
+
+
+void mesh_loader::start(void)
+{
+    size_t threads = dake::worker_count();
+    if (threads > jobs.size())
+        threads = jobs.size();
+
+    reader = std::thread(&mesh_loader::read_all, this);
+
+    for (size_t i = 0; i < threads; i++)
+        workers.push_back(std::thread(&mesh_loader::work, this));
+}
+
+
+void mesh_loader::build_lods(obj_reader *mesh, const job &j)
+{
+    if (lod_ratios.empty())
+        return;
+
+    std::string lod_file = j.filename + ".lod";
+    bool cached = j.flags & obj_reader::LOAD_CACHED;
+
+    if (cached && mesh->load_lods(lod_file, lod_ratios))
+        return;
+
+    mesh->build_lods(lod_ratios);
+
+    if (cached)
+        mesh->save_lods(lod_file);
+}
+
+
+void mesh_loader::read_all(void)
+{
+    // Hands every job to the workers once its file has been read, and adds
+    // the next files to the batch as long as they fit into MAX_READ_AHEAD
+    class receiver: public dake::file_receiver
+    {
+        public:
+            mesh_loader *loader;
+            dake::file_batch *batch;
+            // By job: whether the file read is the one to be parsed
+            std::vector<bool> parse;
+            // Jobs with the files to read for them (and their sizes), in
+            // order; those up to "next" have been added to the batch, of
+            // which "in_flight" have not arrived yet
+            std::vector<size_t> order;
+            std::vector<std::string> names;
+            std::vector<size_t> sizes;
+            size_t next, in_flight;
+
+            // Called with the loader's lock held. If nothing is being read,
+            // waits for the workers to take enough for the next file (so at
+            // least one is always read, however big it is).
+            void add_files(std::unique_lock<std::mutex> &guard)
+            {
+                while (next < order.size())
+                {
+                    if (loader->read_ahead && (loader->read_ahead + sizes[next] > MAX_READ_AHEAD))
+                    {
+                        // The next file to arrive calls this again
+                        if (in_flight)
+                            return;
+
+                        loader->contents_taken.wait(guard);
+                        continue;
+                    }
+
+                    loader->jobs[order[next]].read_size = sizes[next];
+                    loader->read_ahead += sizes[next];
+                    batch->add(names[next], *this, order[next]);
+                    in_flight++;
+                    next++;
+                }
+            }
+
+            void file_read(size_t tag, const std::string &, std::vector<char> &data, bool ok)
+            {
+                std::unique_lock<std::mutex> guard(loader->lock);
+
+                job &j = loader->jobs[tag];
+                if (ok && parse[tag])
+                {
+                    j.contents.swap(data);
+                    j.has_contents = true;
+                }
+                else
+                {
+                    loader->read_ahead -= j.read_size;
+                    j.read_size = 0;
+                }
+
+                loader->ready.push_back(tag);
+                loader->job_ready.notify_one();
+
+                in_flight--;
+                add_files(guard);
+            }
+    };
+
+    dake::file_batch batch;
+
+    receiver rcv;
+    rcv.loader = this;
+    rcv.batch = &batch;
+    rcv.next = 0;
+    rcv.in_flight = 0;
+
+    // Meshes found in shared memory do not need their files
+    std::vector<size_t> shared;
+
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        rcv.parse.push_back(false);
+        if ((jobs[i].flags & obj_reader::LOAD_SHARED) && obj_reader::is_shared(jobs[i].filename, jobs[i].flags))
+        {
+            shared.push_back(i);
+            continue;
+        }
+
+        // An existing cache is most likely up to date, so read that instead
+        // (obj_reader then finds it in the page cache)
+        std::string cache = jobs[i].filename + ".cache";
+        struct stat st;
+        bool cached = (jobs[i].flags & obj_reader::LOAD_CACHED) && !stat(cache.c_str(), &st);
+        if (!cached && stat(jobs[i].filename.c_str(), &st))
+            st.st_size = 0;
+
+        rcv.parse[i] = !cached;
+        rcv.order.push_back(i);
+        rcv.names.push_back(cached ? cache : jobs[i].filename);
+        rcv.sizes.push_back(st.st_size);
+    }
+
+    {
+        std::unique_lock<std::mutex> guard(lock);
+
+        ready.insert(ready.end(), shared.begin(), shared.end());
+        job_ready.notify_all();
+
+        rcv.add_files(guard);
+    }
+
+    batch.run();
+
+    std::lock_guard<std::mutex> guard(lock);
+    all_read = true;
+    job_ready.notify_all();
+}
+
+
+obj_reader *mesh_loader::load(const job &j, const std::vector<char> *data)
+{
+    obj_reader *mesh = NULL;
+
+    bool lazy;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        lazy = j.lazy;
+    }
+    int flags = lazy ? j.flags : (j.flags & ~obj_reader::LOAD_LAZY);
+
+    try
+    {
+        mesh = data ? new obj_reader(j.filename, *data, flags) : new obj_reader(j.filename, flags);
+        // Lazily loaded meshes only get prepared once complete() asks for it
+        if (!lazy)
+        {
+            mesh->get_indexed_mesh();
+            build_lods(mesh, j);
+        }
+    }
+    catch (...)
+    {
+        fprintf(stderr, "Could not load mesh %s\n", j.filename.c_str());
+        delete mesh;
+        mesh = NULL;
+    }
+
+    return mesh;
+}
+
+
+// Every worker takes the next job whose file has been read until there are
+// none left
+void mesh_loader::work(void)
+{
+    std::unique_lock<std::mutex> guard(lock);
+
+    for (;;)
+    {
+        while (ready.empty() && !all_read)
+            job_ready.wait(guard);
+        if (ready.empty())
+            return;
+
+        size_t i = ready.front();
+        ready.pop_front();
+
+        std::vector<char> data;
+        data.swap(jobs[i].contents);
+        bool has_data = jobs[i].has_contents;
+        jobs[i].has_contents = false;
+
+        read_ahead -= jobs[i].read_size;
+        jobs[i].read_size = 0;
+        contents_taken.notify_one();
+
+        guard.unlock();
+        obj_reader *mesh = load(jobs[i], has_data ? &data : NULL);
+        // Not needed any longer
+        std::vector<char>().swap(data);
+        guard.lock();
+
+        jobs[i].mesh = mesh;
+        done_count++;
+    }
+}
+
+
+obj_reader *mesh_loader::get(size_t index)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return jobs[index].mesh;
+}
+
+
+size_t mesh_loader::finished(void)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return done_count;
+}
+
+
+void mesh_loader::complete(const obj_reader *mesh)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        if ((jobs[i].mesh == mesh) && jobs[i].lazy)
+        {
+            jobs[i].lazy = false;
+            completing.insert(i);
+        }
+    }
+}
+
+
+void mesh_loader::watch(size_t index)
+{
+    obj_reader *mesh = jobs[index].mesh;
+
+    std::vector<std::pair<std::string, source_kind> > files;
+    files.push_back(std::make_pair(jobs[index].filename, SOURCE_MESH));
+
+    const std::vector<std::string> &libs = mesh->get_mtl_files();
+    for (std::vector<std::string>::const_iterator li = libs.begin(); li != libs.end(); li++)
+        files.push_back(std::make_pair(*li, SOURCE_MTL));
+
+    const std::vector<const material *> &mats = mesh->get_materials();
+    for (std::vector<const material *>::const_iterator mi = mats.begin(); mi != mats.end(); mi++)
+        if ((*mi)->tex)
+            files.push_back(std::make_pair((*mi)->tex_fname, SOURCE_TEXTURE));
+
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        std::map<std::string, source>::iterator si = sources.find(files[i].first);
+        if (si == sources.end())
+        {
+            if (!watcher.watch(files[i].first))
+                continue;
+
+            source src;
+            src.kind = files[i].second;
+            si = sources.insert(std::make_pair(files[i].first, src)).first;
+        }
+
+        si->second.jobs.insert(index);
+    }
+
+    jobs[index].watched = true;
+}
+
+
+void mesh_loader::reload(std::vector<std::string> textures, std::map<std::string, std::set<size_t> > libs,
+                         std::set<size_t> meshes)
+{
+    for (std::vector<std::string>::const_iterator ti = textures.begin(); ti != textures.end(); ti++)
+        dake::texture_manager::instance().reload(*ti);
+
+    for (std::map<std::string, std::set<size_t> >::const_iterator li = libs.begin(); li != libs.end(); li++)
+        if (mtl_library_manager::instance().reload(li->first))
+            meshes.insert(li->second.begin(), li->second.end());
+
+    for (std::set<size_t>::const_iterator mi = meshes.begin(); mi != meshes.end(); mi++)
+    {
+        obj_reader *mesh = load(jobs[*mi]);
+
+        // Keep the old mesh if the file could not be read (e.g. because it
+        // is being written again already), i.e. if it has no vertices (and
+        // so an empty bounding box; the vertices themselves may still be in
+        // shared memory, see obj_reader::LOAD_SHARED)
+        if (mesh && (mesh->get_bbox_min()[0] > mesh->get_bbox_max()[0]))
+        {
+            delete mesh;
+            mesh = NULL;
+        }
+        if (!mesh)
+        {
+            fprintf(stderr, "Could not reload mesh %s\n", jobs[*mi].filename.c_str());
+            continue;
+        }
+
+        std::lock_guard<std::mutex> guard(lock);
+        reloaded.push_back(std::make_pair(*mi, mesh));
+    }
+
+    reloading = false;
+}
+
+
+bool mesh_loader::update(void)
+{
+    bool replaced = false;
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        for (size_t i = 0; i < reloaded.size(); i++)
+        {
+            job &j = jobs[reloaded[i].first];
+            delete j.mesh;
+            j.mesh = reloaded[i].second;
+            // It may use other files now
+            j.watched = false;
+            replaced = true;
+
+            // Reloaded lazily before complete() was called for it
+            if (!j.lazy && !j.mesh->is_complete())
+                completing.insert(reloaded[i].first);
+        }
+        reloaded.clear();
+    }
+
+    if (hot_reload)
+    {
+        for (size_t i = 0; i < jobs.size(); i++)
+            if (!jobs[i].watched && get(i))
+                watch(i);
+
+        std::vector<std::string> files;
+        watcher.poll(files);
+        changed.insert(files.begin(), files.end());
+    }
+
+    // Changes noticed (and meshes to be completed) during a reload are
+    // handled after it
+    if (reloading)
+        return replaced;
+
+    std::set<size_t> meshes;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        meshes.swap(completing);
+    }
+
+    if (changed.empty() && meshes.empty())
+        return replaced;
+
+    if (reloader.joinable())
+        reloader.join();
+
+    std::vector<std::string> textures;
+    std::map<std::string, std::set<size_t> > libs;
+
+    for (std::set<std::string>::const_iterator ci = changed.begin(); ci != changed.end(); ci++)
+    {
+        const source &src = sources[*ci];
+        if (src.kind == SOURCE_TEXTURE)
+            textures.push_back(*ci);
+        else if (src.kind == SOURCE_MTL)
+            libs[*ci] = src.jobs;
+        else
+            meshes.insert(src.jobs.begin(), src.jobs.end());
+    }
+    changed.clear();
+
+    reloading = true;
+    reloader = std::thread(&mesh_loader::reload, this, textures, libs, meshes);
+
+    return replaced;
+}
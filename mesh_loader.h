@@ -0,0 +1,197 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "dake/file_watcher.h"
+
+#include "obj_reader.h"
+
+
+// Loads a set of OBJ files on a pool of background threads, so the caller
+// can go on (e.g. keep rendering) and pick up every mesh as soon as it is
+// ready. Meshes are also prepared for drawing (see
+// obj_reader::get_indexed_mesh) and get their levels of detail (see
+// obj_reader::build_lods) before they are handed out, unless they are
+// loaded with obj_reader::LOAD_LAZY; those are loaded completely (and
+// prepared) in the background once complete() asks for it, and swapped in
+// by update() like reloaded meshes. With obj_reader::LOAD_CACHED, the
+// levels are stored in "<file>.lod" next to each file and loaded from there
+// if they are still up to date.
+//
+// All files are read at once as one batch (see dake::file_batch) on a
+// thread of its own, and every mesh is parsed as soon as its file has
+// arrived, straight from the data read; the material libraries and
+// textures of every mesh are read as a batch of their own (see
+// mtl_library_manager::prefetch). With obj_reader::LOAD_CACHED, the cache
+// file is read instead if there is one, which brings it into the page cache
+// for obj_reader. Meshes found in shared memory (see
+// obj_reader::LOAD_SHARED) are not read at all. Files are only read so far
+// ahead of the workers that at most MAX_READ_AHEAD bytes (see
+// mesh_loader.cxx) wait for them, unless a single file is bigger.
+//
+// With hot_reload set, the files every mesh has been loaded from (the OBJ
+// file, its material libraries and their textures) are watched (see
+// dake::file_watcher). When one of them changes, update() reloads what it
+// affects in the background and swaps the new meshes in once they are
+// ready: Textures are read again in place, so the meshes using them stay.
+// Material libraries are parsed again, and only if their materials have
+// changed, the meshes using them are loaded again, like those whose OBJ
+// files have changed.
+class mesh_loader
+{
+    private:
+        struct job
+        {
+            std::string filename;
+            int flags;
+            obj_reader *mesh;
+            // Set once the files "mesh" has been loaded from are watched
+            bool watched;
+            // The contents of the file, if they have been read for parsing
+            // and not yet taken by a worker
+            std::vector<char> contents;
+            bool has_contents;
+            // Size of the file read for it, until a worker takes it
+            size_t read_size;
+            // Set while it is still loaded with obj_reader::LOAD_LAZY,
+            // i.e. until complete() is called for it
+            bool lazy;
+        };
+
+        // Fixed once start() has been called, except for "mesh",
+        // "contents", "read_size" and "lazy", which are protected by "lock"
+        // (as are "done_count", "ready", "all_read", "read_ahead",
+        // "reloaded" and "completing")
+        std::vector<job> jobs;
+        std::mutex lock;
+        size_t done_count;
+
+        // Jobs whose files have been read (in that order), but which no
+        // worker has taken yet
+        std::deque<size_t> ready;
+        // Set once all files have been read
+        bool all_read;
+        std::condition_variable job_ready;
+
+        // Sum of "read_size" over all jobs, i.e. the bytes read (or being
+        // read) which no worker has taken yet
+        size_t read_ahead;
+        std::condition_variable contents_taken;
+
+        std::thread reader;
+        std::vector<std::thread> workers;
+
+        // Run by "reader": Read the files of all jobs as one batch, handing
+        // every job to the workers as soon as its file has arrived, and
+        // adding files to the batch only as the workers take what has been
+        // read
+        void read_all(void);
+
+        enum source_kind
+        {
+            SOURCE_MESH,
+            SOURCE_MTL,
+            SOURCE_TEXTURE
+        };
+
+        // A file watched for hot reloading and the jobs loaded from it
+        struct source
+        {
+            source_kind kind;
+            std::set<size_t> jobs;
+        };
+
+        // Only used by update()
+        dake::file_watcher watcher;
+        std::map<std::string, source> sources;
+        // Files changed, but not yet reloaded
+        std::set<std::string> changed;
+
+        // Meshes loaded again (by job index), not yet swapped in by update()
+        std::vector<std::pair<size_t, obj_reader *> > reloaded;
+        // Jobs complete() has been called for, not yet handed to "reloader"
+        std::set<size_t> completing;
+        std::thread reloader;
+        std::atomic<bool> reloading;
+
+        void work(void);
+
+        // Load the mesh for job "j", parsing "data" if given instead of
+        // reading the file (see obj_reader), completely unless the job is
+        // still lazy; returns NULL if that failed
+        obj_reader *load(const job &j, const std::vector<char> *data = NULL);
+
+        // Give "mesh" (loaded for job "j") its levels of detail
+        void build_lods(obj_reader *mesh, const job &j);
+
+        // Watch the files the mesh of job "index" has been loaded from
+        void watch(size_t index);
+
+        // Run by "reloader": Read the given textures again, parse the
+        // given material libraries again and then load the given meshes
+        // again (completing those complete() has been called for), plus
+        // those using any of the libraries which have changed
+        void reload(std::vector<std::string> textures, std::map<std::string, std::set<size_t> > libs,
+                    std::set<size_t> meshes);
+
+        mesh_loader(const mesh_loader &);
+        mesh_loader &operator=(const mesh_loader &);
+
+    public:
+        // The ratios of triangles to keep in the levels of detail (see
+        // obj_reader::build_lods); no levels are built if this is empty.
+        // Must not be changed after start().
+        std::vector<float> lod_ratios;
+
+        // Reload meshes when the files they have been loaded from change
+        // (see update()); off by default. Only works on Linux.
+        bool hot_reload;
+
+        mesh_loader(void);
+        // Waits for all files to be loaded (and reloaded) and deletes the
+        // meshes
+        ~mesh_loader(void);
+
+        // Add a file to be loaded with the given obj_reader flags; returns
+        // its index. Must not be called after start().
+        size_t add(const std::string &filename, int flags);
+
+        // Start loading all files added, parsing them on up to
+        // dake::worker_count() threads
+        void start(void);
+
+        // Number of files added
+        size_t size(void) const { return jobs.size(); }
+
+        // The mesh loaded from file "index", or NULL if it is not ready yet
+        // or could not be loaded
+        obj_reader *get(size_t index);
+
+        // Number of files loaded (or failed to load) so far
+        size_t finished(void);
+
+        // Have the mesh "mesh" (returned by get(), loaded with
+        // obj_reader::LOAD_LAZY) loaded completely and prepared for drawing
+        // in the background, instead of completing it on the caller's
+        // thread; get() returns the complete mesh once update() has swapped
+        // it in. Does nothing if that has been asked for already.
+        void complete(const obj_reader *mesh);
+
+        // Swap in the meshes reloaded (or completed) since the last call,
+        // deleting those they replace, and start completing the meshes
+        // complete() has been called for and, with hot_reload set,
+        // reloading whatever has changed since. Has to be called regularly,
+        // at a time nothing refers to any mesh returned by get() before,
+        // which has to be called again afterwards. Returns true if any mesh
+        // was replaced.
+        bool update(void);
+};
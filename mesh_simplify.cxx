@@ -0,0 +1,901 @@
+// Mesh simplification by quadric error edge collapses.
+//
+// Every vertex gets a quadric summing up the (area weighted) squared
+// distances to the planes of its faces. Open borders, material boundaries
+// and attribute seams additionally get planes perpendicular to their faces
+// through them, so moving away from them is expensive. Collapsing vertex u
+// into its neighbor v costs the combined quadric evaluated at v, plus the
+// difference of their normals and texture coordinates. The cheapest collapse
+// is taken from a priority queue until the targets are reached; queue
+// entries are invalidated by stamping the vertices they refer to instead of
+// removing them.
+//
+// Since the indexed mesh splits vertices along attribute seams, the
+// simplifier works on positions: all vertices with the same position are
+// one "point". A collapse of point u into point v replaces every vertex of
+// u by the vertex of v it shares an edge with, or else by the one of v's
+// vertices with the most similar attributes (the difference adds to the
+// cost).
+
+#include "mesh_simplify.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+
+// Sum of the equations of planes (n * x + d = 0) as a symmetric 4x4 matrix,
+// plus the area of the faces they have been taken from
+struct quadric
+{
+    double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+    double area;
+
+    quadric(void):
+        a2(0.), ab(0.), ac(0.), ad(0.), b2(0.), bc(0.), bd(0.), c2(0.), cd(0.), d2(0.),
+        area(0.)
+    {}
+
+    // Add a plane with a normalized normal, weighted with "w"
+    void add_plane(const dake::vec3 &n, double d, double w)
+    {
+        double a = n[0], b = n[1], c = n[2];
+
+        a2 += w * a * a; ab += w * a * b; ac += w * a * c; ad += w * a * d;
+        b2 += w * b * b; bc += w * b * c; bd += w * b * d;
+        c2 += w * c * c; cd += w * c * d;
+        d2 += w * d * d;
+    }
+
+    quadric &operator+=(const quadric &q)
+    {
+        a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+        b2 += q.b2; bc += q.bc; bd += q.bd;
+        c2 += q.c2; cd += q.cd;
+        d2 += q.d2;
+        area += q.area;
+        return *this;
+    }
+
+    // Weighted sum of the squared distances of "p" to all planes
+    double eval(const dake::vec3 &p) const
+    {
+        double x = p[0], y = p[1], z = p[2];
+        double e = a2 * x * x + 2. * ab * x * y + 2. * ac * x * z + 2. * ad * x
+                 + b2 * y * y + 2. * bc * y * z + 2. * bd * y
+                 + c2 * z * z + 2. * cd * z
+                 + d2;
+        return (e > 0.) ? e : 0.;
+    }
+};
+
+
+static inline uint64_t edge_key(uint32_t a, uint32_t b)
+{
+    return (a < b) ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+}
+
+static inline uint64_t hash_position(const dake::vec3 &p)
+{
+    uint32_t bits[3];
+    for (int i = 0; i < 3; i++)
+    {
+        // +0 and -0 are the same position
+        float f = p[i] + 0.f;
+        memcpy(&bits[i], &f, sizeof(bits[i]));
+    }
+
+    uint64_t h = (uint64_t)bits[0] * UINT64_C(0x9e3779b97f4a7c15)
+               ^ (uint64_t)bits[1] * UINT64_C(0xc2b2ae3d27d4eb4f)
+               ^ (uint64_t)bits[2] * UINT64_C(0x165667b19e3779f9);
+    return h ^ (h >> 31);
+}
+
+static inline bool same_position(const dake::vec3 &a, const dake::vec3 &b)
+{
+    return (a[0] == b[0]) && (a[1] == b[1]) && (a[2] == b[2]);
+}
+
+
+// A possible collapse of point u into point v; only valid as long as the
+// stamps of both points have not changed since
+struct collapse
+{
+    double cost;
+    uint32_t u, v;
+    uint32_t stamp_u, stamp_v;
+
+    // For the priority queue: the cheapest collapse comes first
+    bool operator<(const collapse &c) const
+    { return cost > c.cost; }
+};
+
+
+class simplifier
+{
+    private:
+        const indexed_mesh &mesh;
+        const simplify_options &opts;
+
+        // Corners (vertex indices) and material of every triangle, and
+        // whether it has been collapsed away
+        std::vector<uint32_t> tris;
+        std::vector<const material *> tri_mats;
+        std::vector<bool> tri_dead;
+        size_t live_count;
+
+        // Point (the first vertex with the same position) of every vertex
+        std::vector<uint32_t> point_of;
+
+        // Per point: its quadric, its triangles (which may contain dead
+        // ones), its stamp and the number of boundary edges it is on
+        std::vector<quadric> quadrics;
+        std::vector<std::vector<uint32_t> > point_tris;
+        std::vector<uint32_t> stamps;
+        std::vector<unsigned> boundary_count;
+        std::vector<bool> point_dead;
+
+        // Edges (between points) which are borders, material boundaries or
+        // seams; collapses must not move them off themselves
+        std::unordered_map<uint64_t, bool> boundary_edges;
+
+        // Point and line batches of the original mesh, carried over as they
+        // are
+        std::vector<mesh_batch> other_batches;
+
+        std::priority_queue<collapse> queue;
+
+        // Squared size of the mesh, scaling the attribute differences
+        double extent2;
+
+        // Largest error of any collapse so far
+        double max_error;
+
+        const dake::vec3 &pos(uint32_t vertex) const
+        { return mesh.vertices[vertex].position; }
+
+        bool same_tex_coord(uint32_t a, uint32_t b) const
+        {
+            const dake::vec2 &ta = mesh.vertices[a].tex_coord, &tb = mesh.vertices[b].tex_coord;
+            return (ta[0] == tb[0]) && (ta[1] == tb[1]);
+        }
+
+        bool is_boundary(uint32_t a, uint32_t b) const
+        { return boundary_edges.find(edge_key(a, b)) != boundary_edges.end(); }
+
+        void add_triangle(uint32_t a, uint32_t b, uint32_t c, const material *mat);
+        void find_points(void);
+        void find_boundaries(void);
+        double attribute_distance(uint32_t a, uint32_t b) const;
+        bool map_vertices(uint32_t u, uint32_t v, std::vector<std::pair<uint32_t, uint32_t> > &map) const;
+        bool evaluate(uint32_t u, uint32_t v, double &cost) const;
+        bool check_topology(uint32_t u, uint32_t v) const;
+        void push_edges(uint32_t p);
+        void fill_queue(void);
+        void do_collapse(uint32_t u, uint32_t v, const std::vector<std::pair<uint32_t, uint32_t> > &map);
+        void snapshot(mesh_lod &lod) const;
+
+    public:
+        simplifier(const indexed_mesh &m, const simplify_options &o);
+
+        void run(const std::vector<float> &ratios, std::vector<mesh_lod> &levels);
+};
+
+
+simplifier::simplifier(const indexed_mesh &m, const simplify_options &o):
+    mesh(m), opts(o), live_count(0), extent2(0.), max_error(0.)
+{
+    // Fan all polygons into triangles, dropping the degenerate ones
+    for (std::vector<mesh_batch>::const_iterator bi = mesh.batches.begin(); bi != mesh.batches.end(); bi++)
+    {
+        if (bi->face_size < 3)
+        {
+            other_batches.push_back(*bi);
+            continue;
+        }
+
+        for (unsigned f = bi->first; f < bi->first + bi->count; f += bi->face_size)
+            for (unsigned c = 2; c < bi->face_size; c++)
+                add_triangle(mesh.index(f), mesh.index(f + c - 1), mesh.index(f + c), bi->mat);
+    }
+
+    tri_dead.assign(tri_mats.size(), false);
+    live_count = tri_mats.size();
+
+    find_points();
+    find_boundaries();
+}
+
+
+void simplifier::add_triangle(uint32_t a, uint32_t b, uint32_t c, const material *mat)
+{
+    if (same_position(pos(a), pos(b)) || same_position(pos(b), pos(c)) || same_position(pos(c), pos(a)))
+        return;
+
+    tris.push_back(a);
+    tris.push_back(b);
+    tris.push_back(c);
+    tri_mats.push_back(mat);
+}
+
+
+// Find the points with an open addressing hash table over the positions
+// and set up everything kept per point
+void simplifier::find_points(void)
+{
+    size_t vertex_count = mesh.vertices.size();
+
+    size_t capacity = 16;
+    while (capacity < vertex_count * 2)
+        capacity *= 2;
+    std::vector<uint32_t> slots(capacity, 0);
+    size_t mask = capacity - 1;
+
+    point_of.resize(vertex_count);
+
+    dake::vec3 pmin = vertex_count ? pos(0) : dake::vec3(), pmax = pmin;
+
+    for (uint32_t i = 0; i < vertex_count; i++)
+    {
+        size_t slot = hash_position(pos(i)) & mask;
+        while (slots[slot] && !same_position(pos(slots[slot] - 1), pos(i)))
+            slot = (slot + 1) & mask;
+
+        if (!slots[slot])
+            slots[slot] = i + 1;
+        point_of[i] = slots[slot] - 1;
+
+        for (int j = 0; j < 3; j++)
+        {
+            pmin[j] = std::min(pmin[j], pos(i)[j]);
+            pmax[j] = std::max(pmax[j], pos(i)[j]);
+        }
+    }
+
+    double diag = (pmax - pmin).length();
+    extent2 = diag * diag;
+
+    quadrics.resize(vertex_count);
+    point_tris.resize(vertex_count);
+    stamps.assign(vertex_count, 0);
+    boundary_count.assign(vertex_count, 0);
+    point_dead.assign(vertex_count, false);
+
+    for (uint32_t t = 0; t < tri_mats.size(); t++)
+    {
+        const dake::vec3 &p0 = pos(tris[t * 3]), &p1 = pos(tris[t * 3 + 1]), &p2 = pos(tris[t * 3 + 2]);
+        dake::vec3 n = (p1 - p0) ^ (p2 - p0);
+        float len = n.length();
+
+        quadric q;
+        if (len > 0.f)
+        {
+            n /= len;
+            q.add_plane(n, -n.dot(p0), len * .5);
+            q.area = len * .5;
+        }
+
+        for (int c = 0; c < 3; c++)
+        {
+            uint32_t p = point_of[tris[t * 3 + c]];
+            quadrics[p] += q;
+            point_tris[p].push_back(t);
+        }
+    }
+}
+
+
+// An edge is a boundary if it has only one triangle (or more than two),
+// if its triangles have different materials or if their texture
+// coordinates differ on it (a seam). Seams in the normals are not, as
+// they are usually just creases; collapses across them are only made
+// expensive by the difference in normals.
+void simplifier::find_boundaries(void)
+{
+    struct edge_use
+    {
+        unsigned count;
+        const material *mat;
+        // Vertices at the lower and the higher point of the edge
+        uint32_t lo, hi;
+        bool boundary;
+    };
+
+    std::unordered_map<uint64_t, edge_use> edges;
+    edges.reserve(tris.size());
+
+    for (uint32_t t = 0; t < tri_mats.size(); t++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            uint32_t va = tris[t * 3 + c], vb = tris[t * 3 + (c + 1) % 3];
+            uint32_t a = point_of[va], b = point_of[vb];
+            if (a > b)
+            {
+                std::swap(a, b);
+                std::swap(va, vb);
+            }
+
+            std::unordered_map<uint64_t, edge_use>::iterator ei = edges.find(edge_key(a, b));
+            if (ei == edges.end())
+            {
+                edge_use eu = { 1, tri_mats[t], va, vb, false };
+                edges.insert(std::make_pair(edge_key(a, b), eu));
+            }
+            else
+            {
+                edge_use &eu = ei->second;
+                eu.count++;
+                if ((eu.mat != tri_mats[t]) || !same_tex_coord(eu.lo, va) || !same_tex_coord(eu.hi, vb))
+                    eu.boundary = true;
+            }
+        }
+    }
+
+    for (uint32_t t = 0; t < tri_mats.size(); t++)
+    {
+        const dake::vec3 &p0 = pos(tris[t * 3]), &p1 = pos(tris[t * 3 + 1]), &p2 = pos(tris[t * 3 + 2]);
+        dake::vec3 n = (p1 - p0) ^ (p2 - p0);
+        if (n.length() <= 0.f)
+            continue;
+        n.normalize();
+
+        for (int c = 0; c < 3; c++)
+        {
+            uint32_t a = point_of[tris[t * 3 + c]], b = point_of[tris[t * 3 + (c + 1) % 3]];
+            const edge_use &eu = edges.find(edge_key(a, b))->second;
+
+            if ((eu.count == 2) && !eu.boundary)
+                continue;
+
+            if (boundary_edges.insert(std::make_pair(edge_key(a, b), true)).second)
+            {
+                boundary_count[a]++;
+                boundary_count[b]++;
+            }
+
+            // The plane through the edge perpendicular to the triangle
+            dake::vec3 dir = pos(b) - pos(a);
+            float len = dir.length();
+            dake::vec3 bn = (dir ^ n) / len;
+
+            quadric q;
+            q.add_plane(bn, -bn.dot(pos(a)), len * len * opts.boundary_weight);
+            quadrics[a] += q;
+            quadrics[b] += q;
+        }
+    }
+}
+
+
+// Weighted squared difference of the attributes of two vertices
+double simplifier::attribute_distance(uint32_t a, uint32_t b) const
+{
+    const mesh_vertex &va = mesh.vertices[a], &vb = mesh.vertices[b];
+    double dist = 0.;
+
+    if (mesh.has_normals)
+    {
+        dake::vec3 dn = va.normal - vb.normal;
+        dist += opts.normal_weight * dn.dot(dn);
+    }
+    if (mesh.has_tex_coords)
+    {
+        float du = va.tex_coord[0] - vb.tex_coord[0], dv = va.tex_coord[1] - vb.tex_coord[1];
+        dist += opts.tex_coord_weight * (du * du + dv * dv);
+    }
+
+    return dist;
+}
+
+
+// Find which vertex of v every vertex of u would be replaced by: the one it
+// shares an edge with, or else the one with the most similar attributes.
+// Fails if u and v are not connected (anymore).
+bool simplifier::map_vertices(uint32_t u, uint32_t v, std::vector<std::pair<uint32_t, uint32_t> > &map) const
+{
+    std::vector<uint32_t> verts_u, verts_v;
+
+    map.clear();
+
+    for (std::vector<uint32_t>::const_iterator ti = point_tris[u].begin(); ti != point_tris[u].end(); ti++)
+    {
+        if (tri_dead[*ti])
+            continue;
+
+        const uint32_t *t = &tris[*ti * 3];
+        uint32_t vu = 0, vv = 0;
+        bool has_v = false;
+
+        for (int c = 0; c < 3; c++)
+        {
+            if (point_of[t[c]] == u)
+                vu = t[c];
+            else if (point_of[t[c]] == v)
+            {
+                vv = t[c];
+                has_v = true;
+            }
+        }
+
+        verts_u.push_back(vu);
+        if (!has_v)
+            continue;
+
+        bool found = false;
+        for (size_t i = 0; !found && (i < map.size()); i++)
+            found = map[i].first == vu;
+
+        if (!found)
+            map.push_back(std::make_pair(vu, vv));
+    }
+
+    if (map.empty())
+        return false;
+
+    std::sort(verts_u.begin(), verts_u.end());
+    verts_u.erase(std::unique(verts_u.begin(), verts_u.end()), verts_u.end());
+    if (verts_u.size() == map.size())
+        return true;
+
+    for (std::vector<uint32_t>::const_iterator ti = point_tris[v].begin(); ti != point_tris[v].end(); ti++)
+    {
+        if (tri_dead[*ti])
+            continue;
+
+        for (int c = 0; c < 3; c++)
+            if (point_of[tris[*ti * 3 + c]] == v)
+                verts_v.push_back(tris[*ti * 3 + c]);
+    }
+
+    std::sort(verts_v.begin(), verts_v.end());
+    verts_v.erase(std::unique(verts_v.begin(), verts_v.end()), verts_v.end());
+
+    for (std::vector<uint32_t>::const_iterator ui = verts_u.begin(); ui != verts_u.end(); ui++)
+    {
+        bool found = false;
+        for (size_t i = 0; !found && (i < map.size()); i++)
+            found = map[i].first == *ui;
+        if (found)
+            continue;
+
+        uint32_t best = verts_v[0];
+        double best_dist = attribute_distance(*ui, best);
+        for (size_t i = 1; i < verts_v.size(); i++)
+        {
+            double dist = attribute_distance(*ui, verts_v[i]);
+            if (dist < best_dist)
+            {
+                best = verts_v[i];
+                best_dist = dist;
+            }
+        }
+
+        map.push_back(std::make_pair(*ui, best));
+    }
+
+    return true;
+}
+
+
+// Cost of collapsing u into v; false if that collapse may not be done
+bool simplifier::evaluate(uint32_t u, uint32_t v, double &cost) const
+{
+    // Points on boundaries may only move along them, and only if they are
+    // not a corner of one (or on several)
+    if (boundary_count[u] && ((boundary_count[u] != 2) || !is_boundary(u, v)))
+        return false;
+
+    std::vector<std::pair<uint32_t, uint32_t> > map;
+    if (!map_vertices(u, v, map))
+        return false;
+
+    quadric q = quadrics[u];
+    q += quadrics[v];
+    cost = q.eval(pos(v));
+
+    double attr = 0.;
+    for (size_t i = 0; i < map.size(); i++)
+        attr += attribute_distance(map[i].first, map[i].second);
+
+    cost += attr * extent2 * quadrics[u].area;
+    return true;
+}
+
+
+// Check that collapsing u into v keeps the mesh manifold and flips no
+// triangle
+bool simplifier::check_topology(uint32_t u, uint32_t v) const
+{
+    std::vector<uint32_t> ring_u, ring_v, opposite;
+
+    for (std::vector<uint32_t>::const_iterator ti = point_tris[u].begin(); ti != point_tris[u].end(); ti++)
+    {
+        if (tri_dead[*ti])
+            continue;
+
+        const uint32_t *t = &tris[*ti * 3];
+        bool has_v = false;
+        for (int c = 0; c < 3; c++)
+            has_v = has_v || (point_of[t[c]] == v);
+
+        for (int c = 0; c < 3; c++)
+        {
+            uint32_t p = point_of[t[c]];
+            if ((p != u) && (p != v))
+            {
+                ring_u.push_back(p);
+                if (has_v)
+                    opposite.push_back(p);
+            }
+        }
+
+        if (has_v)
+            continue;
+
+        // The triangle must not flip or degenerate when u moves to v
+        dake::vec3 p[3], q[3];
+        for (int c = 0; c < 3; c++)
+        {
+            p[c] = pos(t[c]);
+            q[c] = (point_of[t[c]] == u) ? pos(v) : p[c];
+        }
+
+        dake::vec3 n0 = (p[1] - p[0]) ^ (p[2] - p[0]), n1 = (q[1] - q[0]) ^ (q[2] - q[0]);
+        if (n1.dot(n0) <= 0.f)
+            return false;
+    }
+
+    for (std::vector<uint32_t>::const_iterator ti = point_tris[v].begin(); ti != point_tris[v].end(); ti++)
+    {
+        if (tri_dead[*ti])
+            continue;
+
+        for (int c = 0; c < 3; c++)
+        {
+            uint32_t p = point_of[tris[*ti * 3 + c]];
+            if ((p != u) && (p != v))
+                ring_v.push_back(p);
+        }
+    }
+
+    std::sort(ring_u.begin(), ring_u.end());
+    ring_u.erase(std::unique(ring_u.begin(), ring_u.end()), ring_u.end());
+    std::sort(ring_v.begin(), ring_v.end());
+    ring_v.erase(std::unique(ring_v.begin(), ring_v.end()), ring_v.end());
+    std::sort(opposite.begin(), opposite.end());
+    opposite.erase(std::unique(opposite.begin(), opposite.end()), opposite.end());
+
+    // Link condition: the only neighbors u and v have in common are the
+    // ones opposite to their edge
+    std::vector<uint32_t> common;
+    std::set_intersection(ring_u.begin(), ring_u.end(), ring_v.begin(), ring_v.end(), std::back_inserter(common));
+    if (common.size() != opposite.size())
+        return false;
+
+    // A boundary must not be joined with another one
+    if (boundary_count[u])
+    {
+        for (std::vector<uint32_t>::const_iterator pi = ring_u.begin(); pi != ring_u.end(); pi++)
+            if ((*pi != v) && is_boundary(u, *pi) && is_boundary(v, *pi))
+                return false;
+    }
+
+    return true;
+}
+
+
+// Queue the collapses of all edges of point "p" (in both directions)
+void simplifier::push_edges(uint32_t p)
+{
+    std::vector<uint32_t> ring;
+
+    for (std::vector<uint32_t>::const_iterator ti = point_tris[p].begin(); ti != point_tris[p].end(); ti++)
+    {
+        if (tri_dead[*ti])
+            continue;
+
+        for (int c = 0; c < 3; c++)
+        {
+            uint32_t q = point_of[tris[*ti * 3 + c]];
+            if (q != p)
+                ring.push_back(q);
+        }
+    }
+
+    std::sort(ring.begin(), ring.end());
+    ring.erase(std::unique(ring.begin(), ring.end()), ring.end());
+
+    for (std::vector<uint32_t>::const_iterator qi = ring.begin(); qi != ring.end(); qi++)
+    {
+        collapse c;
+
+        if (evaluate(p, *qi, c.cost))
+        {
+            c.u = p;
+            c.v = *qi;
+            c.stamp_u = stamps[p];
+            c.stamp_v = stamps[*qi];
+            queue.push(c);
+        }
+
+        if (evaluate(*qi, p, c.cost))
+        {
+            c.u = *qi;
+            c.v = p;
+            c.stamp_u = stamps[*qi];
+            c.stamp_v = stamps[p];
+            queue.push(c);
+        }
+    }
+}
+
+
+// (Re-)queue the collapses of all edges. Every edge is pushed twice per
+// direction, but stamping each point before pushing its edges invalidates
+// the entries pushed for its neighbors before.
+void simplifier::fill_queue(void)
+{
+    queue = std::priority_queue<collapse>();
+
+    for (uint32_t p = 0; p < point_of.size(); p++)
+    {
+        if ((point_of[p] == p) && !point_dead[p])
+        {
+            stamps[p]++;
+            push_edges(p);
+        }
+    }
+}
+
+
+void simplifier::do_collapse(uint32_t u, uint32_t v, const std::vector<std::pair<uint32_t, uint32_t> > &map)
+{
+    // Move the boundary from u to v
+    if (boundary_count[u])
+    {
+        uint32_t w = u;
+
+        for (std::vector<uint32_t>::const_iterator ti = point_tris[u].begin(); (w == u) && (ti != point_tris[u].end()); ti++)
+        {
+            if (tri_dead[*ti])
+                continue;
+
+            for (int c = 0; c < 3; c++)
+            {
+                uint32_t p = point_of[tris[*ti * 3 + c]];
+                if ((p != u) && (p != v) && is_boundary(u, p))
+                    w = p;
+            }
+        }
+
+        boundary_edges.erase(edge_key(u, v));
+        if (w != u)
+        {
+            boundary_edges.erase(edge_key(u, w));
+            boundary_edges.insert(std::make_pair(edge_key(v, w), true));
+        }
+        else
+            boundary_count[v]--;
+    }
+
+    for (std::vector<uint32_t>::const_iterator ti = point_tris[u].begin(); ti != point_tris[u].end(); ti++)
+    {
+        if (tri_dead[*ti])
+            continue;
+
+        uint32_t *t = &tris[*ti * 3];
+        bool has_v = false;
+        for (int c = 0; c < 3; c++)
+            has_v = has_v || (point_of[t[c]] == v);
+
+        if (has_v)
+        {
+            tri_dead[*ti] = true;
+            live_count--;
+            continue;
+        }
+
+        for (int c = 0; c < 3; c++)
+        {
+            if (point_of[t[c]] != u)
+                continue;
+
+            for (size_t i = 0; i < map.size(); i++)
+                if (map[i].first == t[c])
+                    t[c] = map[i].second;
+        }
+
+        point_tris[v].push_back(*ti);
+    }
+
+    // Drop v's dead triangles, so its list does not grow without bounds
+    std::vector<uint32_t> &vt = point_tris[v];
+    size_t out = 0;
+    for (size_t i = 0; i < vt.size(); i++)
+        if (!tri_dead[vt[i]])
+            vt[out++] = vt[i];
+    vt.resize(out);
+
+    quadrics[v] += quadrics[u];
+    point_tris[u].clear();
+    point_dead[u] = true;
+    boundary_count[u] = 0;
+    stamps[u]++;
+    stamps[v]++;
+
+    push_edges(v);
+}
+
+
+// Build an indexed mesh from the current triangles, with the vertices in
+// the order of their first use and the triangles ordered by material (in
+// the order in which the materials appear in the original mesh)
+void simplifier::snapshot(mesh_lod &lod) const
+{
+    indexed_mesh &out = lod.mesh;
+
+    std::vector<uint32_t> new_index(mesh.vertices.size(), UINT32_MAX);
+    std::vector<uint32_t> indices;
+
+    out.vertices.clear();
+    out.batches.clear();
+    out.has_normals = mesh.has_normals;
+    out.has_tex_coords = mesh.has_tex_coords;
+
+    std::vector<const material *> mat_order;
+    std::unordered_map<const material *, std::vector<uint32_t> > by_mat;
+
+    for (uint32_t t = 0; t < tri_mats.size(); t++)
+    {
+        if (tri_dead[t])
+            continue;
+
+        std::unordered_map<const material *, std::vector<uint32_t> >::iterator mi = by_mat.find(tri_mats[t]);
+        if (mi == by_mat.end())
+        {
+            mat_order.push_back(tri_mats[t]);
+            mi = by_mat.insert(std::make_pair(tri_mats[t], std::vector<uint32_t>())).first;
+        }
+        mi->second.push_back(t);
+    }
+
+    for (std::vector<const material *>::const_iterator mi = mat_order.begin(); mi != mat_order.end(); mi++)
+    {
+        const std::vector<uint32_t> &list = by_mat.find(*mi)->second;
+
+        mesh_batch b;
+        b.first = indices.size();
+        b.count = list.size() * 3;
+        b.face_size = 3;
+        b.mat = *mi;
+        out.batches.push_back(b);
+
+        for (std::vector<uint32_t>::const_iterator ti = list.begin(); ti != list.end(); ti++)
+            for (int c = 0; c < 3; c++)
+                indices.push_back(tris[*ti * 3 + c]);
+    }
+
+    for (std::vector<mesh_batch>::const_iterator bi = other_batches.begin(); bi != other_batches.end(); bi++)
+    {
+        mesh_batch b = *bi;
+        b.first = indices.size();
+        out.batches.push_back(b);
+
+        for (unsigned i = bi->first; i < bi->first + bi->count; i++)
+            indices.push_back(mesh.index(i));
+    }
+
+    for (std::vector<uint32_t>::iterator ii = indices.begin(); ii != indices.end(); ii++)
+    {
+        if (new_index[*ii] == UINT32_MAX)
+        {
+            new_index[*ii] = out.vertices.size();
+            out.vertices.edit().push_back(mesh.vertices[*ii]);
+        }
+        *ii = new_index[*ii];
+    }
+
+    out.indices16.clear();
+    out.indices32.clear();
+    if (out.vertices.size() <= 65536)
+        out.indices16.edit().assign(indices.begin(), indices.end());
+    else
+        out.indices32.edit().swap(indices);
+
+    lod.ratio = tri_mats.empty() ? 1.f : static_cast<float>(live_count) / tri_mats.size();
+    lod.error = sqrt(max_error);
+}
+
+
+void simplifier::run(const std::vector<float> &ratios, std::vector<mesh_lod> &levels)
+{
+    size_t level = 0;
+    size_t last_count = tri_mats.size();
+    bool progress = true;
+
+    fill_queue();
+
+    std::vector<std::pair<uint32_t, uint32_t> > map;
+
+    while (level < ratios.size())
+    {
+        size_t target = static_cast<size_t>(ratios[level] * tri_mats.size());
+
+        if (live_count <= target)
+        {
+            // Levels which would not be coarser than the previous one are
+            // left out
+            if (live_count < last_count)
+            {
+                levels.push_back(mesh_lod());
+                snapshot(levels.back());
+                last_count = live_count;
+            }
+            level++;
+            continue;
+        }
+
+        if (queue.empty())
+        {
+            // Collapses found invalid before may have become valid since
+            if (!progress)
+                break;
+            progress = false;
+            fill_queue();
+            continue;
+        }
+
+        collapse c = queue.top();
+        queue.pop();
+
+        if (point_dead[c.u] || point_dead[c.v] || (stamps[c.u] != c.stamp_u) || (stamps[c.v] != c.stamp_v))
+            continue;
+
+        double cost;
+        if (!evaluate(c.u, c.v, cost) || !check_topology(c.u, c.v))
+            continue;
+
+        // The error reported is the geometric one only
+        quadric q = quadrics[c.u];
+        q += quadrics[c.v];
+        double error = (q.area > 0.) ? q.eval(pos(c.v)) / q.area : 0.;
+        if (error > (double)opts.max_error * opts.max_error)
+            break;
+
+        map_vertices(c.u, c.v, map);
+        do_collapse(c.u, c.v, map);
+
+        max_error = std::max(max_error, error);
+        progress = true;
+    }
+}
+
+
+
+
+void simplify_mesh(const indexed_mesh &mesh, const std::vector<float> &ratios, std::vector<mesh_lod> &levels,
+                   const simplify_options &opts)
+{
+    simplifier s(mesh, opts);
+    s.run(ratios, levels);
+}
+
+
+int select_lod(const std::vector<mesh_lod> &levels, float bbox_diagonal, float projected_size, float max_pixel_error)
+{
+    if (!(bbox_diagonal > 0.f))
+        return -1;
+
+    int selected = -1;
+    for (size_t i = 0; i < levels.size(); i++)
+        if (levels[i].error / bbox_diagonal * projected_size <= max_pixel_error)
+            selected = i;
+
+    return selected;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <vector>
+
+#include "indexed_mesh.h"
+
+
+// Parameters for simplify_mesh
+struct simplify_options
+{
+    // Weight of the difference between the normals resp. texture
+    // coordinates of two vertices when collapsing one into the other,
+    // relative to the geometric error (attribute differences are scaled by
+    // the size of the mesh, so the weights do not depend on it)
+    float normal_weight, tex_coord_weight;
+
+    // Weight of the planes keeping open borders, material boundaries and
+    // attribute seams in place, relative to the faces' planes
+    float boundary_weight;
+
+    // Stop simplifying once a collapse would introduce a larger error (in
+    // the mesh's units); levels not reached then are left out
+    float max_error;
+
+    simplify_options(void):
+        normal_weight(.05f), tex_coord_weight(.05f), boundary_weight(10.f),
+        max_error(1e30f)
+    {}
+};
+
+// One level of detail of a mesh
+struct mesh_lod
+{
+    // A pure triangle mesh (all batches have a face_size of 3, except for
+    // point and line batches carried over from the original mesh) using a
+    // subset of the original vertices
+    indexed_mesh mesh;
+
+    // Number of triangles relative to the original mesh
+    float ratio;
+
+    // Estimated geometric error against the original mesh, in the mesh's
+    // units
+    float error;
+};
+
+
+// Simplify "mesh" by collapsing edges in the order of their quadric error
+// (Garland and Heckbert), plus the change in normals and texture coordinates
+// they cause. Every collapse moves one vertex onto a neighbor, so the
+// remaining vertices keep their attributes; vertices on open borders,
+// material boundaries and texture seams only move along them, so faces
+// keep their materials and boundaries stay where they are. Polygons are
+// fanned into triangles first.
+//
+// "ratios" are the fractions of the triangles to keep, in descending order;
+// one level is appended to "levels" for each of them (unless simplification
+// stops before, see simplify_options::max_error). All levels are taken from
+// the same sequence of collapses, so they form a chain of increasingly
+// coarse versions. Implemented in mesh_simplify.cxx.
+void simplify_mesh(const indexed_mesh &mesh, const std::vector<float> &ratios, std::vector<mesh_lod> &levels,
+                   const simplify_options &opts = simplify_options());
+
+// Select the coarsest level in "levels" whose error is at most
+// "max_pixel_error" pixels when the mesh's bounding box (whose diagonal is
+// "bbox_diagonal" long) is "projected_size" pixels large on screen. Returns
+// -1 if the original mesh has to be used.
+int select_lod(const std::vector<mesh_lod> &levels, float bbox_diagonal, float projected_size,
+               float max_pixel_error = 1.f);
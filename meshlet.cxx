@@ -0,0 +1,402 @@
+// Meshlet building and cluster culling.
+//
+// Meshlets are grown greedily: starting from the first triangle not taken
+// yet, the adjacent triangle (one sharing a position with the meshlet) that
+// adds the fewest new vertices is added until the meshlet is full or has
+// no more neighbors. The candidates are kept in a list which is filled
+// whenever a vertex is added, so growing a meshlet only looks at the
+// triangles around it.
+
+#include "meshlet.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <stdint.h>
+
+
+static inline uint64_t hash_position(const dake::vec3 &p)
+{
+    uint32_t bits[3];
+    for (int i = 0; i < 3; i++)
+    {
+        // +0 and -0 are the same position
+        float f = p[i] + 0.f;
+        memcpy(&bits[i], &f, sizeof(bits[i]));
+    }
+
+    uint64_t h = (uint64_t)bits[0] * UINT64_C(0x9e3779b97f4a7c15)
+               ^ (uint64_t)bits[1] * UINT64_C(0xc2b2ae3d27d4eb4f)
+               ^ (uint64_t)bits[2] * UINT64_C(0x165667b19e3779f9);
+    return h ^ (h >> 31);
+}
+
+static inline bool same_position(const dake::vec3 &a, const dake::vec3 &b)
+{
+    return (a[0] == b[0]) && (a[1] == b[1]) && (a[2] == b[2]);
+}
+
+
+// Bounding sphere of the given points by Ritter's algorithm: start with the
+// sphere around two points far apart, then grow it to include all others
+static void bounding_sphere(const indexed_mesh &mesh, const uint32_t *verts, size_t count, dake::vec3 &center, float &radius)
+{
+    const dake::vec3 &first = mesh.vertices[verts[0]].position;
+    dake::vec3 a = first, b = first;
+    float max_dist = -1.f;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const dake::vec3 &p = mesh.vertices[verts[i]].position;
+        float dist = (p - first).length();
+        if (dist > max_dist)
+        {
+            max_dist = dist;
+            a = p;
+        }
+    }
+
+    max_dist = -1.f;
+    for (size_t i = 0; i < count; i++)
+    {
+        const dake::vec3 &p = mesh.vertices[verts[i]].position;
+        float dist = (p - a).length();
+        if (dist > max_dist)
+        {
+            max_dist = dist;
+            b = p;
+        }
+    }
+
+    center = (a + b) * .5f;
+    radius = (b - a).length() * .5f;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const dake::vec3 &p = mesh.vertices[verts[i]].position;
+        float dist = (p - center).length();
+        if (dist > radius)
+        {
+            // Move the center towards the point just enough to include it
+            float new_radius = (radius + dist) * .5f;
+            center += (p - center) * ((new_radius - radius) / dist);
+            radius = new_radius;
+        }
+    }
+}
+
+
+// Calculate the bounding sphere and the normal cone of meshlet "m"
+static void meshlet_bounds(const indexed_mesh &mesh, const meshlet_mesh &mm, meshlet &m)
+{
+    const uint32_t *verts = &mm.vertices[m.first_vertex];
+    const uint8_t *tris = &mm.triangles[m.first_triangle * 3];
+
+    bounding_sphere(mesh, verts, m.vertex_count, m.center, m.radius);
+
+    std::vector<dake::vec3> normals;
+    normals.reserve(m.triangle_count);
+
+    dake::vec3 sum;
+    for (unsigned i = 0; i < m.triangle_count; i++)
+    {
+        const dake::vec3 &p0 = mesh.vertices[verts[tris[i * 3]]].position;
+        const dake::vec3 &p1 = mesh.vertices[verts[tris[i * 3 + 1]]].position;
+        const dake::vec3 &p2 = mesh.vertices[verts[tris[i * 3 + 2]]].position;
+
+        dake::vec3 n = (p1 - p0) ^ (p2 - p0);
+        float len = n.length();
+        if (len <= 0.f)
+            continue;
+
+        normals.push_back(n / len);
+        sum += normals.back();
+    }
+
+    m.cone_axis = dake::vec3(0.f, 0.f, 1.f);
+    m.cone_cutoff = 1.f;
+
+    float len = sum.length();
+    if (len <= 0.f)
+        return;
+    m.cone_axis = sum / len;
+
+    float min_dot = 1.f;
+    for (std::vector<dake::vec3>::const_iterator ni = normals.begin(); ni != normals.end(); ni++)
+        min_dot = std::min(min_dot, ni->dot(m.cone_axis));
+
+    // With normals spread over more than a hemisphere, the meshlet always
+    // faces the viewer to some part; otherwise, the cutoff is the sine of
+    // the cone's opening angle
+    if (min_dot > 0.f)
+        m.cone_cutoff = sqrtf(1.f - min_dot * min_dot);
+}
+
+
+void meshlet_mesh::build(const indexed_mesh &mesh, unsigned max_vertices, unsigned max_triangles)
+{
+    meshlets.clear();
+    vertices.clear();
+    triangles.clear();
+
+    max_vertices = std::max(3u, std::min(max_vertices, 256u));
+    max_triangles = std::max(1u, max_triangles);
+
+    // Fan all polygons into triangles
+    std::vector<uint32_t> tris;
+    std::vector<const material *> tri_mats;
+
+    for (std::vector<mesh_batch>::const_iterator bi = mesh.batches.begin(); bi != mesh.batches.end(); bi++)
+    {
+        if (bi->face_size < 3)
+            continue;
+
+        for (unsigned f = bi->first; f < bi->first + bi->count; f += bi->face_size)
+        {
+            for (unsigned c = 2; c < bi->face_size; c++)
+            {
+                tris.push_back(mesh.index(f));
+                tris.push_back(mesh.index(f + c - 1));
+                tris.push_back(mesh.index(f + c));
+                tri_mats.push_back(bi->mat);
+            }
+        }
+    }
+
+    size_t tri_count = tri_mats.size(), vertex_count = mesh.vertices.size();
+
+    // Vertices split along seams (or flat shaded faces) do not share an
+    // index, so neighbors are found through positions: every vertex is
+    // mapped to the first one with the same position, using an open
+    // addressing hash table
+    std::vector<uint32_t> point_of(vertex_count);
+    {
+        size_t capacity = 16;
+        while (capacity < vertex_count * 2)
+            capacity *= 2;
+        std::vector<uint32_t> slots(capacity, 0);
+        size_t mask = capacity - 1;
+
+        for (uint32_t i = 0; i < vertex_count; i++)
+        {
+            const dake::vec3 &p = mesh.vertices[i].position;
+            size_t slot = hash_position(p) & mask;
+            while (slots[slot] && !same_position(mesh.vertices[slots[slot] - 1].position, p))
+                slot = (slot + 1) & mask;
+
+            if (!slots[slot])
+                slots[slot] = i + 1;
+            point_of[i] = slots[slot] - 1;
+        }
+    }
+
+    // The triangles around every point, as compressed sparse rows
+    std::vector<uint32_t> adj_offsets(vertex_count + 1, 0), adj(tris.size());
+    for (std::vector<uint32_t>::const_iterator vi = tris.begin(); vi != tris.end(); vi++)
+        adj_offsets[point_of[*vi] + 1]++;
+    for (size_t i = 0; i < vertex_count; i++)
+        adj_offsets[i + 1] += adj_offsets[i];
+    {
+        std::vector<uint32_t> fill(adj_offsets.begin(), adj_offsets.end() - 1);
+        for (size_t i = 0; i < tris.size(); i++)
+            adj[fill[point_of[tris[i]]]++] = i / 3;
+    }
+
+    std::vector<bool> used(tri_count, false);
+    // Index of every vertex in the current meshlet, or UINT32_MAX
+    std::vector<uint32_t> local(vertex_count, UINT32_MAX);
+    std::vector<uint32_t> candidates;
+
+    size_t seed = 0;
+    for (;;)
+    {
+        while ((seed < tri_count) && used[seed])
+            seed++;
+        if (seed >= tri_count)
+            break;
+
+        meshlet m;
+        m.first_vertex = vertices.size();
+        m.vertex_count = 0;
+        m.first_triangle = triangles.size() / 3;
+        m.triangle_count = 0;
+        m.mat = tri_mats[seed];
+
+        candidates.clear();
+        size_t next = seed;
+
+        for (;;)
+        {
+            used[next] = true;
+            m.triangle_count++;
+
+            for (int c = 0; c < 3; c++)
+            {
+                uint32_t v = tris[next * 3 + c];
+
+                if (local[v] == UINT32_MAX)
+                {
+                    local[v] = m.vertex_count++;
+                    vertices.push_back(v);
+
+                    uint32_t p = point_of[v];
+                    for (uint32_t i = adj_offsets[p]; i < adj_offsets[p + 1]; i++)
+                        if (!used[adj[i]] && (tri_mats[adj[i]] == m.mat))
+                            candidates.push_back(adj[i]);
+                }
+
+                triangles.push_back(local[v]);
+            }
+
+            if (m.triangle_count >= max_triangles)
+                break;
+
+            // Find the candidate adding the fewest vertices, dropping the
+            // ones taken in the meantime
+            size_t best = tri_count;
+            int best_new = 4;
+
+            for (size_t i = 0; i < candidates.size(); )
+            {
+                uint32_t t = candidates[i];
+                if (used[t])
+                {
+                    candidates[i] = candidates.back();
+                    candidates.pop_back();
+                    continue;
+                }
+
+                int new_verts = (local[tris[t * 3]] == UINT32_MAX) + (local[tris[t * 3 + 1]] == UINT32_MAX)
+                              + (local[tris[t * 3 + 2]] == UINT32_MAX);
+                if (new_verts < best_new)
+                {
+                    best = t;
+                    best_new = new_verts;
+                    if (!new_verts)
+                        break;
+                }
+                i++;
+            }
+
+            if ((best == tri_count) || (m.vertex_count + best_new > max_vertices))
+                break;
+
+            next = best;
+        }
+
+        for (unsigned i = 0; i < m.vertex_count; i++)
+            local[vertices[m.first_vertex + i]] = UINT32_MAX;
+
+        meshlet_bounds(mesh, *this, m);
+        meshlets.push_back(m);
+    }
+}
+
+
+
+
+cluster_culler::cluster_culler(void):
+    has_eye(false),
+    frustum(true),
+    backface(true)
+{
+}
+
+
+static float det3(float a, float b, float c, float d, float e, float f, float g, float h, float i)
+{
+    return a * (e * i - f * h) - b * (d * i - f * g) + c * (d * h - e * g);
+}
+
+
+void cluster_culler::set_view(const float *m)
+{
+    // Rows of the (column-major) matrix
+    dake::vec4 row[4];
+    for (int r = 0; r < 4; r++)
+        row[r] = dake::vec4(m[r], m[4 + r], m[8 + r], m[12 + r]);
+
+    // The planes bounding the clip space, -w <= x, y, z <= w
+    for (int i = 0; i < 3; i++)
+    {
+        planes[i * 2] = row[3] + row[i];
+        planes[i * 2 + 1] = row[3] - row[i];
+    }
+
+    for (int i = 0; i < 6; i++)
+    {
+        float len = dake::vec3(planes[i]).length();
+        if (len > 0.f)
+            planes[i] = planes[i] / len;
+    }
+
+    // The eye is the point which ends up with x = y = w = 0 in clip space,
+    // i.e. the null space of those three rows
+    const dake::vec4 &r0 = row[0], &r1 = row[1], &r3 = row[3];
+    float e[4] = {
+         det3(r0[1], r0[2], r0[3], r1[1], r1[2], r1[3], r3[1], r3[2], r3[3]),
+        -det3(r0[0], r0[2], r0[3], r1[0], r1[2], r1[3], r3[0], r3[2], r3[3]),
+         det3(r0[0], r0[1], r0[3], r1[0], r1[1], r1[3], r3[0], r3[1], r3[3]),
+        -det3(r0[0], r0[1], r0[2], r1[0], r1[1], r1[2], r3[0], r3[1], r3[2])
+    };
+
+    float e_len = sqrtf(e[0] * e[0] + e[1] * e[1] + e[2] * e[2] + e[3] * e[3]);
+    has_eye = fabsf(e[3]) > 1e-6f * e_len;
+    if (has_eye)
+        eye = dake::vec3(e[0] / e[3], e[1] / e[3], e[2] / e[3]);
+}
+
+
+void cluster_culler::cull(const meshlet_mesh &meshlets, std::vector<uint32_t> &indices, std::vector<mesh_batch> &batches,
+                          cull_stats &stats) const
+{
+    for (std::vector<meshlet>::const_iterator mi = meshlets.meshlets.begin(); mi != meshlets.meshlets.end(); mi++)
+    {
+        const meshlet &m = *mi;
+
+        stats.clusters++;
+        stats.triangles += m.triangle_count;
+
+        if (frustum)
+        {
+            bool outside = false;
+            for (int i = 0; !outside && (i < 6); i++)
+                outside = dake::vec3(planes[i]).dot(m.center) + planes[i][3] < -m.radius;
+
+            if (outside)
+            {
+                stats.frustum_culled++;
+                continue;
+            }
+        }
+
+        if (backface && has_eye)
+        {
+            dake::vec3 view = m.center - eye;
+            if (view.dot(m.cone_axis) >= m.cone_cutoff * view.length() + m.radius)
+            {
+                stats.backface_culled++;
+                continue;
+            }
+        }
+
+        if (batches.empty() || (batches.back().mat != m.mat) || (batches.back().first + batches.back().count != indices.size()))
+        {
+            mesh_batch b;
+            b.first = indices.size();
+            b.count = 0;
+            b.face_size = 3;
+            b.mat = m.mat;
+            batches.push_back(b);
+        }
+
+        const uint32_t *verts = &meshlets.vertices[m.first_vertex];
+        const uint8_t *tris = &meshlets.triangles[m.first_triangle * 3];
+        for (unsigned i = 0; i < m.triangle_count * 3; i++)
+            indices.push_back(verts[tris[i]]);
+
+        batches.back().count += m.triangle_count * 3;
+        stats.triangles_drawn += m.triangle_count;
+    }
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+
+#include "dake/vector.h"
+
+#include "indexed_mesh.h"
+
+
+// Default limits for the size of a meshlet (the ones commonly used for mesh
+// shaders)
+#define MESHLET_MAX_VERTICES    64
+#define MESHLET_MAX_TRIANGLES   124
+
+
+// A small cluster of triangles with the same material, together with the
+// data needed to cull it as a whole
+struct meshlet
+{
+    // Range in meshlet_mesh::vertices resp. of triangles in
+    // meshlet_mesh::triangles
+    unsigned first_vertex, vertex_count;
+    unsigned first_triangle, triangle_count;
+
+    const material *mat;
+
+    // Bounding sphere of the vertices
+    dake::vec3 center;
+    float radius;
+
+    // Cone containing the normals of all triangles: the meshlet is facing
+    // away from a viewer at "eye" if
+    //   dot(center - eye, cone_axis) >= cone_cutoff * |center - eye| + radius
+    // A cutoff of 1 means it never is.
+    dake::vec3 cone_axis;
+    float cone_cutoff;
+};
+
+// A triangle mesh split into meshlets. Each meshlet has a list of the
+// vertices it uses (indices into the indexed mesh it has been built from)
+// and its triangles refer to that list with 8 bit indices, so meshlets are
+// self-contained.
+struct meshlet_mesh
+{
+    std::vector<meshlet> meshlets;
+    std::vector<uint32_t> vertices;
+    // Three indices per triangle, relative to the meshlet's first vertex
+    std::vector<uint8_t> triangles;
+
+    // Build the meshlets from all faces of "mesh" with at least three
+    // corners (polygons are fanned). Every meshlet is grown from a seed
+    // triangle by adding the adjacent triangle (sharing a position) with the
+    // fewest new vertices until one of the limits (at most 256 vertices)
+    // would be exceeded.
+    void build(const indexed_mesh &mesh, unsigned max_vertices = MESHLET_MAX_VERTICES,
+               unsigned max_triangles = MESHLET_MAX_TRIANGLES);
+};
+
+
+// Statistics of a cluster_culler, summed up over all meshes culled
+struct cull_stats
+{
+    size_t clusters, frustum_culled, backface_culled;
+    size_t triangles, triangles_drawn;
+
+    cull_stats(void):
+        clusters(0), frustum_culled(0), backface_culled(0),
+        triangles(0), triangles_drawn(0)
+    {}
+};
+
+// Rejects meshlets which are outside of the view frustum or face away from
+// the viewer, so only the rest has to be drawn
+class cluster_culler
+{
+    private:
+        // Frustum planes (normal in xyz, distance in w), pointing inwards
+        dake::vec4 planes[6];
+        // Position of the viewer (only if the projection is a perspective
+        // one; otherwise, there is no backface culling)
+        dake::vec3 eye;
+        bool has_eye;
+
+    public:
+        // Which tests are done; both are enabled by default
+        bool frustum, backface;
+
+        cluster_culler(void);
+
+        // Set the transformation from the meshes' coordinates into clip
+        // space (projection times modelview, column-major as in OpenGL)
+        void set_view(const float *object_to_clip);
+
+        // Append the indices (into the indexed mesh "meshlets" has been built
+        // from) of all visible meshlets' triangles to "indices", and one
+        // batch (see mesh_batch) per run of meshlets with the same material
+        // to "batches". Updates "stats".
+        void cull(const meshlet_mesh &meshlets, std::vector<uint32_t> &indices, std::vector<mesh_batch> &batches,
+                  cull_stats &stats) const;
+};
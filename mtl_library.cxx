@@ -0,0 +1,247 @@
+#include "mtl_library.h"
+
+#include "dake/file_batch.h"
+#include "dake/path.h"
+#include "dake/texture.h"
+
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <utility>
+
+
+mtl_library_manager::~mtl_library_manager(void)
+{
+    for (std::map<std::string, mtl_library *>::iterator i = libraries.begin(); i != libraries.end(); i++)
+        delete i->second;
+    for (std::vector<mtl_library *>::iterator i = replaced.begin(); i != replaced.end(); i++)
+        delete *i;
+}
+
+
+const mtl_library *mtl_library_manager::find_library(const std::string &filename, const std::string &dirname)
+{
+    std::string path, dir;
+    if (!dake::canonical_path(filename, path) || !dake::canonical_path(dirname, dir))
+        return NULL;
+
+    std::string key = path + '\n' + dir;
+
+    // Parsing happens with the lock held, so no library is ever parsed
+    // twice
+    std::lock_guard<std::mutex> guard(lock);
+
+    std::map<std::string, mtl_library *>::iterator i = libraries.find(key);
+    if (i != libraries.end())
+        return i->second;
+
+    mtl_library *lib = new mtl_library;
+    lib->filename = path;
+    lib->dirname = dirname;
+
+    try
+    {
+        if (!load_mtl_library(filename, dirname, lib->materials))
+        {
+            delete lib;
+            return NULL;
+        }
+    }
+    catch (...)
+    {
+        delete lib;
+        throw;
+    }
+
+    libraries[key] = lib;
+    return lib;
+}
+
+
+// Tag of the textures in a prefetch batch; libraries are tagged with their
+// index
+#define TEXTURE_TAG ((size_t)-1)
+
+// Parses the libraries of a prefetch batch as they arrive and adds the
+// textures they use to the batch, creating every texture once it has been
+// read (so the image reader finds it in the page cache)
+class mtl_prefetcher: public dake::file_receiver
+{
+    public:
+        dake::file_batch batch;
+        std::string dirname;
+        // Libraries by key (see find_library); NULL if it could not be read
+        std::vector<std::pair<std::string, mtl_library *> > libs;
+        // The materials using every texture
+        std::map<std::string, std::vector<material *> > textures;
+
+        ~mtl_prefetcher(void)
+        {
+            for (size_t i = 0; i < libs.size(); i++)
+                delete libs[i].second;
+        }
+
+        void file_read(size_t tag, const std::string &name, std::vector<char> &data, bool ok)
+        {
+            if (tag == TEXTURE_TAG)
+            {
+                const dake::texture *tex = dake::texture_manager::instance().find_texture(name);
+
+                const std::vector<material *> &users = textures[name];
+                for (std::vector<material *>::const_iterator mi = users.begin(); mi != users.end(); mi++)
+                    (*mi)->tex = tex;
+                return;
+            }
+
+            mtl_library *&lib = libs[tag].second;
+            if (!ok)
+            {
+                delete lib;
+                lib = NULL;
+                return;
+            }
+
+            std::istringstream in(std::string(data.begin(), data.end()));
+            load_mtl_library(in, dirname, lib->materials, false);
+
+            for (std::vector<material>::iterator mi = lib->materials.begin(); mi != lib->materials.end(); mi++)
+            {
+                if (mi->tex_fname.empty())
+                    continue;
+
+                std::vector<material *> &users = textures[mi->tex_fname];
+                if (users.empty())
+                    batch.add(mi->tex_fname, *this, TEXTURE_TAG);
+                users.push_back(&*mi);
+            }
+        }
+};
+
+
+void mtl_library_manager::prefetch(const std::vector<std::string> &filenames, const std::string &dirname)
+{
+    std::string dir;
+    if (!dake::canonical_path(dirname, dir))
+        return;
+
+    mtl_prefetcher pf;
+    pf.dirname = dirname;
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        for (std::vector<std::string>::const_iterator fi = filenames.begin(); fi != filenames.end(); fi++)
+        {
+            std::string path;
+            if (!dake::canonical_path(*fi, path))
+                continue;
+
+            std::string key = path + '\n' + dir;
+            if (libraries.find(key) != libraries.end())
+                continue;
+
+            bool queued = false;
+            for (size_t i = 0; (i < pf.libs.size()) && !queued; i++)
+                queued = pf.libs[i].first == key;
+            if (queued)
+                continue;
+
+            mtl_library *lib = new mtl_library;
+            lib->filename = path;
+            lib->dirname = dirname;
+            pf.libs.push_back(std::make_pair(key, lib));
+            pf.batch.add(*fi, pf, pf.libs.size() - 1);
+        }
+    }
+
+    if (pf.libs.empty())
+        return;
+
+    // Not holding the lock, so other threads can go on finding libraries
+    try
+    {
+        pf.batch.run();
+    }
+    catch (...)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+
+    for (size_t i = 0; i < pf.libs.size(); i++)
+    {
+        if (!pf.libs[i].second || (libraries.find(pf.libs[i].first) != libraries.end()))
+            continue;
+
+        libraries[pf.libs[i].first] = pf.libs[i].second;
+        pf.libs[i].second = NULL;
+    }
+}
+
+
+static bool same_vec4(const dake::vec4 &a, const dake::vec4 &b)
+{
+    return (a[0] == b[0]) && (a[1] == b[1]) && (a[2] == b[2]) && (a[3] == b[3]);
+}
+
+
+static bool same_material(const material &a, const material &b)
+{
+    return (a.name == b.name) && same_vec4(a.ambient, b.ambient) && same_vec4(a.diffuse, b.diffuse) &&
+           same_vec4(a.specular, b.specular) && (a.spec_co == b.spec_co) && (a.illum == b.illum) &&
+           (a.tex == b.tex) && (a.tex_fname == b.tex_fname);
+}
+
+
+bool mtl_library_manager::reload(const std::string &filename)
+{
+    std::string path;
+    if (!dake::canonical_path(filename, path))
+        return false;
+
+    std::lock_guard<std::mutex> guard(lock);
+
+    bool any_replaced = false;
+
+    for (std::map<std::string, mtl_library *>::iterator i = libraries.begin(); i != libraries.end(); i++)
+    {
+        if (i->second->filename != path)
+            continue;
+
+        mtl_library *lib = new mtl_library;
+        lib->filename = path;
+        lib->dirname = i->second->dirname;
+
+        // Keep the old library if the new one cannot be read (e.g. because
+        // it is just being written) or nothing has changed
+        bool changed = false;
+        try
+        {
+            if (load_mtl_library(path, lib->dirname, lib->materials))
+            {
+                const std::vector<material> &old_mats = i->second->materials;
+                changed = old_mats.size() != lib->materials.size();
+                for (size_t m = 0; (m < old_mats.size()) && !changed; m++)
+                    changed = !same_material(old_mats[m], lib->materials[m]);
+            }
+        }
+        catch (...)
+        {
+        }
+
+        if (!changed)
+        {
+            delete lib;
+            continue;
+        }
+
+        replaced.push_back(i->second);
+        i->second = lib;
+        any_replaced = true;
+    }
+
+    return any_replaced;
+}
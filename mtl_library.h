@@ -0,0 +1,72 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "obj_reader.h"
+
+
+// The materials of one material library (.mtl file), in file order
+struct mtl_library
+{
+    std::string filename;
+    // The directory texture names have been resolved against, as given
+    // when the library was parsed first (so reloading it yields the same
+    // texture names)
+    std::string dirname;
+    std::vector<material> materials;
+};
+
+
+// Process-wide cache of material libraries, so every library is parsed
+// (and its textures are looked up) only once, no matter how many OBJ files
+// use it; all of them share the same material objects. Libraries are never
+// freed, not even when they are replaced by reload(). May be used from
+// multiple threads at once (though libraries prefetched by several threads
+// at the same time may be parsed more than once; only one of them is kept).
+class mtl_library_manager
+{
+    private:
+        // Keyed by the canonical path of the library and the directory
+        // relative texture names are resolved against
+        std::map<std::string, mtl_library *> libraries;
+        // Libraries replaced by reload(), which may still be in use
+        std::vector<mtl_library *> replaced;
+        std::mutex lock;
+
+        static void create_instance(mtl_library_manager **libman)
+        { *libman = new mtl_library_manager; }
+
+    public:
+        ~mtl_library_manager(void);
+
+        // Get the library "filename", whose texture names are relative to
+        // "dirname" (see load_mtl_library), parsing it if that has not been
+        // done before. Returns NULL if the file could not be opened.
+        const mtl_library *find_library(const std::string &filename, const std::string &dirname);
+
+        // Read all of the given libraries (whose texture names are relative
+        // to "dirname") which have not been parsed yet and the textures they
+        // use as one batch (see dake::file_batch), parsing every file as
+        // soon as it arrives, so find_library has them ready. Libraries
+        // which cannot be read or parsed this way are left to find_library
+        // (which reports the error).
+        void prefetch(const std::vector<std::string> &filenames, const std::string &dirname);
+
+        // Parse all libraries loaded from "filename" again (as it has
+        // changed). Those whose materials are not the same any longer are
+        // replaced, so find_library returns the new ones from now on;
+        // meshes have to be loaded again to use them. Returns true if any
+        // library has been replaced.
+        bool reload(const std::string &filename);
+
+        static mtl_library_manager &instance(void)
+        {
+            static mtl_library_manager *libman = NULL;
+            static std::once_flag created;
+            std::call_once(created, create_instance, &libman);
+            return *libman;
+        }
+};
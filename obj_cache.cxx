@@ -0,0 +1,1436 @@
+// Binary sidecar cache for obj_reader. After an OBJ file has been parsed,
+// its lists are written to "<file>.cache" next to it; later loads map that
+// file and copy the lists out of it instead of parsing the OBJ again.
+//
+// The cache stores the size, modification time and a content hash of the
+// OBJ file and every material library it loaded. It is used only if all of
+// them still match; if just the size or time differ (e.g. after a fresh
+// checkout), the content hash decides and the stamps are refreshed.
+//
+// obj_cache_converter writes the same file from a streamed OBJ file,
+// spooling the lists to temporary files instead of keeping them in memory.
+//
+// The levels of detail built by obj_reader::build_lods can be stored in a
+// file of their own, which is tied to the single-indexed mesh they have been
+// built from by a hash of it.
+//
+// With LOAD_SHARED, the same data is also put into a block of shared memory
+// (see dake::shared_memory), followed by the single-indexed mesh and its
+// quantized version, so other processes loading the same mesh take it from
+// there instead of parsing (or even reading) any file. The block is named
+// after a hash of the OBJ file's contents (which every process computes
+// once per file and stamp), the directory its material libraries are
+// looked up in and the content flags. Readers using the block draw the
+// meshes right from it and only copy the lists out of it once they are
+// asked for them.
+//
+// A block starts with a shared_header; its "ready" field is set only once
+// everything else has been written. The material libraries are recorded
+// with their canonical names, so processes running in other directories
+// can check them as well; blocks whose libraries have changed are removed
+// by the first process to notice and then replaced. Every reader using a
+// block enters its process into the block's table of users, and the last
+// one to stop using it removes it (processes which have died do not count;
+// if all of them have, the block stays until the next process using it is
+// done with it).
+
+#include "mesh_simplify.h"
+#include "mtl_library.h"
+#include "obj_reader.h"
+#include "obj_stream.h"
+
+#include "dake/atomic_file.h"
+#include "dake/hash.h"
+#include "dake/mapped_file.h"
+#include "dake/path.h"
+#include "dake/shared_memory.h"
+
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <new>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+
+#define CACHE_MAGIC     0x48434a4f // "OJCH"
+#define CACHE_VERSION   5
+
+#define LOD_MAGIC       0x444c4a4f // "OJLD"
+#define LOD_VERSION     1
+
+#define SHARED_MAGIC    0x48534a4f // "OJSH"
+#define SHARED_VERSION  2
+
+// Number of readers which can be entered as users of a block at once
+#define SHARED_USERS    64
+
+// Parts of cache data read_cache takes: check the obj file against its
+// source entry (otherwise only its size), check the material libraries and
+// load them (plus the bounding box), load the groups and lists, and load
+// only the positions
+#define READ_OBJ_SOURCE (1 << 0)
+#define READ_HEAD       (1 << 1)
+#define READ_LISTS      (1 << 2)
+#define READ_POSITIONS  (1 << 3)
+#define READ_ALL        (READ_OBJ_SOURCE | READ_HEAD | READ_LISTS)
+
+
+struct cache_header
+{
+    uint32_t magic, version;
+    uint32_t source_count, material_count;
+    uint32_t content_flags, group_count;
+    uint64_t vertex_count, normal_count, tex_coord_count;
+    uint64_t face_count, corner_count;
+    float bbox_min[3], bbox_max[3];
+};
+
+struct lod_header
+{
+    uint32_t magic, version;
+    uint32_t ratio_count, level_count;
+    uint32_t material_count, reserved;
+    // Hash of the single-indexed mesh the levels have been built from
+    uint64_t mesh_hash;
+};
+
+struct lod_level_header
+{
+    float ratio, error;
+    uint32_t has_normals, has_tex_coords;
+    uint64_t vertex_count, index_count, batch_count;
+    // Size of one index in bytes
+    uint32_t index_size, reserved;
+};
+
+// In front of the cache data in a shared memory block
+struct shared_header
+{
+    uint32_t magic, version;
+    // Set by the creator once everything else has been written
+    std::atomic<uint32_t> ready;
+    // Process ID of the creator
+    int32_t creator;
+    // Size of the cache data following this header
+    uint64_t size;
+    // Position (from the start of the block) and size of the draw data (a
+    // shared_draw_header and what it refers to)
+    uint64_t draw_offset, draw_size;
+    // Process IDs of the readers using the block (zero in free entries)
+    std::atomic<int32_t> users[SHARED_USERS];
+};
+
+// The single-indexed mesh and its quantized version in a shared memory
+// block; both have the same indices and batches
+struct shared_draw_header
+{
+    uint32_t has_normals, has_tex_coords;
+    uint64_t vertex_count, index_count, batch_count;
+    // Size of one index in bytes
+    uint32_t index_size;
+    // Whether the quantized vertices are there
+    uint32_t has_compact;
+    float pos_min[3], pos_scale[3];
+    // Positions of the lists from the start of the draw data; a batch is
+    // stored as its first index, index count, face size and material index
+    // (-1 for the default material)
+    uint64_t vertex_offset, index_offset, batch_offset, compact_offset;
+};
+
+// One file the cached data was loaded from
+struct cache_source
+{
+    std::string name;
+    uint64_t size;
+    int64_t mtime;
+    uint64_t hash;
+};
+
+
+// Helper for building the cache file in memory
+class cache_writer
+{
+    public:
+        std::vector<char> buf;
+
+        void put(const void *data, size_t len)
+        { buf.insert(buf.end(), static_cast<const char *>(data), static_cast<const char *>(data) + len); }
+
+        template<typename T> void put(const T &val)
+        { put(&val, sizeof(val)); }
+
+        void put_string(const std::string &str)
+        { uint32_t len = str.length(); put(len); put(str.data(), len); }
+};
+
+// Helper for reading the mapped cache file with bounds checks
+class cache_reader
+{
+    private:
+        const char *p, *e;
+
+    public:
+        cache_reader(const char *start, const char *end): p(start), e(end) {}
+
+        const char *take(size_t len)
+        {
+            if ((size_t)(e - p) < len)
+                throw 42;
+            const char *ret = p;
+            p += len;
+            return ret;
+        }
+
+        template<typename T> void get(T &val)
+        { memcpy(static_cast<void *>(&val), take(sizeof(val)), sizeof(val)); }
+
+        void get_string(std::string &str)
+        { uint32_t len; get(len); str.assign(take(len), len); }
+
+        // Copy "count" elements into a vector of a type with the same layout
+        template<typename T> void get_array(std::vector<T> &vec, size_t count, size_t elem_size)
+        {
+            if (elem_size != sizeof(T))
+                throw 42;
+            if (count > (size_t)(e - p) / elem_size)
+                throw 42;
+            vec.resize(count);
+            if (count)
+                memcpy(static_cast<void *>(&vec[0]), take(count * elem_size), count * elem_size);
+        }
+};
+
+
+static bool file_stamp(const std::string &name, uint64_t &size, int64_t &mtime)
+{
+    struct stat st;
+    if (stat(name.c_str(), &st) < 0)
+        return false;
+
+    size = st.st_size;
+#ifdef __linux__
+    mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#else
+    mtime = (int64_t)st.st_mtime * 1000000000;
+#endif
+    return true;
+}
+
+
+static bool file_hash(const std::string &name, uint64_t &hash)
+{
+    dake::mapped_file file(name);
+    if (!file.is_open())
+        return false;
+
+    hash = dake::hash64(file.begin(), file.size());
+    return true;
+}
+
+
+static std::string cache_name(const std::string &filename)
+{
+    return filename + ".cache";
+}
+
+
+// Stamp and hash the obj file and its material libraries
+static bool collect_sources(const std::string &filename, const std::vector<std::string> &libs,
+                            std::vector<cache_source> &sources)
+{
+    sources.resize(1 + libs.size());
+    sources[0].name = filename;
+    for (size_t i = 0; i < libs.size(); i++)
+        sources[i + 1].name = libs[i];
+
+    for (size_t i = 0; i < sources.size(); i++)
+        if (!file_stamp(sources[i].name, sources[i].size, sources[i].mtime) || !file_hash(sources[i].name, sources[i].hash))
+            return false;
+
+    return true;
+}
+
+
+// Put everything in front of the vertex list: the header, the sources, the
+// materials and the groups
+static void put_head(cache_writer &wr, const cache_header &hdr, const std::vector<cache_source> &sources,
+                     const std::vector<const material *> &materials, const std::vector<obj_group> &groups)
+{
+    wr.put(hdr);
+
+    for (size_t i = 0; i < sources.size(); i++)
+    {
+        wr.put_string(sources[i].name);
+        wr.put(sources[i].size);
+        wr.put(sources[i].mtime);
+        wr.put(sources[i].hash);
+    }
+
+    for (std::vector<const material *>::const_iterator mi = materials.begin(); mi != materials.end(); mi++)
+    {
+        const material &m = **mi;
+
+        wr.put_string(m.name);
+        wr.put(m.ambient);
+        wr.put(m.diffuse);
+        wr.put(m.specular);
+        wr.put(m.spec_co);
+        wr.put(m.illum);
+        wr.put_string(m.tex_fname);
+    }
+
+    for (std::vector<obj_group>::const_iterator gi = groups.begin(); gi != groups.end(); gi++)
+    {
+        wr.put_string(gi->object);
+        wr.put_string(gi->group);
+    }
+}
+
+
+// Write the sidecar file "name": first "head", then the contents of the
+// files "tails" (from their beginning). The data goes to a temporary file
+// first, so no other process ever maps a partially written file (see
+// dake::atomic_file).
+static bool store_file(const std::string &name, const std::vector<char> &head, FILE *const *tails, size_t tail_count)
+{
+    dake::atomic_file file(name);
+    FILE *fp = file.stream();
+    if (!fp)
+    {
+        fprintf(stderr, "Could not write mesh cache %s\n", name.c_str());
+        return false;
+    }
+
+    bool ok = head.empty() || (fwrite(&head[0], 1, head.size(), fp) == head.size());
+
+    std::vector<char> buf(1 << 16);
+    for (size_t i = 0; ok && (i < tail_count); i++)
+    {
+        rewind(tails[i]);
+
+        size_t len;
+        while (ok && ((len = fread(&buf[0], 1, buf.size(), tails[i])) > 0))
+            ok = fwrite(&buf[0], 1, len, fp) == len;
+
+        ok = ok && !ferror(tails[i]);
+    }
+
+    if (!ok || !file.commit())
+    {
+        fprintf(stderr, "Could not write mesh cache %s\n", name.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+
+
+
+bool obj_reader::read_cache(const char *begin, const char *end, const std::string &filename,
+                            const std::string &cache, const material *default_mat, int content, int parts,
+                            bool &restamp)
+{
+    restamp = false;
+
+    try
+    {
+        cache_reader rd(begin, end);
+
+        cache_header hdr;
+        rd.get(hdr);
+        if ((hdr.magic != CACHE_MAGIC) || (hdr.version != CACHE_VERSION))
+            return false;
+        if ((parts & READ_HEAD) && (hdr.content_flags != (uint32_t)content))
+            return false;
+
+        // Check whether all sources are still the same
+        std::vector<std::string> libs;
+        for (uint32_t i = 0; i < hdr.source_count; i++)
+        {
+            cache_source src;
+            rd.get_string(src.name);
+            rd.get(src.size);
+            rd.get(src.mtime);
+            rd.get(src.hash);
+
+            if (i)
+                libs.push_back(src.name);
+            if (!(parts & READ_HEAD))
+                continue;
+
+            // Data found by the obj file's contents (see shared_name) may
+            // have been made from another file with the same contents
+            if (!i && !(parts & READ_OBJ_SOURCE))
+            {
+                uint64_t size;
+                int64_t mtime;
+                if (!file_stamp(filename, size, mtime) || (size != src.size))
+                    return false;
+                continue;
+            }
+
+            if (!i && (src.name != filename))
+                return false;
+
+            uint64_t size;
+            int64_t mtime;
+            if (!file_stamp(src.name, size, mtime))
+                return false;
+
+            if ((size != src.size) || (mtime != src.mtime))
+            {
+                uint64_t hash;
+                if ((size != src.size) || !file_hash(src.name, hash) || (hash != src.hash))
+                    return false;
+
+                restamp = true;
+            }
+        }
+
+        // The materials are taken from the libraries (which have just been
+        // found to be unchanged), so they are shared with all other readers
+        // using them; the table in the cache only has to match
+        if (parts & READ_HEAD)
+        {
+            if (!libs.empty())
+                mtl_library_manager::instance().prefetch(libs, obj_dirname);
+            for (std::vector<std::string>::const_iterator li = libs.begin(); li != libs.end(); li++)
+                if (!add_mtl_library(*li))
+                    throw 42;
+
+            for (int i = 0; i < 3; i++)
+            {
+                bbox_min[i] = hdr.bbox_min[i];
+                bbox_max[i] = hdr.bbox_max[i];
+            }
+        }
+
+        if (hdr.material_count != materials.size())
+            throw 42;
+
+        for (uint32_t i = 0; i < hdr.material_count; i++)
+        {
+            material m;
+
+            rd.get_string(m.name);
+            rd.get(m.ambient);
+            rd.get(m.diffuse);
+            rd.get(m.specular);
+            rd.get(m.spec_co);
+            rd.get(m.illum);
+            rd.get_string(m.tex_fname);
+
+            if (m.name != materials[i]->name)
+                throw 42;
+        }
+
+        if (!(parts & (READ_LISTS | READ_POSITIONS)))
+            return true;
+
+        // Every name takes at least its length
+        if (!hdr.group_count || (hdr.group_count > (size_t)(end - begin) / (2 * sizeof(uint32_t))))
+            throw 42;
+
+        std::vector<obj_group> file_groups(hdr.group_count);
+        for (uint32_t i = 0; i < hdr.group_count; i++)
+        {
+            rd.get_string(file_groups[i].object);
+            rd.get_string(file_groups[i].group);
+        }
+
+        rd.get_array(vertices, hdr.vertex_count, 3 * sizeof(float));
+        if (!(parts & READ_LISTS))
+            return true;
+
+        groups.swap(file_groups);
+
+        std::vector<int32_t> face_mats;
+        rd.get_array(normals, hdr.normal_count, 3 * sizeof(float));
+        rd.get_array(tex_coords, hdr.tex_coord_count, 2 * sizeof(float));
+        rd.get_array(faces.offsets, hdr.face_count + 1, sizeof(uint32_t));
+        rd.get_array(face_mats, hdr.face_count, sizeof(int32_t));
+        rd.get_array(faces.groups, hdr.face_count, sizeof(uint32_t));
+        rd.get_array(faces.smoothing, hdr.face_count, sizeof(uint32_t));
+        rd.get_array(faces.corners, hdr.corner_count, 3 * sizeof(int32_t));
+
+        if (faces.offsets[0])
+            throw 42;
+
+        faces.mats.resize(hdr.face_count);
+        for (size_t i = 0; i < hdr.face_count; i++)
+        {
+            if ((faces.offsets[i] > faces.offsets[i + 1]) || (faces.offsets[i + 1] > hdr.corner_count))
+                throw 42;
+            if ((face_mats[i] < -1) || (face_mats[i] >= (int32_t)materials.size()))
+                throw 42;
+            if (faces.groups[i] >= hdr.group_count)
+                throw 42;
+
+            faces.mats[i] = (face_mats[i] < 0) ? default_mat : materials[face_mats[i]];
+        }
+    }
+    catch (int)
+    {
+        fprintf(stderr, "Ignoring corrupt mesh cache %s\n", cache.c_str());
+
+        vertices.clear();
+        normals.clear();
+        tex_coords.clear();
+        faces.clear();
+        groups.assign(1, obj_group());
+        if (parts & READ_HEAD)
+        {
+            materials.clear();
+            material_names.clear();
+            mtl_files.clear();
+        }
+        return false;
+    }
+
+    return true;
+}
+
+
+bool obj_reader::load_cache(const std::string &filename, const material *default_mat, int content)
+{
+    dake::mapped_file file(cache_name(filename));
+    if (!file.is_open())
+        return false;
+
+    bool restamp;
+    if (!read_cache(file.begin(), file.end(), filename, cache_name(filename), default_mat, content, READ_ALL, restamp))
+        return false;
+
+    if (restamp)
+        write_cache(filename, content);
+
+    return true;
+}
+
+
+
+
+bool obj_reader::build_cache(const std::string &filename, const std::vector<std::string> &libs, int content,
+                             std::vector<char> &buf)
+{
+    std::vector<cache_source> sources;
+    if (!collect_sources(filename, libs, sources))
+        return false;
+
+    cache_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = CACHE_MAGIC;
+    hdr.version = CACHE_VERSION;
+    hdr.content_flags = content;
+    hdr.source_count = sources.size();
+    hdr.material_count = materials.size();
+    hdr.group_count = groups.size();
+    hdr.vertex_count = vertices.size();
+    hdr.normal_count = normals.size();
+    hdr.tex_coord_count = tex_coords.size();
+    hdr.face_count = faces.size();
+    hdr.corner_count = faces.corners.size();
+    for (int i = 0; i < 3; i++)
+    {
+        hdr.bbox_min[i] = bbox_min[i];
+        hdr.bbox_max[i] = bbox_max[i];
+    }
+
+    cache_writer wr;
+    put_head(wr, hdr, sources, materials, groups);
+
+    if (!vertices.empty())
+        wr.put(&vertices[0], vertices.size() * sizeof(vertices[0]));
+    if (!normals.empty())
+        wr.put(&normals[0], normals.size() * sizeof(normals[0]));
+    if (!tex_coords.empty())
+        wr.put(&tex_coords[0], tex_coords.size() * sizeof(tex_coords[0]));
+
+    wr.put(&faces.offsets[0], faces.offsets.size() * sizeof(faces.offsets[0]));
+
+    // Index of every material in the list; all others are the default one
+    std::unordered_map<const material *, int32_t> mat_indices;
+    for (size_t i = 0; i < materials.size(); i++)
+        mat_indices.insert(std::make_pair(materials[i], (int32_t)i));
+
+    for (size_t i = 0; i < faces.size(); i++)
+    {
+        std::unordered_map<const material *, int32_t>::const_iterator mi = mat_indices.find(faces.mats[i]);
+        int32_t mat_index = (mi != mat_indices.end()) ? mi->second : -1;
+        wr.put(mat_index);
+    }
+
+    if (!faces.groups.empty())
+        wr.put(&faces.groups[0], faces.groups.size() * sizeof(faces.groups[0]));
+    if (!faces.smoothing.empty())
+        wr.put(&faces.smoothing[0], faces.smoothing.size() * sizeof(faces.smoothing[0]));
+
+    if (!faces.corners.empty())
+        wr.put(&faces.corners[0], faces.corners.size() * sizeof(faces.corners[0]));
+
+    buf.swap(wr.buf);
+    return true;
+}
+
+
+void obj_reader::write_cache(const std::string &filename, int content)
+{
+    std::vector<char> buf;
+    if (build_cache(filename, mtl_files, content, buf))
+        store_file(cache_name(filename), buf, NULL, 0);
+}
+
+
+
+
+// Hash of the contents of the file "path" (a canonical path); every file is
+// only hashed once per process, unless its size or modification time
+// changes
+static bool content_hash(const std::string &path, uint64_t &hash)
+{
+    static std::mutex lock;
+    static std::map<std::string, cache_source> known;
+
+    cache_source src;
+    if (!file_stamp(path, src.size, src.mtime))
+        return false;
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        std::map<std::string, cache_source>::const_iterator ki = known.find(path);
+        if ((ki != known.end()) && (ki->second.size == src.size) && (ki->second.mtime == src.mtime))
+        {
+            hash = ki->second.hash;
+            return true;
+        }
+    }
+
+    dake::mapped_file file(path);
+    if (!file.is_open())
+        return false;
+
+    src.name = path;
+    src.hash = dake::hash64_wide(file.begin(), file.size());
+    hash = src.hash;
+
+    std::lock_guard<std::mutex> guard(lock);
+    known[path] = src;
+    return true;
+}
+
+
+// Name of the shared memory block for the given obj file and content flags;
+// "path" receives the file's canonical path
+static bool shared_name(const std::string &filename, int content, std::string &name, std::string &path)
+{
+    std::string dir;
+    uint64_t hash;
+    if (!dake::canonical_path(filename, path) || !dake::canonical_path(dake::directory_of(filename), dir) || !content_hash(path, hash))
+        return false;
+
+    char key[40];
+    uint32_t flags = content;
+    hash = dake::hash64(dir.data(), dir.length(), hash);
+    hash = dake::hash64(&flags, sizeof(flags), hash);
+    snprintf(key, sizeof(key), "/obj_reader.%016llx", (unsigned long long)hash);
+
+    name = key;
+    return true;
+}
+
+
+static int32_t current_process(void)
+{
+#ifdef __linux__
+    return getpid();
+#else
+    return 0;
+#endif
+}
+
+
+static bool process_alive(int32_t pid)
+{
+#ifdef __linux__
+    return !kill(pid, 0) || (errno != ESRCH);
+#else
+    (void)pid;
+    return true;
+#endif
+}
+
+
+static size_t align16(size_t ofs)
+{
+    return (ofs + 15) & ~(size_t)15;
+}
+
+
+// A block of shared memory used by a reader
+struct shared_mesh
+{
+    dake::shared_memory block;
+    std::string name;
+    // Entry of the reader in the block's table of users, or -1 if it has
+    // not been entered (e.g. because the table has been full)
+    int slot;
+
+    shared_mesh(void): slot(-1) {}
+    ~shared_mesh(void);
+
+    shared_header *header(void) { return reinterpret_cast<shared_header *>(block.data()); }
+
+    // Enter this process into the table of users
+    void attach(void);
+};
+
+
+void shared_mesh::attach(void)
+{
+    shared_header *hdr = header();
+    int32_t self = current_process();
+
+    for (int i = 0; (i < SHARED_USERS) && (slot < 0); i++)
+    {
+        // Entries of processes which have died are free again
+        int32_t pid = hdr->users[i].load();
+        if (pid && process_alive(pid))
+            continue;
+
+        if (hdr->users[i].compare_exchange_strong(pid, self))
+            slot = i;
+    }
+}
+
+
+shared_mesh::~shared_mesh(void)
+{
+    if (slot < 0)
+        return;
+
+    shared_header *hdr = header();
+    hdr->users[slot].store(0);
+
+    for (int i = 0; i < SHARED_USERS; i++)
+    {
+        int32_t pid = hdr->users[i].load();
+        if (!pid)
+            continue;
+        if (process_alive(pid))
+            return;
+
+        hdr->users[i].compare_exchange_strong(pid, 0);
+    }
+
+    // This has been the last user
+    block.remove_if_same(name);
+}
+
+
+// Check the draw data in the given block and make "mesh" and "cmesh" views
+// of it; "batch_mats" receives the material index of every batch (as
+// stored, so -1 for the default material), which must be less than
+// "material_count"
+static bool map_draw_data(const dake::shared_memory &block, const shared_header &hdr, uint32_t material_count,
+                          indexed_mesh &mesh, compact_mesh &cmesh, std::vector<int32_t> &batch_mats)
+{
+    if ((hdr.draw_offset > block.size()) || (hdr.draw_size > block.size() - hdr.draw_offset) ||
+        (hdr.draw_size < sizeof(shared_draw_header)) || (hdr.draw_offset % 16))
+        return false;
+
+    const char *draw = block.begin() + hdr.draw_offset;
+    const shared_draw_header &dh = *reinterpret_cast<const shared_draw_header *>(draw);
+
+    // Whether "count" elements of "size" bytes at "ofs" are within the
+    // draw data and aligned
+    struct
+    {
+        uint64_t limit;
+        bool operator()(uint64_t ofs, uint64_t count, uint64_t size) const
+        { return !(ofs % 16) && (ofs <= limit) && (count <= (limit - ofs) / size); }
+    } inside = { hdr.draw_size };
+
+    if (!inside(dh.vertex_offset, dh.vertex_count, sizeof(mesh_vertex)) ||
+        !inside(dh.index_offset, dh.index_count, dh.index_size ? dh.index_size : 1) ||
+        !inside(dh.batch_offset, dh.batch_count, 4 * sizeof(uint32_t)) ||
+        (dh.has_compact && !inside(dh.compact_offset, dh.vertex_count, sizeof(compact_vertex))))
+        return false;
+
+    const mesh_vertex *vertices = reinterpret_cast<const mesh_vertex *>(draw + dh.vertex_offset);
+    mesh.vertices.set_view(vertices, dh.vertex_count);
+
+    mesh.indices16.clear();
+    mesh.indices32.clear();
+    if (dh.index_size == sizeof(uint16_t))
+        mesh.indices16.set_view(reinterpret_cast<const uint16_t *>(draw + dh.index_offset), dh.index_count);
+    else if (dh.index_size == sizeof(uint32_t))
+        mesh.indices32.set_view(reinterpret_cast<const uint32_t *>(draw + dh.index_offset), dh.index_count);
+    else
+        return false;
+
+    // Everything drawn must stay within the vertices
+    for (size_t i = 0; i < dh.index_count; i++)
+        if (mesh.index(i) >= dh.vertex_count)
+            return false;
+
+    mesh.has_normals = dh.has_normals;
+    mesh.has_tex_coords = dh.has_tex_coords;
+
+    const uint32_t *batches = reinterpret_cast<const uint32_t *>(draw + dh.batch_offset);
+    mesh.batches.resize(dh.batch_count);
+    batch_mats.resize(dh.batch_count);
+    for (size_t i = 0; i < dh.batch_count; i++)
+    {
+        const uint32_t *b = batches + 4 * i;
+        int32_t mat_index = (int32_t)b[3];
+
+        if ((b[0] > dh.index_count) || (b[1] > dh.index_count - b[0]))
+            return false;
+        if ((mat_index < -1) || (mat_index >= (int32_t)material_count))
+            return false;
+
+        mesh.batches[i].first = b[0];
+        mesh.batches[i].count = b[1];
+        mesh.batches[i].face_size = b[2];
+        mesh.batches[i].mat = NULL;
+        batch_mats[i] = mat_index;
+    }
+
+    cmesh = compact_mesh();
+    if (dh.has_compact)
+    {
+        cmesh.vertices.set_view(reinterpret_cast<const compact_vertex *>(draw + dh.compact_offset), dh.vertex_count);
+        cmesh.indices16 = mesh.indices16;
+        cmesh.indices32 = mesh.indices32;
+        cmesh.has_normals = mesh.has_normals;
+        cmesh.has_tex_coords = mesh.has_tex_coords;
+        cmesh.pos_min = dake::vec3(dh.pos_min[0], dh.pos_min[1], dh.pos_min[2]);
+        cmesh.pos_scale = dake::vec3(dh.pos_scale[0], dh.pos_scale[1], dh.pos_scale[2]);
+    }
+
+    return true;
+}
+
+
+bool obj_reader::load_shared(const std::string &filename, const material *default_mat, int content)
+{
+    std::string name, path;
+    if (!shared_name(filename, content, name, path))
+        return false;
+
+    std::shared_ptr<shared_mesh> sm(new shared_mesh);
+    sm->name = name;
+
+    // Writable for the table of users only
+    if (!sm->block.open(name, true))
+        return false;
+
+    const shared_header *hdr = sm->header();
+    if ((sm->block.size() < sizeof(*hdr)) || (hdr->magic != SHARED_MAGIC) || (hdr->version != SHARED_VERSION))
+        return false;
+
+    if (!hdr->ready.load(std::memory_order_acquire))
+    {
+        // Still being written, unless its creator has died in the process
+        if (!process_alive(hdr->creator))
+            sm->block.remove_if_same(name);
+        return false;
+    }
+
+    const char *data = sm->block.begin() + sizeof(*hdr);
+    cache_header chdr;
+    if ((hdr->size > sm->block.size() - sizeof(*hdr)) || (hdr->size < sizeof(chdr)))
+    {
+        sm->block.remove_if_same(name);
+        return false;
+    }
+    memcpy(&chdr, data, sizeof(chdr));
+
+    indexed_mesh mesh;
+    compact_mesh cmesh;
+    std::vector<int32_t> batch_mats;
+
+    // Changed material libraries are only noticed here, so the block has
+    // to make way for a new one then. The restamp flag does not matter, the
+    // libraries are hashed whenever their stamps differ.
+    bool restamp;
+    if (!map_draw_data(sm->block, *hdr, chdr.material_count, mesh, cmesh, batch_mats) ||
+        !read_cache(data, data + hdr->size, filename, name, default_mat, content, READ_HEAD, restamp))
+    {
+        sm->block.remove_if_same(name);
+        return false;
+    }
+
+    for (size_t i = 0; i < mesh.batches.size(); i++)
+        mesh.batches[i].mat = (batch_mats[i] < 0) ? default_mat : materials[batch_mats[i]];
+    if (!cmesh.vertices.empty())
+        cmesh.batches = mesh.batches;
+
+    indexed = mesh;
+    compact = cmesh;
+
+    sm->attach();
+    shared = sm;
+    lists_shared = true;
+    positions_shared = true;
+    return true;
+}
+
+
+void obj_reader::unshare_positions(void)
+{
+    if (!positions_shared)
+        return;
+
+    positions_shared = false;
+
+    const char *data = shared->block.begin() + sizeof(shared_header);
+    bool restamp;
+    read_cache(data, data + shared->header()->size, std::string(), shared->name, NULL, 0, READ_POSITIONS, restamp);
+}
+
+
+void obj_reader::unshare_lists(const material *default_mat)
+{
+    if (!lists_shared)
+        return;
+
+    // The positions come along
+    lists_shared = false;
+    positions_shared = false;
+
+    const char *data = shared->block.begin() + sizeof(shared_header);
+    bool restamp;
+    read_cache(data, data + shared->header()->size, std::string(), shared->name, default_mat, 0, READ_LISTS,
+               restamp);
+}
+
+
+void obj_reader::publish_shared(const std::string &filename, int content)
+{
+    std::string name, path;
+    if (!shared_name(filename, content, name, path))
+        return;
+
+    std::vector<std::string> libs(mtl_files.size());
+    for (size_t i = 0; i < mtl_files.size(); i++)
+        if (!dake::canonical_path(mtl_files[i], libs[i]))
+            return;
+
+    std::vector<char> buf;
+    if (!build_cache(path, libs, content, buf))
+        return;
+
+    const indexed_mesh &mesh = get_indexed_mesh();
+    const compact_mesh &cmesh = get_compact_mesh();
+    bool has_compact = !cmesh.vertices.empty();
+
+    shared_draw_header dh;
+    memset(&dh, 0, sizeof(dh));
+    dh.has_normals = mesh.has_normals;
+    dh.has_tex_coords = mesh.has_tex_coords;
+    dh.vertex_count = mesh.vertices.size();
+    dh.index_count = mesh.index_count();
+    dh.batch_count = mesh.batches.size();
+    dh.index_size = mesh.index_size();
+    dh.has_compact = has_compact;
+    for (int i = 0; i < 3; i++)
+    {
+        dh.pos_min[i] = cmesh.pos_min[i];
+        dh.pos_scale[i] = cmesh.pos_scale[i];
+    }
+
+    dh.vertex_offset = align16(sizeof(dh));
+    dh.index_offset = align16(dh.vertex_offset + dh.vertex_count * sizeof(mesh_vertex));
+    dh.batch_offset = align16(dh.index_offset + dh.index_count * dh.index_size);
+    dh.compact_offset = align16(dh.batch_offset + dh.batch_count * 4 * sizeof(uint32_t));
+    size_t draw_size = dh.compact_offset + (has_compact ? dh.vertex_count * sizeof(compact_vertex) : 0);
+    size_t draw_offset = align16(sizeof(shared_header) + buf.size());
+
+    // Fails if some other process has been faster, which is fine
+    std::shared_ptr<shared_mesh> sm(new shared_mesh);
+    sm->name = name;
+    if (!sm->block.create(name, draw_offset + draw_size))
+        return;
+
+    shared_header *hdr = new (sm->block.data()) shared_header;
+    hdr->magic = SHARED_MAGIC;
+    hdr->version = SHARED_VERSION;
+    hdr->creator = current_process();
+    hdr->size = buf.size();
+    hdr->draw_offset = draw_offset;
+    hdr->draw_size = draw_size;
+    hdr->ready.store(0, std::memory_order_relaxed);
+    for (int i = 0; i < SHARED_USERS; i++)
+        hdr->users[i].store(0, std::memory_order_relaxed);
+
+    // Entered before anyone else can see it, so no other process takes
+    // itself for the last user before this one has been entered
+    sm->attach();
+
+    memcpy(sm->block.data() + sizeof(*hdr), buf.data(), buf.size());
+
+    char *draw = sm->block.data() + draw_offset;
+    memcpy(draw, &dh, sizeof(dh));
+    if (dh.vertex_count)
+        memcpy(draw + dh.vertex_offset, mesh.vertices.data(), dh.vertex_count * sizeof(mesh_vertex));
+    if (dh.index_count)
+        memcpy(draw + dh.index_offset, mesh.index_data(), dh.index_count * dh.index_size);
+
+    // Index of every material in the list; all others are the default one
+    std::unordered_map<const material *, int32_t> mat_indices;
+    for (size_t i = 0; i < materials.size(); i++)
+        mat_indices.insert(std::make_pair(materials[i], (int32_t)i));
+
+    for (size_t i = 0; i < dh.batch_count; i++)
+    {
+        std::unordered_map<const material *, int32_t>::const_iterator mi = mat_indices.find(mesh.batches[i].mat);
+        uint32_t b[4] = {
+            mesh.batches[i].first, mesh.batches[i].count, mesh.batches[i].face_size,
+            (uint32_t)((mi != mat_indices.end()) ? mi->second : -1)
+        };
+        memcpy(draw + dh.batch_offset + i * sizeof(b), b, sizeof(b));
+    }
+
+    if (has_compact)
+        memcpy(draw + dh.compact_offset, cmesh.vertices.data(), dh.vertex_count * sizeof(compact_vertex));
+
+    hdr->ready.store(1, std::memory_order_release);
+
+    // Use the block from now on, like any other process would; the lists
+    // are copied back only if they are needed
+    indexed.vertices.set_view(reinterpret_cast<const mesh_vertex *>(draw + dh.vertex_offset), dh.vertex_count);
+    if (dh.index_size == sizeof(uint16_t))
+        indexed.indices16.set_view(reinterpret_cast<const uint16_t *>(draw + dh.index_offset), dh.index_count);
+    else
+        indexed.indices32.set_view(reinterpret_cast<const uint32_t *>(draw + dh.index_offset), dh.index_count);
+    if (has_compact)
+    {
+        compact.vertices.set_view(reinterpret_cast<const compact_vertex *>(draw + dh.compact_offset), dh.vertex_count);
+        compact.indices16 = indexed.indices16;
+        compact.indices32 = indexed.indices32;
+    }
+
+    std::vector<dake::vec3>().swap(vertices);
+    std::vector<dake::vec3>().swap(normals);
+    std::vector<dake::vec2>().swap(tex_coords);
+    face_list().swap(faces);
+    groups.assign(1, obj_group());
+    std::vector<submesh>().swap(submeshes);
+
+    shared = sm;
+    lists_shared = true;
+    positions_shared = true;
+}
+
+
+bool obj_reader::shared_ready(const std::string &filename, int content)
+{
+    std::string name, path;
+    if (!shared_name(filename, content, name, path))
+        return false;
+
+    dake::shared_memory block;
+    if (!block.open(name))
+        return false;
+
+    const shared_header *hdr = reinterpret_cast<const shared_header *>(block.begin());
+    return (block.size() >= sizeof(*hdr)) && (hdr->magic == SHARED_MAGIC) && (hdr->version == SHARED_VERSION) &&
+           hdr->ready.load(std::memory_order_acquire);
+}
+
+
+bool obj_reader::unpublish_shared(const std::string &filename, int content)
+{
+    std::string name, path;
+    if (!shared_name(filename, content, name, path))
+        return false;
+
+    return dake::shared_memory::remove(name);
+}
+
+
+
+
+static uint64_t mesh_hash(const indexed_mesh &mesh)
+{
+    uint64_t h = dake::hash64(mesh.vertices.data(), mesh.vertices.size() * sizeof(mesh_vertex));
+    h = dake::hash64(mesh.index_data(), mesh.index_count() * mesh.index_size(), h);
+    return h;
+}
+
+
+bool obj_reader::save_lods(const std::string &filename)
+{
+    const indexed_mesh &mesh = get_indexed_mesh();
+
+    lod_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = LOD_MAGIC;
+    hdr.version = LOD_VERSION;
+    hdr.ratio_count = lod_ratios.size();
+    hdr.level_count = lods.size();
+    hdr.material_count = materials.size();
+    hdr.mesh_hash = mesh_hash(mesh);
+
+    cache_writer wr;
+    wr.put(hdr);
+
+    for (std::vector<float>::const_iterator ri = lod_ratios.begin(); ri != lod_ratios.end(); ri++)
+        wr.put(*ri);
+
+    for (std::vector<const material *>::const_iterator mi = materials.begin(); mi != materials.end(); mi++)
+        wr.put_string((*mi)->name);
+
+    std::unordered_map<const material *, int32_t> mat_indices;
+    for (size_t i = 0; i < materials.size(); i++)
+        mat_indices.insert(std::make_pair(materials[i], (int32_t)i));
+
+    for (std::vector<mesh_lod>::const_iterator li = lods.begin(); li != lods.end(); li++)
+    {
+        const indexed_mesh &m = li->mesh;
+
+        lod_level_header lhdr;
+        memset(&lhdr, 0, sizeof(lhdr));
+        lhdr.ratio = li->ratio;
+        lhdr.error = li->error;
+        lhdr.has_normals = m.has_normals;
+        lhdr.has_tex_coords = m.has_tex_coords;
+        lhdr.vertex_count = m.vertices.size();
+        lhdr.index_count = m.index_count();
+        lhdr.batch_count = m.batches.size();
+        lhdr.index_size = m.index_size();
+        wr.put(lhdr);
+
+        wr.put(m.vertices.data(), m.vertices.size() * sizeof(mesh_vertex));
+        wr.put(m.index_data(), m.index_count() * m.index_size());
+
+        for (std::vector<mesh_batch>::const_iterator bi = m.batches.begin(); bi != m.batches.end(); bi++)
+        {
+            std::unordered_map<const material *, int32_t>::const_iterator mi = mat_indices.find(bi->mat);
+            int32_t mat_index = (mi != mat_indices.end()) ? mi->second : -1;
+            uint32_t fields[3] = { bi->first, bi->count, bi->face_size };
+
+            wr.put(fields);
+            wr.put(mat_index);
+        }
+    }
+
+    return store_file(filename, wr.buf, NULL, 0);
+}
+
+
+bool obj_reader::read_lods(const std::string &filename, const std::vector<float> &ratios, const material *default_mat)
+{
+    dake::mapped_file file(filename);
+    if (!file.is_open())
+        return false;
+
+    const indexed_mesh &mesh = get_indexed_mesh();
+    std::vector<mesh_lod> levels;
+
+    try
+    {
+        cache_reader rd(file.begin(), file.end());
+
+        lod_header hdr;
+        rd.get(hdr);
+        if ((hdr.magic != LOD_MAGIC) || (hdr.version != LOD_VERSION))
+            return false;
+
+        // The levels are only of use if they have been built with the same
+        // ratios from the same mesh
+        if ((hdr.ratio_count != ratios.size()) || (hdr.mesh_hash != mesh_hash(mesh)))
+            return false;
+
+        for (uint32_t i = 0; i < hdr.ratio_count; i++)
+        {
+            float ratio;
+            rd.get(ratio);
+            if (ratio != ratios[i])
+                return false;
+        }
+
+        if (hdr.material_count != materials.size())
+            return false;
+
+        for (uint32_t i = 0; i < hdr.material_count; i++)
+        {
+            std::string name;
+            rd.get_string(name);
+            if (name != materials[i]->name)
+                return false;
+        }
+
+        if (hdr.level_count > hdr.ratio_count)
+            throw 42;
+
+        levels.resize(hdr.level_count);
+        for (std::vector<mesh_lod>::iterator li = levels.begin(); li != levels.end(); li++)
+        {
+            indexed_mesh &m = li->mesh;
+
+            lod_level_header lhdr;
+            rd.get(lhdr);
+            li->ratio = lhdr.ratio;
+            li->error = lhdr.error;
+            m.has_normals = lhdr.has_normals;
+            m.has_tex_coords = lhdr.has_tex_coords;
+
+            rd.get_array(m.vertices.edit(), lhdr.vertex_count, sizeof(mesh_vertex));
+
+            if (lhdr.index_size == sizeof(uint16_t))
+                rd.get_array(m.indices16.edit(), lhdr.index_count, sizeof(uint16_t));
+            else if (lhdr.index_size == sizeof(uint32_t))
+                rd.get_array(m.indices32.edit(), lhdr.index_count, sizeof(uint32_t));
+            else
+                throw 42;
+
+            for (size_t i = 0; i < lhdr.index_count; i++)
+                if (m.index(i) >= lhdr.vertex_count)
+                    throw 42;
+
+            if (lhdr.batch_count > lhdr.index_count + 1)
+                throw 42;
+
+            m.batches.resize(lhdr.batch_count);
+            for (std::vector<mesh_batch>::iterator bi = m.batches.begin(); bi != m.batches.end(); bi++)
+            {
+                uint32_t fields[3];
+                int32_t mat_index;
+
+                rd.get(fields);
+                rd.get(mat_index);
+
+                if ((fields[0] > lhdr.index_count) || (fields[1] > lhdr.index_count - fields[0]))
+                    throw 42;
+                if ((mat_index < -1) || (mat_index >= (int32_t)materials.size()))
+                    throw 42;
+
+                bi->first = fields[0];
+                bi->count = fields[1];
+                bi->face_size = fields[2];
+                bi->mat = (mat_index < 0) ? default_mat : materials[mat_index];
+            }
+        }
+    }
+    catch (int)
+    {
+        fprintf(stderr, "Ignoring corrupt LOD file %s\n", filename.c_str());
+        return false;
+    }
+
+    lods.swap(levels);
+    lod_ratios = ratios;
+    return true;
+}
+
+
+
+
+obj_cache_converter::obj_cache_converter(const std::string &fname):
+    filename(fname), failed(false), current_mat(-1), groups(1), current_group(0), current_smoothing(0),
+    vertex_count(0), normal_count(0), tex_coord_count(0),
+    face_count(0), corner_count(0)
+{
+    size_t slash = filename.rfind('/');
+    dirname = (slash == std::string::npos) ? std::string(".") : filename.substr(0, slash ? slash : 1);
+
+    for (int i = 0; i < SEC_COUNT; i++)
+        if (!(sections[i] = tmpfile()))
+            failed = true;
+
+    bbox_max = -std::numeric_limits<float>::max();
+    bbox_min = -bbox_max;
+
+    // The offsets start with the first face's beginning
+    uint32_t zero = 0;
+    put(SEC_OFFSETS, &zero, sizeof(zero));
+}
+
+
+obj_cache_converter::~obj_cache_converter(void)
+{
+    for (int i = 0; i < SEC_COUNT; i++)
+        if (sections[i])
+            fclose(sections[i]);
+}
+
+
+void obj_cache_converter::put(section sec, const void *data, size_t len)
+{
+    if (!failed && len && (fwrite(data, 1, len, sections[sec]) != len))
+        failed = true;
+}
+
+
+void obj_cache_converter::add_vertices(const dake::vec3 *v, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            if (v[i][j] < bbox_min[j])
+                bbox_min[j] = v[i][j];
+            if (v[i][j] > bbox_max[j])
+                bbox_max[j] = v[i][j];
+        }
+    }
+
+    put(SEC_VERTICES, v, count * sizeof(*v));
+    vertex_count += count;
+}
+
+
+void obj_cache_converter::add_normals(const dake::vec3 *n, size_t count)
+{
+    put(SEC_NORMALS, n, count * sizeof(*n));
+    normal_count += count;
+}
+
+
+void obj_cache_converter::add_tex_coords(const dake::vec2 *t, size_t count)
+{
+    put(SEC_TEX_COORDS, t, count * sizeof(*t));
+    tex_coord_count += count;
+}
+
+
+void obj_cache_converter::add_faces(const face_list &list, size_t first, size_t count)
+{
+    size_t begin = list.offsets[first], end = list.offsets[first + count];
+
+    // The offsets are stored as 32 bit values
+    if (corner_count + (end - begin) > UINT32_MAX)
+    {
+        failed = true;
+        return;
+    }
+
+    for (size_t i = first; i < first + count; i++)
+    {
+        uint32_t offset = corner_count + list.offsets[i + 1] - begin;
+        put(SEC_OFFSETS, &offset, sizeof(offset));
+        put(SEC_MATERIALS, &current_mat, sizeof(current_mat));
+        put(SEC_GROUPS, &current_group, sizeof(current_group));
+        put(SEC_SMOOTHING, &current_smoothing, sizeof(current_smoothing));
+    }
+
+    put(SEC_CORNERS, &list.corners[begin], (end - begin) * sizeof(list.corners[0]));
+
+    face_count += count;
+    corner_count += end - begin;
+}
+
+
+void obj_cache_converter::material_lib(const std::string &fname)
+{
+    if (!load_mtl_library(fname, dirname, materials, false))
+    {
+        fprintf(stderr, "Could not open material lib %s\n", fname.c_str());
+        throw 42;
+    }
+
+    mtl_files.push_back(fname);
+}
+
+
+void obj_cache_converter::use_material(const std::string &name)
+{
+    for (size_t i = 0; i < materials.size(); i++)
+    {
+        if (materials[i].name == name)
+        {
+            current_mat = i;
+            return;
+        }
+    }
+
+    fprintf(stderr, "Could not find material %s\n", name.c_str());
+    throw 84;
+}
+
+
+void obj_cache_converter::object(const std::string &name)
+{
+    obj_group g;
+    g.object = name;
+
+    groups.push_back(g);
+    current_group = groups.size() - 1;
+}
+
+
+void obj_cache_converter::group(const std::string &name)
+{
+    obj_group g;
+    g.object = groups[current_group].object;
+    g.group = name;
+
+    groups.push_back(g);
+    current_group = groups.size() - 1;
+}
+
+
+void obj_cache_converter::smoothing_group(unsigned group)
+{
+    current_smoothing = group;
+}
+
+
+bool obj_cache_converter::finish(void)
+{
+    if (failed)
+    {
+        fprintf(stderr, "Could not write mesh cache %s\n", cache_name(filename).c_str());
+        return false;
+    }
+
+    std::vector<cache_source> sources;
+    if (!collect_sources(filename, mtl_files, sources))
+        return false;
+
+    cache_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = CACHE_MAGIC;
+    hdr.version = CACHE_VERSION;
+    hdr.content_flags = 0;
+    hdr.source_count = sources.size();
+    hdr.material_count = materials.size();
+    hdr.group_count = groups.size();
+    hdr.vertex_count = vertex_count;
+    hdr.normal_count = normal_count;
+    hdr.tex_coord_count = tex_coord_count;
+    hdr.face_count = face_count;
+    hdr.corner_count = corner_count;
+    for (int i = 0; i < 3; i++)
+    {
+        hdr.bbox_min[i] = bbox_min[i];
+        hdr.bbox_max[i] = bbox_max[i];
+    }
+
+    std::vector<const material *> mat_list;
+    for (size_t i = 0; i < materials.size(); i++)
+        mat_list.push_back(&materials[i]);
+
+    cache_writer wr;
+    put_head(wr, hdr, sources, mat_list, groups);
+
+    return store_file(cache_name(filename), wr.buf, sections, SEC_COUNT);
+}
@@ -0,0 +1,936 @@
+// Compact mesh format for obj_reader (files ending in .objz), meant for
+// storing meshes where a raw binary dump (like the cache, see obj_cache.cxx)
+// would still be too big, e.g. on network drives. Loading one fills the very
+// same lists as loading the OBJ file it has been made from.
+//
+// Everything is stored as byte-aligned variable length integers (seven bits
+// per byte, signed values zigzag encoded), so the file has no byte order
+// and decoding never needs more than a shift and a mask per byte:
+//  * Positions and texture coordinates are quantized within their bounding
+//    box, normals in octahedral coordinates (see dake/quantize.h), with the
+//    number of bits given by codec_options. Every vertex is stored as the
+//    difference to the one before it, which is small for meshes whose
+//    vertices are in the order of first use (see optimize_vertex_fetch).
+//  * The three indices of every face corner are stored as one 4 bit code
+//    each, with a separate stream of values for the codes which need one.
+//    A code either names one of the last values stored ("adjacency": faces
+//    share their vertices with faces shortly before them), stands for "the
+//    next index never used before", or, for normal and texture coordinate
+//    indices, for "the index used with this corner's vertex index last
+//    time". Anything else is stored as the difference to the previous
+//    corner's index.
+//  * Face sizes, materials, groups and smoothing groups are run-length
+//    encoded.
+//
+// Materials are stored by name and taken from the material libraries when
+// loading, just as for the OBJ file; libraries in the directory of the
+// compressed file (or below) are referred to relative to it.
+//
+// Loading is split into one task per stream (see PARALLEL_MIN_CORNERS). On
+// a single core, it takes about twice as long as loading the cache, while
+// the file is 10-20% of the cache's size; so it is faster wherever reading
+// the cache takes longer than decoding, i.e. below about 1.5 GB/s (see
+// bench/codec.cxx).
+
+#include "mtl_library.h"
+#include "obj_reader.h"
+
+#include "dake/atomic_file.h"
+#include "dake/byte_order.h"
+#include "dake/mapped_file.h"
+#include "dake/parallel.h"
+#include "dake/path.h"
+#include "dake/quantize.h"
+
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+
+#define CODEC_MAGIC     "OJCZ"
+#define CODEC_VERSION   1
+
+// Number of recently stored indices a corner code can refer to, and the
+// size of the ring buffer keeping them (a power of two)
+#define RECENT_COUNT    13
+#define RING_SIZE       16
+
+// Meshes with fewer corners are decoded on a single thread
+#define PARALLEL_MIN_CORNERS    (1 << 16)
+
+// Corner codes; CODE_RECENT + i refers to the i-th last index stored
+#define CODE_NEXT       0
+#define CODE_ESCAPE     1
+#define CODE_SAME       2
+#define CODE_RECENT     3
+
+
+// Streams following the header, in this order
+enum codec_stream
+{
+    STREAM_POSITIONS,
+    STREAM_NORMALS,
+    STREAM_TEX_COORDS,
+    STREAM_FACE_SIZES,
+    STREAM_FACE_MATS,
+    STREAM_FACE_GROUPS,
+    STREAM_FACE_SMOOTHING,
+    STREAM_VERTEX_CODES,
+    STREAM_VERTEX_VALUES,
+    STREAM_NORMAL_CODES,
+    STREAM_NORMAL_VALUES,
+    STREAM_TEX_COORD_CODES,
+    STREAM_TEX_COORD_VALUES,
+
+    STREAM_COUNT
+};
+
+
+struct codec_header
+{
+    uint64_t vertex_count, normal_count, tex_coord_count;
+    uint64_t face_count, corner_count;
+    uint32_t mtl_file_count, material_count, group_count;
+    uint32_t position_bits, normal_bits, tex_coord_bits;
+    // Dequantization: value = min + q * scale
+    float position_min[3], position_scale[3];
+    float tex_coord_min[2], tex_coord_scale[2];
+    uint64_t stream_size[STREAM_COUNT];
+};
+
+
+static inline uint64_t zigzag(int64_t v)
+{
+    return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t v)
+{
+    return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+
+// Helper for building one stream in memory
+class codec_writer
+{
+    public:
+        std::vector<char> buf;
+
+        void put_varint(uint64_t v)
+        {
+            while (v >= 0x80)
+            {
+                buf.push_back(static_cast<char>(v | 0x80));
+                v >>= 7;
+            }
+            buf.push_back(static_cast<char>(v));
+        }
+
+        void put_signed(int64_t v)
+        { put_varint(zigzag(v)); }
+
+        void put_float(float v)
+        {
+            uint32_t bits;
+            memcpy(&bits, &v, sizeof(bits));
+            for (int i = 0; i < 4; i++)
+                buf.push_back(static_cast<char>(bits >> (8 * i)));
+        }
+
+        void put_string(const std::string &str)
+        { put_varint(str.length()); buf.insert(buf.end(), str.begin(), str.end()); }
+};
+
+// Helper for reading one stream with bounds checks
+class codec_reader
+{
+    private:
+        const uint8_t *p, *e;
+
+    public:
+        codec_reader(const char *start, size_t len):
+            p(reinterpret_cast<const uint8_t *>(start)), e(p + len) {}
+
+        bool at_end(void) const
+        { return p == e; }
+
+        size_t remaining(void) const
+        { return e - p; }
+
+        const char *take(size_t len)
+        {
+            if ((size_t)(e - p) < len)
+                throw 42;
+            const char *ret = reinterpret_cast<const char *>(p);
+            p += len;
+            return ret;
+        }
+
+        uint64_t get_varint(void)
+        {
+            // Most values fit into one or two bytes
+            if (e - p >= 2)
+            {
+                if (!(p[0] & 0x80))
+                    return *p++;
+                if (!(p[1] & 0x80))
+                {
+                    uint64_t v = (p[0] & 0x7f) | (static_cast<uint64_t>(p[1]) << 7);
+                    p += 2;
+                    return v;
+                }
+            }
+
+            uint64_t v = 0;
+            for (int shift = 0; shift < 64; shift += 7)
+            {
+                if (p == e)
+                    throw 42;
+                uint8_t b = *p++;
+                v |= static_cast<uint64_t>(b & 0x7f) << shift;
+                if (!(b & 0x80))
+                    return v;
+            }
+            throw 42;
+        }
+
+        int64_t get_signed(void)
+        { return unzigzag(get_varint()); }
+
+        float get_float(void)
+        { return dake::load_value<float>(take(4), false); }
+
+        void get_string(std::string &str)
+        { size_t len = get_varint(); str.assign(take(len), len); }
+};
+
+
+// State of the prediction of one index stream, kept alike by the encoder
+// and the decoder
+struct index_predictor
+{
+    // The last indices stored by CODE_NEXT or CODE_ESCAPE
+    int recent[RING_SIZE];
+    unsigned head;
+    int64_t max_index;
+    int last;
+    // Index last used with every vertex index (for CODE_SAME); empty for
+    // the vertex index stream itself
+    std::vector<int> same;
+
+    index_predictor(size_t vertex_count, bool use_same):
+        head(0), max_index(0), last(0)
+    {
+        memset(recent, 0, sizeof(recent));
+        if (use_same)
+            same.assign(vertex_count + 1, INT_MIN);
+    }
+
+    // Only indices never stored before (CODE_NEXT) or not predicted at all
+    // (CODE_ESCAPE) go into "recent"; any other value has been stored
+    // before, so it is not above "max_index" either
+    void update(int value, int vertex, unsigned code)
+    {
+        if (code <= CODE_ESCAPE)
+        {
+            recent[head++ & (RING_SIZE - 1)] = value;
+            if (value > max_index)
+                max_index = value;
+        }
+        last = value;
+        if ((unsigned)vertex < same.size())
+            same[vertex] = value;
+    }
+};
+
+
+// Encode one index of every corner; "field" points to the index within a
+// face_corner. The vertex index stream is encoded without CODE_SAME.
+static void encode_indices(const std::vector<face_corner> &corners, int face_corner::*field, size_t vertex_count,
+                           codec_writer &codes, codec_writer &values)
+{
+    bool use_same = field != &face_corner::index_vertex;
+
+    // Nothing at all is stored if no corner has a normal resp. texture
+    // coordinate index
+    bool any = !use_same;
+    for (std::vector<face_corner>::const_iterator ci = corners.begin(); !any && (ci != corners.end()); ci++)
+        any = (*ci).*field != -1;
+    if (!any)
+        return;
+
+    index_predictor pred(vertex_count, use_same);
+
+    codes.buf.assign((corners.size() + 1) / 2, 0);
+
+    for (size_t i = 0; i < corners.size(); i++)
+    {
+        int value = corners[i].*field;
+        int vertex = use_same ? corners[i].index_vertex : -1;
+        unsigned code = CODE_ESCAPE;
+
+        if ((unsigned)vertex < pred.same.size() && (pred.same[vertex] == value))
+            code = CODE_SAME;
+        else if (value == pred.max_index + 1)
+            code = CODE_NEXT;
+        else
+        {
+            for (unsigned j = 0; j < RECENT_COUNT; j++)
+            {
+                if (pred.recent[(pred.head - 1 - j) & (RING_SIZE - 1)] == value)
+                {
+                    code = CODE_RECENT + j;
+                    break;
+                }
+            }
+        }
+
+        if (code == CODE_ESCAPE)
+            values.put_signed((int64_t)value - pred.last);
+
+        codes.buf[i / 2] |= code << (4 * (i % 2));
+        pred.update(value, vertex, code);
+    }
+}
+
+
+// Decode what encode_indices has encoded into "corners" (which must have
+// the vertex indices already for the other streams). This does what
+// index_predictor::update does, but only as much of it as each code needs.
+template<bool use_same> static void decode_indices(std::vector<face_corner> &corners, size_t first,
+                                                   int face_corner::*field, size_t vertex_count,
+                                                   codec_reader codes, codec_reader values)
+{
+    size_t count = corners.size() - first;
+    face_corner *fc = corners.data() + first;
+
+    if (use_same && codes.at_end())
+    {
+        for (size_t i = 0; i < count; i++)
+            fc[i].*field = -1;
+        return;
+    }
+
+    const uint8_t *code_bytes = reinterpret_cast<const uint8_t *>(codes.take((count + 1) / 2));
+    if (!codes.at_end())
+        throw 42;
+
+    index_predictor pred(vertex_count, use_same);
+    int *recent = pred.recent, *same = pred.same.data();
+    unsigned head = 0;
+    int64_t max_index = 0;
+    int last = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        unsigned code = (code_bytes[i / 2] >> (4 * (i % 2))) & 0xf;
+        unsigned vertex = use_same ? fc[i].index_vertex : 0;
+        int value;
+
+        if (code >= CODE_RECENT)
+            value = recent[(head - 1 - (code - CODE_RECENT)) & (RING_SIZE - 1)];
+        else if (code == CODE_SAME)
+        {
+            if (!use_same || (vertex > vertex_count))
+                throw 42;
+            // Nothing to update but "last"
+            last = fc[i].*field = same[vertex];
+            continue;
+        }
+        else
+        {
+            int64_t v = (code == CODE_NEXT) ? max_index + 1 : last + values.get_signed();
+            if ((v < INT_MIN) || (v > INT_MAX))
+                throw 42;
+
+            value = v;
+            recent[head++ & (RING_SIZE - 1)] = value;
+            if (value > max_index)
+                max_index = value;
+        }
+
+        fc[i].*field = last = value;
+        if (use_same && (vertex <= vertex_count))
+            same[vertex] = value;
+    }
+
+    if (!values.at_end())
+        throw 42;
+}
+
+
+// Quantize "count" vectors of N floats within their bounding box with
+// "bits" bits per component and store every one as the difference to the
+// one before. Non-finite components are clamped into the box.
+template<int N> static void encode_quantized(const float *data, size_t count, unsigned bits, float *min, float *scale,
+                                             codec_writer &out)
+{
+    double levels = (1u << bits) - 1;
+    double inv[N];
+
+    for (int c = 0; c < N; c++)
+    {
+        float lo = HUGE_VALF, hi = -HUGE_VALF;
+        for (size_t i = 0; i < count; i++)
+        {
+            float v = data[i * N + c];
+            if (std::isfinite(v))
+            {
+                lo = std::min(lo, v);
+                hi = std::max(hi, v);
+            }
+        }
+        if (lo > hi)
+            lo = hi = 0.f;
+
+        min[c] = lo;
+        scale[c] = (hi - lo) / levels;
+        inv[c] = (hi > lo) ? levels / ((double)hi - lo) : 0.;
+    }
+
+    int32_t prev[N] = { 0 };
+    for (size_t i = 0; i < count; i++)
+    {
+        for (int c = 0; c < N; c++)
+        {
+            double f = (data[i * N + c] - (double)min[c]) * inv[c] + .5;
+            int32_t q = (f >= 0.) ? ((f <= levels) ? (int32_t)f : (int32_t)levels) : 0;
+
+            out.put_signed(q - prev[c]);
+            prev[c] = q;
+        }
+    }
+}
+
+
+template<int N> static void decode_quantized(float *data, size_t count, const float *min, const float *scale,
+                                             codec_reader in)
+{
+    int32_t q[N] = { 0 };
+    for (size_t i = 0; i < count; i++)
+    {
+        for (int c = 0; c < N; c++)
+        {
+            q[c] += in.get_signed();
+            data[i * N + c] = min[c] + q[c] * scale[c];
+        }
+    }
+
+    if (!in.at_end())
+        throw 42;
+}
+
+
+// Normals are stored in octahedral coordinates (see dake::to_oct) with
+// "bits" bits per coordinate, again as differences to the normal before
+static void encode_normals(const std::vector<dake::vec3> &normals, unsigned bits, codec_writer &out)
+{
+    float max_q = (1 << (bits - 1)) - 1;
+    int32_t prev[2] = { 0, 0 };
+
+    for (std::vector<dake::vec3>::const_iterator ni = normals.begin(); ni != normals.end(); ni++)
+    {
+        float coord[2];
+        dake::to_oct(*ni, coord[0], coord[1]);
+
+        for (int c = 0; c < 2; c++)
+        {
+            int32_t q = lrintf(coord[c] * max_q);
+            out.put_signed(q - prev[c]);
+            prev[c] = q;
+        }
+    }
+}
+
+
+static void decode_normals(dake::vec3 *normals, size_t count, unsigned bits, codec_reader in)
+{
+    int32_t max_q = (1 << (bits - 1)) - 1;
+    float scale = 1.f / max_q;
+    int32_t q[2] = { 0, 0 };
+
+    for (size_t i = 0; i < count; i++)
+    {
+        for (int c = 0; c < 2; c++)
+        {
+            q[c] += in.get_signed();
+            if ((q[c] < -max_q) || (q[c] > max_q))
+                throw 42;
+        }
+        normals[i] = dake::from_oct(q[0] * scale, q[1] * scale);
+    }
+
+    if (!in.at_end())
+        throw 42;
+}
+
+
+// Run-length encoding of per-face values
+static void encode_runs(const std::vector<unsigned> &values, codec_writer &out)
+{
+    for (size_t i = 0; i < values.size();)
+    {
+        size_t j = i + 1;
+        while ((j < values.size()) && (values[j] == values[i]))
+            j++;
+
+        out.put_varint(values[i]);
+        out.put_varint(j - i);
+        i = j;
+    }
+}
+
+
+// Decode "count" values, passing each to "store" with its index
+template<typename F> static void decode_runs(size_t count, codec_reader in, F store)
+{
+    size_t i = 0;
+    while (i < count)
+    {
+        uint64_t value = in.get_varint();
+        uint64_t run = in.get_varint();
+        if (!run || (run > count - i) || (value > UINT_MAX))
+            throw 42;
+
+        for (uint64_t j = 0; j < run; j++)
+            store(i++, (unsigned)value);
+    }
+
+    if (!in.at_end())
+        throw 42;
+}
+
+
+// Name of "path" relative to the directory "dir" if it is in there (or
+// below), its absolute name otherwise
+static std::string relative_name(const std::string &path, const std::string &dir)
+{
+    std::string abs_path, abs_dir;
+    if (!dake::canonical_path(path, abs_path) || !dake::canonical_path(dir, abs_dir))
+        return path;
+
+    if (abs_path == abs_dir)
+        return ".";
+    if (!abs_path.compare(0, abs_dir.length() + 1, abs_dir + "/"))
+        return abs_path.substr(abs_dir.length() + 1);
+    return abs_path;
+}
+
+
+// Reverse relative_name
+static std::string resolve_name(const std::string &name, const std::string &dir)
+{
+    if (name == ".")
+        return dir;
+    return (name[0] == '/') ? name : dir + "/" + name;
+}
+
+
+static void put_header(codec_writer &wr, const codec_header &hdr)
+{
+    wr.buf.insert(wr.buf.end(), CODEC_MAGIC, CODEC_MAGIC + 4);
+    wr.put_varint(CODEC_VERSION);
+
+    wr.put_varint(hdr.vertex_count);
+    wr.put_varint(hdr.normal_count);
+    wr.put_varint(hdr.tex_coord_count);
+    wr.put_varint(hdr.face_count);
+    wr.put_varint(hdr.corner_count);
+    wr.put_varint(hdr.mtl_file_count);
+    wr.put_varint(hdr.material_count);
+    wr.put_varint(hdr.group_count);
+    wr.put_varint(hdr.position_bits);
+    wr.put_varint(hdr.normal_bits);
+    wr.put_varint(hdr.tex_coord_bits);
+
+    for (int i = 0; i < 3; i++)
+    {
+        wr.put_float(hdr.position_min[i]);
+        wr.put_float(hdr.position_scale[i]);
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        wr.put_float(hdr.tex_coord_min[i]);
+        wr.put_float(hdr.tex_coord_scale[i]);
+    }
+
+    for (int i = 0; i < STREAM_COUNT; i++)
+        wr.put_varint(hdr.stream_size[i]);
+}
+
+
+// Returns false if this is no compressed mesh of a version we know
+static bool get_header(codec_reader &rd, codec_header &hdr)
+{
+    if (memcmp(rd.take(4), CODEC_MAGIC, 4) || (rd.get_varint() != CODEC_VERSION))
+        return false;
+
+    hdr.vertex_count = rd.get_varint();
+    hdr.normal_count = rd.get_varint();
+    hdr.tex_coord_count = rd.get_varint();
+    hdr.face_count = rd.get_varint();
+    hdr.corner_count = rd.get_varint();
+    hdr.mtl_file_count = rd.get_varint();
+    hdr.material_count = rd.get_varint();
+    hdr.group_count = rd.get_varint();
+    hdr.position_bits = rd.get_varint();
+    hdr.normal_bits = rd.get_varint();
+    hdr.tex_coord_bits = rd.get_varint();
+
+    for (int i = 0; i < 3; i++)
+    {
+        hdr.position_min[i] = rd.get_float();
+        hdr.position_scale[i] = rd.get_float();
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        hdr.tex_coord_min[i] = rd.get_float();
+        hdr.tex_coord_scale[i] = rd.get_float();
+    }
+
+    for (int i = 0; i < STREAM_COUNT; i++)
+        hdr.stream_size[i] = rd.get_varint();
+
+    // Every vertex, normal and texture coordinate takes at least one byte
+    // in its stream and every corner half a byte in the vertex index one,
+    // and every name following the header (the texture directory, the
+    // material libraries and materials, and object and group of every
+    // group) at least its length byte, which bounds the counts by the file
+    // size before anything is allocated for them
+    uint64_t name_count = 1 + (uint64_t)hdr.mtl_file_count + hdr.material_count + 2 * (uint64_t)hdr.group_count;
+    if ((hdr.position_bits < 1) || (hdr.position_bits > 24) || (hdr.tex_coord_bits < 1) ||
+        (hdr.tex_coord_bits > 24) || (hdr.normal_bits < 2) || (hdr.normal_bits > 16) ||
+        (hdr.vertex_count > hdr.stream_size[STREAM_POSITIONS]) ||
+        (hdr.normal_count > hdr.stream_size[STREAM_NORMALS]) ||
+        (hdr.tex_coord_count > hdr.stream_size[STREAM_TEX_COORDS]) ||
+        (hdr.face_count > UINT_MAX) || (hdr.corner_count > UINT_MAX) ||
+        ((hdr.corner_count + 1) / 2 != hdr.stream_size[STREAM_VERTEX_CODES]) ||
+        (hdr.face_count > hdr.corner_count) || !hdr.group_count || (name_count > rd.remaining()))
+    {
+        throw 42;
+    }
+
+    return true;
+}
+
+
+
+
+bool obj_reader::save_compressed(const std::string &filename, const codec_options &opts)
+{
+    complete_lists();
+
+    codec_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.vertex_count = vertices.size();
+    hdr.normal_count = normals.size();
+    hdr.tex_coord_count = tex_coords.size();
+    hdr.face_count = faces.size();
+    hdr.corner_count = faces.corners.size();
+    hdr.mtl_file_count = mtl_files.size();
+    hdr.material_count = materials.size();
+    hdr.group_count = groups.size();
+    hdr.position_bits = std::max(1u, std::min(opts.position_bits, 24u));
+    hdr.normal_bits = std::max(2u, std::min(opts.normal_bits, 16u));
+    hdr.tex_coord_bits = std::max(1u, std::min(opts.tex_coord_bits, 24u));
+
+    std::vector<codec_writer> streams(STREAM_COUNT);
+
+    encode_quantized<3>(reinterpret_cast<const float *>(vertices.data()), vertices.size(), hdr.position_bits,
+                        hdr.position_min, hdr.position_scale, streams[STREAM_POSITIONS]);
+    encode_normals(normals, hdr.normal_bits, streams[STREAM_NORMALS]);
+    encode_quantized<2>(reinterpret_cast<const float *>(tex_coords.data()), tex_coords.size(), hdr.tex_coord_bits,
+                        hdr.tex_coord_min, hdr.tex_coord_scale, streams[STREAM_TEX_COORDS]);
+
+    std::vector<unsigned> sizes(faces.size()), mats(faces.size());
+
+    // Index of every material in the list plus one; all others are the
+    // default one (0)
+    std::unordered_map<const material *, unsigned> mat_indices;
+    for (size_t i = 0; i < materials.size(); i++)
+        mat_indices.insert(std::make_pair(materials[i], (unsigned)i + 1));
+
+    for (size_t i = 0; i < faces.size(); i++)
+    {
+        sizes[i] = faces.offsets[i + 1] - faces.offsets[i];
+
+        std::unordered_map<const material *, unsigned>::const_iterator mi = mat_indices.find(faces.mats[i]);
+        mats[i] = (mi != mat_indices.end()) ? mi->second : 0;
+    }
+
+    encode_runs(sizes, streams[STREAM_FACE_SIZES]);
+    encode_runs(mats, streams[STREAM_FACE_MATS]);
+    encode_runs(faces.groups, streams[STREAM_FACE_GROUPS]);
+    encode_runs(faces.smoothing, streams[STREAM_FACE_SMOOTHING]);
+
+    encode_indices(faces.corners, &face_corner::index_vertex, vertices.size(),
+                   streams[STREAM_VERTEX_CODES], streams[STREAM_VERTEX_VALUES]);
+    encode_indices(faces.corners, &face_corner::index_normal, vertices.size(),
+                   streams[STREAM_NORMAL_CODES], streams[STREAM_NORMAL_VALUES]);
+    encode_indices(faces.corners, &face_corner::index_texcoord, vertices.size(),
+                   streams[STREAM_TEX_COORD_CODES], streams[STREAM_TEX_COORD_VALUES]);
+
+    for (int i = 0; i < STREAM_COUNT; i++)
+        hdr.stream_size[i] = streams[i].buf.size();
+
+    codec_writer head;
+    put_header(head, hdr);
+
+    // Libraries next to the file (or below) are stored relative to it, so
+    // both can be moved together; so is the directory texture names are
+    // relative to (the OBJ file's, see mtl_library_manager::find_library)
+    std::string dir = dake::directory_of(filename);
+    head.put_string(relative_name(obj_dirname, dir));
+    for (std::vector<std::string>::const_iterator li = mtl_files.begin(); li != mtl_files.end(); li++)
+        head.put_string(relative_name(*li, dir));
+
+    for (std::vector<const material *>::const_iterator mi = materials.begin(); mi != materials.end(); mi++)
+        head.put_string((*mi)->name);
+
+    for (std::vector<obj_group>::const_iterator gi = groups.begin(); gi != groups.end(); gi++)
+    {
+        head.put_string(gi->object);
+        head.put_string(gi->group);
+    }
+
+    // Written to a temporary file first, so nobody loads a partial file
+    // (see mesh_loader::hot_reload)
+    dake::atomic_file file(filename);
+    FILE *fp = file.stream();
+    bool ok = fp && (fwrite(&head.buf[0], 1, head.buf.size(), fp) == head.buf.size());
+    for (int i = 0; ok && (i < STREAM_COUNT); i++)
+        ok = streams[i].buf.empty() || (fwrite(&streams[i].buf[0], 1, streams[i].buf.size(), fp) == streams[i].buf.size());
+
+    if (!ok || !file.commit())
+    {
+        fprintf(stderr, "Could not write compressed mesh %s\n", filename.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+
+
+
+bool obj_reader::load_compressed(const std::string &filename, bool positions_only)
+{
+    dake::mapped_file file(filename);
+    if (!file.is_open())
+        return false;
+
+    size_t first_vertex = vertices.size(), first_normal = normals.size(), first_tex_coord = tex_coords.size();
+    size_t first_face = faces.size(), first_corner = faces.corners.size();
+    std::vector<obj_group> old_groups(groups);
+
+    try
+    {
+        codec_reader rd(file.begin(), file.size());
+
+        codec_header hdr;
+        if (!get_header(rd, hdr))
+        {
+            fprintf(stderr, "%s: Not a compressed mesh of a known version\n", filename.c_str());
+            return false;
+        }
+
+        std::string texture_dir;
+        std::vector<std::string> libs(hdr.mtl_file_count), mat_names(hdr.material_count);
+        std::vector<obj_group> file_groups(hdr.group_count);
+
+        rd.get_string(texture_dir);
+        for (uint32_t i = 0; i < hdr.mtl_file_count; i++)
+            rd.get_string(libs[i]);
+        for (uint32_t i = 0; i < hdr.material_count; i++)
+            rd.get_string(mat_names[i]);
+        for (uint32_t i = 0; i < hdr.group_count; i++)
+        {
+            rd.get_string(file_groups[i].object);
+            rd.get_string(file_groups[i].group);
+        }
+
+        std::vector<codec_reader> streams;
+        for (int i = 0; i < STREAM_COUNT; i++)
+            streams.push_back(codec_reader(rd.take(hdr.stream_size[i]), hdr.stream_size[i]));
+
+        vertices.resize(first_vertex + hdr.vertex_count);
+        if (positions_only)
+        {
+            decode_quantized<3>(reinterpret_cast<float *>(vertices.data() + first_vertex), hdr.vertex_count,
+                                hdr.position_min, hdr.position_scale, streams[STREAM_POSITIONS]);
+            return true;
+        }
+
+        // Materials are taken from the libraries, by name; the i-th
+        // material of the file usually is the i-th of the libraries
+        std::string dir = dake::directory_of(filename);
+        obj_dirname = resolve_name(texture_dir, dir);
+
+        std::vector<std::string> lib_paths;
+        for (std::vector<std::string>::const_iterator li = libs.begin(); li != libs.end(); li++)
+            lib_paths.push_back(resolve_name(*li, dir));
+        if (!lib_paths.empty())
+            mtl_library_manager::instance().prefetch(lib_paths, obj_dirname);
+
+        size_t first_material = materials.size();
+        for (std::vector<std::string>::const_iterator li = lib_paths.begin(); li != lib_paths.end(); li++)
+        {
+            if (!add_mtl_library(*li))
+            {
+                fprintf(stderr, "Could not open material lib %s\n", li->c_str());
+                throw 42;
+            }
+        }
+
+        std::vector<const material *> mat_table(1 + hdr.material_count, current_mat);
+        for (uint32_t i = 0; i < hdr.material_count; i++)
+        {
+            if ((first_material + i < materials.size()) && (materials[first_material + i]->name == mat_names[i]))
+                mat_table[i + 1] = materials[first_material + i];
+            else
+            {
+                std::unordered_map<std::string, const material *>::const_iterator mi = material_names.find(mat_names[i]);
+                if (mi == material_names.end())
+                {
+                    fprintf(stderr, "Could not find material %s\n", mat_names[i].c_str());
+                    throw 42;
+                }
+                mat_table[i + 1] = mi->second;
+            }
+        }
+
+        // A fresh reader's only group is replaced by those from the file
+        size_t first_group = groups.size();
+        if (!first_face && (first_group == 1) && groups[0].object.empty() && groups[0].group.empty())
+            first_group = 0;
+        groups.resize(first_group);
+        groups.insert(groups.end(), file_groups.begin(), file_groups.end());
+
+        normals.resize(first_normal + hdr.normal_count);
+        tex_coords.resize(first_tex_coord + hdr.tex_coord_count);
+        faces.offsets.resize(first_face + hdr.face_count + 1);
+        faces.mats.resize(first_face + hdr.face_count);
+        faces.groups.resize(first_face + hdr.face_count);
+        faces.smoothing.resize(first_face + hdr.face_count);
+        faces.corners.resize(first_corner + hdr.corner_count);
+
+        // The streams are independent of each other, except for the normal
+        // and texture coordinate indices, which need the vertex indices
+        // (so tasks 5 and 6 have to wait for task 4)
+        auto decode_stream = [&](size_t task) {
+            switch (task)
+            {
+                case 0:
+                    decode_quantized<3>(reinterpret_cast<float *>(vertices.data() + first_vertex), hdr.vertex_count,
+                                        hdr.position_min, hdr.position_scale, streams[STREAM_POSITIONS]);
+                    break;
+
+                case 1:
+                    decode_normals(normals.data() + first_normal, hdr.normal_count, hdr.normal_bits,
+                                   streams[STREAM_NORMALS]);
+                    break;
+
+                case 2:
+                    decode_quantized<2>(reinterpret_cast<float *>(tex_coords.data() + first_tex_coord),
+                                        hdr.tex_coord_count, hdr.tex_coord_min, hdr.tex_coord_scale,
+                                        streams[STREAM_TEX_COORDS]);
+                    break;
+
+                case 3:
+                {
+                    unsigned *offsets = faces.offsets.data() + first_face;
+                    uint64_t total = 0;
+                    decode_runs(hdr.face_count, streams[STREAM_FACE_SIZES], [&](size_t i, unsigned size) {
+                        total += size;
+                        if (total > hdr.corner_count)
+                            throw 42;
+                        offsets[i + 1] = offsets[0] + total;
+                    });
+                    if (total != hdr.corner_count)
+                        throw 42;
+
+                    decode_runs(hdr.face_count, streams[STREAM_FACE_MATS], [&](size_t i, unsigned mat) {
+                        if (mat > hdr.material_count)
+                            throw 42;
+                        faces.mats[first_face + i] = mat_table[mat];
+                    });
+                    decode_runs(hdr.face_count, streams[STREAM_FACE_GROUPS], [&](size_t i, unsigned group) {
+                        if (group >= hdr.group_count)
+                            throw 42;
+                        faces.groups[first_face + i] = first_group + group;
+                    });
+                    decode_runs(hdr.face_count, streams[STREAM_FACE_SMOOTHING], [&](size_t i, unsigned smoothing) {
+                        faces.smoothing[first_face + i] = smoothing;
+                    });
+                    break;
+                }
+
+                case 4:
+                    decode_indices<false>(faces.corners, first_corner, &face_corner::index_vertex, hdr.vertex_count,
+                                          streams[STREAM_VERTEX_CODES], streams[STREAM_VERTEX_VALUES]);
+                    break;
+
+                case 5:
+                    decode_indices<true>(faces.corners, first_corner, &face_corner::index_normal, hdr.vertex_count,
+                                         streams[STREAM_NORMAL_CODES], streams[STREAM_NORMAL_VALUES]);
+                    break;
+
+                case 6:
+                    decode_indices<true>(faces.corners, first_corner, &face_corner::index_texcoord, hdr.vertex_count,
+                                         streams[STREAM_TEX_COORD_CODES], streams[STREAM_TEX_COORD_VALUES]);
+                    break;
+            }
+        };
+
+        // Starting threads does not pay off for small meshes
+        if (hdr.corner_count < PARALLEL_MIN_CORNERS)
+        {
+            for (size_t task = 0; task < 7; task++)
+                decode_stream(task);
+        }
+        else
+        {
+            dake::parallel_for(5, decode_stream);
+            dake::parallel_for(2, [&](size_t task) { decode_stream(5 + task); });
+        }
+
+        // Indices are relative to the file, so they have to be moved
+        // behind anything loaded before
+        if (first_vertex || first_normal || first_tex_coord)
+        {
+            for (size_t i = first_corner; i < faces.corners.size(); i++)
+            {
+                face_corner &fc = faces.corners[i];
+                if (fc.index_vertex > 0)
+                    fc.index_vertex += first_vertex;
+                if (fc.index_normal > 0)
+                    fc.index_normal += first_normal;
+                if (fc.index_texcoord > 0)
+                    fc.index_texcoord += first_tex_coord;
+            }
+        }
+    }
+    catch (int)
+    {
+        fprintf(stderr, "%s: Corrupt compressed mesh\n", filename.c_str());
+
+        vertices.resize(first_vertex);
+        normals.resize(first_normal);
+        tex_coords.resize(first_tex_coord);
+        faces.offsets.resize(first_face + 1);
+        faces.mats.resize(first_face);
+        faces.groups.resize(first_face);
+        faces.smoothing.resize(first_face);
+        faces.corners.resize(first_corner);
+        groups = old_groups;
+        return false;
+    }
+
+    return true;
+}
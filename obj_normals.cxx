@@ -0,0 +1,302 @@
+// Normal generation for obj_reader: Gives every face corner without a normal
+// one, as the angle weighted average of the normals of the faces around its
+// position (Thürmer and Wüthrich, so the result does not depend on how the
+// surface is tessellated).
+//
+// Only faces in the same smoothing group are averaged; faces with smoothing
+// turned off ("s off" or "s 0") stay flat. If no face is in any smoothing
+// group (as in files without s statements), all of them are treated as if
+// they were in the same one. With a crease angle, faces whose normals differ
+// by more than that are not averaged either.
+//
+// Every corner is assigned a slot for its (position, smoothing group) pair.
+// Without a crease angle, the slots' sums are accumulated in parallel over
+// the faces, every thread into a partial sum of its own, which are added up
+// afterwards, so no two threads ever write to the same place. With a crease
+// angle, every corner gathers the faces of its slot on its own.
+
+#include "obj_reader.h"
+
+#include "dake/parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <stdint.h>
+
+
+// Fewest faces worth giving a thread of their own
+#define MIN_FACES_PER_BLOCK 4096
+
+
+// Call func(b, first, last) for "blocks" ranges b of about the same size
+// which together cover [0, count), on all workers
+template<typename F> static void parallel_blocks(size_t count, size_t blocks, F func)
+{
+    dake::parallel_for(blocks, [&](size_t b) {
+        func(b, count * b / blocks, count * (b + 1) / blocks);
+    });
+}
+
+
+static inline uint64_t hash_key(uint64_t key)
+{
+    uint64_t h = key * UINT64_C(0x9e3779b97f4a7c15);
+    return h ^ (h >> 29);
+}
+
+
+static inline bool same_normal(const dake::vec3 &a, const dake::vec3 &b)
+{
+    return (a[0] == b[0]) && (a[1] == b[1]) && (a[2] == b[2]);
+}
+
+
+size_t obj_reader::generate_normals(float crease_angle)
+{
+    complete_lists();
+
+    size_t face_count = faces.size(), corner_count = faces.corners.size();
+    size_t normal_count = normals.size(), vertex_count = vertices.size();
+
+    size_t missing = 0;
+    for (std::vector<face_corner>::const_iterator ci = faces.corners.begin(); ci != faces.corners.end(); ci++)
+        if ((ci->index_normal <= 0) || ((size_t)ci->index_normal > normal_count))
+            missing++;
+    if (!missing)
+        return 0;
+
+    bool any_smoothing = false;
+    for (std::vector<unsigned>::const_iterator si = faces.smoothing.begin(); si != faces.smoothing.end() && !any_smoothing; si++)
+        any_smoothing = *si;
+
+    size_t blocks = std::max((size_t)1, std::min((size_t)dake::worker_count(), face_count / MIN_FACES_PER_BLOCK));
+
+
+    // Unit normal (by Newell's method) of every face and the angle at every
+    // corner
+    std::vector<dake::vec3> face_normals(face_count);
+    std::vector<float> weights(corner_count, 0.f);
+
+    parallel_blocks(face_count, blocks, [&](size_t, size_t first, size_t last) {
+        for (size_t f = first; f < last; f++)
+        {
+            size_t start = faces.offsets[f], count = faces.offsets[f + 1] - start;
+            const face_corner *c = &faces.corners[start];
+
+            std::vector<dake::vec3> pos(count);
+            for (size_t i = 0; i < count; i++)
+                if ((c[i].index_vertex > 0) && ((size_t)c[i].index_vertex <= vertex_count))
+                    pos[i] = vertices[c[i].index_vertex - 1];
+
+            dake::vec3 n(0.f, 0.f, 0.f);
+            for (size_t i = 0; i < count; i++)
+            {
+                const dake::vec3 &a = pos[i], &b = pos[(i + 1) % count];
+                n.x() += (a.y() - b.y()) * (a.z() + b.z());
+                n.y() += (a.z() - b.z()) * (a.x() + b.x());
+                n.z() += (a.x() - b.x()) * (a.y() + b.y());
+            }
+
+            float len = n.length();
+            face_normals[f] = (len > 0.f) ? n / len : n;
+
+            for (size_t i = 0; (i < count) && (count >= 3); i++)
+            {
+                dake::vec3 e1 = pos[(i + 1) % count] - pos[i], e2 = pos[(i + count - 1) % count] - pos[i];
+                float l1 = e1.length(), l2 = e2.length();
+                if ((l1 > 0.f) && (l2 > 0.f))
+                    weights[start + i] = acosf(std::max(-1.f, std::min(1.f, e1.dot(e2) / (l1 * l2))));
+            }
+        }
+    });
+
+
+    // Slot of every corner of a smooth face; flat faces' corners and those
+    // without a valid position get none. Open addressing with linear
+    // probing over (position, smoothing group) keys.
+    std::vector<uint32_t> slot_of(corner_count, UINT32_MAX);
+    size_t slot_count = 0;
+    {
+        size_t capacity = 16;
+        while (capacity < corner_count * 2)
+            capacity *= 2;
+        std::vector<uint64_t> keys(capacity);
+        std::vector<uint32_t> slots(capacity, UINT32_MAX);
+        size_t mask = capacity - 1;
+
+        for (size_t f = 0; f < face_count; f++)
+        {
+            unsigned group = any_smoothing ? faces.smoothing[f] : 1;
+            if (!group)
+                continue;
+
+            for (size_t c = faces.offsets[f]; c < faces.offsets[f + 1]; c++)
+            {
+                int vi = faces.corners[c].index_vertex;
+                if ((vi <= 0) || ((size_t)vi > vertex_count))
+                    continue;
+
+                uint64_t key = ((uint64_t)vi << 32) | group;
+                size_t s = hash_key(key) & mask;
+                while ((slots[s] != UINT32_MAX) && (keys[s] != key))
+                    s = (s + 1) & mask;
+
+                if (slots[s] == UINT32_MAX)
+                {
+                    keys[s] = key;
+                    slots[s] = slot_count++;
+                }
+                slot_of[c] = slots[s];
+            }
+        }
+    }
+
+
+    // Sum of the weighted face normals of every corner needing a normal,
+    // not normalized yet
+    std::vector<dake::vec3> corner_sums(corner_count);
+
+    if (crease_angle >= 180.f)
+    {
+        // Every block of faces is summed up into a list of its own, which
+        // are then added up slot by slot
+        std::vector<std::vector<dake::vec3> > partial(blocks);
+
+        parallel_blocks(face_count, blocks, [&](size_t b, size_t first, size_t last) {
+            std::vector<dake::vec3> &sum = partial[b];
+            sum.assign(slot_count, dake::vec3(0.f, 0.f, 0.f));
+
+            for (size_t f = first; f < last; f++)
+                for (size_t c = faces.offsets[f]; c < faces.offsets[f + 1]; c++)
+                    if (slot_of[c] != UINT32_MAX)
+                        sum[slot_of[c]] += face_normals[f] * weights[c];
+        });
+
+        parallel_blocks(slot_count, blocks, [&](size_t, size_t first, size_t last) {
+            for (size_t b = 1; b < blocks; b++)
+                for (size_t i = first; i < last; i++)
+                    partial[0][i] += partial[b][i];
+        });
+
+        for (size_t c = 0; c < corner_count; c++)
+            if (slot_of[c] != UINT32_MAX)
+                corner_sums[c] = partial[0][slot_of[c]];
+    }
+    else
+    {
+        float min_dot = cosf(crease_angle * static_cast<float>(M_PI) / 180.f);
+
+        // The corners in every slot, as compressed sparse rows, and the
+        // face of every corner
+        std::vector<uint32_t> slot_offsets(slot_count + 1, 0), slot_corners, face_of(corner_count);
+        for (size_t f = 0; f < face_count; f++)
+            for (size_t c = faces.offsets[f]; c < faces.offsets[f + 1]; c++)
+                face_of[c] = f;
+
+        for (size_t c = 0; c < corner_count; c++)
+            if (slot_of[c] != UINT32_MAX)
+                slot_offsets[slot_of[c] + 1]++;
+        for (size_t i = 0; i < slot_count; i++)
+            slot_offsets[i + 1] += slot_offsets[i];
+
+        slot_corners.resize(slot_offsets[slot_count]);
+        {
+            std::vector<uint32_t> fill(slot_offsets.begin(), slot_offsets.end() - 1);
+            for (size_t c = 0; c < corner_count; c++)
+                if (slot_of[c] != UINT32_MAX)
+                    slot_corners[fill[slot_of[c]]++] = c;
+        }
+
+        // Every corner only reads the others, so they can all be done at
+        // once
+        parallel_blocks(corner_count, blocks, [&](size_t, size_t first, size_t last) {
+            for (size_t c = first; c < last; c++)
+            {
+                if (slot_of[c] == UINT32_MAX)
+                    continue;
+
+                const dake::vec3 &n = face_normals[face_of[c]];
+                dake::vec3 sum(0.f, 0.f, 0.f);
+
+                for (uint32_t i = slot_offsets[slot_of[c]]; i < slot_offsets[slot_of[c] + 1]; i++)
+                {
+                    uint32_t d = slot_corners[i];
+                    const dake::vec3 &m = face_normals[face_of[d]];
+                    if (m.dot(n) >= min_dot)
+                        sum += m * weights[d];
+                }
+
+                corner_sums[c] = sum;
+            }
+        });
+    }
+
+
+    // Append the new normals, sharing them between all corners of a slot
+    // resp. a flat face which got the very same one
+    size_t added = 0;
+
+    // The slots' normals are only known after going through all corners,
+    // so they are collected per slot first, with the one every corner
+    // chose, and then appended back to back starting at slot_first (one
+    // based)
+    std::vector<std::vector<dake::vec3> > per_slot(slot_count);
+    std::vector<uint32_t> choice(corner_count, 0);
+    std::vector<int> slot_first(slot_count, 0);
+
+    for (size_t f = 0; f < face_count; f++)
+    {
+        int flat_index = 0;
+
+        for (size_t c = faces.offsets[f]; c < faces.offsets[f + 1]; c++)
+        {
+            face_corner &fc = faces.corners[c];
+            if ((fc.index_normal > 0) && ((size_t)fc.index_normal <= normal_count))
+                continue;
+
+            float len = corner_sums[c].length();
+            if ((slot_of[c] == UINT32_MAX) || (len <= 0.f))
+            {
+                // Flat face (or nothing to average): the face's normal
+                if (!flat_index)
+                {
+                    normals.push_back(face_normals[f]);
+                    flat_index = normals.size();
+                    added++;
+                }
+                fc.index_normal = flat_index;
+                continue;
+            }
+
+            dake::vec3 n = corner_sums[c] / len;
+            std::vector<dake::vec3> &list = per_slot[slot_of[c]];
+
+            size_t i;
+            for (i = 0; i < list.size(); i++)
+                if (same_normal(list[i], n))
+                    break;
+            if (i == list.size())
+                list.push_back(n);
+
+            choice[c] = i;
+            // Resolved below, once the slot's normals have been appended
+            fc.index_normal = -1;
+        }
+    }
+
+    for (size_t i = 0; i < slot_count; i++)
+    {
+        slot_first[i] = normals.size() + 1;
+        normals.insert(normals.end(), per_slot[i].begin(), per_slot[i].end());
+        added += per_slot[i].size();
+    }
+
+    for (size_t c = 0; c < corner_count; c++)
+        if (faces.corners[c].index_normal == -1)
+            faces.corners[c].index_normal = slot_first[slot_of[c]] + choice[c];
+
+    invalidate_derived();
+
+    return added;
+}
@@ -0,0 +1,463 @@
+// Binary PLY import for obj_reader: Fills the very same lists as loading an
+// OBJ file. Positions, normals (nx, ny, nz) and texture coordinates (u, v or
+// s, t) are taken from the vertex element, so normals and texture
+// coordinates share the positions' indices. Faces are taken from the face
+// element's vertex_indices list; a per-corner texcoord list (as written by
+// MeshLab) replaces the vertices' texture coordinates. All other elements
+// and properties are skipped. ASCII PLY files are not supported.
+//
+// Where the file's layout allows it (32 bit floats in this machine's byte
+// order next to each other), attributes are copied from the mapped file with
+// memcpy, in one go if the vertex records contain nothing else.
+
+#include "obj_reader.h"
+
+#include "dake/byte_order.h"
+#include "dake/mapped_file.h"
+
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+
+enum ply_type
+{
+    PLY_NONE,
+    PLY_INT8,
+    PLY_UINT8,
+    PLY_INT16,
+    PLY_UINT16,
+    PLY_INT32,
+    PLY_UINT32,
+    PLY_FLOAT32,
+    PLY_FLOAT64
+};
+
+struct ply_property
+{
+    std::string name;
+    ply_type type;
+    // Type of the element count of a list property, PLY_NONE for scalar
+    // properties
+    ply_type count_type;
+};
+
+struct ply_element
+{
+    std::string name;
+    size_t count;
+    std::vector<ply_property> props;
+    // Offset of every property within a record (only valid if there are
+    // no lists) and the size of a record (0 if there are lists)
+    std::vector<size_t> offsets;
+    size_t stride;
+
+    int find(const char *prop) const
+    {
+        for (size_t i = 0; i < props.size(); i++)
+            if (props[i].name == prop)
+                return i;
+        return -1;
+    }
+};
+
+
+static size_t type_size(ply_type t)
+{
+    static const size_t sizes[] = { 0, 1, 1, 2, 2, 4, 4, 4, 8 };
+    return sizes[t];
+}
+
+
+static ply_type parse_type(const std::string &s)
+{
+    if ((s == "char") || (s == "int8"))
+        return PLY_INT8;
+    if ((s == "uchar") || (s == "uint8"))
+        return PLY_UINT8;
+    if ((s == "short") || (s == "int16"))
+        return PLY_INT16;
+    if ((s == "ushort") || (s == "uint16"))
+        return PLY_UINT16;
+    if ((s == "int") || (s == "int32"))
+        return PLY_INT32;
+    if ((s == "uint") || (s == "uint32"))
+        return PLY_UINT32;
+    if ((s == "float") || (s == "float32"))
+        return PLY_FLOAT32;
+    if ((s == "double") || (s == "float64"))
+        return PLY_FLOAT64;
+    return PLY_NONE;
+}
+
+
+// Value of type t at p
+static double get_value(const char *p, ply_type t, bool big)
+{
+    switch (t)
+    {
+        case PLY_INT8:    return dake::load_value<int8_t>(p, big);
+        case PLY_UINT8:   return dake::load_value<uint8_t>(p, big);
+        case PLY_INT16:   return dake::load_value<int16_t>(p, big);
+        case PLY_UINT16:  return dake::load_value<uint16_t>(p, big);
+        case PLY_INT32:   return dake::load_value<int32_t>(p, big);
+        case PLY_UINT32:  return dake::load_value<uint32_t>(p, big);
+        case PLY_FLOAT32: return dake::load_value<float>(p, big);
+        case PLY_FLOAT64: return dake::load_value<double>(p, big);
+        default:          return 0.;
+    }
+}
+
+
+// Parse the header at p; p is left at the first byte of the body
+static bool parse_header(const char *&p, const char *e, bool &big, std::vector<ply_element> &elements,
+                         const std::string &filename)
+{
+    bool format = false;
+
+    for (int line_no = 0; p < e; line_no++)
+    {
+        const char *eol = static_cast<const char *>(memchr(p, '\n', e - p));
+        if (!eol)
+            break;
+
+        std::stringstream line(std::string(p, (eol > p && eol[-1] == '\r') ? eol - 1 : eol));
+        p = eol + 1;
+
+        std::string keyword;
+        line >> keyword;
+
+        if (!line_no)
+        {
+            if (keyword != "ply")
+                break;
+        }
+        else if (keyword == "format")
+        {
+            std::string fmt;
+            line >> fmt;
+            if (fmt == "ascii")
+            {
+                fprintf(stderr, "%s: ASCII PLY files are not supported\n", filename.c_str());
+                return false;
+            }
+            else if ((fmt != "binary_little_endian") && (fmt != "binary_big_endian"))
+                break;
+
+            big = fmt == "binary_big_endian";
+            format = true;
+        }
+        else if (keyword == "element")
+        {
+            ply_element el;
+            line >> el.name >> el.count;
+            if (line.fail())
+                break;
+            elements.push_back(el);
+        }
+        else if (keyword == "property")
+        {
+            if (elements.empty())
+                break;
+
+            ply_property prop;
+            std::string type;
+            line >> type;
+            if (type == "list")
+            {
+                std::string count_type;
+                line >> count_type >> type;
+                prop.count_type = parse_type(count_type);
+                if (prop.count_type == PLY_NONE)
+                    break;
+            }
+            else
+                prop.count_type = PLY_NONE;
+
+            prop.type = parse_type(type);
+            line >> prop.name;
+            if ((prop.type == PLY_NONE) || line.fail())
+                break;
+
+            elements.back().props.push_back(prop);
+        }
+        else if (keyword == "end_header")
+        {
+            if (!format)
+                break;
+
+            for (std::vector<ply_element>::iterator ei = elements.begin(); ei != elements.end(); ei++)
+            {
+                ei->stride = 0;
+                for (std::vector<ply_property>::const_iterator pi = ei->props.begin(); pi != ei->props.end(); pi++)
+                {
+                    ei->offsets.push_back(ei->stride);
+                    ei->stride += type_size(pi->type);
+                }
+
+                for (std::vector<ply_property>::const_iterator pi = ei->props.begin(); pi != ei->props.end(); pi++)
+                    if (pi->count_type != PLY_NONE)
+                        ei->stride = 0;
+            }
+            return true;
+        }
+        else if ((keyword != "comment") && (keyword != "obj_info") && !keyword.empty())
+            break;
+    }
+
+    fprintf(stderr, "%s: Invalid PLY header\n", filename.c_str());
+    return false;
+}
+
+
+// Size of the record at p of an element with lists, or 0 if it does not end
+// before e
+static size_t record_size(const char *p, const char *e, const ply_element &el, bool big)
+{
+    const char *start = p;
+
+    for (std::vector<ply_property>::const_iterator pi = el.props.begin(); pi != el.props.end(); pi++)
+    {
+        if (pi->count_type != PLY_NONE)
+        {
+            if ((size_t)(e - p) < type_size(pi->count_type))
+                return 0;
+            double count = get_value(p, pi->count_type, big);
+            p += type_size(pi->count_type);
+
+            if ((count < 0.) || (count * type_size(pi->type) > e - p))
+                return 0;
+            p += (size_t)count * type_size(pi->type);
+        }
+        else
+        {
+            if ((size_t)(e - p) < type_size(pi->type))
+                return 0;
+            p += type_size(pi->type);
+        }
+    }
+
+    return p - start;
+}
+
+
+// Copy the "n" scalar properties "idx" of all records of "el" at "base"
+// into "out", n floats per record
+static void copy_floats(const char *base, const ply_element &el, const int *idx, int n, bool big, float *out)
+{
+    bool direct = (big != dake::little_endian());
+    for (int i = 0; (i < n) && direct; i++)
+        direct = (el.props[idx[i]].type == PLY_FLOAT32) && (el.offsets[idx[i]] == el.offsets[idx[0]] + 4 * i);
+
+    if (direct && (el.stride == 4 * (size_t)n))
+        memcpy(out, base, el.count * el.stride);
+    else if (direct)
+        for (size_t r = 0; r < el.count; r++)
+            memcpy(out + r * n, base + r * el.stride + el.offsets[idx[0]], 4 * n);
+    else
+        for (size_t r = 0; r < el.count; r++)
+            for (int i = 0; i < n; i++)
+                out[r * n + i] = get_value(base + r * el.stride + el.offsets[idx[i]], el.props[idx[i]].type, big);
+}
+
+
+// Find the properties with one of the given names for each of the n
+// components; returns false unless all of them are there
+static bool find_props(const ply_element &el, const char *const names[][2], int n, int *idx)
+{
+    for (int i = 0; i < n; i++)
+    {
+        idx[i] = el.find(names[i][0]);
+        if ((idx[i] < 0) && names[i][1])
+            idx[i] = el.find(names[i][1]);
+        if ((idx[i] < 0) || (el.props[idx[i]].count_type != PLY_NONE))
+            return false;
+    }
+    return true;
+}
+
+
+static bool truncated(const std::string &filename)
+{
+    fprintf(stderr, "%s: Truncated PLY file\n", filename.c_str());
+    return false;
+}
+
+
+bool obj_reader::load_ply(const std::string &filename, bool positions_only)
+{
+    dake::mapped_file file(filename);
+    if (!file.is_open())
+        return false;
+
+    const char *p = file.begin(), *e = file.end();
+    bool big = false;
+    std::vector<ply_element> elements;
+
+    if (!parse_header(p, e, big, elements, filename))
+        return false;
+
+    static const char *const position_names[][2] = { { "x", NULL }, { "y", NULL }, { "z", NULL } };
+    static const char *const normal_names[][2] = { { "nx", NULL }, { "ny", NULL }, { "nz", NULL } };
+    static const char *const tex_coord_names[][2] = { { "u", "s" }, { "v", "t" } };
+    static const char *const texture_names[][2] = { { "texture_u", "texture_s" }, { "texture_v", "texture_t" } };
+
+    size_t first_vertex = vertices.size(), vertex_count = 0;
+    bool has_normals = false, has_tex_coords = false;
+
+    for (std::vector<ply_element>::const_iterator ei = elements.begin(); ei != elements.end(); ei++)
+    {
+        const ply_element &el = *ei;
+
+        if (el.name == "vertex")
+        {
+            int pos[3], nrm[3], tc[2];
+            if (!el.stride || !find_props(el, position_names, 3, pos))
+            {
+                fprintf(stderr, "%s: Unsupported PLY vertex layout\n", filename.c_str());
+                return false;
+            }
+            if (el.count > (size_t)(e - p) / el.stride)
+                return truncated(filename);
+
+            vertex_count = el.count;
+            vertices.resize(first_vertex + vertex_count);
+            copy_floats(p, el, pos, 3, big, reinterpret_cast<float *>(vertices.data() + first_vertex));
+
+            if (positions_only)
+                return true;
+
+            has_normals = find_props(el, normal_names, 3, nrm);
+            if (has_normals)
+            {
+                size_t first = normals.size();
+                normals.resize(first + vertex_count);
+                copy_floats(p, el, nrm, 3, big, reinterpret_cast<float *>(normals.data() + first));
+            }
+
+            has_tex_coords = find_props(el, tex_coord_names, 2, tc) || find_props(el, texture_names, 2, tc);
+            if (has_tex_coords)
+            {
+                size_t first = tex_coords.size();
+                tex_coords.resize(first + vertex_count);
+                copy_floats(p, el, tc, 2, big, reinterpret_cast<float *>(tex_coords.data() + first));
+            }
+
+            p += el.count * el.stride;
+        }
+        else if ((el.name == "face") && !positions_only)
+        {
+            int vi = el.find("vertex_indices");
+            if (vi < 0)
+                vi = el.find("vertex_index");
+            int ti = el.find("texcoord");
+
+            if ((vi < 0) || (el.props[vi].count_type == PLY_NONE) ||
+                (el.props[vi].type == PLY_FLOAT32) || (el.props[vi].type == PLY_FLOAT64))
+            {
+                fprintf(stderr, "%s: Unsupported PLY face layout\n", filename.c_str());
+                return false;
+            }
+            if ((ti >= 0) && (el.props[ti].count_type == PLY_NONE))
+                ti = -1;
+
+            // Normals and texture coordinates are indexed like the
+            // positions (if there are any)
+            int normal_base = has_normals ? normals.size() - vertex_count + 1 : 0;
+            int tex_coord_base = has_tex_coords ? tex_coords.size() - vertex_count + 1 : 0;
+
+            size_t first_face = faces.size();
+            faces.offsets.reserve(faces.offsets.size() + el.count);
+            faces.corners.reserve(faces.corners.size() + 3 * el.count);
+
+            bool native_indices = (big != dake::little_endian()) &&
+                                  ((el.props[vi].type == PLY_INT32) || (el.props[vi].type == PLY_UINT32));
+
+            size_t r;
+            for (r = 0; r < el.count; r++)
+            {
+                size_t size = record_size(p, e, el, big);
+                if (!size)
+                    break;
+
+                for (size_t i = 0; i < el.props.size(); i++)
+                {
+                    const ply_property &prop = el.props[i];
+                    if (prop.count_type == PLY_NONE)
+                    {
+                        p += type_size(prop.type);
+                        continue;
+                    }
+
+                    size_t count = get_value(p, prop.count_type, big);
+                    p += type_size(prop.count_type);
+
+                    if ((int)i == vi)
+                    {
+                        for (size_t c = 0; c < count; c++)
+                        {
+                            int32_t v;
+                            if (native_indices)
+                                memcpy(&v, p + 4 * c, 4);
+                            else
+                                v = get_value(p + type_size(prop.type) * c, prop.type, big);
+
+                            face_corner fc;
+                            fc.index_vertex = first_vertex + v + 1;
+                            fc.index_normal = has_normals ? normal_base + v : -1;
+                            fc.index_texcoord = has_tex_coords ? tex_coord_base + v : -1;
+                            faces.corners.push_back(fc);
+                        }
+                        faces.offsets.push_back(faces.corners.size());
+                    }
+                    else if (((int)i == ti) && (ti > vi))
+                    {
+                        // Replaces the vertices' texture coordinates for the
+                        // corners added just before
+                        size_t corners = faces.offsets.back() - faces.offsets[faces.offsets.size() - 2];
+                        if (count == 2 * corners)
+                        {
+                            for (size_t c = 0; c < corners; c++)
+                            {
+                                tex_coords.push_back(dake::vec2(get_value(p + type_size(prop.type) * 2 * c, prop.type, big),
+                                                                get_value(p + type_size(prop.type) * (2 * c + 1), prop.type, big)));
+                                faces.corners[faces.offsets.back() - corners + c].index_texcoord = tex_coords.size();
+                            }
+                        }
+                    }
+
+                    p += count * type_size(prop.type);
+                }
+            }
+
+            size_t added = faces.offsets.size() - 1 - first_face;
+            faces.mats.insert(faces.mats.end(), added, current_mat);
+            faces.groups.insert(faces.groups.end(), added, current_group);
+            faces.smoothing.insert(faces.smoothing.end(), added, current_smoothing);
+
+            if (r < el.count)
+                return truncated(filename);
+        }
+        else if (el.stride)
+        {
+            if (el.count > (size_t)(e - p) / el.stride)
+                return truncated(filename);
+            p += el.count * el.stride;
+        }
+        else
+        {
+            for (size_t r = 0; r < el.count; r++)
+            {
+                size_t size = record_size(p, e, el, big);
+                if (!size)
+                    return truncated(filename);
+                p += size;
+            }
+        }
+    }
+
+    return true;
+}
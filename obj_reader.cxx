@@ -1,13 +1,20 @@
 #include "obj_reader.h"
+#include "obj_scan.h"
+#include "mtl_library.h"
 
+#include "dake/mapped_file.h"
+#include "dake/parallel.h"
 #include "dake/texture.h"
 
+#include <algorithm>
+#include <cctype>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <limits>
 #include <fstream>
+#include <mutex>
 #ifdef __GNUC__
 #include <libgen.h>
 #endif
@@ -39,17 +46,56 @@ char *dirname(char *path)
 #endif
 
 
-obj_reader::obj_reader(const std::string &filename)
+// Flags which change the loaded lists and not just the way they are loaded
+#define CONTENT_FLAGS (obj_reader::LOAD_WELD | obj_reader::LOAD_TRIANGULATE | obj_reader::LOAD_OPTIMIZE | \
+                       obj_reader::LOAD_NORMALS)
+
+
+static void create_default_material(material **mat)
 {
-    // Create a new file stream and open the file
-    ifstream file(filename.c_str());
+    *mat = new material;
+    (*mat)->name = std::string("__DEFAULT__");
+    (*mat)->ambient = dake::vec4(0.f, 0.f, 0.f, 1.f);
+    (*mat)->diffuse = dake::vec4(1.f, 1.f, 1.f, 1.f);
+    (*mat)->specular = dake::vec4(1.f, 1.f, 1.f, 1.f);
+    (*mat)->spec_co = 100.f;
+    (*mat)->illum = 2;
+    (*mat)->tex = NULL;
+}
+
+
+// Material of faces without a usemtl statement before them
+static const material *default_material(void)
+{
+    // Readers may be created on several threads at once
+    static material *default_mat = NULL;
+    static std::once_flag default_mat_created;
+    std::call_once(default_mat_created, create_default_material, &default_mat);
+
+    return default_mat;
+}
 
-    // Show an error message if the file could not be loaded
-    if (!file.is_open()) {
-        std::cerr<<"Error: Could not find file "<<filename<<"."<<std::endl;
-        return;
-    }
 
+obj_reader::obj_reader(const std::string &filename, int flags):
+    incomplete(false),
+    lists_shared(false),
+    positions_shared(false)
+{
+    init(filename, flags, NULL);
+}
+
+
+obj_reader::obj_reader(const std::string &filename, const std::vector<char> &data, int flags):
+    incomplete(false),
+    lists_shared(false),
+    positions_shared(false)
+{
+    init(filename, flags, &data);
+}
+
+
+void obj_reader::init(const std::string &filename, int flags, const std::vector<char> *data)
+{
 #ifdef __GNUC__
     char copy[filename.length() + 1];
 #else
@@ -62,20 +108,172 @@ obj_reader::obj_reader(const std::string &filename)
 #endif
 
 
-    static material *default_mat = NULL;
-    if (!default_mat)
+    current_mat = default_material();
+
+    groups.push_back(obj_group());
+    current_group = 0;
+    current_smoothing = 0;
+
+
+    // An up to date cache is loaded completely, since that is cheap anyway
+    if ((flags & LOAD_SHARED) && load_shared(filename, default_material(), flags & CONTENT_FLAGS))
+        return;
+
+    if ((flags & LOAD_CACHED) && load_cache(filename, default_material(), flags & CONTENT_FLAGS))
+    {
+        if (flags & LOAD_SHARED)
+            publish_shared(filename, flags & CONTENT_FLAGS);
+        return;
+    }
+
+    if (flags & LOAD_LAZY)
+    {
+        if (!load_file(filename, flags, true, data)) {
+            std::cerr<<"Error: Could not find file "<<filename<<"."<<std::endl;
+            return;
+        }
+
+        calculate_bounding_box();
+
+        // The rest is loaded by complete()
+        incomplete = true;
+        lazy_filename = filename;
+        lazy_flags = flags;
+        return;
+    }
+
+    load(filename, flags, data);
+}
+
+
+
+
+void obj_reader::load(const std::string &filename, int flags, const std::vector<char> *data)
+{
+    // Show an error message if the file could not be loaded
+    if (!load_file(filename, flags, false, data)) {
+        std::cerr<<"Error: Could not find file "<<filename<<"."<<std::endl;
+        return;
+    }
+
+    // Calculate the bounding box
+    calculate_bounding_box();
+
+    if (flags & LOAD_WELD)
+        weld_vertices();
+
+    // Before triangulating, so polygons are smoothed as a whole
+    if (flags & LOAD_NORMALS)
+        generate_normals();
+
+    if (flags & LOAD_TRIANGULATE)
+        triangulate();
+
+    if (flags & LOAD_OPTIMIZE)
     {
-        default_mat = new material;
-        default_mat->name = std::string("__DEFAULT__");
-        default_mat->ambient = dake::vec4(0.f, 0.f, 0.f, 1.f);
-        default_mat->diffuse = dake::vec4(1.f, 1.f, 1.f, 1.f);
-        default_mat->specular = dake::vec4(1.f, 1.f, 1.f, 1.f);
-        default_mat->spec_co = 100.f;
-        default_mat->illum = 2;
-        default_mat->tex = NULL;
+        optimize_vertex_cache();
+        optimize_vertex_fetch();
     }
 
-    current_mat = default_mat;
+    if (flags & LOAD_CACHED)
+        write_cache(filename, flags & CONTENT_FLAGS);
+
+    if (flags & LOAD_SHARED)
+        publish_shared(filename, flags & CONTENT_FLAGS);
+}
+
+
+
+
+bool obj_reader::is_shared(const std::string &filename, int flags)
+{
+    return shared_ready(filename, flags & CONTENT_FLAGS);
+}
+
+
+bool obj_reader::remove_shared(const std::string &filename, int flags)
+{
+    return unpublish_shared(filename, flags & CONTENT_FLAGS);
+}
+
+
+
+
+// Whether "filename" ends in "ext" (given in lower case), in any case
+static bool has_extension(const std::string &filename, const char *ext)
+{
+    size_t len = strlen(ext);
+    if (filename.length() < len)
+        return false;
+
+    for (size_t i = 0; i < len; i++)
+        if (tolower(static_cast<unsigned char>(filename[filename.length() - len + i])) != ext[i])
+            return false;
+
+    return true;
+}
+
+
+bool obj_reader::load_file(const std::string &filename, int flags, bool positions_only, const std::vector<char> *data)
+{
+    if (has_extension(filename, ".ply"))
+        return load_ply(filename, positions_only);
+    if (has_extension(filename, ".stl"))
+        return load_stl(filename, positions_only);
+    if (has_extension(filename, ".objz"))
+        return load_compressed(filename, positions_only);
+
+    if (data)
+        return load_text(data->data(), data->data() + data->size(), flags & LOAD_PARALLEL, positions_only);
+    if (flags & (LOAD_MAPPED | LOAD_PARALLEL))
+        return load_mapped(filename, flags & LOAD_PARALLEL, positions_only);
+    return load_stream(filename, positions_only);
+}
+
+
+
+
+void obj_reader::complete()
+{
+    if (!incomplete)
+        return;
+
+    incomplete = false;
+
+    // Everything is loaded anew, so the positions must not be there twice
+    vertices.clear();
+    load(lazy_filename, lazy_flags);
+}
+
+
+void obj_reader::complete_lists()
+{
+    complete();
+    // Publishing the mesh (see LOAD_SHARED) lets go of the lists
+    unshare_lists(default_material());
+}
+
+
+
+void obj_reader::invalidate_derived()
+{
+    indexed = indexed_mesh();
+    compact = compact_mesh();
+    meshlets = meshlet_mesh();
+    submeshes.clear();
+    lods.clear();
+}
+
+
+
+
+bool obj_reader::load_stream(const std::string &filename, bool positions_only)
+{
+    // Create a new file stream and open the file
+    ifstream file(filename.c_str());
+
+    if (!file.is_open())
+        return false;
 
 
     // This string represents one line of the file
@@ -95,6 +293,9 @@ obj_reader::obj_reader(const std::string &filename)
         string definition_type;
         line>>definition_type;
 
+        if (positions_only && (definition_type != "v"))
+            continue;
+
         // If the definition type is "v" then a vertex is defined
         if (definition_type == "v")
             process_vertex(line);
@@ -118,13 +319,233 @@ obj_reader::obj_reader(const std::string &filename)
         // If the definition type is "usemtl" then a material shall be used
         if (definition_type == "usemtl")
             process_usemtl(line);
+        else
+        // If the definition type is "o" or "g" then a new object resp.
+        // group starts
+        if (definition_type == "o")
+            process_object(line);
+        else
+        if (definition_type == "g")
+            process_group(line);
+        else
+        // If the definition type is "s" then a new smoothing group starts
+        if (definition_type == "s")
+            process_smoothing(line);
     }
 
     // All done. Close this file
     file.close();
 
-    // Calculate the bounding box
-    calculate_bounding_box();
+    return true;
+}
+
+
+
+
+// Smallest amount of data worth handing to a thread of its own
+#define MIN_CHUNK_SIZE (128 << 10)
+
+
+bool obj_reader::load_mapped(const std::string &filename, bool parallel, bool positions_only)
+{
+    dake::mapped_file file(filename);
+
+    if (!file.is_open())
+        return false;
+
+    return load_text(file.begin(), file.end(), parallel, positions_only);
+}
+
+
+bool obj_reader::load_text(const char *begin, const char *end, bool parallel, bool positions_only)
+{
+    size_t size = end - begin;
+
+    size_t chunk_count = 1;
+    if (parallel)
+    {
+        chunk_count = size / MIN_CHUNK_SIZE;
+        if (chunk_count > dake::worker_count())
+            chunk_count = dake::worker_count();
+        if (!chunk_count)
+            chunk_count = 1;
+    }
+
+    // Split the file into chunks of about the same size, moving every
+    // boundary to the start of the following line
+    std::vector<const char *> bounds(chunk_count + 1);
+    bounds[0] = begin;
+    for (size_t i = 1; i < chunk_count; i++)
+    {
+        const char *p = begin + size * i / chunk_count;
+        if (p < bounds[i - 1])
+            p = bounds[i - 1];
+
+        const char *nl = static_cast<const char *>(memchr(p, '\n', end - p));
+        bounds[i] = nl ? nl + 1 : end;
+    }
+    bounds[chunk_count] = end;
+
+    std::vector<obj_chunk> chunks(chunk_count);
+
+    dake::parallel_for(chunk_count, [&](size_t i) {
+        scan_obj(bounds[i], bounds[i + 1], chunks[i], positions_only);
+    });
+
+    merge(chunks);
+
+    return true;
+}
+
+
+
+
+void obj_reader::merge(std::vector<obj_chunk> &chunks)
+{
+    size_t count = chunks.size();
+
+    // Read all material libraries (and their textures) at once before
+    std::vector<std::string> libs;
+    for (size_t i = 0; i < count; i++)
+    {
+        for (size_t j = 0; j < chunks[i].statements.size(); j++)
+        {
+            if (chunks[i].statements[j].kind != obj_chunk::statement::MTLLIB)
+                continue;
+
+            stringstream line(chunks[i].statements[j].arg);
+            std::string name;
+            line >> name;
+            libs.push_back(library_path(name));
+        }
+    }
+    if (!libs.empty())
+        mtl_library_manager::instance().prefetch(libs, obj_dirname);
+
+    // Execute all material and group statements in file order, so every
+    // usemtl sees exactly the material libraries loaded before it.
+    // Remember the material, group and smoothing group active at the start
+    // of every chunk.
+    std::vector<const material *> start_mat(count);
+    std::vector<unsigned> start_group(count), start_smoothing(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        start_mat[i] = current_mat;
+        start_group[i] = current_group;
+        start_smoothing[i] = current_smoothing;
+
+        for (size_t j = 0; j < chunks[i].statements.size(); j++)
+        {
+            obj_chunk::statement &st = chunks[i].statements[j];
+            stringstream line(st.arg);
+
+            switch (st.kind)
+            {
+                case obj_chunk::statement::MTLLIB: process_mtllib(line); break;
+                case obj_chunk::statement::USEMTL: process_usemtl(line); break;
+                case obj_chunk::statement::OBJECT: process_object(line); break;
+                case obj_chunk::statement::GROUP:  process_group(line); break;
+                case obj_chunk::statement::SMOOTHING: process_smoothing(line); break;
+            }
+
+            st.mat = current_mat;
+            st.group = current_group;
+            st.smoothing = current_smoothing;
+        }
+    }
+
+    // Offsets of every chunk's elements in the merged lists
+    std::vector<size_t> vbase(count + 1), tbase(count + 1), nbase(count + 1), fbase(count + 1), cbase(count + 1);
+    for (size_t i = 0; i < count; i++)
+    {
+        vbase[i + 1] = vbase[i] + chunks[i].vertices.size();
+        tbase[i + 1] = tbase[i] + chunks[i].tex_coords.size();
+        nbase[i + 1] = nbase[i] + chunks[i].normals.size();
+        fbase[i + 1] = fbase[i] + chunks[i].faces.size();
+        cbase[i + 1] = cbase[i] + chunks[i].faces.corners.size();
+    }
+
+    size_t fofs = faces.size();
+
+    if ((count == 1) && vertices.empty() && normals.empty() && tex_coords.empty() && faces.empty())
+    {
+        // Nothing to merge, just take over the lists
+        vertices.swap(chunks[0].vertices);
+        normals.swap(chunks[0].normals);
+        tex_coords.swap(chunks[0].tex_coords);
+        faces.swap(chunks[0].faces);
+    }
+    else
+    {
+        size_t vofs = vertices.size(), tofs = tex_coords.size(), nofs = normals.size(), cofs = faces.corners.size();
+
+        vertices.resize(vofs + vbase[count]);
+        tex_coords.resize(tofs + tbase[count]);
+        normals.resize(nofs + nbase[count]);
+        faces.corners.resize(cofs + cbase[count]);
+        faces.offsets.resize(fofs + fbase[count] + 1);
+        faces.mats.resize(fofs + fbase[count]);
+        faces.groups.resize(fofs + fbase[count]);
+        faces.smoothing.resize(fofs + fbase[count]);
+
+        dake::parallel_for(count, [&](size_t i) {
+            const obj_chunk &c = chunks[i];
+
+            std::copy(c.vertices.begin(), c.vertices.end(), vertices.begin() + vofs + vbase[i]);
+            std::copy(c.tex_coords.begin(), c.tex_coords.end(), tex_coords.begin() + tofs + tbase[i]);
+            std::copy(c.normals.begin(), c.normals.end(), normals.begin() + nofs + nbase[i]);
+            std::copy(c.faces.corners.begin(), c.faces.corners.end(), faces.corners.begin() + cofs + cbase[i]);
+
+            // Every chunk's offsets start with 0, which is the end of the
+            // previous chunk's last face
+            for (size_t j = 1; j < c.faces.offsets.size(); j++)
+                faces.offsets[fofs + fbase[i] + j] = c.faces.offsets[j] + cofs + cbase[i];
+
+            // Relative indices refer to everything before this chunk, too
+            for (size_t j = 0; j < c.relative.size(); j++)
+            {
+                const obj_chunk::relative_corner &rc = c.relative[j];
+                face_corner &fc = faces.corners[cofs + cbase[i] + rc.corner];
+
+                if (rc.mask & 1)
+                    fc.index_vertex += vofs + vbase[i];
+                if (rc.mask & 2)
+                    fc.index_texcoord += tofs + tbase[i];
+                if (rc.mask & 4)
+                    fc.index_normal += nofs + nbase[i];
+            }
+        });
+    }
+
+    // Assign the materials, groups and smoothing groups
+    dake::parallel_for(count, [&](size_t i) {
+        const obj_chunk &c = chunks[i];
+        const material **m = faces.mats.data() + fofs + fbase[i];
+        unsigned *g = faces.groups.data() + fofs + fbase[i];
+        unsigned *sg = faces.smoothing.data() + fofs + fbase[i];
+        const material *mat = start_mat[i];
+        unsigned group = start_group[i], smoothing = start_smoothing[i];
+        size_t j = 0;
+
+        for (size_t k = 0; k < c.statements.size(); k++)
+        {
+            for (; j < c.statements[k].face_count; j++)
+            {
+                m[j] = mat;
+                g[j] = group;
+                sg[j] = smoothing;
+            }
+            mat = c.statements[k].mat;
+            group = c.statements[k].group;
+            smoothing = c.statements[k].smoothing;
+        }
+        for (; j < fbase[i + 1] - fbase[i]; j++)
+        {
+            m[j] = mat;
+            g[j] = group;
+            sg[j] = smoothing;
+        }
+    });
 }
 
 
@@ -259,17 +680,15 @@ void obj_reader::process_face(std::stringstream &line)
 {
     // The method must parse the line and read the definition. More information
     // on how this line is defined can be found in the body of this method.
-    face new_face;
-
-    new_face.mat = current_mat;
+    // The corners are appended directly to the list of all corners.
+    faces.begin_face(current_mat, current_group, current_smoothing);
 
     // *** Begin of task 1.2.4 ****
     // The parameter "line" is a string stream that contains the line
     // of the .obj-file where a normal is defined. The reading pointer
     // if this stream lies at the first face point.
-    // The result of this method is the filled variable "new_face"
-    // that has the type "face". A face has one property "corners" which
-    // is a list of "face_point"s.
+    // The result of this method is the new face in "faces". A face has
+    // one property "corners" which is a list of "face_point"s.
 
     // Split the line into face points that are separated by whitespaces
     string entry;
@@ -326,39 +745,35 @@ void obj_reader::process_face(std::stringstream &line)
             }
         }
 
-        // Finally, add the new corner to the list "corners" of new_face.
-        new_face.corners.push_back(new_corner);
+        // Finally, add the new corner to the new face.
+        faces.add_corner(new_corner);
 
         // ...
     }
 
-    // Remember to add the newly created face to the end of the
-    // list "faces" here.
-    faces.push_back(new_face);
-
     // *** End of task 1.2.4 ***
 }
 
 
 
-void obj_reader::process_mtllib(std::stringstream &line)
+bool load_mtl_library(const std::string &filename, const std::string &dirname, std::vector<material> &mats,
+                      bool load_textures)
 {
-    std::string remaining;
-    line >> remaining;
-    if (remaining[0] != '/')
-        remaining = obj_dirname + "/" + remaining;
-
-    std::ifstream file(remaining.c_str());
+    std::ifstream file(filename.c_str());
     if (!file.is_open())
-    {
-        fprintf(stderr, "Could not open material lib %s\n", remaining.c_str());
-        throw 42;
-    }
+        return false;
+
+    load_mtl_library(file, dirname, mats, load_textures);
+    return true;
+}
+
 
+void load_mtl_library(std::istream &in, const std::string &dirname, std::vector<material> &mats, bool load_textures)
+{
     material *mat = NULL;
 
     std::string mtl_str_line;
-    while (std::getline(file, mtl_str_line, '\n'))
+    while (std::getline(in, mtl_str_line, '\n'))
     {
         std::stringstream mtl_line(mtl_str_line);
 
@@ -369,7 +784,7 @@ void obj_reader::process_mtllib(std::stringstream &line)
         {
             if (mat)
             {
-                materials.push_back(*mat);
+                mats.push_back(*mat);
                 delete mat;
             }
 
@@ -400,21 +815,64 @@ void obj_reader::process_mtllib(std::stringstream &line)
             if (fname != ".")
             {
                 if (fname[0] != '/')
-                    fname = obj_dirname + "/" + fname;
-                mat->tex = dake::texture_manager::instance().find_texture(fname);
+                    fname = dirname + "/" + fname;
+                mat->tex_fname = fname;
+                if (load_textures)
+                    mat->tex = dake::texture_manager::instance().find_texture(fname);
             }
         }
     }
 
     if (mat)
     {
-        materials.push_back(*mat);
+        mats.push_back(*mat);
         delete mat;
     }
 }
 
 
 
+void obj_reader::process_mtllib(std::stringstream &line)
+{
+    std::string remaining;
+    line >> remaining;
+    remaining = library_path(remaining);
+
+    if (!add_mtl_library(remaining))
+    {
+        fprintf(stderr, "Could not open material lib %s\n", remaining.c_str());
+        throw 42;
+    }
+}
+
+
+
+std::string obj_reader::library_path(const std::string &name) const
+{
+    return (name[0] == '/') ? name : obj_dirname + "/" + name;
+}
+
+
+
+bool obj_reader::add_mtl_library(const std::string &filename)
+{
+    const mtl_library *lib = mtl_library_manager::instance().find_library(filename, obj_dirname);
+    if (!lib)
+        return false;
+
+    for (std::vector<material>::const_iterator i = lib->materials.begin(); i != lib->materials.end(); i++)
+    {
+        materials.push_back(&*i);
+        // Does not replace materials with the same name loaded before
+        material_names.insert(std::make_pair(i->name, &*i));
+    }
+
+    mtl_files.push_back(filename);
+    return true;
+}
+
+
+
 void obj_reader::process_usemtl(std::stringstream &line)
 {
     std::string name;
@@ -425,8 +883,54 @@ void obj_reader::process_usemtl(std::stringstream &line)
 
 
 
+// Read the remainder of the line without surrounding blanks
+static std::string rest_of_line(std::stringstream &line)
+{
+    std::string rest;
+    getline(line, rest);
+
+    size_t first = rest.find_first_not_of(" \t\r");
+    if (first == std::string::npos)
+        return std::string();
+
+    return rest.substr(first, rest.find_last_not_of(" \t\r") - first + 1);
+}
+
+
+
+void obj_reader::process_object(std::stringstream &line)
+{
+    obj_group g;
+    g.object = rest_of_line(line);
+
+    groups.push_back(g);
+    current_group = groups.size() - 1;
+}
+
+
+
+void obj_reader::process_group(std::stringstream &line)
+{
+    obj_group g;
+    g.object = groups[current_group].object;
+    g.group = rest_of_line(line);
+
+    groups.push_back(g);
+    current_group = groups.size() - 1;
+}
+
+
+
+void obj_reader::process_smoothing(std::stringstream &line)
+{
+    current_smoothing = parse_smoothing_group(rest_of_line(line));
+}
+
+
+
 // Get the list of vertices
 const vector<dake::vec3> &obj_reader::get_vertices() {
+    unshare_positions();
     return vertices;
 }
 
@@ -435,6 +939,7 @@ const vector<dake::vec3> &obj_reader::get_vertices() {
 
 // Get the list of normals
 const vector<dake::vec3> &obj_reader::get_normals() {
+    complete_lists();
     return normals;
 }
 
@@ -442,6 +947,7 @@ const vector<dake::vec3> &obj_reader::get_normals() {
 
 // Get the list of texture coordinates
 const vector<dake::vec2> &obj_reader::get_tex_coords(void) {
+    complete_lists();
     return tex_coords;
 }
 
@@ -449,17 +955,169 @@ const vector<dake::vec2> &obj_reader::get_tex_coords(void) {
 
 
 // Get the list of faces
-const vector<face> &obj_reader::get_faces() {
+const face_list &obj_reader::get_faces() {
+    complete_lists();
     return faces;
 }
 
 
 
+// Get the single-indexed mesh
+const indexed_mesh &obj_reader::get_indexed_mesh() {
+    // May have been taken from shared memory without the lists
+    if (indexed.batches.empty())
+    {
+        // Completing a lazy reader may publish it, which builds the mesh
+        complete();
+        if (indexed.batches.empty())
+        {
+            complete_lists();
+            if (!faces.empty())
+                indexed.build(vertices, normals, tex_coords, faces);
+        }
+    }
+
+    return indexed;
+}
+
+
+
+// Get the quantized single-indexed mesh
+const compact_mesh &obj_reader::get_compact_mesh() {
+    if (compact.batches.empty())
+    {
+        if (!indexed.batches.empty())
+            compact.build(indexed);
+        else
+        {
+            complete();
+            if (compact.batches.empty())
+            {
+                complete_lists();
+                if (!faces.empty())
+                {
+                    indexed_mesh temp;
+                    temp.build(vertices, normals, tex_coords, faces);
+                    compact.build(temp);
+                }
+            }
+        }
+    }
+
+    return compact;
+}
+
+
+
+// Get the meshlets
+const meshlet_mesh &obj_reader::get_meshlets() {
+    if (meshlets.meshlets.empty())
+        meshlets.build(get_indexed_mesh());
+
+    return meshlets;
+}
+
+
+
+// Build the levels of detail
+const std::vector<mesh_lod> &obj_reader::build_lods(const std::vector<float> &ratios, const simplify_options &opts) {
+    lods.clear();
+    simplify_mesh(get_indexed_mesh(), ratios, lods, opts);
+    lod_ratios = ratios;
+
+    return lods;
+}
+
+
+
+// Get the levels of detail
+const std::vector<mesh_lod> &obj_reader::get_lods() {
+    return lods;
+}
+
+
+
+// Load stored levels of detail
+bool obj_reader::load_lods(const std::string &filename, const std::vector<float> &ratios) {
+    complete();
+    return read_lods(filename, ratios, default_material());
+}
+
+
+
+// Get the material libraries and their materials (as far as loaded)
+const std::vector<std::string> &obj_reader::get_mtl_files() {
+    return mtl_files;
+}
+
+const std::vector<const material *> &obj_reader::get_materials() {
+    return materials;
+}
+
+
+
+// Get the list of objects/groups
+const std::vector<obj_group> &obj_reader::get_groups() {
+    complete_lists();
+    return groups;
+}
+
+
+
+// Get the faces split by group and material
+const std::vector<submesh> &obj_reader::get_submeshes() {
+    complete_lists();
+    if (submeshes.empty() && !faces.empty())
+    {
+        for (size_t i = 0; i < faces.size(); i++)
+        {
+            if (submeshes.empty() || (submeshes.back().group != faces.groups[i]) || (submeshes.back().mat != faces.mats[i]))
+            {
+                submesh sm;
+                sm.group = faces.groups[i];
+                sm.mat = faces.mats[i];
+                sm.first_face = i;
+                sm.face_count = 0;
+                sm.first_corner = faces.offsets[i];
+                sm.corner_count = 0;
+                sm.bbox_max = -std::numeric_limits<float>::max();
+                sm.bbox_min = -sm.bbox_max;
+                submeshes.push_back(sm);
+            }
+
+            submesh &sm = submeshes.back();
+            sm.face_count++;
+            sm.corner_count += faces.offsets[i + 1] - faces.offsets[i];
+
+            for (unsigned j = faces.offsets[i]; j < faces.offsets[i + 1]; j++)
+            {
+                int vi = faces.corners[j].index_vertex;
+                if ((vi <= 0) || ((size_t)vi > vertices.size()))
+                    continue;
+
+                const dake::vec3 &v = vertices[vi - 1];
+                for (int k = 0; k < 3; k++)
+                {
+                    if (v[k] < sm.bbox_min[k])
+                        sm.bbox_min[k] = v[k];
+                    if (v[k] > sm.bbox_max[k])
+                        sm.bbox_max[k] = v[k];
+                }
+            }
+        }
+    }
+
+    return submeshes;
+}
+
+
+
 const material &obj_reader::get_material(const std::string &name)
 {
-    for (std::vector<material>::iterator i = materials.begin(); i != materials.end(); i++)
-        if ((*i).name == name)
-            return *i;
+    complete();
+    std::unordered_map<std::string, const material *>::const_iterator i = material_names.find(name);
+    if (i != material_names.end())
+        return *i->second;
 
     fprintf(stderr, "Could not find material %s\n", name.c_str());
     throw 84;
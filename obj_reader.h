@@ -1,12 +1,20 @@
 #pragma once
 
+#include <memory>
 #include <vector>
 #include <string>
 #include <sstream>
+#include <unordered_map>
 
 #include "dake/texture.h"
 #include "dake/vector.h"
 
+#include "compact_mesh.h"
+#include "indexed_mesh.h"
+#include "mesh_simplify.h"
+#include "meshlet.h"
+#include "vertex_cache.h"
+
 
 // A face point contains indices for a vertex, a normal
 // and a texture coordinate
@@ -18,22 +26,155 @@ struct face_corner {
 
 struct material
 {
-    material(void) { tex = NULL; }
+    material(void) { spec_co = 0.f; illum = 0; tex = NULL; }
 
     std::string name;
     dake::vec4 ambient, diffuse, specular;
     float spec_co;
     int illum;
     const dake::texture *tex;
+    // Full name of the texture file (empty if there is none); set even if
+    // the texture itself has not been loaded
+    std::string tex_fname;
 };
 
-// A face is a list of face points
+// A list of face points which are stored somewhere else (in the
+// face_list they belong to)
+struct corner_range
+{
+    typedef const face_corner *const_iterator;
+
+    const face_corner *first, *last;
+
+    const_iterator begin(void) const { return first; }
+    const_iterator end(void) const { return last; }
+    size_t size(void) const { return last - first; }
+    const face_corner &operator[](size_t i) const { return first[i]; }
+};
+
+// A face is a list of face points. This is only a view into the face_list
+// it has been taken from.
 struct face {
-    std::vector<face_corner> corners;
+    corner_range corners;
+    const material *mat;
+    // Index of the object/group the face belongs to (see obj_group)
+    unsigned group;
+    // Smoothing group of the face (see face_list::smoothing)
+    unsigned smoothing;
+};
+
+// Object and group names given by the o and g statements in an OBJ file.
+// Group 0 is the one faces belong to before any such statement.
+struct obj_group
+{
+    std::string object, group;
+};
+
+// A range of consecutive faces belonging to the same object/group and using
+// the same material, together with the bounding box of the vertices they
+// use. The corner range is also the range of indices in the indexed mesh.
+struct submesh
+{
+    unsigned group;
     const material *mat;
+    size_t first_face, face_count;
+    size_t first_corner, corner_count;
+    dake::vec3 bbox_min, bbox_max;
+};
+
+// The faces of a mesh, stored as compressed sparse rows: The corners of all
+// faces are stored back to back in one list, face i consisting of the
+// corners from corners[offsets[i]] up to (excluding) corners[offsets[i + 1]].
+// This avoids a heap allocation per face and lets traversals stream
+// through memory.
+struct face_list
+{
+    std::vector<face_corner> corners;
+    // One entry more than there are faces, starting with 0
+    std::vector<unsigned> offsets;
+    // Material of every face
+    std::vector<const material *> mats;
+    // Object/group of every face
+    std::vector<unsigned> groups;
+    // Smoothing group of every face as given by the s statements; 0 if
+    // smoothing is off
+    std::vector<unsigned> smoothing;
+
+    class const_iterator
+    {
+        private:
+            const face_list *list;
+            size_t index;
+
+        public:
+            const_iterator(const face_list *l, size_t i): list(l), index(i) {}
+
+            face operator*(void) const { return (*list)[index]; }
+            const_iterator &operator++(void) { index++; return *this; }
+            bool operator==(const const_iterator &ci) const { return index == ci.index; }
+            bool operator!=(const const_iterator &ci) const { return index != ci.index; }
+    };
+
+    face_list(void): offsets(1, 0) {}
+
+    size_t size(void) const { return mats.size(); }
+    bool empty(void) const { return mats.empty(); }
+
+    face operator[](size_t i) const
+    {
+        face f;
+        f.corners.first = corners.data() + offsets[i];
+        f.corners.last = corners.data() + offsets[i + 1];
+        f.mat = mats[i];
+        f.group = groups[i];
+        f.smoothing = smoothing[i];
+        return f;
+    }
+
+    const_iterator begin(void) const { return const_iterator(this, 0); }
+    const_iterator end(void) const { return const_iterator(this, size()); }
+
+    // Start a new face; its corners are then added with add_corner()
+    void begin_face(const material *mat, unsigned group = 0, unsigned smooth = 0)
+    { offsets.push_back(corners.size()); mats.push_back(mat); groups.push_back(group); smoothing.push_back(smooth); }
+
+    // Add a corner to the face started last
+    void add_corner(const face_corner &c)
+    { corners.push_back(c); offsets.back()++; }
+
+    void clear(void)
+    { corners.clear(); offsets.assign(1, 0); mats.clear(); groups.clear(); smoothing.clear(); }
+
+    void swap(face_list &fl)
+    {
+        corners.swap(fl.corners); offsets.swap(fl.offsets); mats.swap(fl.mats); groups.swap(fl.groups);
+        smoothing.swap(fl.smoothing);
+    }
 };
 
 
+// Load all materials from the material library "filename" and append them
+// to "mats". Relative texture file names are resolved against "dirname".
+// The textures themselves are only loaded if "load_textures" is set;
+// otherwise, only material::tex_fname is set. Returns
+// false if the file could not be opened.
+bool load_mtl_library(const std::string &filename, const std::string &dirname, std::vector<material> &mats,
+                      bool load_textures = true);
+
+// The same, but parse the library from "in" (e.g. because it has been read
+// already, see mtl_library_manager::prefetch)
+void load_mtl_library(std::istream &in, const std::string &dirname, std::vector<material> &mats,
+                      bool load_textures = true);
+
+
+// Internal state of the mapped loader, see obj_scan.h
+struct obj_chunk;
+
+// A block of shared memory a reader has taken its mesh from, see
+// obj_cache.cxx
+struct shared_mesh;
+
+
 class obj_reader {
 
 private:
@@ -44,15 +185,60 @@ private:
     // List of texture coordinates. Access this list with the method "get_tex_coords".
     std::vector<dake::vec2> tex_coords;
     // List of faces. Access this list with the method "get_faces".
-    std::vector<face> faces;
-    // List of materials.
-    std::vector<material> materials;
+    face_list faces;
+    // List of materials of all libraries loaded, in order. They belong to
+    // the libraries, which are shared between readers (see
+    // mtl_library_manager).
+    std::vector<const material *> materials;
+    // The materials by name (the first one if a name is used multiple
+    // times)
+    std::unordered_map<std::string, const material *> material_names;
+    // Names of the material libraries loaded
+    std::vector<std::string> mtl_files;
+    // All objects/groups the faces refer to
+    std::vector<obj_group> groups;
+    // Ranges of faces of the same group and material, built on first use
+    // by get_submeshes
+    std::vector<submesh> submeshes;
 
     // The minimum and maximum point of the bounding box
     dake::vec3 bbox_min, bbox_max;
 
+    // Single-indexed version of the mesh, built on first use by
+    // get_indexed_mesh
+    indexed_mesh indexed;
+
+    // Quantized version of the single-indexed mesh, built on first use by
+    // get_compact_mesh
+    compact_mesh compact;
+
+    // The single-indexed mesh split into meshlets, built on first use by
+    // get_meshlets
+    meshlet_mesh meshlets;
+
+    // Simplified versions of the single-indexed mesh (see build_lods) and
+    // the ratios they have been built for
+    std::vector<mesh_lod> lods;
+    std::vector<float> lod_ratios;
+
     // For internal use during loading only
     const material *current_mat;
+    unsigned current_group;
+    unsigned current_smoothing;
+
+    // Set while only the positions have been loaded (see LOAD_LAZY);
+    // the file and flags to load the rest with
+    bool incomplete;
+    std::string lazy_filename;
+    int lazy_flags;
+
+    // The block of shared memory the mesh has been taken from or published
+    // in (see LOAD_SHARED), if any; the single-indexed and quantized meshes
+    // are views of it then. The flags are set while the lists above resp.
+    // only the positions have not been copied from it yet (which happens
+    // when a getter first needs them).
+    std::shared_ptr<shared_mesh> shared;
+    bool lists_shared, positions_shared;
 
     // This method is called for every line in the obj file that contains
     // a vertex definition.
@@ -86,12 +272,234 @@ private:
     // nc
     void process_usemtl(std::stringstream &line);
 
+    // These methods are called for every line containing an o resp. a g
+    // statement; they start a new entry in "groups".
+    void process_object(std::stringstream &line);
+    void process_group(std::stringstream &line);
+
+    // This method is called for every line containing an s statement
+    void process_smoothing(std::stringstream &line);
+
+    // Add the materials from the given library (a full path) to the lists
+    // above. Returns false if the library could not be opened.
+    bool add_mtl_library(const std::string &filename);
+
+    // Full path of the library named in a mtllib statement
+    std::string library_path(const std::string &name) const;
+
+    // Load the file line by line through string streams, calling the
+    // process_* methods above. If "positions_only" is set, all lines but
+    // vertex definitions are skipped.
+    bool load_stream(const std::string &filename, bool positions_only);
+
+    // Load the file by mapping it into memory and scanning the mapped
+    // bytes directly (see LOAD_MAPPED). If "parallel" is set, the file is
+    // split into chunks at line boundaries which are scanned by several
+    // threads at once (see LOAD_PARALLEL). "positions_only" works as for
+    // load_stream.
+    bool load_mapped(const std::string &filename, bool parallel, bool positions_only);
+
+    // Scan the contents of an obj file in [begin, end) like load_mapped
+    bool load_text(const char *begin, const char *end, bool parallel, bool positions_only);
+
+    // Load a binary PLY resp. STL file into the same lists, copying the
+    // attributes straight from the mapped file where its layout allows it.
+    // "positions_only" works as for load_stream. Implemented in obj_ply.cxx
+    // resp. obj_stl.cxx.
+    bool load_ply(const std::string &filename, bool positions_only);
+    bool load_stl(const std::string &filename, bool positions_only);
+
+    // Load a file written by save_compressed into the same lists.
+    // "positions_only" works as for load_stream. Implemented in
+    // obj_codec.cxx.
+    bool load_compressed(const std::string &filename, bool positions_only);
+
+    // Load the file with the method matching its extension (.ply, .stl,
+    // .objz, anything else is taken to be an OBJ file) and the flags. If
+    // "data" is given, an OBJ file is scanned from there instead of being
+    // read (binary files are always read from the file).
+    bool load_file(const std::string &filename, int flags, bool positions_only, const std::vector<char> *data = NULL);
+
+    // Load the file with the given flags and apply the processing they ask
+    // for (everything but LOAD_CACHED and LOAD_LAZY)
+    void load(const std::string &filename, int flags, const std::vector<char> *data = NULL);
+
+    // Shared by the constructors
+    void init(const std::string &filename, int flags, const std::vector<char> *data);
+
+    // Load everything LOAD_LAZY has left out, if anything. Called by all
+    // getters which need more than the positions.
+    void complete();
+
+    // Drop the single-indexed meshes, the submeshes, the meshlets and the
+    // levels of detail, which are rebuilt from the lists when they are
+    // needed next. Called by every pass changing the faces.
+    void invalidate_derived();
+
+    // complete() and copy the lists from the shared block if that has not
+    // been done yet. Called by all getters returning the lists and by all
+    // passes changing them.
+    void complete_lists();
+
+    // Copy the lists from the shared block, if that has not been done yet.
+    // Implemented in obj_cache.cxx.
+    void unshare_lists(const material *default_mat);
+
+    // Copy only the positions from the shared block, if that has not been
+    // done yet (see get_vertices). Implemented in obj_cache.cxx.
+    void unshare_positions(void);
+
+    // Try to fill all lists from the binary cache file belonging to the
+    // given obj file (see LOAD_CACHED). Returns false if there is no such
+    // file or it is outdated. Faces without a material get "default_mat".
+    // Implemented in obj_cache.cxx.
+    // "content" are the flags which change the lists' content (like
+    // LOAD_WELD); the cache is only used if it has been created with the
+    // same ones.
+    bool load_cache(const std::string &filename, const material *default_mat, int content);
+
+    // Fill the lists from cache data in [begin, end) (see load_cache),
+    // which has been made for "filename" and is called "cache" in messages.
+    // "parts" are the parts of the data to take (see READ_* in
+    // obj_cache.cxx). Sets "restamp" if the data only matches because the
+    // source hashes are unchanged (while their modification times are
+    // not).
+    bool read_cache(const char *begin, const char *end, const std::string &filename, const std::string &cache,
+                    const material *default_mat, int content, int parts, bool &restamp);
+
+    // Build the cache data for "filename" from the lists, recording the
+    // given names for the obj file and its material libraries
+    bool build_cache(const std::string &filename, const std::vector<std::string> &libs, int content,
+                     std::vector<char> &buf);
+
+    // Write the binary cache file for the given obj file from the lists
+    void write_cache(const std::string &filename, int content);
+
+    // Like load_cache, but from the block of shared memory published by
+    // the first process to load the given obj file (see LOAD_SHARED),
+    // without copying anything but the material table. Outdated blocks
+    // are removed.
+    bool load_shared(const std::string &filename, const material *default_mat, int content);
+
+    // Publish the lists and the single-indexed and quantized meshes in a
+    // block of shared memory for the given obj file, unless there is one
+    // already, and switch over to using it (freeing the lists until they
+    // are needed again)
+    void publish_shared(const std::string &filename, int content);
+
+    // Whether a block has been published for the given obj file
+    static bool shared_ready(const std::string &filename, int content);
+
+    // Remove the block published for the given obj file, if any
+    static bool unpublish_shared(const std::string &filename, int content);
+
+    // Load the levels of detail from the given file if they have been
+    // built from the current mesh with the given ratios (see load_lods).
+    // Implemented in obj_cache.cxx.
+    bool read_lods(const std::string &filename, const std::vector<float> &ratios, const material *default_mat);
+
+    // Append the lists scanned from consecutive ranges of a file to the
+    // object's lists, executing material statements in file order and
+    // offsetting relative indices.
+    void merge(std::vector<obj_chunk> &chunks);
+
     // Calculate the bounding box. This method is called after the mesh
     // was loaded. The results are stored in bbox_min and bbox_max.
     // They are used in get_center and get_max_extent.
     void calculate_bounding_box();
 
 public:
+    // Flags which may be given to the constructor
+    enum load_flags
+    {
+        // Map the file into memory and parse it with a hand-written
+        // scanner instead of going through a string stream per line.
+        // Fills the very same lists as the default path.
+        LOAD_MAPPED = 1 << 0,
+
+        // Like LOAD_MAPPED, but split the file into chunks at line
+        // boundaries and scan them on multiple threads. The result is
+        // identical to LOAD_MAPPED.
+        LOAD_PARALLEL = 1 << 1,
+
+        // Load the lists from a binary cache file next to the obj file
+        // ("<filename>.cache") if that is up to date; otherwise, parse the
+        // obj file and (re-)create the cache.
+        LOAD_CACHED = 1 << 2,
+
+        // Merge vertices with exactly the same position after loading
+        // (see weld_vertices)
+        LOAD_WELD = 1 << 3,
+
+        // Split all polygons into triangles after loading (see triangulate)
+        LOAD_TRIANGULATE = 1 << 4,
+
+        // Only parse the vertex positions (skipping all other lines) and
+        // load everything else, including material libraries and textures,
+        // when a getter first needs it. Meant for point clouds, which only
+        // need get_vertices(). Other flags take effect once the rest is
+        // loaded, so with LOAD_WELD the vertex list changes then. An up to
+        // date cache (see LOAD_CACHED and LOAD_SHARED) is always loaded
+        // completely.
+        LOAD_LAZY = 1 << 5,
+
+        // Reorder the triangles for the vertex cache and then the vertices
+        // for fetching them after loading (see optimize_vertex_cache and
+        // optimize_vertex_fetch); best combined with LOAD_TRIANGULATE
+        LOAD_OPTIMIZE = 1 << 6,
+
+        // Generate normals for all face corners without one after loading
+        // (see generate_normals)
+        LOAD_NORMALS = 1 << 7,
+
+        // Take the mesh from a block of shared memory if another process
+        // has loaded a file with the same contents (from the same
+        // directory) with the same content flags (like LOAD_WELD) before
+        // and its material libraries are still the same; otherwise load the
+        // file as usual and publish it there for the next process. The
+        // single-indexed and quantized meshes (see get_indexed_mesh and
+        // get_compact_mesh) are used right from there without copying
+        // them; the lists are only copied once a getter needs them. This is
+        // checked before LOAD_CACHED. Only works on Linux; a block is
+        // removed once no process uses it any longer.
+        LOAD_SHARED = 1 << 8
+    };
+
+    // Precision of the attributes stored by save_compressed, in bits per
+    // component: positions and texture coordinates are quantized within
+    // their bounding box (at most 24 bits), normals in octahedral
+    // coordinates (at most 16 bits)
+    struct codec_options
+    {
+        unsigned position_bits, normal_bits, tex_coord_bits;
+
+        codec_options(void):
+            position_bits(16), normal_bits(12), tex_coord_bits(16)
+        {}
+    };
+
+    // Result of weld_vertices
+    struct weld_stats
+    {
+        size_t vertices_removed;
+        size_t faces_removed;
+    };
+
+    // Result of optimize_vertex_cache: the efficiency of the vertex cache
+    // before and after reordering
+    struct reorder_stats
+    {
+        vertex_cache_stats before, after;
+    };
+
+    // Result of optimize_vertex_fetch: the fetch statistics of the
+    // positions, normals and texture coordinates (summed up) before and
+    // after reordering
+    struct fetch_stats
+    {
+        vertex_fetch_stats before, after;
+    };
+
     // Read the obj file whose name is stored in the variable "filename".
     // After calling this constructor, 3 lists are filled:
     //  * vertices: A list of vec3 elements that contain the vertex positions
@@ -99,9 +507,62 @@ public:
     //  * faces: A list of faces that contain the face positions
     // All three lists can be used from an object of this class by calling
     // the getters below.
-    obj_reader(const std::string &filename);
+    // "flags" is a combination of the load_flags above.
+    // Files ending in .ply or .stl are read as binary PLY resp. STL files
+    // instead (for which LOAD_MAPPED and LOAD_PARALLEL make no difference).
+    obj_reader(const std::string &filename, int flags = 0);
+
+    // Like the constructor above, but if the obj file has to be parsed
+    // (i.e. there is no up to date cache etc.), it is parsed from "data",
+    // its contents read before (e.g. as part of a dake::file_batch), without
+    // reading it again. The data is not needed after construction. Apart
+    // from that, LOAD_MAPPED is always taken to be set.
+    obj_reader(const std::string &filename, const std::vector<char> &data, int flags = 0);
+
+    // Merge all vertices whose positions are at most "tolerance" apart
+    // (with a tolerance of 0, only exact duplicates are merged), remap the
+    // faces' vertex indices and remove the faces which degenerate to less
+    // than three distinct vertices or to no area. Implemented in
+    // obj_weld.cxx.
+    weld_stats weld_vertices(float tolerance = 0.f);
 
-    // Get the list of vertices
+    // Split all faces into triangles: convex ones are fanned, concave ones
+    // are split by ear clipping in their best-fit plane. Faces with less
+    // than three corners are removed, so the face list is a pure triangle
+    // list afterwards. Implemented in obj_triangulate.cxx.
+    void triangulate();
+
+    // Give every face corner without a (valid) normal one: the angle
+    // weighted average of the normals of the faces around its position
+    // which are in the same smoothing group (see face_list::smoothing) and
+    // whose normals differ by at most "crease_angle" degrees from its
+    // face's (180 means any). Faces with smoothing turned off get their own
+    // flat normal, unless no face is in any smoothing group (as in files
+    // without s statements); then all faces are smoothed. The new normals
+    // are appended to the list of normals. Returns how many there are.
+    // Implemented in obj_normals.cxx.
+    size_t generate_normals(float crease_angle = 180.f);
+
+    // Reorder the triangles so that drawing them makes good use of a vertex
+    // cache of "cache_size" entries (see optimize_vertex_cache in
+    // vertex_cache.h). Triangles are only moved within runs of consecutive
+    // triangles with the same material and object/group; other faces stay
+    // where they are. Implemented in obj_vertex_cache.cxx.
+    reorder_stats optimize_vertex_cache(unsigned cache_size = VERTEX_CACHE_SIZE);
+
+    // Renumber the positions, normals and texture coordinates in the order
+    // the faces use them first (those which are not used at all go to the
+    // end), so they are read sequentially when going through the faces.
+    // Meant to be called after optimize_vertex_cache. Implemented in
+    // obj_vertex_cache.cxx.
+    fetch_stats optimize_vertex_fetch();
+
+    // False while a LOAD_LAZY load has not been completed yet, i.e. until
+    // the first getter needing more than the positions has been called
+    bool is_complete(void) const { return !incomplete; }
+
+    // Get the list of vertices (the only getter which never has to
+    // complete a LOAD_LAZY load, just like the bounding box getters)
     const std::vector<dake::vec3> &get_vertices();
 
     // Get the list of normals
@@ -111,11 +572,81 @@ public:
     const std::vector<dake::vec2> &get_tex_coords(void);
 
     // Get the list of faces
-    const std::vector<face> &get_faces();
+    const face_list &get_faces();
+
+    // Get the mesh with one combined vertex list and one index per face
+    // corner. It is built when this is called for the first time.
+    const indexed_mesh &get_indexed_mesh();
+
+    // Get the single-indexed mesh with quantized vertex attributes (see
+    // compact_mesh). It is built when this is called for the first time; if
+    // the full precision mesh has not been built before, it is only built
+    // temporarily, so it does not take up memory alongside the compact one.
+    const compact_mesh &get_compact_mesh();
+
+    // Get the single-indexed mesh split into meshlets (see meshlet_mesh)
+    // of at most MESHLET_MAX_VERTICES vertices and MESHLET_MAX_TRIANGLES
+    // triangles. They are built when this is called for the first time.
+    const meshlet_mesh &get_meshlets();
+
+    // Get the list of objects/groups faces refer to
+    const std::vector<obj_group> &get_groups();
+
+    // Get the faces split into ranges of the same group and material, each
+    // with its own bounding box. They are built when this is called for
+    // the first time.
+    const std::vector<submesh> &get_submeshes();
+
+    // Build a chain of simplified versions of the single-indexed mesh, one
+    // per entry of "ratios" (the fractions of triangles to keep, in
+    // descending order; see simplify_mesh). Levels which would not be
+    // coarser than the previous one are left out. Replaces any levels built
+    // or loaded before.
+    const std::vector<mesh_lod> &build_lods(const std::vector<float> &ratios,
+                                            const simplify_options &opts = simplify_options());
+
+    // Get the levels of detail built by build_lods or loaded by load_lods
+    // (empty if there are none)
+    const std::vector<mesh_lod> &get_lods();
+
+    // Store the levels of detail in the given file, so they can be loaded
+    // later instead of being built again. Returns false if that failed.
+    // Implemented in obj_cache.cxx.
+    bool save_lods(const std::string &filename);
+
+    // Load the levels of detail stored by save_lods. Returns false (and
+    // leaves the levels as they are) if the file does not exist, is
+    // corrupt, or has been built from a different mesh or with different
+    // ratios.
+    bool load_lods(const std::string &filename, const std::vector<float> &ratios);
+
+    // Store the mesh in a compact binary file, which is loaded like an obj
+    // file if its name ends in ".objz" (see obj_codec.cxx). Attributes are
+    // stored with the precision given by "opts" (normals also become unit
+    // length); everything else is kept exactly. Returns false if the file
+    // could not be written.
+    bool save_compressed(const std::string &filename, const codec_options &opts = codec_options());
+
+    // Whether a block of shared memory has been published for the given
+    // file with the given flags (see LOAD_SHARED), so loading it with them
+    // will most likely not need to read it
+    static bool is_shared(const std::string &filename, int flags);
+
+    // Remove the block of shared memory published for the given file when
+    // it has been loaded with the given flags (see LOAD_SHARED) before the
+    // last process using it is done with it; processes using it keep it.
+    // Returns false if there is none.
+    static bool remove_shared(const std::string &filename, int flags);
 
     // Get a specific material
     const material &get_material(const std::string &name);
 
+    // Get the names of the material libraries loaded resp. all materials
+    // from them, in order. These do not complete a LOAD_LAZY load (so they
+    // are empty until something else has).
+    const std::vector<std::string> &get_mtl_files();
+    const std::vector<const material *> &get_materials();
+
     // Get the minimum point of the bounding box
     const dake::vec3 &get_bbox_min();
 
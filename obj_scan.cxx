@@ -0,0 +1,223 @@
+// Scanner shared by the mapped obj_reader loader and the streaming reader.
+// All helpers work on a range [p, e) which is not NUL-terminated and never
+// allocate memory.
+
+#include "obj_scan.h"
+
+#include "dake/parse.h"
+
+#include <cstring>
+
+
+static inline bool is_blank(char c)
+{
+    return (c == ' ') || (c == '\t') || (c == '\r');
+}
+
+static inline const char *skip_blanks(const char *p, const char *e)
+{
+    while ((p < e) && is_blank(*p))
+        p++;
+    return p;
+}
+
+// Checks whether [p, e) starts with the keyword "kw" followed by a blank;
+// if so, returns a pointer to the first character after the blank.
+static inline const char *match_keyword(const char *p, const char *e, const char *kw, size_t kwlen)
+{
+    if ((size_t)(e - p) <= kwlen)
+        return NULL;
+    if (memcmp(p, kw, kwlen) || !is_blank(p[kwlen]))
+        return NULL;
+    return p + kwlen + 1;
+}
+
+// Like match_keyword, but the keyword may also end the line (as in a bare
+// "g"), in which case "e" is returned
+static inline const char *match_statement(const char *p, const char *e, const char *kw, size_t kwlen)
+{
+    if (((size_t)(e - p) == kwlen) && !memcmp(p, kw, kwlen))
+        return e;
+    return match_keyword(p, e, kw, kwlen);
+}
+
+// Parse a floating point number starting at p (after skipping blanks)
+static inline bool scan_float(const char *&p, const char *e, float &out)
+{
+    p = skip_blanks(p, e);
+    return dake::parse_float(p, e, out);
+}
+
+// Read "count" floats into "dst"; missing values are left untouched
+static void scan_floats(const char *p, const char *e, float *dst, int count)
+{
+    for (int i = 0; i < count; i++)
+        if (!scan_float(p, e, dst[i]))
+            break;
+}
+
+// Parse one face corner (v, v/t, v//n or v/t/n). Relative (negative)
+// indices are resolved against the given list sizes. Returns -1 on a
+// syntax error, or else a mask of the relative indices encountered (see
+// obj_chunk::relative_corner).
+static int scan_corner(const char *&p, const char *e, face_corner &c, int nv, int nt, int nn)
+{
+    int relative = 0;
+
+    c.index_vertex = c.index_texcoord = c.index_normal = -1;
+
+    if (!dake::parse_int(p, e, c.index_vertex))
+        return -1;
+    if (c.index_vertex < 0)
+    {
+        c.index_vertex += nv + 1;
+        relative |= 1;
+    }
+
+    if ((p < e) && (*p == '/'))
+    {
+        p++;
+        if ((p < e) && (*p != '/'))
+        {
+            if (!dake::parse_int(p, e, c.index_texcoord))
+                return -1;
+            if (c.index_texcoord < 0)
+            {
+                c.index_texcoord += nt + 1;
+                relative |= 2;
+            }
+        }
+
+        if ((p < e) && (*p == '/'))
+        {
+            p++;
+            if (!dake::parse_int(p, e, c.index_normal))
+                return -1;
+            if (c.index_normal < 0)
+            {
+                c.index_normal += nn + 1;
+                relative |= 4;
+            }
+        }
+    }
+
+    if ((p < e) && !is_blank(*p) && (*p != '\n'))
+        return -1;
+
+    return relative;
+}
+
+
+void scan_obj(const char *p, const char *end, obj_chunk &chunk, bool positions_only)
+{
+    while (p < end)
+    {
+        p = skip_blanks(p, end);
+        if (p >= end)
+            break;
+
+        const char *eol = static_cast<const char *>(memchr(p, '\n', end - p));
+        if (!eol)
+            eol = end;
+
+        const char *arg;
+
+        if (positions_only)
+        {
+            if ((arg = match_keyword(p, eol, "v", 1)) != NULL)
+            {
+                dake::vec3 new_vertex;
+                scan_floats(arg, eol, new_vertex, 3);
+                chunk.vertices.push_back(new_vertex);
+            }
+        }
+        else if (*p == 'v')
+        {
+            if ((arg = match_keyword(p, eol, "v", 1)) != NULL)
+            {
+                dake::vec3 new_vertex;
+                scan_floats(arg, eol, new_vertex, 3);
+                chunk.vertices.push_back(new_vertex);
+            }
+            else if ((arg = match_keyword(p, eol, "vn", 2)) != NULL)
+            {
+                dake::vec3 new_normal;
+                scan_floats(arg, eol, new_normal, 3);
+                chunk.normals.push_back(new_normal);
+            }
+            else if ((arg = match_keyword(p, eol, "vt", 2)) != NULL)
+            {
+                dake::vec2 new_tex_coord;
+                scan_floats(arg, eol, new_tex_coord, 2);
+                chunk.tex_coords.push_back(new_tex_coord);
+            }
+        }
+        else if ((arg = match_keyword(p, eol, "f", 1)) != NULL)
+        {
+            chunk.faces.begin_face(NULL);
+
+            for (;;)
+            {
+                arg = skip_blanks(arg, eol);
+                if (arg >= eol)
+                    break;
+
+                face_corner new_corner;
+                int relative = scan_corner(arg, eol, new_corner, chunk.vertices.size(), chunk.tex_coords.size(), chunk.normals.size());
+                if (relative < 0)
+                    throw 42;
+
+                if (relative)
+                {
+                    obj_chunk::relative_corner rc = { chunk.faces.corners.size(), relative };
+                    chunk.relative.push_back(rc);
+                }
+
+                chunk.faces.add_corner(new_corner);
+            }
+        }
+        else if (((arg = match_statement(p, eol, "mtllib", 6)) != NULL) ||
+                 ((arg = match_statement(p, eol, "usemtl", 6)) != NULL) ||
+                 ((arg = match_statement(p, eol, "o", 1)) != NULL) ||
+                 ((arg = match_statement(p, eol, "g", 1)) != NULL) ||
+                 ((arg = match_statement(p, eol, "s", 1)) != NULL))
+        {
+            // These statements are rare; they are only recorded here and
+            // executed in order by whoever puts the chunks together
+            obj_chunk::statement st;
+
+            switch (*p)
+            {
+                case 'm': st.kind = obj_chunk::statement::MTLLIB; break;
+                case 'u': st.kind = obj_chunk::statement::USEMTL; break;
+                case 'o': st.kind = obj_chunk::statement::OBJECT; break;
+                case 's': st.kind = obj_chunk::statement::SMOOTHING; break;
+                default:  st.kind = obj_chunk::statement::GROUP; break;
+            }
+
+            const char *arg_end = eol;
+            arg = skip_blanks(arg, eol);
+            while ((arg_end > arg) && is_blank(arg_end[-1]))
+                arg_end--;
+
+            st.face_count = chunk.faces.size();
+            st.arg = std::string(arg, arg_end);
+            st.mat = NULL;
+            st.group = st.smoothing = 0;
+            chunk.statements.push_back(st);
+        }
+
+        p = (eol < end) ? eol + 1 : end;
+    }
+}
+
+
+unsigned parse_smoothing_group(const std::string &arg)
+{
+    const char *p = arg.c_str();
+    int group;
+
+    if (!dake::parse_int(p, p + arg.length(), group) || (group < 0))
+        return 0;
+    return group;
+}
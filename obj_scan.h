@@ -0,0 +1,79 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "dake/vector.h"
+
+#include "obj_reader.h"
+
+
+// Everything the scanner found in one range of an OBJ file. Lists are local
+// to the range; obj_reader::merge() resp. the streaming reader put them
+// together.
+struct obj_chunk
+{
+    std::vector<dake::vec3> vertices;
+    std::vector<dake::vec3> normals;
+    std::vector<dake::vec2> tex_coords;
+    // The corners are put into one growing list, which serves as an arena
+    // for all faces of the chunk
+    face_list faces;
+
+    // A mtllib, usemtl, o, g or s statement together with the number of
+    // faces defined before it in this chunk, in file order. "arg" is the
+    // rest of the line without leading and trailing blanks; "mat", "group"
+    // and "smoothing" are set by whoever executes the statement.
+    struct statement
+    {
+        enum kind_type
+        {
+            MTLLIB,
+            USEMTL,
+            OBJECT,
+            GROUP,
+            SMOOTHING
+        } kind;
+
+        size_t face_count;
+        std::string arg;
+        const material *mat;
+        unsigned group, smoothing;
+    };
+    std::vector<statement> statements;
+
+    // A face corner with relative indices, which have only been resolved
+    // against this chunk's lists so far. "mask" has bit 0 set for the
+    // vertex index, bit 1 for the texture coordinate and bit 2 for the
+    // normal index.
+    struct relative_corner
+    {
+        size_t corner;
+        int mask;
+    };
+    std::vector<relative_corner> relative;
+
+    // Empty all lists, keeping their memory for the next range
+    void clear(void)
+    {
+        vertices.clear();
+        normals.clear();
+        tex_coords.clear();
+        faces.clear();
+        statements.clear();
+        relative.clear();
+    }
+};
+
+
+// Scan all definitions in the range [p, end) into "chunk", which must
+// start out empty. The range has to consist of whole lines. Geometry lines
+// are parsed in place without creating any strings or streams; faces get
+// no material (see obj_chunk::statements). With "positions_only", all lines
+// but vertex definitions are skipped. This touches nothing but "chunk" and
+// may thus run on several ranges concurrently. Implemented in obj_scan.cxx.
+void scan_obj(const char *p, const char *end, obj_chunk &chunk, bool positions_only = false);
+
+// The smoothing group given by the argument of an s statement: 0 for "off"
+// (or anything else which is not a number)
+unsigned parse_smoothing_group(const std::string &arg);
@@ -0,0 +1,104 @@
+// Binary STL import for obj_reader: Fills the very same lists as loading an
+// OBJ file. Every triangle gets three positions of its own (LOAD_WELD merges
+// them) and its facet normal for all three corners, unless that is zero, in
+// which case the corners get no normal (see LOAD_NORMALS). ASCII STL files
+// are not supported.
+//
+// STL files are always little endian; on such machines the positions of
+// every triangle are copied from the mapped file with a single memcpy.
+
+#include "obj_reader.h"
+
+#include "dake/byte_order.h"
+#include "dake/mapped_file.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <stdint.h>
+
+
+// Size of the header (including the triangle count) and of every triangle
+#define STL_HEADER_SIZE     84
+#define STL_TRIANGLE_SIZE   50
+
+
+bool obj_reader::load_stl(const std::string &filename, bool positions_only)
+{
+    dake::mapped_file file(filename);
+    if (!file.is_open())
+        return false;
+
+    const char *data = file.begin();
+    size_t count = 0;
+
+    if (file.size() >= STL_HEADER_SIZE)
+        count = dake::load_value<uint32_t>(data + 80, false);
+
+    if ((file.size() < STL_HEADER_SIZE) || ((file.size() - STL_HEADER_SIZE) / STL_TRIANGLE_SIZE < count))
+    {
+        // Binary files may start with "solid" just as well, but they do not
+        // go on with "facet" (as text)
+        std::string start(data, std::min(file.size(), (size_t)512));
+        if (!start.compare(0, 5, "solid") && (start.find("facet") != std::string::npos))
+            fprintf(stderr, "%s: ASCII STL files are not supported\n", filename.c_str());
+        else
+            fprintf(stderr, "%s: Truncated STL file\n", filename.c_str());
+        return false;
+    }
+
+    const char *tri = data + STL_HEADER_SIZE;
+    bool native = dake::little_endian();
+
+    size_t first_vertex = vertices.size();
+    vertices.resize(first_vertex + 3 * count);
+    float *pos = reinterpret_cast<float *>(vertices.data() + first_vertex);
+
+    for (size_t t = 0; t < count; t++)
+    {
+        const char *src = tri + t * STL_TRIANGLE_SIZE + 12;
+        if (native)
+            memcpy(pos + 9 * t, src, 36);
+        else
+            for (int i = 0; i < 9; i++)
+                pos[9 * t + i] = dake::load_value<float>(src + 4 * i, false);
+    }
+
+    if (positions_only)
+        return true;
+
+
+    faces.offsets.reserve(faces.offsets.size() + count);
+    faces.corners.reserve(faces.corners.size() + 3 * count);
+
+    for (size_t t = 0; t < count; t++)
+    {
+        const char *src = tri + t * STL_TRIANGLE_SIZE;
+        dake::vec3 n(dake::load_value<float>(src, false), dake::load_value<float>(src + 4, false),
+                     dake::load_value<float>(src + 8, false));
+
+        int normal_index = -1;
+        if ((n.x() != 0.f) || (n.y() != 0.f) || (n.z() != 0.f))
+        {
+            normals.push_back(n);
+            normal_index = normals.size();
+        }
+
+        for (int i = 0; i < 3; i++)
+        {
+            face_corner fc;
+            fc.index_vertex = first_vertex + 3 * t + i + 1;
+            fc.index_normal = normal_index;
+            fc.index_texcoord = -1;
+            faces.corners.push_back(fc);
+        }
+        faces.offsets.push_back(faces.corners.size());
+    }
+
+    faces.mats.insert(faces.mats.end(), count, current_mat);
+    faces.groups.insert(faces.groups.end(), count, current_group);
+    faces.smoothing.insert(faces.smoothing.end(), count, current_smoothing);
+
+    return true;
+}
@@ -0,0 +1,229 @@
+// Streaming OBJ reader: reads a file through a fixed-size window, scans
+// whole lines with the mapped loader's scanner and passes what it found to
+// a consumer before reading on.
+
+#include "obj_stream.h"
+#include "obj_scan.h"
+
+#include "dake/path.h"
+
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <sstream>
+
+
+// Hand everything in "chunk" to the consumer. "vbase", "tbase" and "nbase"
+// are the numbers of vertices, texture coordinates and normals passed on
+// before; they are updated.
+static void pass_on(obj_chunk &chunk, obj_consumer &consumer, const std::string &dir,
+                    size_t &vbase, size_t &tbase, size_t &nbase)
+{
+    // Relative indices refer to everything before this chunk, too
+    for (std::vector<obj_chunk::relative_corner>::const_iterator ri = chunk.relative.begin(); ri != chunk.relative.end(); ri++)
+    {
+        face_corner &fc = chunk.faces.corners[ri->corner];
+
+        if (ri->mask & 1)
+            fc.index_vertex += vbase;
+        if (ri->mask & 2)
+            fc.index_texcoord += tbase;
+        if (ri->mask & 4)
+            fc.index_normal += nbase;
+    }
+
+    if (!chunk.vertices.empty())
+        consumer.add_vertices(&chunk.vertices[0], chunk.vertices.size());
+    if (!chunk.normals.empty())
+        consumer.add_normals(&chunk.normals[0], chunk.normals.size());
+    if (!chunk.tex_coords.empty())
+        consumer.add_tex_coords(&chunk.tex_coords[0], chunk.tex_coords.size());
+
+    vbase += chunk.vertices.size();
+    tbase += chunk.tex_coords.size();
+    nbase += chunk.normals.size();
+
+    // Interleave the faces with the statements between them
+    size_t first = 0;
+    for (std::vector<obj_chunk::statement>::const_iterator si = chunk.statements.begin(); si != chunk.statements.end(); si++)
+    {
+        if (si->face_count > first)
+            consumer.add_faces(chunk.faces, first, si->face_count - first);
+        first = si->face_count;
+
+        std::stringstream line(si->arg);
+        std::string name;
+        line >> name;
+
+        switch (si->kind)
+        {
+            case obj_chunk::statement::MTLLIB:
+                consumer.material_lib(name[0] == '/' ? name : dir + "/" + name);
+                break;
+            case obj_chunk::statement::USEMTL:
+                consumer.use_material(name);
+                break;
+            case obj_chunk::statement::OBJECT:
+                consumer.object(si->arg);
+                break;
+            case obj_chunk::statement::GROUP:
+                consumer.group(si->arg);
+                break;
+            case obj_chunk::statement::SMOOTHING:
+                consumer.smoothing_group(parse_smoothing_group(si->arg));
+                break;
+        }
+    }
+
+    if (chunk.faces.size() > first)
+        consumer.add_faces(chunk.faces, first, chunk.faces.size() - first);
+}
+
+
+bool read_obj_stream(const std::string &filename, obj_consumer &consumer, size_t window)
+{
+    FILE *fp = fopen(filename.c_str(), "rb");
+    if (!fp)
+        return false;
+
+    std::string dir = dake::directory_of(filename);
+
+    std::vector<char> buf(window ? window : 1);
+    size_t filled = 0;
+    bool eof = false;
+
+    obj_chunk chunk;
+    size_t vbase = 0, tbase = 0, nbase = 0;
+
+    try
+    {
+        while (!eof || filled)
+        {
+            if (!eof)
+            {
+                filled += fread(&buf[filled], 1, buf.size() - filled, fp);
+                if (filled < buf.size())
+                {
+                    if (ferror(fp))
+                    {
+                        fclose(fp);
+                        return false;
+                    }
+                    eof = true;
+                }
+            }
+
+            // Only scan whole lines; the incomplete one at the end is kept
+            // for the next round
+            size_t len = filled;
+            if (!eof)
+            {
+                while (len && (buf[len - 1] != '\n'))
+                    len--;
+
+                if (!len)
+                {
+                    // This line does not fit into the window at all
+                    buf.resize(buf.size() * 2);
+                    continue;
+                }
+            }
+
+            scan_obj(&buf[0], &buf[0] + len, chunk);
+            pass_on(chunk, consumer, dir, vbase, tbase, nbase);
+            chunk.clear();
+
+            memmove(&buf[0], &buf[len], filled - len);
+            filled -= len;
+        }
+    }
+    catch (...)
+    {
+        fclose(fp);
+        throw;
+    }
+
+    fclose(fp);
+    return true;
+}
+
+
+
+
+obj_stream_stats::obj_stream_stats(void):
+    vertex_count(0), normal_count(0), tex_coord_count(0),
+    face_count(0), corner_count(0), triangle_count(0),
+    material_lib_count(0), material_switch_count(0),
+    object_count(0), group_count(0)
+{
+    bbox_max = -std::numeric_limits<float>::max();
+    bbox_min = -bbox_max;
+}
+
+
+void obj_stream_stats::add_vertices(const dake::vec3 *v, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            if (v[i][j] < bbox_min[j])
+                bbox_min[j] = v[i][j];
+            if (v[i][j] > bbox_max[j])
+                bbox_max[j] = v[i][j];
+        }
+    }
+
+    vertex_count += count;
+}
+
+
+void obj_stream_stats::add_normals(const dake::vec3 *, size_t count)
+{
+    normal_count += count;
+}
+
+
+void obj_stream_stats::add_tex_coords(const dake::vec2 *, size_t count)
+{
+    tex_coord_count += count;
+}
+
+
+void obj_stream_stats::add_faces(const face_list &list, size_t first, size_t count)
+{
+    for (size_t i = first; i < first + count; i++)
+    {
+        size_t corners = list.offsets[i + 1] - list.offsets[i];
+
+        corner_count += corners;
+        if (corners >= 3)
+            triangle_count += corners - 2;
+    }
+
+    face_count += count;
+}
+
+
+void obj_stream_stats::material_lib(const std::string &)
+{
+    material_lib_count++;
+}
+
+
+void obj_stream_stats::use_material(const std::string &)
+{
+    material_switch_count++;
+}
+
+
+void obj_stream_stats::object(const std::string &)
+{
+    object_count++;
+}
+
+
+void obj_stream_stats::group(const std::string &)
+{
+    group_count++;
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "dake/vector.h"
+
+#include "obj_reader.h"
+
+
+// Default number of bytes read_obj_stream() scans at once
+#define OBJ_STREAM_WINDOW (1 << 20)
+
+
+// Receives the contents of an OBJ file from read_obj_stream(), in file
+// order and in batches. The data passed to any method is only valid during
+// that call. All methods do nothing by default.
+class obj_consumer
+{
+    public:
+        virtual ~obj_consumer(void) {}
+
+        // New vertices, normals resp. texture coordinates. Their indices
+        // continue where the previous batch ended.
+        virtual void add_vertices(const dake::vec3 *, size_t) {}
+        virtual void add_normals(const dake::vec3 *, size_t) {}
+        virtual void add_tex_coords(const dake::vec2 *, size_t) {}
+
+        // The faces [first, first + count) of "list". All corner indices are
+        // absolute (relative ones have been resolved already), but only refer
+        // to elements passed in earlier calls. The faces' materials are not
+        // set; they use the material named in the last use_material() call.
+        // Their groups and smoothing groups are not set either, see
+        // object(), group() and smoothing_group().
+        virtual void add_faces(const face_list &, size_t, size_t) {}
+
+        // A mtllib statement, with the library's name resolved against the
+        // OBJ file's directory
+        virtual void material_lib(const std::string &) {}
+
+        // A usemtl statement
+        virtual void use_material(const std::string &) {}
+
+        // An o resp. g statement, with the name(s) following it
+        virtual void object(const std::string &) {}
+        virtual void group(const std::string &) {}
+
+        // An s statement; 0 means smoothing is off
+        virtual void smoothing_group(unsigned) {}
+};
+
+
+// Read an OBJ file piece by piece, handing everything in it to "consumer".
+// At most "window" bytes of the file are scanned at once (a little more if
+// a single line is longer than that), so the memory used does not depend on
+// the size of the file. Uses the same scanner as obj_reader::LOAD_MAPPED.
+// Returns false if the file could not be read; throws on syntax errors.
+bool read_obj_stream(const std::string &filename, obj_consumer &consumer, size_t window = OBJ_STREAM_WINDOW);
+
+
+// Consumer counting the elements of a file and calculating its bounding box
+class obj_stream_stats: public obj_consumer
+{
+    public:
+        size_t vertex_count, normal_count, tex_coord_count;
+        size_t face_count, corner_count;
+        // Number of triangles the faces would make when triangulated
+        size_t triangle_count;
+        size_t material_lib_count, material_switch_count;
+        size_t object_count, group_count;
+
+        // The same values obj_reader::get_bbox_min() resp. _max() would
+        // return
+        dake::vec3 bbox_min, bbox_max;
+
+        obj_stream_stats(void);
+
+        void add_vertices(const dake::vec3 *v, size_t count);
+        void add_normals(const dake::vec3 *n, size_t count);
+        void add_tex_coords(const dake::vec2 *t, size_t count);
+        void add_faces(const face_list &list, size_t first, size_t count);
+        void material_lib(const std::string &filename);
+        void use_material(const std::string &name);
+        void object(const std::string &name);
+        void group(const std::string &name);
+};
+
+
+// Consumer converting an OBJ file into the binary cache file obj_reader
+// loads with LOAD_CACHED (without any other content flags), so huge files
+// can be converted without ever holding them in memory. The lists are
+// spooled into temporary files and put together by finish(). Implemented in
+// obj_cache.cxx.
+//
+//     obj_cache_converter conv(filename);
+//     if (read_obj_stream(filename, conv))
+//         conv.finish();
+class obj_cache_converter: public obj_consumer
+{
+    private:
+        enum section
+        {
+            SEC_VERTICES,
+            SEC_NORMALS,
+            SEC_TEX_COORDS,
+            SEC_OFFSETS,
+            SEC_MATERIALS,
+            SEC_GROUPS,
+            SEC_SMOOTHING,
+            SEC_CORNERS,
+
+            SEC_COUNT
+        };
+
+        std::string filename, dirname;
+        FILE *sections[SEC_COUNT];
+        bool failed;
+
+        std::vector<material> materials;
+        std::vector<std::string> mtl_files;
+        int32_t current_mat;
+        std::vector<obj_group> groups;
+        uint32_t current_group;
+        uint32_t current_smoothing;
+
+        uint64_t vertex_count, normal_count, tex_coord_count;
+        uint64_t face_count, corner_count;
+        dake::vec3 bbox_min, bbox_max;
+
+        void put(section sec, const void *data, size_t len);
+
+        obj_cache_converter(const obj_cache_converter &);
+        obj_cache_converter &operator=(const obj_cache_converter &);
+
+    public:
+        // "filename" is the OBJ file to be converted; it has to be given
+        // exactly the same way obj_reader will get it later
+        obj_cache_converter(const std::string &filename);
+        ~obj_cache_converter(void);
+
+        void add_vertices(const dake::vec3 *v, size_t count);
+        void add_normals(const dake::vec3 *n, size_t count);
+        void add_tex_coords(const dake::vec2 *t, size_t count);
+        void add_faces(const face_list &list, size_t first, size_t count);
+        void material_lib(const std::string &filename);
+        void use_material(const std::string &name);
+        void object(const std::string &name);
+        void group(const std::string &name);
+        void smoothing_group(unsigned group);
+
+        // Write the cache file. Returns false if that failed.
+        bool finish(void);
+};
@@ -0,0 +1,177 @@
+// Triangulation for obj_reader: Splits all polygons into triangles, so the
+// face list becomes a pure triangle list.
+//
+// Convex polygons are simply fanned. Concave ones are projected onto their
+// plane (as given by the Newell normal, which is the best fit for
+// non-planar polygons) and split by ear clipping.
+
+#include "obj_reader.h"
+
+#include <cmath>
+#include <vector>
+
+
+struct tri_point
+{
+    float x, y;
+};
+
+// Twice the signed area of the triangle abc (positive if counterclockwise)
+static inline float cross2(const tri_point &a, const tri_point &b, const tri_point &c)
+{
+    return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+}
+
+// Whether p lies inside or on the border of the counterclockwise triangle abc
+static inline bool in_triangle(const tri_point &p, const tri_point &a, const tri_point &b, const tri_point &c)
+{
+    return (cross2(a, b, p) >= 0.f) && (cross2(b, c, p) >= 0.f) && (cross2(c, a, p) >= 0.f);
+}
+
+
+// Split the polygon given by "corners" (count of them) into triangles,
+// appending the indices of the corners of each triangle (relative to
+// "corners") to "out"
+static void triangulate_polygon(const face_corner *corners, size_t count, const std::vector<dake::vec3> &positions,
+                                std::vector<size_t> &out)
+{
+    std::vector<dake::vec3> pos(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        int vi = corners[i].index_vertex;
+        if ((vi > 0) && ((size_t)vi <= positions.size()))
+            pos[i] = positions[vi - 1];
+    }
+
+    // Newell normal
+    dake::vec3 n(0.f, 0.f, 0.f);
+    for (size_t i = 0; i < count; i++)
+    {
+        const dake::vec3 &a = pos[i], &b = pos[(i + 1) % count];
+        n.x() += (a.y() - b.y()) * (a.z() + b.z());
+        n.y() += (a.z() - b.z()) * (a.x() + b.x());
+        n.z() += (a.x() - b.x()) * (a.y() + b.y());
+    }
+
+    // Basis of the plane, chosen so that the polygon is counterclockwise
+    // in it
+    dake::vec3 u, v;
+    if (fabsf(n.x()) > fabsf(n.y()))
+        u = dake::vec3(-n.z(), 0.f, n.x());
+    else
+        u = dake::vec3(0.f, n.z(), -n.y());
+    v = n ^ u;
+
+    std::vector<tri_point> p(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        p[i].x = pos[i].dot(u);
+        p[i].y = pos[i].dot(v);
+    }
+
+    bool convex = true;
+    for (size_t i = 0; (i < count) && convex; i++)
+        if (cross2(p[i], p[(i + 1) % count], p[(i + 2) % count]) < 0.f)
+            convex = false;
+
+    if (convex)
+    {
+        for (size_t i = 1; i + 1 < count; i++)
+        {
+            out.push_back(0);
+            out.push_back(i);
+            out.push_back(i + 1);
+        }
+        return;
+    }
+
+
+    // Ear clipping on a doubly linked ring of the remaining corners
+    std::vector<size_t> prev(count), next(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        prev[i] = (i + count - 1) % count;
+        next[i] = (i + 1) % count;
+    }
+
+    size_t remaining = count, cur = 0, tries = 0;
+    while (remaining > 3)
+    {
+        size_t a = prev[cur], b = cur, c = next[cur];
+        bool ear = cross2(p[a], p[b], p[c]) > 0.f;
+
+        // No other remaining corner may lie within the ear
+        for (size_t k = next[c]; ear && (k != a); k = next[k])
+            if (in_triangle(p[k], p[a], p[b], p[c]))
+                ear = false;
+
+        // If there is no proper ear left (because of degenerate or self
+        // intersecting input), cut off any corner to make progress
+        if (ear || (tries >= remaining))
+        {
+            out.push_back(a);
+            out.push_back(b);
+            out.push_back(c);
+
+            next[a] = c;
+            prev[c] = a;
+            remaining--;
+            tries = 0;
+            cur = a;
+        }
+        else
+        {
+            cur = c;
+            tries++;
+        }
+    }
+
+    out.push_back(prev[cur]);
+    out.push_back(cur);
+    out.push_back(next[cur]);
+}
+
+
+
+
+void obj_reader::triangulate()
+{
+    complete_lists();
+
+    face_list tris;
+    std::vector<size_t> tri_indices;
+
+    tris.corners.reserve(faces.corners.size() * 3 / 2);
+
+    for (size_t i = 0; i < faces.size(); i++)
+    {
+        size_t first = faces.offsets[i], count = faces.offsets[i + 1] - first;
+        const face_corner *c = &faces.corners[first];
+
+        // Points and lines do not make any triangles
+        if (count < 3)
+            continue;
+
+        if (count == 3)
+        {
+            tris.begin_face(faces.mats[i], faces.groups[i], faces.smoothing[i]);
+            for (size_t j = 0; j < 3; j++)
+                tris.add_corner(c[j]);
+            continue;
+        }
+
+        tri_indices.clear();
+        triangulate_polygon(c, count, vertices, tri_indices);
+
+        for (size_t j = 0; j < tri_indices.size(); j += 3)
+        {
+            tris.begin_face(faces.mats[i], faces.groups[i], faces.smoothing[i]);
+            for (size_t k = 0; k < 3; k++)
+                tris.add_corner(c[tri_indices[j + k]]);
+        }
+    }
+
+    faces.swap(tris);
+
+    invalidate_derived();
+}
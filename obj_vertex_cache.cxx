@@ -0,0 +1,171 @@
+// Vertex cache and fetch optimization for obj_reader (see vertex_cache.h).
+//
+// optimize_vertex_cache reorders the triangles so the GPU's post-transform
+// vertex cache is used well. Faces are only reordered within runs of
+// consecutive triangles with the same material and object/group, so batches
+// and submeshes stay the same. Every run is optimized on its own, with its
+// vertices renumbered densely so the pass stays linear in the number of
+// faces.
+//
+// optimize_vertex_fetch then renumbers the positions, normals and texture
+// coordinates in the order the faces use them, so walking over the faces
+// walks over the lists (mostly) sequentially.
+
+#include "obj_reader.h"
+#include "vertex_cache.h"
+
+#include <vector>
+#include <stdint.h>
+
+
+// Renumber "list" in the order the corners' "index" (one based) first refers
+// to its elements and remap the corners accordingly. Adds the fetch
+// statistics of the list before and after to "stats".
+template<typename T>
+static void reorder_list(std::vector<T> &list, std::vector<face_corner> &corners, int face_corner::*index,
+                         obj_reader::fetch_stats &stats)
+{
+    std::vector<uint32_t> indices, remap;
+    indices.reserve(corners.size());
+
+    for (std::vector<face_corner>::const_iterator ci = corners.begin(); ci != corners.end(); ci++)
+        if (((*ci).*index > 0) && ((size_t)((*ci).*index) <= list.size()))
+            indices.push_back((*ci).*index - 1);
+
+    stats.before += measure_vertex_fetch(indices.data(), indices.size(), list.size(), sizeof(T));
+
+    optimize_vertex_fetch(indices.data(), indices.size(), list.size(), remap);
+
+    std::vector<T> reordered(list.size());
+    for (size_t i = 0; i < list.size(); i++)
+        reordered[remap[i]] = list[i];
+    list.swap(reordered);
+
+    for (std::vector<face_corner>::iterator ci = corners.begin(); ci != corners.end(); ci++)
+        if (((*ci).*index > 0) && ((size_t)((*ci).*index) <= list.size()))
+            (*ci).*index = remap[(*ci).*index - 1] + 1;
+
+    for (std::vector<uint32_t>::iterator ii = indices.begin(); ii != indices.end(); ii++)
+        *ii = remap[*ii];
+
+    stats.after += measure_vertex_fetch(indices.data(), indices.size(), list.size(), sizeof(T));
+}
+
+
+obj_reader::reorder_stats obj_reader::optimize_vertex_cache(unsigned cache_size)
+{
+    complete_lists();
+
+    reorder_stats stats;
+
+    // The single-indexed vertex of every corner, as the GPU caches vertices
+    // by their index
+    indexed_mesh temp;
+    const indexed_mesh *mesh = &indexed;
+    if (indexed.batches.empty())
+    {
+        temp.build(vertices, normals, tex_coords, faces);
+        mesh = &temp;
+    }
+
+    stats.before = measure_vertex_cache(*mesh, cache_size);
+
+    face_list reordered;
+    reordered.corners.reserve(faces.corners.size());
+
+    // Index of every vertex within the current run, or UINT32_MAX
+    std::vector<uint32_t> local(mesh->vertices.size(), UINT32_MAX);
+    std::vector<uint32_t> run_vertices, run_indices, order;
+
+    // Fanned triangles in the new order, for measuring the result
+    std::vector<uint32_t> tris;
+
+    size_t i = 0;
+    while (i < faces.size())
+    {
+        size_t first = faces.offsets[i];
+
+        if (faces.offsets[i + 1] - first != 3)
+        {
+            reordered.begin_face(faces.mats[i], faces.groups[i], faces.smoothing[i]);
+            for (size_t c = first; c < faces.offsets[i + 1]; c++)
+                reordered.add_corner(faces.corners[c]);
+
+            for (size_t c = first + 2; c < faces.offsets[i + 1]; c++)
+            {
+                tris.push_back(mesh->index(first));
+                tris.push_back(mesh->index(c - 1));
+                tris.push_back(mesh->index(c));
+            }
+
+            i++;
+            continue;
+        }
+
+        // Find the run of triangles starting here
+        size_t end = i + 1;
+        while ((end < faces.size()) && (faces.offsets[end + 1] - faces.offsets[end] == 3) &&
+               (faces.mats[end] == faces.mats[i]) && (faces.groups[end] == faces.groups[i]))
+        {
+            end++;
+        }
+
+        run_indices.clear();
+        for (size_t c = first; c < faces.offsets[end]; c++)
+        {
+            uint32_t v = mesh->index(c);
+            if (local[v] == UINT32_MAX)
+            {
+                local[v] = run_vertices.size();
+                run_vertices.push_back(v);
+            }
+            run_indices.push_back(local[v]);
+        }
+
+        ::optimize_vertex_cache(run_indices.data(), run_indices.size(), run_vertices.size(), order, cache_size);
+
+        for (std::vector<uint32_t>::const_iterator ti = order.begin(); ti != order.end(); ti++)
+        {
+            size_t face = i + *ti;
+
+            reordered.begin_face(faces.mats[face], faces.groups[face], faces.smoothing[face]);
+            for (size_t c = faces.offsets[face]; c < faces.offsets[face + 1]; c++)
+            {
+                reordered.add_corner(faces.corners[c]);
+                tris.push_back(mesh->index(c));
+            }
+        }
+
+        for (std::vector<uint32_t>::const_iterator vi = run_vertices.begin(); vi != run_vertices.end(); vi++)
+            local[*vi] = UINT32_MAX;
+        run_vertices.clear();
+
+        i = end;
+    }
+
+    stats.after = measure_vertex_cache(tris.data(), tris.size(), mesh->vertices.size(), cache_size);
+
+    faces.swap(reordered);
+
+    invalidate_derived();
+
+    return stats;
+}
+
+
+
+obj_reader::fetch_stats obj_reader::optimize_vertex_fetch()
+{
+    complete_lists();
+
+    fetch_stats stats;
+
+    reorder_list(vertices, faces.corners, &face_corner::index_vertex, stats);
+    reorder_list(normals, faces.corners, &face_corner::index_normal, stats);
+    reorder_list(tex_coords, faces.corners, &face_corner::index_texcoord, stats);
+
+    // The single-indexed mesh does not change, as its vertices are created
+    // in the order of the faces anyway, and so does nothing built from it
+
+    return stats;
+}
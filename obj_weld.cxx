@@ -0,0 +1,292 @@
+// Vertex welding for obj_reader: Merges vertex positions which are closer
+// to each other than a given tolerance and removes the faces which
+// degenerate by doing so.
+//
+// Vertices are sorted into a hash grid with cells as wide as the tolerance,
+// so every vertex only has to be compared against the vertices kept so far
+// in the 27 cells around it, which makes the pass run in about linear time.
+
+#include "obj_reader.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <stdint.h>
+
+
+// Integer coordinates of a grid cell
+struct weld_cell
+{
+    int64_t x, y, z;
+
+    bool operator==(const weld_cell &c) const
+    { return (x == c.x) && (y == c.y) && (z == c.z); }
+};
+
+static inline uint64_t hash_cell(const weld_cell &c)
+{
+    uint64_t h = (uint64_t)c.x * UINT64_C(0x9e3779b97f4a7c15)
+               ^ (uint64_t)c.y * UINT64_C(0xc2b2ae3d27d4eb4f)
+               ^ (uint64_t)c.z * UINT64_C(0x165667b19e3779f9);
+    return h ^ (h >> 31);
+}
+
+
+// Limit of the cell coordinates, so they fit into an int64_t even for
+// tiny tolerances (far beyond it, distinct cells may be merged into one,
+// which only costs time)
+#define MAX_CELL 4.e18
+
+// Cell of a (finite) position. Without a tolerance, only exactly equal
+// positions are merged; then, the cell is just the position's bit pattern.
+static inline weld_cell cell_of(const dake::vec3 &v, float tolerance)
+{
+    weld_cell c;
+    int64_t *co[3] = { &c.x, &c.y, &c.z };
+
+    for (int i = 0; i < 3; i++)
+    {
+        if (tolerance > 0.f)
+        {
+            double cell = floor((double)v[i] / tolerance);
+            *co[i] = (int64_t)((cell < -MAX_CELL) ? -MAX_CELL : (cell > MAX_CELL) ? MAX_CELL : cell);
+        }
+        else
+        {
+            // +0 and -0 are equal
+            float f = v[i] + 0.f;
+            uint32_t bits;
+            memcpy(&bits, &f, sizeof(bits));
+            *co[i] = bits;
+        }
+    }
+
+    return c;
+}
+
+
+// Whether the polygon with the given corners (at least three, without
+// consecutive repeats) has collapsed: it has less than three distinct
+// vertices or no area (by its Newell normal, relative to its perimeter).
+// Polygons with vertex indices out of range are never taken for collapsed.
+static bool collapsed(const face_corner *corners, size_t count, const std::vector<dake::vec3> &vertices)
+{
+    std::vector<int> distinct(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        if ((corners[i].index_vertex < 1) || ((size_t)corners[i].index_vertex > vertices.size()))
+            return false;
+        distinct[i] = corners[i].index_vertex;
+    }
+
+    std::sort(distinct.begin(), distinct.end());
+    if (std::unique(distinct.begin(), distinct.end()) - distinct.begin() < 3)
+        return true;
+
+    double nx = 0., ny = 0., nz = 0., perimeter = 0.;
+    for (size_t i = 0; i < count; i++)
+    {
+        const dake::vec3 &a = vertices[corners[i].index_vertex - 1];
+        const dake::vec3 &b = vertices[corners[(i + 1) % count].index_vertex - 1];
+
+        nx += ((double)a.y() - b.y()) * ((double)a.z() + b.z());
+        ny += ((double)a.z() - b.z()) * ((double)a.x() + b.x());
+        nz += ((double)a.x() - b.x()) * ((double)a.y() + b.y());
+
+        dake::vec3 d = b - a;
+        perimeter += sqrt((double)d.x() * d.x() + (double)d.y() * d.y() + (double)d.z() * d.z());
+    }
+
+    // Twice the area against the perimeter squared, which is scale
+    // invariant; only slivers far thinner than any useful face fall below
+    return sqrt(nx * nx + ny * ny + nz * nz) <= FLT_EPSILON * perimeter * perimeter;
+}
+
+
+// Hash table mapping grid cells to the list of vertices kept in them
+class weld_grid
+{
+    private:
+        struct slot
+        {
+            weld_cell cell;
+            // Index of the first vertex in this cell plus one, or 0 if the
+            // slot is unused
+            uint32_t head;
+        };
+
+        std::vector<slot> slots;
+        size_t mask;
+
+    public:
+        // Next vertex in the same cell (plus one, or 0 for the end)
+        std::vector<uint32_t> next;
+
+        weld_grid(size_t max_entries)
+        {
+            size_t capacity = 16;
+            while (capacity < max_entries * 2)
+                capacity *= 2;
+
+            slot empty;
+            memset(&empty, 0, sizeof(empty));
+            slots.assign(capacity, empty);
+            mask = capacity - 1;
+        }
+
+        // First vertex in the given cell plus one, or 0 if there is none
+        uint32_t head(const weld_cell &c) const
+        {
+            for (size_t s = hash_cell(c) & mask; slots[s].head; s = (s + 1) & mask)
+                if (slots[s].cell == c)
+                    return slots[s].head;
+            return 0;
+        }
+
+        // Add vertex "index" to the given cell
+        void insert(const weld_cell &c, uint32_t index)
+        {
+            size_t s = hash_cell(c) & mask;
+            while (slots[s].head && !(slots[s].cell == c))
+                s = (s + 1) & mask;
+
+            if (next.size() <= index)
+                next.resize(index + 1, 0);
+
+            next[index] = slots[s].head;
+            slots[s].cell = c;
+            slots[s].head = index + 1;
+        }
+};
+
+
+
+
+obj_reader::weld_stats obj_reader::weld_vertices(float tolerance)
+{
+    complete_lists();
+
+    weld_stats stats;
+    stats.vertices_removed = stats.faces_removed = 0;
+
+    size_t count = vertices.size();
+    int range = (tolerance > 0.f) ? 1 : 0;
+    float tol_sq = tolerance * tolerance;
+
+    weld_grid grid(count);
+
+    // New index (0-based) of every old vertex
+    std::vector<uint32_t> remap(count);
+    std::vector<dake::vec3> kept;
+    kept.reserve(count);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const dake::vec3 &v = vertices[i];
+
+        // Infinite or NaN positions (which the parser may produce) are
+        // never merged
+        if (!std::isfinite(v.x()) || !std::isfinite(v.y()) || !std::isfinite(v.z()))
+        {
+            remap[i] = kept.size();
+            kept.push_back(v);
+            continue;
+        }
+
+        weld_cell c = cell_of(v, tolerance);
+        uint32_t found = 0;
+
+        for (int dz = -range; (dz <= range) && !found; dz++)
+        {
+            for (int dy = -range; (dy <= range) && !found; dy++)
+            {
+                for (int dx = -range; (dx <= range) && !found; dx++)
+                {
+                    weld_cell n = { c.x + dx, c.y + dy, c.z + dz };
+
+                    for (uint32_t k = grid.head(n); k; k = grid.next[k - 1])
+                    {
+                        dake::vec3 d = kept[k - 1] - v;
+                        if (range ? (d.x() * d.x() + d.y() * d.y() + d.z() * d.z() <= tol_sq)
+                                  : ((kept[k - 1].x() == v.x()) && (kept[k - 1].y() == v.y()) && (kept[k - 1].z() == v.z())))
+                        {
+                            found = k;
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+
+        if (found)
+            remap[i] = found - 1;
+        else
+        {
+            remap[i] = kept.size();
+            grid.insert(c, kept.size());
+            kept.push_back(v);
+        }
+    }
+
+    stats.vertices_removed = count - kept.size();
+    vertices.swap(kept);
+
+
+    // Rewrite the faces in place, dropping corners which now refer to the
+    // same vertex as their predecessor and faces which have collapsed,
+    // i.e. with less than three corners left, less than three distinct
+    // vertices or no area (faces which had less than three corners in the
+    // first place are left alone)
+    size_t out_corner = 0, out_face = 0, last = 0;
+
+    for (size_t i = 0; i < faces.size(); i++)
+    {
+        // offsets[i] may have been overwritten already
+        size_t first = last;
+        size_t start = out_corner;
+        last = faces.offsets[i + 1];
+
+        for (size_t j = first; j < last; j++)
+        {
+            face_corner c = faces.corners[j];
+            if ((c.index_vertex > 0) && ((size_t)c.index_vertex <= count))
+                c.index_vertex = remap[c.index_vertex - 1] + 1;
+
+            if ((out_corner > start) && (faces.corners[out_corner - 1].index_vertex == c.index_vertex))
+                continue;
+
+            faces.corners[out_corner++] = c;
+        }
+
+        // The polygon is closed, so the last corner may equal the first
+        while ((out_corner - start > 1) && (faces.corners[out_corner - 1].index_vertex == faces.corners[start].index_vertex))
+            out_corner--;
+
+        if ((last - first >= 3) &&
+            ((out_corner - start < 3) || collapsed(&faces.corners[start], out_corner - start, vertices)))
+        {
+            out_corner = start;
+            stats.faces_removed++;
+            continue;
+        }
+
+        faces.mats[out_face] = faces.mats[i];
+        faces.groups[out_face] = faces.groups[i];
+        faces.smoothing[out_face] = faces.smoothing[i];
+        faces.offsets[++out_face] = out_corner;
+    }
+
+    faces.corners.resize(out_corner);
+    faces.offsets.resize(out_face + 1);
+    faces.mats.resize(out_face);
+    faces.groups.resize(out_face);
+    faces.smoothing.resize(out_face);
+
+    invalidate_derived();
+
+    calculate_bounding_box();
+
+    return stats;
+}
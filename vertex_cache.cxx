@@ -0,0 +1,296 @@
+// Vertex cache simulation and triangle reordering (Tipsify), vertex fetch
+// simulation and reordering.
+
+#include "vertex_cache.h"
+
+#include <algorithm>
+#include <vector>
+#include <stdint.h>
+
+
+vertex_cache_stats measure_vertex_cache(const uint32_t *indices, size_t index_count, size_t vertex_count,
+                                        unsigned cache_size, vertex_cache_model model)
+{
+    vertex_cache_stats stats;
+    stats.triangles = index_count / 3;
+    index_count = stats.triangles * 3;
+
+    cache_size = std::max(1u, cache_size);
+
+    if (model == VERTEX_CACHE_FIFO)
+    {
+        // A vertex is in the cache iff less than cache_size vertices have
+        // been inserted since it has been inserted itself
+        std::vector<size_t> inserted(vertex_count, 0);
+        size_t time = cache_size + 1;
+
+        for (size_t i = 0; i < index_count; i++)
+        {
+            uint32_t v = indices[i];
+            if (v >= vertex_count)
+                continue;
+
+            if (!inserted[v])
+                stats.vertices++;
+            if (time - inserted[v] > cache_size)
+            {
+                inserted[v] = time++;
+                stats.transforms++;
+            }
+        }
+    }
+    else
+    {
+        // Entries ordered from the most to the least recently used one
+        std::vector<uint32_t> cache;
+        std::vector<bool> seen(vertex_count, false);
+        cache.reserve(cache_size + 1);
+
+        for (size_t i = 0; i < index_count; i++)
+        {
+            uint32_t v = indices[i];
+            if (v >= vertex_count)
+                continue;
+
+            if (!seen[v])
+            {
+                seen[v] = true;
+                stats.vertices++;
+            }
+
+            std::vector<uint32_t>::iterator ci = std::find(cache.begin(), cache.end(), v);
+            if (ci == cache.end())
+            {
+                stats.transforms++;
+                if (cache.size() >= cache_size)
+                    cache.pop_back();
+            }
+            else
+                cache.erase(ci);
+
+            cache.insert(cache.begin(), v);
+        }
+    }
+
+    return stats;
+}
+
+
+vertex_cache_stats measure_vertex_cache(const indexed_mesh &mesh, unsigned cache_size, vertex_cache_model model)
+{
+    std::vector<uint32_t> tris;
+
+    for (std::vector<mesh_batch>::const_iterator bi = mesh.batches.begin(); bi != mesh.batches.end(); bi++)
+    {
+        if (bi->face_size < 3)
+            continue;
+
+        for (unsigned f = bi->first; f < bi->first + bi->count; f += bi->face_size)
+        {
+            for (unsigned c = 2; c < bi->face_size; c++)
+            {
+                tris.push_back(mesh.index(f));
+                tris.push_back(mesh.index(f + c - 1));
+                tris.push_back(mesh.index(f + c));
+            }
+        }
+    }
+
+    return measure_vertex_cache(tris.data(), tris.size(), mesh.vertices.size(), cache_size, model);
+}
+
+
+void optimize_vertex_cache(const uint32_t *indices, size_t index_count, size_t vertex_count,
+                           std::vector<uint32_t> &order, unsigned cache_size)
+{
+    size_t tri_count = index_count / 3;
+    index_count = tri_count * 3;
+
+    order.clear();
+    order.reserve(tri_count);
+
+    // The triangles around every vertex, as compressed sparse rows; "live"
+    // is the number of those not emitted yet
+    std::vector<uint32_t> adj_offsets(vertex_count + 1, 0), adj(index_count), live(vertex_count, 0);
+    for (size_t i = 0; i < index_count; i++)
+        if (indices[i] < vertex_count)
+            adj_offsets[indices[i] + 1]++;
+    for (size_t i = 0; i < vertex_count; i++)
+    {
+        live[i] = adj_offsets[i + 1];
+        adj_offsets[i + 1] += adj_offsets[i];
+    }
+    {
+        std::vector<uint32_t> fill(adj_offsets.begin(), adj_offsets.end() - 1);
+        for (size_t i = 0; i < index_count; i++)
+            if (indices[i] < vertex_count)
+                adj[fill[indices[i]]++] = i / 3;
+    }
+
+    // Triangles without any vertex in range are kept, at the end
+    std::vector<bool> emitted(tri_count, false);
+
+    // Time every vertex has last been inserted into the simulated FIFO
+    // cache at (see measure_vertex_cache)
+    std::vector<size_t> cache_time(vertex_count, 0);
+    size_t time = cache_size + 1;
+
+    // Vertices of all emitted triangles, most recent last: when the
+    // neighborhood of the current vertex is used up, the order continues
+    // from the most recent one which still has triangles left
+    std::vector<uint32_t> dead_end;
+    std::vector<uint32_t> candidates;
+    size_t cursor = 0;
+
+    int64_t fan = vertex_count ? 0 : -1;
+    while (fan >= 0)
+    {
+        candidates.clear();
+
+        for (uint32_t i = adj_offsets[fan]; i < adj_offsets[fan + 1]; i++)
+        {
+            uint32_t t = adj[i];
+            if (emitted[t])
+                continue;
+
+            for (int j = 0; j < 3; j++)
+            {
+                uint32_t v = indices[t * 3 + j];
+                if (v >= vertex_count)
+                    continue;
+
+                dead_end.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+
+                if (time - cache_time[v] > cache_size)
+                    cache_time[v] = time++;
+            }
+
+            emitted[t] = true;
+            order.push_back(t);
+        }
+
+        // Next fanning vertex: the one among the candidates which stays in
+        // the cache while its remaining triangles are emitted (each of them
+        // inserts at most two other vertices) and has been there the
+        // longest; if there is none, the dead-end stack is used
+        int64_t best = -1;
+        size_t best_priority = 0;
+        for (std::vector<uint32_t>::const_iterator ci = candidates.begin(); ci != candidates.end(); ci++)
+        {
+            if (!live[*ci])
+                continue;
+
+            size_t priority = 0;
+            if (time - cache_time[*ci] + 2 * live[*ci] <= cache_size)
+                priority = time - cache_time[*ci];
+
+            if (priority > best_priority)
+            {
+                best = *ci;
+                best_priority = priority;
+            }
+        }
+
+        if (best < 0)
+        {
+            while (!dead_end.empty() && (best < 0))
+            {
+                uint32_t v = dead_end.back();
+                dead_end.pop_back();
+                if (live[v])
+                    best = v;
+            }
+
+            while ((best < 0) && (cursor < vertex_count))
+            {
+                if (live[cursor])
+                    best = cursor;
+                cursor++;
+            }
+        }
+
+        fan = best;
+    }
+
+    for (size_t t = 0; t < tri_count; t++)
+        if (!emitted[t])
+            order.push_back(t);
+}
+
+
+vertex_fetch_stats measure_vertex_fetch(const uint32_t *indices, size_t index_count, size_t vertex_count,
+                                        size_t vertex_size, size_t line_size, size_t cache_lines)
+{
+    vertex_fetch_stats stats;
+
+    line_size = std::max((size_t)1, line_size);
+    cache_lines = std::max((size_t)1, cache_lines);
+
+    // Time every line has last been loaded into the cache at (a FIFO cache
+    // as in measure_vertex_cache)
+    std::vector<size_t> loaded((vertex_count * vertex_size + line_size - 1) / line_size, 0);
+    std::vector<bool> seen(vertex_count, false);
+    size_t time = cache_lines + 1;
+    size_t last = 0;
+
+    for (size_t i = 0; i < index_count; i++)
+    {
+        uint32_t v = indices[i];
+        if (v >= vertex_count)
+            continue;
+
+        if (!seen[v])
+        {
+            seen[v] = true;
+            stats.bytes_used += vertex_size;
+        }
+
+        size_t start = v * vertex_size;
+        if (stats.accesses++)
+            stats.stride_sum += (start > last) ? start - last : last - start;
+        last = start;
+
+        for (size_t line = start / line_size; line <= (start + vertex_size - 1) / line_size; line++)
+        {
+            if (time - loaded[line] > cache_lines)
+            {
+                loaded[line] = time++;
+                stats.bytes_fetched += line_size;
+            }
+        }
+    }
+
+    return stats;
+}
+
+
+vertex_fetch_stats measure_vertex_fetch(const indexed_mesh &mesh, size_t line_size, size_t cache_lines)
+{
+    std::vector<uint32_t> indices(mesh.index_count());
+    for (size_t i = 0; i < indices.size(); i++)
+        indices[i] = mesh.index(i);
+
+    return measure_vertex_fetch(indices.data(), indices.size(), mesh.vertices.size(), sizeof(mesh_vertex),
+                                line_size, cache_lines);
+}
+
+
+size_t optimize_vertex_fetch(const uint32_t *indices, size_t index_count, size_t vertex_count,
+                             std::vector<uint32_t> &remap)
+{
+    remap.assign(vertex_count, UINT32_MAX);
+    uint32_t next = 0;
+
+    for (size_t i = 0; i < index_count; i++)
+        if ((indices[i] < vertex_count) && (remap[indices[i]] == UINT32_MAX))
+            remap[indices[i]] = next++;
+
+    size_t used = next;
+    for (size_t i = 0; i < vertex_count; i++)
+        if (remap[i] == UINT32_MAX)
+            remap[i] = next++;
+
+    return used;
+}
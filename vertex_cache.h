@@ -0,0 +1,112 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+
+#include "indexed_mesh.h"
+
+
+// Default size of the simulated post-transform vertex cache (in vertices)
+#define VERTEX_CACHE_SIZE   16
+
+
+// How the simulated vertex cache replaces its entries: FIFO caches (as in
+// most actual GPUs) evict the vertex inserted first, LRU caches the one used
+// least recently
+enum vertex_cache_model
+{
+    VERTEX_CACHE_FIFO,
+    VERTEX_CACHE_LRU
+};
+
+// Result of measure_vertex_cache
+struct vertex_cache_stats
+{
+    // Number of triangles, of distinct vertices they use and of vertices
+    // which had to be transformed (cache misses)
+    size_t triangles, vertices, transforms;
+
+    vertex_cache_stats(void): triangles(0), vertices(0), transforms(0) {}
+
+    // Average cache miss ratio: transformed vertices per triangle (between
+    // 3 for no reuse at all and about 0.5 for an ideal order of a large
+    // regular mesh)
+    float acmr(void) const
+    { return triangles ? static_cast<float>(transforms) / triangles : 0.f; }
+
+    // Average transform to vertex ratio: how often every vertex is
+    // transformed on average (1 is optimal)
+    float atvr(void) const
+    { return vertices ? static_cast<float>(transforms) / vertices : 0.f; }
+};
+
+
+// Result of measure_vertex_fetch
+struct vertex_fetch_stats
+{
+    // Number of vertex accesses, of bytes actually read from memory (in
+    // whole cache lines) and of bytes in all distinct vertices accessed
+    size_t accesses, bytes_fetched, bytes_used;
+    // Sum of the distances (in bytes) between consecutive accesses
+    double stride_sum;
+
+    vertex_fetch_stats(void): accesses(0), bytes_fetched(0), bytes_used(0), stride_sum(0.) {}
+
+    vertex_fetch_stats &operator+=(const vertex_fetch_stats &s)
+    {
+        accesses += s.accesses;
+        bytes_fetched += s.bytes_fetched;
+        bytes_used += s.bytes_used;
+        stride_sum += s.stride_sum;
+        return *this;
+    }
+
+    // Ratio of the bytes read to the bytes needed (1 is optimal)
+    float overfetch(void) const
+    { return bytes_used ? static_cast<float>(bytes_fetched) / bytes_used : 0.f; }
+
+    // Average distance in bytes between two consecutive accesses
+    float mean_stride(void) const
+    { return (accesses > 1) ? static_cast<float>(stride_sum / (accesses - 1)) : 0.f; }
+};
+
+
+// Simulate drawing the triangle list "indices" (three indices into a list
+// of "vertex_count" vertices per triangle) with a vertex cache of
+// "cache_size" entries. Implemented in vertex_cache.cxx.
+vertex_cache_stats measure_vertex_cache(const uint32_t *indices, size_t index_count, size_t vertex_count,
+                                        unsigned cache_size = VERTEX_CACHE_SIZE,
+                                        vertex_cache_model model = VERTEX_CACHE_FIFO);
+
+// The same for all faces of "mesh" with at least three corners (polygons are
+// fanned, as the driver would do it)
+vertex_cache_stats measure_vertex_cache(const indexed_mesh &mesh, unsigned cache_size = VERTEX_CACHE_SIZE,
+                                        vertex_cache_model model = VERTEX_CACHE_FIFO);
+
+// Find an order of the triangles in "indices" which makes good use of a
+// vertex cache of "cache_size" entries, using Tipsify (Sander, Nehab and
+// Barczak, "Fast Triangle Reordering for Vertex Locality and Reduced
+// Overdraw"): the triangles around one vertex are emitted at once, and the
+// next vertex is one of those just emitted which is still in the cache and
+// has few triangles left, so the order sweeps over the mesh in strips. Runs
+// in linear time. "order" receives the indices of the triangles in their new
+// order.
+void optimize_vertex_cache(const uint32_t *indices, size_t index_count, size_t vertex_count,
+                           std::vector<uint32_t> &order, unsigned cache_size = VERTEX_CACHE_SIZE);
+
+// Simulate fetching the vertices (each "vertex_size" bytes large) used by
+// "indices" in that order through a fully associative FIFO cache of
+// "cache_lines" lines of "line_size" bytes. Every index is counted as an
+// access, regardless of the vertex cache. Implemented in vertex_cache.cxx.
+vertex_fetch_stats measure_vertex_fetch(const uint32_t *indices, size_t index_count, size_t vertex_count,
+                                        size_t vertex_size, size_t line_size = 64, size_t cache_lines = 64);
+
+// The same for all faces of "mesh" (with its interleaved vertices)
+vertex_fetch_stats measure_vertex_fetch(const indexed_mesh &mesh, size_t line_size = 64, size_t cache_lines = 64);
+
+// Renumber the vertices in the order "indices" uses them first, so they are
+// fetched (mostly) sequentially: "remap" receives the new index of every
+// vertex. Vertices not used at all are moved behind all others, keeping
+// their order. Returns the number of vertices used.
+size_t optimize_vertex_fetch(const uint32_t *indices, size_t index_count, size_t vertex_count,
+                             std::vector<uint32_t> &remap);